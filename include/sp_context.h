@@ -11,6 +11,7 @@ extern "C" {
 #include "sp_config.h"
 #include "sp_error.h"
 #include "sp_hash.h"
+#include "sp_pak.h"
 #include "sp_gui.h"
 #include "sp_font.h"
 
@@ -41,7 +42,9 @@ extern "C" {
     bool (*get_is_running)(const sp_context * context);
     void (*set_is_running)(const sp_context * context, bool value);
 
-    const sp_hash_table * (*get_hash)(const sp_context * context);
+    sp_pack_reader * (*get_pak)(const sp_context * context);
+    sp_pack_stream * (*get_stream)(const sp_context * context);
+    errno_t (*reload_resource)(const sp_context * context, const char * key, const char * path);
     int (*get_display_index)(const sp_context * context);
 
     float (*get_scale_w)(const sp_context * context);
@@ -67,6 +70,8 @@ extern "C" {
   } sp_context;
 
   errno_t sp_init_context(sp_context * context, FILE * fp);
+  /* mode picks when the pak's content is checked; sp_init_context is lazy */
+  errno_t sp_init_context_ex(sp_context * context, FILE * fp, sp_pack_verify_mode mode);
   errno_t sp_test_resources(const sp_context * context);
   errno_t sp_quit_context(sp_context * context);
 
@@ -0,0 +1,20 @@
+#ifndef SP_CRC__H
+#define SP_CRC__H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+  /* CRC-32C (Castagnoli), with SSE4.2's crc32 instruction where the CPU has
+   * it and slicing-by-8 tables otherwise. Start from 0; pass the previous
+   * result to continue over more data. */
+  uint32_t sp_crc32c(uint32_t /* crc */, const void * /* data */, size_t /* len */);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SP_CRC__H */
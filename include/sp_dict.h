@@ -0,0 +1,25 @@
+#ifndef SP_DICT__H
+#define SP_DICT__H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#include "sp_error.h"
+
+  /* zlib preset dictionaries can't be longer than the deflate window */
+#define SP_DICT_MAX_LEN ((size_t)32768)
+
+  /* Builds a preset dictionary from sample content: byte runs shared by
+   * several samples are ranked by how much they would save, and the best are
+   * packed into dict with the most valuable at the end, nearest the data.
+   * Fails when the samples have nothing in common. */
+  errno_t sp_dict_train(const unsigned char * const * /* samples */, const size_t * /* sample_lens */, size_t /* sample_count */, unsigned char * /* dict */, size_t /* dict_capacity */, size_t * /* dict_len */);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SP_DICT__H */
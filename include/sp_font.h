@@ -98,6 +98,9 @@ extern "C" {
 
   /* Construct data */
   const sp_font * sp_font_ctor(const sp_font * self, SDL_Renderer * renderer, const void * mem, size_t mem_len, int point_size);
+  /* Construct data from a stream, which the font reads from as glyphs are
+   * needed and closes in its destructor */
+  const sp_font * sp_font_ctor_rw(const sp_font * self, SDL_Renderer * renderer, SDL_RWops * stream, int point_size);
 
   /* Destruct data */
   const sp_font * sp_font_dtor(const sp_font * self);
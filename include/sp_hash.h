@@ -5,12 +5,51 @@
 extern "C" {
 #endif
 
+#include <stdio.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include "sp_str.h"
 
   typedef struct sp_hash_table_impl sp_hash_table_impl;
   typedef void (*sp_hash_free_item)(void * /* item */);
 
+  /* Chained tables keep a tree of items per prime-sized bucket. Open tables
+   * keep keys, with their hashes, in one flat slot array probed a group of
+   * control bytes at a time (SSE2 where available).
+   *
+   * Concurrent tables may be shared between threads: ensure, find, upsert,
+   * remove, next and end can be called from any of them, and lookups never
+   * block.
+   * compact and the dtor need the table to themselves. */
+  typedef enum sp_hash_engine {
+    sphe_chained = 0,
+    sphe_open = 1,
+    sphe_concurrent = 2
+  } sp_hash_engine;
+
+  /* Capacity hints: tables start sized for them, or small when they're 0,
+   * and grow geometrically either way. */
+  typedef struct sp_hash_table_options {
+    size_t expected_keys;
+    size_t expected_string_bytes; /* total key length, without terminators */
+    sp_hash_engine engine;
+    char padding[4]; /* not portable */
+  } sp_hash_table_options;
+
+  /* Walks a table without allocating: start from a zeroed one, call next
+   * until it returns false or you're done, then end. Each key is visited
+   * once; removing the current key is safe, any other change ends the walk.
+   * Concurrent tables walk the buckets as they were when the walk began, and
+   * hold off freeing removed keys until it ends. */
+  typedef struct sp_hash_iter {
+    const sp_str * key;
+    void * value;
+    size_t position; /* engine bookkeeping */
+    size_t remaining;
+    const void * snapshot;
+    size_t epoch;
+  } sp_hash_iter;
+
   typedef struct sp_hash_table sp_hash_table;
   typedef struct sp_hash_table {
     const sp_hash_table * (*ctor)(const sp_hash_table * /* self */);
@@ -20,6 +59,16 @@ extern "C" {
 
     errno_t (*ensure)(const sp_hash_table * /* self */, const char * /* s */, size_t /* s_len */, void * /* value */, sp_str ** /* str */);
     errno_t (*find)(const sp_hash_table * /* self */, const char * /* s */, size_t /* s_len */, void ** /* value */);
+    /* sets the key's value, adding the key if needed; previous is NULL for new keys */
+    errno_t (*upsert)(const sp_hash_table * /* self */, const char * /* s */, size_t /* s_len */, void * /* value */, void ** /* previous */);
+    /* the value is handed back, not freed; sp_str pointers from ensure may move */
+    errno_t (*remove)(const sp_hash_table * /* self */, const char * /* s */, size_t /* s_len */, void ** /* value */);
+    bool (*next)(const sp_hash_table * /* self */, sp_hash_iter * /* iter */);
+    /* ends a walk, finished or not, and zeroes iter for the next one */
+    void (*end)(const sp_hash_table * /* self */, sp_hash_iter * /* iter */);
+    /* Reclaims the strings of removed keys by copying the live ones into a
+     * fresh buffer, and drops removal bookkeeping. Key strings move. */
+    void (*compact)(const sp_hash_table * /* self */);
 
     char * (*print_stats)(const sp_hash_table * /* self */);
     double (*get_load_factor)(const sp_hash_table * /* self */);
@@ -27,6 +76,8 @@ extern "C" {
     size_t (*get_bucket_length)(const sp_hash_table * /* self */);
     size_t (*get_bucket_capacity)(const sp_hash_table * /* self */);
     size_t (*get_key_count)(const sp_hash_table * /* self */);
+    /* bytes held by the table and its interned strings */
+    size_t (*get_memory_usage)(const sp_hash_table * /* self */);
 
     sp_hash_table_impl * impl;
   } sp_hash_table;
@@ -35,10 +86,17 @@ extern "C" {
   const sp_hash_table * sp_hash_table_init(sp_hash_table * /* self */);
   const sp_hash_table * sp_hash_table_acquire();
   const sp_hash_table * sp_hash_table_ctor(const sp_hash_table * /* self */);
+  /* NULL options construct a chained table, as sp_hash_table_ctor does */
+  const sp_hash_table * sp_hash_table_ctor_ex(const sp_hash_table * /* self */, const sp_hash_table_options * /* options */);
   const sp_hash_table * sp_hash_table_dtor(const sp_hash_table * /* self */, const sp_hash_free_item /* free_item_fn */);
   void sp_hash_table_free(const sp_hash_table * /* self */);
   void sp_hash_table_release(const sp_hash_table * /* self */, const sp_hash_free_item /* free_item_fn */);
 
+  /* Times ensure and find, hits and misses, over key_count generated keys in
+   * each engine, and reports what each table holds in memory. */
+  void sp_hash_bench(FILE * /* out */, size_t /* key_count */, size_t /* rounds */);
+  void sp_hash_tests(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,25 @@
+#ifndef SP_LZ__H
+#define SP_LZ__H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#include "sp_error.h"
+
+  /* A small LZ77 block codec using the LZ4 block layout: sequences of a token
+   * (literal length:4, match length - 4:4), extended lengths, literals and a
+   * 16-bit little-endian match offset. Trades ratio for very fast decoding.
+   */
+
+  size_t sp_lz_compress_bound(size_t /* source_len */);
+  errno_t sp_lz_compress(const unsigned char * /* source */, size_t /* source_len */, unsigned char * /* dest */, size_t /* dest_len */, size_t * /* out_len */);
+  errno_t sp_lz_decompress(const unsigned char * /* source */, size_t /* source_len */, unsigned char * /* dest */, size_t /* dest_len */, size_t * /* out_len */);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SP_LZ__H */
@@ -9,24 +9,175 @@ extern "C" {
 #include <stdbool.h>
 #include <stdint.h>
 
-#include "sp_hash.h"
+#include "sp_error.h"
 
   typedef struct sp_pack_version sp_pack_version;
+  typedef struct sp_pack_reader sp_pack_reader;
+  typedef struct sp_pack_stream sp_pack_stream;
+  typedef struct sp_pack_cursor sp_pack_cursor;
 
   typedef struct sp_pack_item_file {
     char * data;
     size_t data_len;
+    /* Lazy-load stub; created and inflated on first sp_pack_find */
+    sp_pack_reader * reader;
+    uint64_t offset; /* entry offset, relative to the start of the pak */
+    uint64_t len; /* encoded entry length */
+    bool is_loaded;
+    bool is_mapped; /* data points into the pak mapping; not owned */
+    char padding[6]; /* not portable */
   } sp_pack_item_file;
 
+  /* Per-entry payload encoding. spc_auto is only meaningful when building a
+   * pak; it deflates the entry and falls back to storing it when deflate
+   * doesn't pay for itself (already-compressed PNGs, fonts, etc). */
+  typedef enum sp_pack_codec {
+    spc_auto = 0,
+    spc_stored = 1,
+    spc_zlib = 2,
+    spc_lz = 3,
+    spc_zlib_dict = 4, /* zlib with the pak's preset dictionary; spc_auto picks it for small entries when there is one */
+    spc_zlib_blocks = 5 /* zlib in independent blocks, for seeking; spc_auto picks it for entries of 1 MiB and up */
+  } sp_pack_codec;
+
+  const char * sp_pack_codec_name(sp_pack_codec /* codec */);
+
   typedef struct sp_pack_content_entry {
     const char * path;
     const char * name;
+    sp_pack_codec codec;
+    char padding[4]; /* not portable */
   } sp_pack_content_entry;
 
+  /* Decompressed bytes the game keeps for released handles */
+#define SP_PACK_DEFAULT_CACHE_BUDGET ((uint64_t)64 << 20)
+
+  /* Chunk size used for the game's own pak; paks hashed in chunks can be
+   * verified in parallel, or lazily as entries are loaded. */
+#define SP_PACK_DEFAULT_CHUNK_SIZE ((uint64_t)1 << 20)
+
+  /* Preset dictionary size used for the game's own pak */
+#define SP_PACK_DEFAULT_DICTIONARY_SIZE ((size_t)16 << 10)
+
+  /* How a pak's content is checked. BLAKE2b catches tampering; CRC32C only
+   * catches corruption, for trusted local builds, at a fraction of the cost;
+   * none skips the checks entirely. Recorded in the pak header. */
+  typedef enum sp_pack_integrity {
+    spi_blake2b = 0,
+    spi_crc32c = 1,
+    spi_none = 2
+  } sp_pack_integrity;
+
+  const char * sp_pack_integrity_name(sp_pack_integrity /* integrity */);
+
+  typedef struct sp_pack_create_options {
+    size_t jobs; /* encoder and hash threads; 0 uses one per online CPU */
+    uint64_t chunk_size; /* 0 hashes the content as a whole; ignored with spi_none */
+    /* 0 for none; otherwise a preset dictionary of up to this many bytes (at
+     * most 32 KiB) is trained on the small entries and stored once in the pak */
+    size_t dictionary_size;
+    /* new paks only; appends and compaction keep the pak's own */
+    sp_pack_integrity integrity;
+    char padding[4]; /* not portable */
+  } sp_pack_create_options;
+
+  typedef enum sp_pack_verify_mode {
+    spvm_full = 0, /* hash all content before returning */
+    spvm_lazy = 1 /* chunked paks only: verify each entry's chunks on first load */
+  } sp_pack_verify_mode;
+
   bool sp_pack_create(FILE * /* fp */, const sp_pack_content_entry * /* content */, size_t /* content_len */);
+  bool sp_pack_create_ex(FILE * /* fp */, const sp_pack_content_entry * /* content */, size_t /* content_len */, const sp_pack_create_options * /* options */);
+  /* Adds or replaces entries without rebuilding the pak: the entries are
+   * written as a new segment at the end of fp (open for update), followed by a
+   * merged index and a new trailer. Appended segments are hashed whole, so
+   * only options->jobs applies. */
+  bool sp_pack_append(FILE * /* fp */, const sp_pack_content_entry * /* content */, size_t /* content_len */, const sp_pack_create_options * /* options */);
+  /* Rewrites the live entries of src into a new pak in dest, reclaiming what
+   * sp_pack_append left behind, content appended again included; NULL options
+   * keep src's chunk size. */
+  bool sp_pack_compact(FILE * /* src */, FILE * /* dest */, const sp_pack_create_options * /* options */);
+  /* Where the pak starts in fp, from the trailer at its end; -1 when fp
+   * doesn't end in a pak */
   long sp_pack_get_offset(FILE * /* fp */);
+  /* Checks the header against the trailer without reading the content, for
+   * finding a pak bundled onto an executable at startup. Pair it with
+   * spvm_lazy, or check the content with sp_pack_is_valid_pak_file. */
+  errno_t sp_pack_probe(FILE * /* fp */, long * /* pak_offset */, uint64_t * /* content_offset */, uint64_t * /* content_len */, uint64_t * /* index_entries */, uint64_t * /* index_offset */, uint64_t * /* index_len */);
   errno_t sp_pack_is_valid_pak_file(FILE * /* fp */, long * /* pak_offset */, uint64_t * /* content_offset */, uint64_t * /* content_len */, uint64_t * /* index_entries */, uint64_t * /* index_offset */, uint64_t * /* index_len */);
-  errno_t sp_pack_verify(FILE * /* fp */, const sp_hash_table * /* hash */);
+  errno_t sp_pack_verify(FILE * /* fp */, sp_pack_reader ** /* out_reader */);
+  errno_t sp_pack_verify_ex(FILE * /* fp */, sp_pack_reader ** /* out_reader */, sp_pack_verify_mode /* mode */);
+  /* Resolves key through the pak's perfect hash, or its sorted index; found
+   * items are owned by the reader and released by sp_pack_reader_free */
+  errno_t sp_pack_find(sp_pack_reader * /* reader */, const char * /* key */, size_t /* key_len */, sp_pack_item_file ** /* out_file */);
+  errno_t sp_pack_item_file_load(sp_pack_item_file * /* file */);
+  /* Reference-counted handles. Released items stay cached until the reader's
+   * budget is exceeded, then the least recently released are evicted and
+   * re-inflated on their next acquire. Items from sp_pack_find are never
+   * evicted; acquiring them is harmless. */
+  errno_t sp_pack_acquire(sp_pack_reader * /* reader */, const char * /* key */, size_t /* key_len */, sp_pack_item_file ** /* out_file */);
+  void sp_pack_retain(sp_pack_item_file * /* file */);
+  void sp_pack_release(sp_pack_item_file * /* file */);
+  /* 0, the default, never evicts; resident counts in-use and pinned items too,
+   * so it can run over the budget */
+  void sp_pack_reader_set_cache_budget(sp_pack_reader * /* reader */, uint64_t /* budget */);
+  uint64_t sp_pack_reader_get_cache_resident(sp_pack_reader * /* reader */);
+  /* Index enumeration, for tools; entries are numbered in index order */
+  typedef struct sp_pack_entry_info {
+    const char * key; /* NULL terminated, and owned by the reader */
+    size_t key_len;
+    uint64_t len; /* the entry as stored, header and payload */
+    uint64_t compressed_len;
+    uint64_t decompressed_len;
+    sp_pack_codec codec;
+    char padding[4]; /* not portable */
+  } sp_pack_entry_info;
+
+  uint64_t sp_pack_reader_get_entry_count(const sp_pack_reader * /* reader */);
+  sp_pack_integrity sp_pack_reader_get_integrity(const sp_pack_reader * /* reader */);
+  errno_t sp_pack_reader_get_entry(sp_pack_reader * /* reader */, uint64_t /* index */, sp_pack_entry_info * /* out_info */);
+  /* Resolves key to its entry number without loading the entry */
+  errno_t sp_pack_reader_find_entry(const sp_pack_reader * /* reader */, const char * /* key */, size_t /* key_len */, uint64_t * /* out_index */);
+  /* Average seconds to decode an entry, and to compute the hashes a load
+   * checks, over rounds runs; the entry is read and verified beforehand */
+  errno_t sp_pack_reader_bench_entry(sp_pack_reader * /* reader */, uint64_t /* index */, size_t /* rounds */, double * /* out_inflate_seconds */, double * /* out_hash_seconds */);
+  /* Development hot-reload: replaces an entry's bytes with the file at path,
+   * read as is. The pak on disk is untouched. Finds, handles and cursors
+   * from before the reload keep the bytes they had; find or acquire again,
+   * and re-create anything built from them, to pick up the new ones. Only
+   * key changes, even when other keys were packed with identical content. */
+  errno_t sp_pack_reader_reload(sp_pack_reader * /* reader */, const char * /* key */, size_t /* key_len */, const char * /* path */);
+  void sp_pack_reader_free(sp_pack_reader * /* reader */);
+
+  /* Seekable reads of one entry, for streaming large resources (music, big
+   * atlases). Block-compressed entries inflate only the blocks that are read,
+   * verifying the chunks under them; anything else is acquired whole. A
+   * cursor reads the entry as it was when opened, reloaded or not. Cursors
+   * are independent, but each belongs to one thread at a time. */
+  errno_t sp_pack_cursor_open(sp_pack_reader * /* reader */, const char * /* key */, size_t /* key_len */, sp_pack_cursor ** /* out_cursor */);
+  /* Returns the bytes read: short at the end of the entry, or on error */
+  size_t sp_pack_cursor_read(sp_pack_cursor * /* cursor */, void * /* dest */, size_t /* len */);
+  errno_t sp_pack_cursor_seek(sp_pack_cursor * /* cursor */, uint64_t /* offset */);
+  uint64_t sp_pack_cursor_tell(const sp_pack_cursor * /* cursor */);
+  uint64_t sp_pack_cursor_len(const sp_pack_cursor * /* cursor */);
+  /* Close cursors before their reader */
+  void sp_pack_cursor_close(sp_pack_cursor * /* cursor */);
+
+  /* Background loading: a worker thread finds, verifies and inflates
+   * requested entries, and sp_pack_stream_drain runs each request's callback
+   * on the calling thread (once per frame, from sp_loop). Finds are safe from
+   * either thread while a stream is running, and only wait on the worker when
+   * they want the entry it is inflating. The file is acquired for the
+   * callback and released after it; sp_pack_retain it to keep it longer. */
+  typedef void (*sp_pack_stream_callback)(const char * /* key */, sp_pack_item_file * /* file */, errno_t /* result */, void * /* user_data */);
+
+  sp_pack_stream * sp_pack_stream_create(sp_pack_reader * /* reader */);
+  errno_t sp_pack_stream_request_item(sp_pack_stream * /* stream */, const char * /* key */, size_t /* key_len */, sp_pack_stream_callback /* callback */, void * /* user_data */);
+  size_t sp_pack_stream_drain(sp_pack_stream * /* stream */);
+  /* Stops the worker; pending requests are dropped without their callbacks.
+   * Free the stream before its reader. */
+  void sp_pack_stream_free(sp_pack_stream * /* stream */);
+
   errno_t sp_pack_upgrade(FILE * /* fp */, const sp_pack_version * /* from */, const sp_pack_version * /* to */);
   errno_t sp_pack_print_resources(FILE * /* dest */, FILE * /* fp */);
   void sp_pack_tests();
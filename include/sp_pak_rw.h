@@ -0,0 +1,28 @@
+#ifndef SP_PAK_RW__H
+#define SP_PAK_RW__H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpadded"
+#include <SDL2/SDL.h>
+#pragma GCC diagnostic pop
+
+#include "sp_pak.h"
+
+  /* SDL_RWops over a pak entry, for TTF_OpenFontRW, IMG_Load_RW and the
+   * like. Reads go through a sp_pack_cursor, so block-compressed entries are
+   * never inflated whole and stored entries are read in place. Read only;
+   * SDL_RWclose closes the cursor, and must come before the reader is freed.
+   * Returns NULL, with SDL_GetError set, when the entry can't be opened. */
+  SDL_RWops * sp_pack_rw_open(sp_pack_reader * /* reader */, const char * /* key */, size_t /* key_len */);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SP_PAK_RW__H */
@@ -14,6 +14,7 @@ extern "C" {
 #include "sp_math.h"
 #include "sp_hash.h"
 #include "sp_pak.h"
+#include "sp_pak_rw.h"
 #include "sp_gui.h"
 #include "sp_font.h"
 #include "sp_base.h"
@@ -30,6 +31,7 @@ extern "C" {
 #include "sp_box.h"
 #include "sp_config.h"
 #include "sp_text.h"
+#include "sp_watch.h"
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,31 @@
+#ifndef SP_WATCH__H
+#define SP_WATCH__H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+
+#include "sp_error.h"
+
+  /* Development file watcher: reports source files that were rewritten since
+   * the last poll. Each file's directory is watched rather than the file, so
+   * editors that save through a rename are still seen. Linux (inotify) only;
+   * sp_watch_create returns NULL elsewhere. */
+
+  typedef struct sp_watch sp_watch;
+
+  sp_watch * sp_watch_create(void);
+  /* key is optional, and handed back alongside path when the file changes */
+  errno_t sp_watch_add(sp_watch * /* watch */, const char * /* path */, const char * /* key */);
+  /* Never blocks; returns false once there are no more changed files. Several
+   * writes to the same file between polls are reported once. */
+  bool sp_watch_poll(sp_watch * /* watch */, const char ** /* out_path */, const char ** /* out_key */);
+  void sp_watch_free(sp_watch * /* watch */);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SP_WATCH__H */
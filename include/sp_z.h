@@ -25,10 +25,33 @@ extern "C" {
 #define SP_SET_BINARY_MODE(file)
 #endif /* >> if defined(MSDOS) || ... */
 
+#include <stdbool.h>
 #include <stdio.h>
 
+  /* Reusable codec state: the zlib streams are initialized on first use and
+   * reset between buffers, so batches of small entries pay for
+   * inflateInit/deflateInit once. Not thread-safe; use one per thread. */
+  typedef struct sp_z sp_z;
+
+  sp_z * sp_z_create(void);
+  /* dest_len is the known decompressed length; inflates in a single call */
+  errno_t sp_z_inflate(sp_z * /* z */, const unsigned char * /* source */, size_t /* source_len */, unsigned char * /* dest */, size_t /* dest_len */, size_t * /* out_len */);
+  /* dest must hold at least sp_deflate_bound(source_len) bytes */
+  errno_t sp_z_deflate(sp_z * /* z */, const unsigned char * /* source */, size_t /* source_len */, unsigned char * /* dest */, size_t /* dest_len */, size_t * /* out_len */);
+  /* Preset dictionary for the *_dict calls; not copied, so it has to outlive
+   * its use. NULL clears it. */
+  void sp_z_set_dictionary(sp_z * /* z */, const unsigned char * /* dict */, size_t /* dict_len */);
+  bool sp_z_has_dictionary(const sp_z * /* z */);
+  errno_t sp_z_inflate_dict(sp_z * /* z */, const unsigned char * /* source */, size_t /* source_len */, unsigned char * /* dest */, size_t /* dest_len */, size_t * /* out_len */);
+  errno_t sp_z_deflate_dict(sp_z * /* z */, const unsigned char * /* source */, size_t /* source_len */, unsigned char * /* dest */, size_t /* dest_len */, size_t * /* out_len */);
+  void sp_z_free(sp_z * /* z */);
+
   errno_t sp_inflate_file(FILE * /* source */, FILE * /* dest */, size_t * /* dest_len */);
   errno_t sp_deflate_file(FILE * /* source */, FILE * /* dest */, size_t * /* dest_len */);
+  size_t sp_deflate_bound(size_t /* source_len */);
+  /* One-shot versions of sp_z_deflate/sp_z_inflate */
+  errno_t sp_deflate_buffer(const unsigned char * /* source */, size_t /* source_len */, unsigned char * /* dest */, size_t /* dest_len */, size_t * /* out_len */);
+  errno_t sp_inflate_buffer(const unsigned char * /* source */, size_t /* source_len */, unsigned char * /* dest */, size_t /* dest_len */, size_t * /* out_len */);
 
 #ifdef __cplusplus
 }
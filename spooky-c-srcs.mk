@@ -6,7 +6,12 @@ spooky_SOURCES = \
 								 sp_hash.c \
 								 sp_io.c \
 								 sp_z.c \
+								 sp_lz.c \
+								 sp_dict.c \
+								 sp_crc.c \
 								 sp_pak.c \
+								 sp_pak_rw.c \
+								 sp_watch.c \
 								 sp_db.c \
 								 sp_time.c \
 								 sp_config.c \
@@ -26,3 +31,15 @@ spooky_SOURCES = \
 								 sp_spooky.c \
 								 $(NULL)
 
+# pak tooling: none of the game's sources, so none of its SDL code
+spooky_pak_SOURCES = \
+								 sp_limits.c \
+								 sp_math.c \
+								 sp_error.c \
+								 sp_z.c \
+								 sp_lz.c \
+								 sp_dict.c \
+								 sp_crc.c \
+								 sp_pak.c \
+								 sp_pak_tool.c \
+								 $(NULL)
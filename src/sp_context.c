@@ -10,8 +10,8 @@
 #include "../config.h"
 #include "../include/sp_log.h"
 #include "../include/sp_pak.h"
+#include "../include/sp_pak_rw.h"
 #include "../include/sp_limits.h"
-#include "../include/sp_hash.h"
 #include "../include/sp_context.h"
 #include "../include/sp_error.h"
 #include "../include/sp_math.h"
@@ -34,7 +34,8 @@ typedef struct sp_context_data {
   SDL_Texture * canvas;
 
   const sp_console * console;
-  const sp_hash_table * hash;
+  sp_pack_reader * pak;
+  sp_pack_stream * stream;
   const sp_font * font_current;
   const sp_base * modal;
 
@@ -182,8 +183,31 @@ static void sp_context_set_is_paused(const sp_context * context, bool is_paused)
   context->data->is_paused = is_paused;
 }
 
-static const sp_hash_table * sp_context_get_hash(const sp_context * context) {
-  return context->data->hash;
+static sp_pack_reader * sp_context_get_pak(const sp_context * context) {
+  return context->data->pak;
+}
+
+static sp_pack_stream * sp_context_get_stream(const sp_context * context) {
+  return context->data->stream;
+}
+
+/* Development hot-reload: swap a pak entry for its source file and re-create
+ * whatever the context built from it. Called between frames. */
+static errno_t sp_context_reload_resource(const sp_context * context, const char * key, const char * path) {
+  sp_context_data * data = context->data;
+
+  if(sp_pack_reader_reload(data->pak, key, strnlen(key, SP_MAX_STRING_LEN), path) != SP_SUCCESS) {
+    SP_LOG(SLS_WARN, "Unable to reload '%s' from '%s'.\n", key, path);
+    return SP_FAILURE;
+  }
+  SP_LOG(SLS_INFO, "Reloaded '%s' from '%s'.\n", key, path);
+
+  const char * font_name = data->config->get_font_name(data->config);
+  if(strncmp(key, font_name, SP_MAX_STRING_LEN) == 0) {
+    data->font_current = sp_context_init_font();
+  }
+
+  return SP_SUCCESS;
 }
 
 static void sp_context_get_center_rect(const sp_context * context, SDL_Rect * rect) {
@@ -205,19 +229,6 @@ static void sp_context_get_translated_mouse_state(const sp_context * context, ui
   if(y) { *y = temp_y; }
 }
 
-static void sp_index_item_free_item(void * item) {
-  if(item) {
-    sp_pack_item_file * pub = item;
-    if(pub) {
-      if(pub->data) {
-        free(pub->data), pub->data = NULL;
-        pub->data_len = 0;
-      }
-      free(pub), pub = NULL;
-    }
-  }
-}
-
 const sp_font * sp_context_init_font(void) {
   const sp_config * config = global_data.config;
   const char * font_name = config->get_font_name(config);
@@ -227,17 +238,17 @@ const sp_font * sp_context_init_font(void) {
     global_data.font_current->free(global_data.font_current);
   }
 
-  const sp_hash_table * hash = global_data.hash;
-
-  sp_pack_item_file * ttf = NULL;
-  void * temp = NULL;
-  hash->find(hash, font_name, strnlen(font_name, SP_MAX_STRING_LEN), &temp);
-  ttf = temp;
+  /* the font reads straight from the pak entry */
+  SDL_RWops * ttf = sp_pack_rw_open(global_data.pak, font_name, strnlen(font_name, SP_MAX_STRING_LEN));
+  if(!ttf) {
+    SP_LOG(SLS_ERROR, "Unable to load font '%s' from the resource pack.\n", font_name);
+    abort();
+  }
 
   const sp_font * font = sp_font_acquire();
   SDL_Renderer * renderer = global_data.renderer;
   font = sp_font_init((sp_font *)(uintptr_t)font);
-  font = font->ctor(font, renderer, ttf->data, ttf->data_len, (int)global_data.font_size);
+  font = sp_font_ctor_rw(font, renderer, ttf, (int)global_data.font_size);
 
   SP_LOG(SLS_INFO, "Font '%s' set to %ipt\n", font->get_name(font), font->get_point_size(font));
 
@@ -245,6 +256,10 @@ const sp_font * sp_context_init_font(void) {
 }
 
 errno_t sp_init_context(sp_context * context, FILE * fp) {
+  return sp_init_context_ex(context, fp, spvm_lazy);
+}
+
+errno_t sp_init_context_ex(sp_context * context, FILE * fp, sp_pack_verify_mode mode) {
   assert(!(context == NULL));
 
   if(context == NULL) { return SP_FAILURE; }
@@ -262,7 +277,9 @@ errno_t sp_init_context(sp_context * context, FILE * fp) {
   context->set_is_paused = &sp_context_set_is_paused;
   context->get_is_running = &sp_context_get_is_running;
   context->set_is_running = &sp_context_set_is_running;
-  context->get_hash = &sp_context_get_hash;
+  context->get_pak = &sp_context_get_pak;
+  context->get_stream = &sp_context_get_stream;
+  context->reload_resource = &sp_context_reload_resource;
   context->get_display_index = &sp_context_get_display_index;
   context->get_scaled_rect = &sp_context_get_scaled_rect;
   context->set_scaled_rect = &sp_context_set_scaled_rect;
@@ -297,12 +314,9 @@ errno_t sp_init_context(sp_context * context, FILE * fp) {
   const char * error_message = NULL;
 
   context->data->font_size = (size_t)config->get_font_size(config);
-  const sp_hash_table * hash = NULL;
-  context->data->hash = sp_hash_table_acquire();
-  context->data->hash = context->data->hash->ctor(context->data->hash);
-  hash = context->data->hash;
-
-  errno_t res = sp_pack_verify(fp, hash);
+  /* Opening the pak only probed its trailer and header; the content is
+   * hashed here in full (--verify), or chunk by chunk on first load. */
+  errno_t res = sp_pack_verify_ex(fp, &context->data->pak, mode);
   if(res != SP_SUCCESS) {
     SP_LOG(SLS_ERROR, "The resource pack is invalid.\n");
     fprintf(stderr, "The resource pack is invalid.\n");
@@ -311,6 +325,13 @@ errno_t sp_init_context(sp_context * context, FILE * fp) {
   } else {
     SP_LOG(SLS_INFO, "Resource pack valid!\n");
   }
+  sp_pack_reader_set_cache_budget(context->data->pak, SP_PACK_DEFAULT_CACHE_BUDGET);
+
+  /* without a worker, resources are still available through sp_pack_find */
+  context->data->stream = sp_pack_stream_create(context->data->pak);
+  if(!context->data->stream) {
+    SP_LOG(SLS_WARN, "Unable to start the resource stream.\n");
+  }
 
   SDL_ClearError();
   SDL_version compiled = { 0 };
@@ -494,7 +515,8 @@ void sp_release_context(sp_context * context) {
       data->font_current->free(data->font_current);
     }
 
-    sp_hash_table_release(data->hash, &sp_index_item_free_item);
+    sp_pack_stream_free(data->stream), data->stream = NULL;
+    sp_pack_reader_free(data->pak), data->pak = NULL;
 
     if(data->canvas) {
       SDL_ClearError();
@@ -0,0 +1,138 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/sp_dict.h"
+
+#define SP_DICT_K 8 /* shortest shared run worth dictionary space */
+#define SP_DICT_MAX_SEGMENT 1024
+#define SP_DICT_MIN_HASH_BITS 12
+#define SP_DICT_MAX_HASH_BITS 22
+
+typedef struct sp_dict_segment {
+  uint64_t score;
+  size_t sample;
+  size_t start;
+  size_t len;
+} sp_dict_segment;
+
+static uint32_t sp_dict_hash(const unsigned char * p, unsigned int bits) {
+  uint64_t v;
+  memcpy(&v, p, sizeof v);
+  return (uint32_t)((v * 0x9e3779b97f4a7c15ull) >> (64 - bits));
+}
+
+static int sp_dict_segment_compare(const void * a, const void * b) {
+  const sp_dict_segment * left = a;
+  const sp_dict_segment * right = b;
+  if(left->score != right->score) { return left->score > right->score ? -1 : 1; }
+  if(left->sample != right->sample) { return left->sample < right->sample ? -1 : 1; }
+  return left->start < right->start ? -1 : (left->start > right->start ? 1 : 0);
+}
+
+/* What a run would save: one match for every other sample still sharing each
+ * of its windows. */
+static uint64_t sp_dict_score(const uint32_t * counts, const unsigned char * p, size_t len, unsigned int bits) {
+  uint64_t score = 0;
+  for(size_t i = 0; i + SP_DICT_K <= len; i++) {
+    uint32_t count = counts[sp_dict_hash(p + i, bits)];
+    if(count > 1) { score += count - 1; }
+  }
+
+  return score;
+}
+
+errno_t sp_dict_train(const unsigned char * const * samples, const size_t * sample_lens, size_t sample_count, unsigned char * dict, size_t dict_capacity, size_t * dict_len) {
+  if(!samples || !sample_lens || !dict || !dict_len) { return SP_FAILURE; }
+  *dict_len = 0;
+
+  if(sample_count < 2 || sample_count >= UINT32_MAX) { return SP_FAILURE; }
+  if(dict_capacity > SP_DICT_MAX_LEN) { dict_capacity = SP_DICT_MAX_LEN; }
+  if(dict_capacity < SP_DICT_K) { return SP_FAILURE; }
+
+  size_t total = 0;
+  for(size_t s = 0; s < sample_count; s++) {
+    if(sample_lens[s] > 0 && !samples[s]) { return SP_FAILURE; }
+    if(sample_lens[s] >= SP_DICT_K) { total += sample_lens[s]; }
+  }
+  if(total == 0) { return SP_FAILURE; }
+
+  /* roughly a slot per window; collisions only blur the counts */
+  unsigned int bits = SP_DICT_MIN_HASH_BITS;
+  while(bits < SP_DICT_MAX_HASH_BITS && ((size_t)1 << bits) < total) { bits++; }
+  size_t slots = (size_t)1 << bits;
+
+  /* how many samples contain each window of SP_DICT_K bytes */
+  uint32_t * counts = calloc(slots, sizeof * counts);
+  uint32_t * seen = calloc(slots, sizeof * seen); /* sample + 1 */
+  if(!counts || !seen) { abort(); }
+
+  for(size_t s = 0; s < sample_count; s++) {
+    for(size_t i = 0; i + SP_DICT_K <= sample_lens[s]; i++) {
+      uint32_t h = sp_dict_hash(samples[s] + i, bits);
+      if(seen[h] == (uint32_t)s + 1) { continue; }
+      seen[h] = (uint32_t)s + 1;
+      counts[h]++;
+    }
+  }
+  free(seen), seen = NULL;
+
+  /* candidate segments: maximal runs of shared windows */
+  size_t segments_len = 0, segments_cap = 64;
+  sp_dict_segment * segments = calloc(segments_cap, sizeof * segments);
+  if(!segments) { abort(); }
+
+  for(size_t s = 0; s < sample_count; s++) {
+    const unsigned char * p = samples[s];
+    size_t len = sample_lens[s];
+    size_t i = 0;
+    while(i + SP_DICT_K <= len) {
+      if(counts[sp_dict_hash(p + i, bits)] < 2) { i++; continue; }
+
+      size_t start = i;
+      while(i + SP_DICT_K <= len && i - start <= SP_DICT_MAX_SEGMENT - SP_DICT_K && counts[sp_dict_hash(p + i, bits)] >= 2) { i++; }
+
+      if(segments_len == segments_cap) {
+        segments_cap *= 2;
+        sp_dict_segment * temp = realloc(segments, segments_cap * sizeof * segments);
+        if(!temp) { abort(); }
+        segments = temp;
+      }
+
+      sp_dict_segment * segment = segments + segments_len++;
+      segment->sample = s;
+      segment->start = start;
+      segment->len = i - start + SP_DICT_K - 1;
+      segment->score = sp_dict_score(counts, p + start, segment->len, bits);
+    }
+  }
+
+  qsort(segments, segments_len, sizeof * segments, &sp_dict_segment_compare);
+
+  /* Greedy fill from the back. A segment is rescored before it goes in, since
+   * copies of it in other samples were claimed along with the first. */
+  size_t pos = dict_capacity;
+  for(size_t i = 0; i < segments_len && pos >= SP_DICT_K; i++) {
+    const sp_dict_segment * segment = segments + i;
+    if(segment->len > pos) { continue; }
+
+    const unsigned char * p = samples[segment->sample] + segment->start;
+    uint64_t score = sp_dict_score(counts, p, segment->len, bits);
+    if(score == 0 || score * 2 < segment->score) { continue; }
+
+    pos -= segment->len;
+    memcpy(dict + pos, p, segment->len);
+    for(size_t j = 0; j + SP_DICT_K <= segment->len; j++) {
+      counts[sp_dict_hash(p + j, bits)] = 0;
+    }
+  }
+
+  free(segments), segments = NULL;
+  free(counts), counts = NULL;
+
+  *dict_len = dict_capacity - pos;
+  if(*dict_len == 0) { return SP_FAILURE; }
+  memmove(dict, dict + pos, *dict_len);
+
+  return SP_SUCCESS;
+}
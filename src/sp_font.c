@@ -257,6 +257,20 @@ const sp_font * sp_font_ctor(const sp_font * self, SDL_Renderer * renderer, cons
   return font;
 }
 
+const sp_font * sp_font_ctor_rw(const sp_font * self, SDL_Renderer * renderer, SDL_RWops * stream, int point_size) {
+  const int DO_NOT_FREE_SRC = 0;
+  assert(stream);
+
+  SDL_ClearError();
+  TTF_Font * ttf_font = TTF_OpenFontRW(stream, DO_NOT_FREE_SRC, point_size);
+  if(!ttf_font) {
+    fprintf(stderr, "Unable to load font from stream. %s\n", TTF_GetError());
+    abort();
+  }
+
+  return sp_font_cctor(self, renderer, point_size, NULL, 0, stream, ttf_font);
+}
+
 const sp_font * sp_font_dtor(const sp_font * self) {
   if(self) {
     sp_font_data * data = self->data;
@@ -9,6 +9,16 @@
 #include <limits.h>
 #include <stddef.h>
 #include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define SP_HASH_HAVE_SSE2 1
+#else
+#define SP_HASH_HAVE_SSE2 0
+#endif
 
 #include "../include/sp_limits.h"
 #include "../include/sp_error.h"
@@ -61,8 +71,26 @@ static const uint64_t sp_hash_primes[] = {
   11493228998133068689llu, 14480561146010017169llu, 18446744073709551557llu
 };
 
-static const size_t SP_HASH_DEFAULT_ATOM_ALLOC = 1 << 12;
-static const size_t SP_HASH_DEFAULT_STRING_ALLOC = 1048576 * 2;
+/* tables start at a small prime and move up the list as keys arrive */
+static const size_t SP_HASH_MIN_PRIME_INDEX = 4;
+static const size_t SP_HASH_DEFAULT_ATOM_ALLOC = 1 << 2;
+static const size_t SP_HASH_MIN_STRING_ALLOC = 1 << 12;
+/* old buckets moved per ensure while a chained table grows */
+static const size_t SP_HASH_REHASH_STEP = 16;
+
+/* open engine: a control byte per slot, either empty, deleted or the low 7
+ * bits of the key's mixed hash; lookups compare a whole group of them at once */
+#define SP_HASH_GROUP_WIDTH 16
+#define SP_HASH_CTRL_EMPTY ((uint8_t)0x80)
+#define SP_HASH_CTRL_DELETED ((uint8_t)0xfe)
+static const size_t SP_HASH_OPEN_MIN_CAPACITY = SP_HASH_GROUP_WIDTH;
+
+/* concurrent engine: writers lock the stripe of the key's mixed hash */
+#define SP_HASH_STRIPE_COUNT 16
+/* removed keys retired before a writer tries to move to the next epoch */
+#define SP_HASH_RETIRED_MAX 64
+/* retired lists kept: the current epoch's, and the two before it */
+#define SP_HASH_EPOCH_COUNT 3
 
 typedef struct sp_string_buffer sp_string_buffer;
 typedef struct sp_string_buffer {
@@ -79,24 +107,89 @@ typedef struct sp_array_limits {
   size_t reallocs;
 } sp_array_limits;
 
-typedef struct sp_hash_bucket_item sp_hash_bucket_item;
+/* Items link to each other by index into their bucket's items, which stays
+ * valid as the array grows; the root is item 0, so 0 is never a child. */
 typedef struct sp_hash_bucket_item {
   sp_str key;
   void * value;
   sp_array_limits siblings_limits;
-  sp_hash_bucket_item ** siblings;
-  sp_hash_bucket_item * right;
-  sp_hash_bucket_item * left;
+  size_t * siblings; /* other items with the same hash */
+  size_t right;
+  size_t left;
 } sp_hash_bucket_item;
 
 typedef struct sp_hash_bucket {
-  uint64_t prime;
   sp_array_limits items_limits;
-  sp_hash_bucket_item * root;
   sp_hash_bucket_item * items;
 } sp_hash_bucket;
 
+/* the key's hash is kept inline; probing and growth never rehash strings */
+typedef struct sp_hash_slot {
+  sp_str key;
+  void * value;
+} sp_hash_slot;
+
+/* Concurrent keys are allocated one at a time with their string, and never
+ * move; the value is swapped in place. */
+typedef struct sp_hash_node {
+  sp_str key;
+  _Atomic(void *) value;
+  char str[];
+} sp_hash_node;
+
+/* Each bucket array links the nodes through its own links, so a grown array
+ * can be built while readers still walk the chains of the last. */
+typedef struct sp_hash_link sp_hash_link;
+typedef struct sp_hash_link {
+  sp_hash_node * node;
+  _Atomic(sp_hash_link *) next;
+  sp_hash_link * retired_next;
+} sp_hash_link;
+
+typedef struct sp_hash_concurrent_array sp_hash_concurrent_array;
+typedef struct sp_hash_concurrent_array {
+  size_t mask; /* bucket count, a power of two, less one */
+  sp_hash_concurrent_array * retired_next;
+  _Atomic(sp_hash_link *) heads[];
+} sp_hash_concurrent_array;
+
+/* lookups in flight by the parity of the epoch they started in, spread by
+ * key so they don't share a cache line */
+typedef struct sp_hash_readers {
+  atomic_size_t counts[2];
+  char padding[48]; /* not portable */
+} sp_hash_readers;
+
+/* removed links and replaced arrays retired during one epoch */
+typedef struct sp_hash_limbo {
+  sp_hash_link * links;
+  sp_hash_concurrent_array * arrays;
+  size_t link_count;
+} sp_hash_limbo;
+
+/* Readers load the published array and walk its chains without locking.
+ * Writers hold the stripe lock of the key's bucket, or every stripe to
+ * publish a grown array. Replaced arrays and removed links may still be in
+ * a reader's hands, so they're retired under the current epoch. The epoch
+ * moves on once no reader is left from the one before, which frees what
+ * was retired then; compact and the dtor free whatever is left. */
+typedef struct sp_hash_concurrent {
+  _Atomic(sp_hash_concurrent_array *) array;
+  atomic_size_t key_count;
+  atomic_size_t epoch;
+  pthread_mutex_t stripes[SP_HASH_STRIPE_COUNT];
+  sp_hash_readers readers[SP_HASH_STRIPE_COUNT];
+  pthread_mutex_t retire_lock;
+  /* guarded by the retire lock */
+  sp_hash_limbo limbo[SP_HASH_EPOCH_COUNT]; /* by epoch */
+  size_t retired_count; /* links */
+  size_t retired_pending; /* links since the epoch last moved on */
+} sp_hash_concurrent;
+
 typedef struct sp_hash_table_impl {
+  sp_hash_engine engine;
+  char padding[4]; /* not portable */
+
   size_t prime_index;
   uint64_t prime;
 
@@ -106,17 +199,40 @@ typedef struct sp_hash_table_impl {
   sp_array_limits buckets_limits;
   sp_hash_bucket * buckets;
 
+  /* while growing, the previous buckets; those below rehash_index have
+   * already been moved into buckets */
+  sp_hash_bucket * old_buckets;
+  size_t old_buckets_len;
+  uint64_t old_prime;
+  size_t rehash_index;
+
   size_t string_count;
   sp_string_buffer * buffers;
   sp_string_buffer * current_buffer;
+  /* string bytes of removed keys, reclaimed by compact */
+  size_t strings_dead;
+
+  /* open engine: slots_capacity (a power of two) slots and control bytes,
+   * with the first group of control bytes mirrored past the end */
+  size_t slots_capacity;
+  size_t slots_growth_left;
+  uint8_t * ctrl;
+  sp_hash_slot * slots;
+
+  sp_hash_concurrent * concurrent;
 } sp_hash_table_impl;
 
-static const sp_hash_table * sp_hash_table_cctor(const sp_hash_table * self, size_t prime_index, sp_string_buffer * buffers, sp_string_buffer * current_buffer);
+static const sp_hash_table * sp_hash_table_cctor(const sp_hash_table * self, const sp_hash_table_options * options);
 
 static errno_t sp_hash_ensure_internal(const sp_hash_table * self, const char * s, size_t s_len, void * value, sp_str ** out_str, bool skip_s_cp, bool skip_rebalance) ;
 static errno_t sp_hash_ensure(const sp_hash_table * self, const char * s, size_t s_len, void * value, sp_str ** out_str);
-static errno_t sp_hash_find_internal(const sp_hash_bucket * bucket, const char * s, size_t s_len, uint64_t hash, void ** out_value);
+static errno_t sp_hash_find_internal(const sp_hash_bucket * bucket, const char * s, size_t s_len, uint64_t hash, sp_hash_bucket_item ** out_item);
 static errno_t sp_hash_find(const sp_hash_table * self, const char * s, size_t s_len, void ** value);
+static errno_t sp_hash_upsert(const sp_hash_table * self, const char * s, size_t s_len, void * value, void ** out_previous);
+static errno_t sp_hash_remove(const sp_hash_table * self, const char * s, size_t s_len, void ** out_value);
+static bool sp_hash_next(const sp_hash_table * self, sp_hash_iter * iter);
+static void sp_hash_end(const sp_hash_table * self, sp_hash_iter * iter);
+static void sp_hash_compact(const sp_hash_table * self);
 static const char * sp_hash_move_string_to_strings(const sp_hash_table * self, const char * s, size_t s_len, size_t * out_len);
 static void sp_hash_clear_strings(const sp_hash_table * self);
 static char * sp_hash_print_stats(const sp_hash_table * self);
@@ -127,6 +243,39 @@ static inline uint64_t sp_hash_get_index(const sp_hash_table * self, uint64_t ha
 static size_t sp_hash_get_bucket_length(const sp_hash_table * self);
 static size_t sp_hash_get_bucket_capacity(const sp_hash_table * self);
 static size_t sp_hash_get_key_count(const sp_hash_table * self);
+static size_t sp_hash_get_memory_usage(const sp_hash_table * self);
+
+static sp_string_buffer * sp_hash_buffer_alloc(size_t capacity);
+static void sp_hash_strings_alloc(sp_hash_table_impl * impl, const sp_hash_table_options * options);
+static size_t sp_hash_strings_memory_usage(const sp_hash_table_impl * impl);
+
+static const sp_hash_table * sp_hash_open_ctor(const sp_hash_table * self, const sp_hash_table_options * options);
+static void sp_hash_open_dtor(const sp_hash_table * self, const sp_hash_free_item free_item_fn);
+static errno_t sp_hash_open_ensure(const sp_hash_table * self, const char * s, size_t s_len, void * value, sp_str ** out_str);
+static errno_t sp_hash_open_find(const sp_hash_table * self, const char * s, size_t s_len, void ** value);
+static errno_t sp_hash_open_upsert(const sp_hash_table * self, const char * s, size_t s_len, void * value, void ** out_previous);
+static errno_t sp_hash_open_remove(const sp_hash_table * self, const char * s, size_t s_len, void ** out_value);
+static bool sp_hash_open_next(const sp_hash_table * self, sp_hash_iter * iter);
+static void sp_hash_open_compact(const sp_hash_table * self);
+static char * sp_hash_open_print_stats(const sp_hash_table * self);
+static double sp_hash_open_get_load_factor(const sp_hash_table * self);
+static size_t sp_hash_open_get_capacity(const sp_hash_table * self);
+static size_t sp_hash_open_get_memory_usage(const sp_hash_table * self);
+
+static const sp_hash_table * sp_hash_concurrent_ctor(const sp_hash_table * self, const sp_hash_table_options * options);
+static void sp_hash_concurrent_dtor(const sp_hash_table * self, const sp_hash_free_item free_item_fn);
+static errno_t sp_hash_concurrent_ensure(const sp_hash_table * self, const char * s, size_t s_len, void * value, sp_str ** out_str);
+static errno_t sp_hash_concurrent_find(const sp_hash_table * self, const char * s, size_t s_len, void ** value);
+static errno_t sp_hash_concurrent_upsert(const sp_hash_table * self, const char * s, size_t s_len, void * value, void ** out_previous);
+static errno_t sp_hash_concurrent_remove(const sp_hash_table * self, const char * s, size_t s_len, void ** out_value);
+static bool sp_hash_concurrent_next(const sp_hash_table * self, sp_hash_iter * iter);
+static void sp_hash_concurrent_end(const sp_hash_table * self, sp_hash_iter * iter);
+static void sp_hash_concurrent_compact(const sp_hash_table * self);
+static char * sp_hash_concurrent_print_stats(const sp_hash_table * self);
+static double sp_hash_concurrent_get_load_factor(const sp_hash_table * self);
+static size_t sp_hash_concurrent_get_bucket_length(const sp_hash_table * self);
+static size_t sp_hash_concurrent_get_key_count(const sp_hash_table * self);
+static size_t sp_hash_concurrent_get_memory_usage(const sp_hash_table * self);
 
 const sp_hash_table * sp_hash_table_alloc() {
   sp_hash_table * self = calloc(1, sizeof * self);
@@ -146,12 +295,18 @@ const sp_hash_table * sp_hash_table_init(sp_hash_table * self) {
 
   self->ensure = &sp_hash_ensure;
   self->find = &sp_hash_find;
+  self->upsert = &sp_hash_upsert;
+  self->remove = &sp_hash_remove;
+  self->next = &sp_hash_next;
+  self->end = &sp_hash_end;
+  self->compact = &sp_hash_compact;
   self->print_stats = &sp_hash_print_stats;
   self->get_load_factor = &sp_hash_get_load_factor;
 
   self->get_bucket_length = &sp_hash_get_bucket_length;
   self->get_bucket_capacity = &sp_hash_get_bucket_capacity;
   self->get_key_count = &sp_hash_get_key_count;
+  self->get_memory_usage = &sp_hash_get_memory_usage;
 
   return self;
 }
@@ -160,47 +315,46 @@ const sp_hash_table * sp_hash_table_acquire() {
   return sp_hash_table_init((sp_hash_table *)(uintptr_t)sp_hash_table_alloc());
 }
 
-const sp_hash_table * sp_hash_table_cctor(const sp_hash_table * self, size_t prime_index, sp_string_buffer * buffers, sp_string_buffer * current_buffer) {
-  sp_hash_table_impl * impl = calloc(1, sizeof * self->impl);
-  if(!impl) goto err0;
+/* the smallest prime with room for expected_keys under the load factor */
+static size_t sp_hash_get_prime_index(size_t expected_keys) {
+  static const size_t last = (sizeof sp_hash_primes / sizeof sp_hash_primes[0]) - 1;
 
-  impl->keys_alloc = SP_HASH_DEFAULT_ATOM_ALLOC;
-  impl->strings_alloc = SP_HASH_DEFAULT_STRING_ALLOC;
+  size_t i = SP_HASH_MIN_PRIME_INDEX;
+  while(i < last && (double)sp_hash_primes[i] * sp_hash_default_load_factor < (double)expected_keys) { i++; }
+
+  return i;
+}
 
+static void sp_hash_buckets_alloc(sp_hash_table_impl * impl, size_t prime_index) {
   impl->prime_index = prime_index;
   impl->prime = sp_hash_primes[impl->prime_index];
-  impl->buckets_limits.capacity = (sizeof sp_hash_primes / sizeof sp_hash_primes[0]);
-  impl->buckets_limits.len = impl->prime_index;
+  if(impl->prime > SIZE_MAX / sizeof * impl->buckets) { abort(); }
+
+  impl->buckets_limits.capacity = (size_t)impl->prime;
+  impl->buckets_limits.len = (size_t)impl->prime;
   impl->buckets = calloc(impl->buckets_limits.capacity, sizeof * impl->buckets);
   if(!impl->buckets) { abort(); }
+}
 
-  if(!buffers) {
-    static const size_t max_buffers = 5;
-
-    size_t i = 0;
-    sp_string_buffer * first_buffer = NULL;
-    sp_string_buffer * prev = NULL;
-    do {
-      sp_string_buffer * buffer = calloc(1, sizeof * impl->buffers);
-      if(prev) { prev->next = buffer; }
-      if(!first_buffer) { first_buffer = buffer; }
-      buffer->next = NULL;
-      buffer->len = 0;
-      buffer->capacity = SP_HASH_DEFAULT_STRING_ALLOC;
-      buffer->strings = calloc(buffer->capacity , sizeof * buffer->strings);
-      prev = buffer;
-      i++;
-    } while(i < max_buffers);
-    impl->buffers = first_buffer;
-    impl->current_buffer = impl->buffers;
-  } else {
-    impl->buffers = buffers;
-    if(current_buffer) {
-      impl->current_buffer = current_buffer;
-    } else {
-      impl->current_buffer = impl->buffers;
+static void sp_hash_buckets_free(sp_hash_bucket * buckets, size_t buckets_len) {
+  for(size_t i = 0; i < buckets_len; i++) {
+    sp_hash_bucket * bucket = &buckets[i];
+    for(size_t j = 0; j < bucket->items_limits.len; j++) {
+      free(bucket->items[j].siblings), bucket->items[j].siblings = NULL;
     }
+    free(bucket->items), bucket->items = NULL;
   }
+  free(buckets);
+}
+
+const sp_hash_table * sp_hash_table_cctor(const sp_hash_table * self, const sp_hash_table_options * options) {
+  sp_hash_table_impl * impl = calloc(1, sizeof * self->impl);
+  if(!impl) goto err0;
+
+  impl->engine = sphe_chained;
+  impl->keys_alloc = SP_HASH_DEFAULT_ATOM_ALLOC;
+  sp_hash_buckets_alloc(impl, sp_hash_get_prime_index(options ? options->expected_keys : 0));
+  sp_hash_strings_alloc(impl, options);
 
   ((sp_hash_table *)(uintptr_t)self)->impl = impl;
 
@@ -211,46 +365,101 @@ err0:
 }
 
 const sp_hash_table * sp_hash_table_ctor(const sp_hash_table * self) {
-  return sp_hash_table_cctor(self, (sizeof sp_hash_primes / sizeof sp_hash_primes[0]) - 1, NULL, NULL);
+  return sp_hash_table_cctor(self, NULL);
 }
 
-void sp_hash_clear_strings(const sp_hash_table * self) {
-  sp_hash_table_impl * impl = self->impl;
+const sp_hash_table * sp_hash_table_ctor_ex(const sp_hash_table * self, const sp_hash_table_options * options) {
+  sp_hash_engine engine = options ? options->engine : sphe_chained;
+  switch(engine) {
+    case sphe_open: return sp_hash_open_ctor(self, options);
+    case sphe_concurrent: return sp_hash_concurrent_ctor(self, options);
+    case sphe_chained:
+    default: return sp_hash_table_cctor(self, options);
+  }
+}
 
-  sp_string_buffer * buffer = impl->buffers;
-  do {
+static sp_string_buffer * sp_hash_buffer_alloc(size_t capacity) {
+  sp_string_buffer * buffer = calloc(1, sizeof * buffer);
+  if(!buffer) { abort(); }
+
+  buffer->next = NULL;
+  buffer->len = 0;
+  buffer->capacity = capacity;
+  buffer->strings = calloc(buffer->capacity, sizeof * buffer->strings);
+  if(!buffer->strings) { abort(); }
+
+  return buffer;
+}
+
+/* One buffer sized for the expected keys and their terminators; any after it
+ * double in size. */
+static void sp_hash_strings_alloc(sp_hash_table_impl * impl, const sp_hash_table_options * options) {
+  size_t capacity = SP_HASH_MIN_STRING_ALLOC;
+  if(options && options->expected_string_bytes < SIZE_MAX / 2 - options->expected_keys) {
+    size_t expected = options->expected_string_bytes + options->expected_keys;
+    if(expected > capacity) { capacity = expected; }
+  }
+
+  impl->buffers = sp_hash_buffer_alloc(capacity);
+  impl->current_buffer = impl->buffers;
+  impl->strings_alloc = capacity * 2;
+}
+
+static void sp_hash_buffers_free(sp_string_buffer * buffer) {
+  while(buffer) {
     sp_string_buffer * next = buffer->next;
     free(buffer->strings), buffer->strings = NULL;
     free(buffer), buffer = NULL;
     buffer = next;
-  } while(buffer);
+  }
+}
+
+void sp_hash_clear_strings(const sp_hash_table * self) {
+  sp_hash_buffers_free(self->impl->buffers), self->impl->buffers = NULL;
+  self->impl->current_buffer = NULL;
 }
 
 void sp_hash_clear_buckets(const sp_hash_table * self) {
   sp_hash_table_impl * impl = self->impl;
 
-  for(size_t i = 0; i < impl->buckets_limits.len; i++) {
-    sp_hash_bucket * bucket = &impl->buckets[i];
-    free(bucket->items), bucket->items = NULL;
+  sp_hash_buckets_free(impl->buckets, impl->buckets_limits.len), impl->buckets = NULL;
+  impl->buckets_limits.len = 0;
+  impl->buckets_limits.capacity = 0;
+
+  if(impl->old_buckets) {
+    sp_hash_buckets_free(impl->old_buckets, impl->old_buckets_len), impl->old_buckets = NULL;
+    impl->old_buckets_len = 0;
   }
+}
 
-  impl->buckets_limits.len = (impl->prime_index + 1);
-  impl->buckets_limits.capacity = (sizeof sp_hash_primes / sizeof sp_hash_primes[0]);
-  free(impl->buckets), impl->buckets = NULL;
+static void sp_hash_buckets_free_values(const sp_hash_bucket * buckets, size_t buckets_len, const sp_hash_free_item free_item_fn) {
+  for(size_t i = 0; i < buckets_len; i++) {
+    const sp_hash_bucket * bucket = &buckets[i];
+    size_t x = bucket->items_limits.len;
+    for(size_t j = 0; j < x; j++) {
+      void * item = bucket->items[j].value;
+      if(item) {
+        free_item_fn(item);
+      }
+    }
+  }
 }
 
 const sp_hash_table * sp_hash_table_dtor(const sp_hash_table * self, const sp_hash_free_item free_item_fn) {
+  if(self->impl->engine == sphe_open) {
+    sp_hash_open_dtor(self, free_item_fn);
+    return self;
+  }
+  if(self->impl->engine == sphe_concurrent) {
+    sp_hash_concurrent_dtor(self, free_item_fn);
+    return self;
+  }
+
   if(free_item_fn != NULL) {
-    /* Free allocated items */
-    for(size_t i = 0; i < self->impl->buckets_limits.len; i++) {
-      const sp_hash_bucket * bucket = &(self->impl->buckets[i]);
-      size_t x = bucket->items_limits.len;
-      for(size_t j = 0; j < x; j++) {
-        void * item = bucket->items[j].value;
-        if(item) {
-          free_item_fn(item);
-        }
-      }
+    /* Free allocated items; moved old buckets are already empty */
+    sp_hash_buckets_free_values(self->impl->buckets, self->impl->buckets_limits.len, free_item_fn);
+    if(self->impl->old_buckets) {
+      sp_hash_buckets_free_values(self->impl->old_buckets, self->impl->old_buckets_len, free_item_fn);
     }
   }
 
@@ -270,22 +479,19 @@ void sp_hash_table_release(const sp_hash_table * self, const sp_hash_free_item f
 }
 
 static inline uint64_t sp_hash_get_index(const sp_hash_table * self, uint64_t hash) {
-  return (hash % sp_hash_primes[self->impl->prime_index]) % self->impl->prime_index;
+  return hash % self->impl->prime;
 }
 
 static sp_hash_bucket * sp_hash_bucket_init(const sp_hash_table * self, uint64_t index) {
   assert(self && self->impl);
+  assert(index < self->impl->buckets_limits.len);
 
   sp_hash_bucket * bucket = &(self->impl->buckets[index]);
-
-  assert(index < self->impl->buckets_limits.len);
-  if(!bucket->prime) {
-    bucket->prime = sp_hash_primes[index];
+  if(!bucket->items) {
     bucket->items_limits.len = 0;
     bucket->items_limits.capacity = self->impl->keys_alloc;
     bucket->items = calloc(bucket->items_limits.capacity, sizeof * bucket->items);
     if(!bucket->items) { abort(); }
-    bucket->root = bucket->items;
   }
 
   return bucket;
@@ -298,7 +504,6 @@ static sp_hash_bucket * sp_hash_bucket_check_and_realloc(sp_hash_bucket * bucket
     sp_hash_bucket_item * temp_items = realloc(bucket->items, (sizeof * temp_items) * bucket->items_limits.capacity);
     if(!temp_items) { abort(); }
     bucket->items = temp_items;
-    bucket->root = bucket->items;
     bucket->items_limits.reallocs++;
   }
 
@@ -308,52 +513,44 @@ static sp_hash_bucket * sp_hash_bucket_check_and_realloc(sp_hash_bucket * bucket
 static sp_hash_bucket_item * sp_hash_bucket_get_next_item(sp_hash_bucket * bucket) {
   bucket = sp_hash_bucket_check_and_realloc(bucket);
   sp_hash_bucket_item * item = bucket->items + bucket->items_limits.len;
+  memset(item, 0, sizeof * item);
   bucket->items_limits.len++;
   assert(item);
   return item;
 }
 
-static void sp_hash_bucket_insert_item(sp_hash_bucket_item * node, sp_hash_bucket_item * item) {
-  if(item->key.hash > node->key.hash) {
-    // insert to the right
-    if(node->right) {
-      sp_hash_bucket_insert_item(node->right, item);
-    } else {
-      node->right = item;
+/* Links item into the bucket's tree by hash; items whose hash is already
+ * there become siblings of that node instead. */
+static void sp_hash_bucket_insert_item(sp_hash_bucket * bucket, size_t item_index) {
+  assert(item_index < bucket->items_limits.len);
+  if(item_index == 0) { return; }
+
+  const sp_hash_bucket_item * item = bucket->items + item_index;
+  size_t node_index = 0;
+  while(true) {
+    sp_hash_bucket_item * node = bucket->items + node_index;
+    if(item->key.hash > node->key.hash) {
+      // insert to the right
+      if(!node->right) { node->right = item_index; return; }
+      node_index = node->right;
     }
-  }
-  else if(item->key.hash < node->key.hash) {
-    // insert to the left
-    if(node->left) {
-      sp_hash_bucket_insert_item(node->left, item);
-    } else {
-      node->left = item;
+    else if(item->key.hash < node->key.hash) {
+      // insert to the left
+      if(!node->left) { node->left = item_index; return; }
+      node_index = node->left;
     }
-  }
-  else {
-    if(!node->key.str && node->key.hash == 0) {
-      node->key = item->key;
-      node->siblings_limits.len = 0;
-      node->siblings = NULL;
-    } else {
-      if(node->siblings_limits.len == 0) {
-        // no siblings, alloc one:
-        node->siblings_limits.len = 0;
-        node->siblings_limits.capacity = 16;
-        node->siblings = calloc(item->siblings_limits.capacity, sizeof * item->siblings);
-        if(!node->siblings) { abort(); }
-      } else if(node->siblings_limits.len + 1 > node->siblings_limits.capacity) {
+    else {
+      if(node->siblings_limits.len + 1 > node->siblings_limits.capacity) {
         // siblings overflow, realloc:
-        node->siblings_limits.capacity *= 2;
-        sp_hash_bucket_item ** temp = realloc(node->siblings, node->siblings_limits.capacity * sizeof * temp);
-        if(!temp) {  abort(); }
+        node->siblings_limits.capacity = node->siblings_limits.capacity > 0 ? node->siblings_limits.capacity * 2 : 4;
+        size_t * temp = realloc(node->siblings, node->siblings_limits.capacity * sizeof * temp);
+        if(!temp) { abort(); }
         node->siblings_limits.reallocs++;
         node->siblings = temp;
       }
       // set next sibling:
-      sp_hash_bucket_item ** sibling = node->siblings + node->siblings_limits.len;
-      *sibling = item;
-      node->siblings_limits.len++;
+      node->siblings[node->siblings_limits.len++] = item_index;
+      return;
     }
   }
 }
@@ -374,68 +571,119 @@ size_t sp_hash_get_key_count(const sp_hash_table * self) {
   return self->impl->string_count;
 }
 
-void sp_hash_rebalance(const sp_hash_table * self) {
-  const sp_hash_table * old_self = self;
-  sp_hash_table_impl * old_impl = old_self->impl;
-  size_t old_buckets_len = old_impl->buckets_limits.len;
+static size_t sp_hash_strings_memory_usage(const sp_hash_table_impl * impl) {
+  size_t usage = 0;
+  for(const sp_string_buffer * buffer = impl->buffers; buffer; buffer = buffer->next) {
+    usage += sizeof * buffer + buffer->capacity;
+  }
 
-  double load_factor = (double)old_impl->string_count / (double)old_buckets_len;
+  return usage;
+}
 
-  if(load_factor > sp_hash_default_load_factor) {
-    uint64_t new_prime_index = old_impl->prime_index + 1;
-    if(new_prime_index > (sizeof sp_hash_primes / sizeof sp_hash_primes[0]) - 1) {
-      return;
+static size_t sp_hash_buckets_memory_usage(const sp_hash_bucket * buckets, size_t buckets_len) {
+  size_t usage = buckets_len * sizeof * buckets;
+  for(size_t i = 0; i < buckets_len; i++) {
+    const sp_hash_bucket * bucket = &buckets[i];
+    usage += bucket->items_limits.capacity * sizeof * bucket->items;
+    for(size_t j = 0; j < bucket->items_limits.len; j++) {
+      usage += bucket->items[j].siblings_limits.capacity * sizeof * bucket->items[j].siblings;
     }
+  }
 
-    sp_hash_bucket * old_buckets = old_impl->buckets;
-    self = sp_hash_table_cctor(self, new_prime_index, old_impl->buffers, old_impl->current_buffer);
-    self->impl->string_count = old_impl->string_count;
-    {
-      // Relocate keys to new hash table:
-      sp_hash_bucket * old_bucket = old_buckets;
-      const sp_hash_bucket * old_bucket_end = old_buckets + old_buckets_len;
-
-      while(old_bucket < old_bucket_end) {
-        if(old_bucket->items_limits.len > 0) {
-          sp_hash_bucket_item * old_item = old_bucket->items;
-          const sp_hash_bucket_item * old_item_end = old_bucket->items + old_bucket->items_limits.len;
-
-          uint64_t hash = old_item->key.hash;
-          uint64_t index = sp_hash_get_index(self, hash);
-
-          sp_hash_bucket * new_bucket = sp_hash_bucket_init(self, index);
-
-          while(old_item < old_item_end) {
-            /* not already added */
-            new_bucket = sp_hash_bucket_check_and_realloc(new_bucket);
-            sp_hash_bucket_item * new_item = sp_hash_bucket_get_next_item(new_bucket);
-            new_item->key = old_item->key;
-            assert(new_item->key.str);
-            sp_hash_bucket_insert_item(new_bucket->root, new_item);
-            old_item++;
-          }
-        }
-        old_bucket++;
-      }
-    }
+  return usage;
+}
 
-    {
-      // release the old hash table, but not the string buffers which are owned by new self->impl:
-      sp_hash_bucket * old_bucket = old_buckets;
-      const sp_hash_bucket * old_bucket_end = old_buckets + old_buckets_len;
-      while(old_bucket < old_bucket_end) {
-        free(old_bucket->items), old_bucket->items = NULL;
-        old_bucket++;
-      }
-      free(old_buckets), old_buckets = NULL;
+size_t sp_hash_get_memory_usage(const sp_hash_table * self) {
+  const sp_hash_table_impl * impl = self->impl;
+  size_t usage = sizeof * impl + sp_hash_buckets_memory_usage(impl->buckets, impl->buckets_limits.len);
+  if(impl->old_buckets) { usage += sp_hash_buckets_memory_usage(impl->old_buckets, impl->old_buckets_len); }
+
+  return usage + sp_hash_strings_memory_usage(impl);
+}
+
+/* Moves up to count of the old buckets' items into the new buckets, and
+ * frees the old buckets once they're all empty. */
+static void sp_hash_rehash_step(const sp_hash_table * self, size_t count) {
+  sp_hash_table_impl * impl = self->impl;
+  assert(impl->old_buckets);
+
+  for(size_t n = 0; n < count && impl->rehash_index < impl->old_buckets_len; n++, impl->rehash_index++) {
+    sp_hash_bucket * old_bucket = &impl->old_buckets[impl->rehash_index];
+    for(size_t j = 0; j < old_bucket->items_limits.len; j++) {
+      sp_hash_bucket_item * old_item = &old_bucket->items[j];
+      sp_hash_bucket * new_bucket = sp_hash_bucket_init(self, sp_hash_get_index(self, old_item->key.hash));
+
+      size_t new_index = new_bucket->items_limits.len;
+      sp_hash_bucket_item * new_item = sp_hash_bucket_get_next_item(new_bucket);
+      new_item->key = old_item->key;
+      new_item->value = old_item->value;
+      assert(new_item->key.str);
+      sp_hash_bucket_insert_item(new_bucket, new_index);
+
+      free(old_item->siblings), old_item->siblings = NULL;
     }
-    free(old_impl), old_impl = NULL;
+    free(old_bucket->items), old_bucket->items = NULL;
+    old_bucket->items_limits.len = 0;
+    old_bucket->items_limits.capacity = 0;
+  }
+
+  if(impl->rehash_index == impl->old_buckets_len) {
+    free(impl->old_buckets), impl->old_buckets = NULL;
+    impl->old_buckets_len = 0;
+    impl->old_prime = 0;
+    impl->rehash_index = 0;
   }
+}
+
+/* Growth is spread across ensures: once the load factor is exceeded, the
+ * next prime's buckets are allocated, and each call then moves the next
+ * SP_HASH_REHASH_STEP old buckets across, so no single insert pays for the
+ * whole table. The strings stay where they are. */
+void sp_hash_rebalance(const sp_hash_table * self) {
+  sp_hash_table_impl * impl = self->impl;
+
+  if(impl->old_buckets) {
+    sp_hash_rehash_step(self, SP_HASH_REHASH_STEP);
+    return;
+  }
+
+  double load_factor = (double)impl->string_count / (double)impl->buckets_limits.len;
+  if(load_factor <= sp_hash_default_load_factor) { return; }
+
+  size_t new_prime_index = impl->prime_index + 1;
+  if(new_prime_index > (sizeof sp_hash_primes / sizeof sp_hash_primes[0]) - 1) {
+    return;
+  }
+
+  impl->old_buckets = impl->buckets;
+  impl->old_buckets_len = impl->buckets_limits.len;
+  impl->old_prime = impl->prime;
+  impl->rehash_index = 0;
+  sp_hash_buckets_alloc(impl, new_prime_index);
 
+  sp_hash_rehash_step(self, SP_HASH_REHASH_STEP);
 
   assert(self && self->impl);
 }
 
+/* While growing, keys whose old bucket hasn't been moved yet may still be
+ * there; everything else, new keys included, is in the new buckets. */
+static errno_t sp_hash_find_item(const sp_hash_table_impl * impl, const char * s, size_t s_len, uint64_t hash, sp_hash_bucket ** out_bucket, sp_hash_bucket_item ** out_item) {
+  sp_hash_bucket * bucket = NULL;
+  if(impl->old_buckets) {
+    size_t old_index = (size_t)(hash % impl->old_prime);
+    bucket = &impl->old_buckets[old_index];
+    if(old_index >= impl->rehash_index && sp_hash_find_internal(bucket, s, s_len, hash, out_item) == SP_SUCCESS) {
+      if(out_bucket) { *out_bucket = bucket; }
+      return SP_SUCCESS;
+    }
+  }
+
+  bucket = &impl->buckets[hash % impl->prime];
+  if(out_bucket) { *out_bucket = bucket; }
+  return sp_hash_find_internal(bucket, s, s_len, hash, out_item);
+}
+
 errno_t sp_hash_ensure(const sp_hash_table * self, const char * s, size_t s_len, void * value, sp_str ** out_str) {
   return sp_hash_ensure_internal(self, s, s_len, value, out_str, false, false);
 }
@@ -451,23 +699,15 @@ errno_t sp_hash_ensure_internal(const sp_hash_table * self, const char * s, size
   sp_hash_table_impl * impl = self->impl;
 
   register uint64_t hash = sp_hash_str(s, s_len);
-  register uint64_t index = sp_hash_get_index(self, hash);
 
-  sp_hash_bucket * bucket = sp_hash_bucket_init(self, index);
-
-  if(bucket->prime) {
-    /* check if it already exists */
-    assert(bucket->root);
-
-    if(sp_hash_find_internal(bucket, s, s_len, hash, NULL) == SP_SUCCESS) {
-      return SP_SUCCESS;
-    }
-
-    /* bucket exists but str wasn't found, above; allocate string and stuff it into a bucket */
-    bucket = sp_hash_bucket_check_and_realloc(bucket);
+  /* check if it already exists */
+  sp_hash_bucket_item * item = NULL;
+  if(sp_hash_find_item(impl, s, s_len, hash, NULL, &item) == SP_SUCCESS) {
+    if(out_str) { *out_str = &item->key; }
+    return SP_SUCCESS;
   }
 
-  assert(bucket && bucket->prime > 0);
+  sp_hash_bucket * bucket = sp_hash_bucket_init(self, sp_hash_get_index(self, hash));
 
   size_t out_len = 0;
   sp_str * temp_str = sp_hash_key_alloc(self, bucket, s, s_len, hash, value, &out_len, skip_s_cp);
@@ -480,8 +720,9 @@ errno_t sp_hash_ensure_internal(const sp_hash_table * self, const char * s, size
 }
 
 static sp_str * sp_hash_key_alloc(const sp_hash_table * self, sp_hash_bucket * bucket, const char * s, size_t s_len, uint64_t hash, void * value, size_t * out_len, bool skip_s_cp) {
-  assert(self && bucket && bucket->prime);
+  assert(self && bucket && bucket->items);
 
+  size_t index = bucket->items_limits.len;
   sp_hash_bucket_item * item = sp_hash_bucket_get_next_item(bucket);
   sp_str * key = &(item->key);
   const char * s_cp = s;
@@ -496,58 +737,42 @@ static sp_str * sp_hash_key_alloc(const sp_hash_table * self, sp_hash_bucket * b
 
   sp_str_ref(s_cp, s_len, hash, key);
 
-  assert(bucket->root && item->key.str);
-  sp_hash_bucket_insert_item(bucket->root, item);
+  assert(item->key.str);
+  sp_hash_bucket_insert_item(bucket, index);
 
   return key;
 }
 
-static inline errno_t sp_hash_bucket_item_tree_search(sp_hash_bucket_item * node, uint64_t hash, sp_hash_bucket_item ** out_item) {
+/* Walks the tree to the node with hash, then checks it and its siblings. */
+errno_t sp_hash_find_internal(const sp_hash_bucket * bucket, const char * s, size_t s_len, uint64_t hash, sp_hash_bucket_item ** out_item) {
   if(out_item) { *out_item = NULL; }
-  if(!node) { return SP_FAILURE; }
-  if(node->key.hash == hash) {
-    if(out_item) { *out_item = node; }
-    return SP_SUCCESS;
-  }
-  else if(hash > node->key.hash) { return sp_hash_bucket_item_tree_search(node->right, hash, out_item); }
-  else if(hash < node->key.hash) { return sp_hash_bucket_item_tree_search(node->left, hash, out_item); }
-  else { return SP_FAILURE; }
-}
-
-errno_t sp_hash_find_internal(const sp_hash_bucket * bucket, const char * s, size_t s_len, uint64_t hash, void ** out_value) {
-  if(out_value) { *out_value = NULL; }
-  if(!bucket || !bucket->prime) { return SP_FAILURE; }
+  if(!bucket || !bucket->items) { return SP_FAILURE; }
   if(bucket->items_limits.len == 0) { return SP_FAILURE; }
 
-  assert(bucket->root);
-
   sp_str needle = {
     .str = s,
     .len = s_len,
     .hash = hash
   };
 
-  sp_hash_bucket_item * item = NULL;
-  if(sp_hash_bucket_item_tree_search(bucket->root, hash, &item) == SP_SUCCESS) {
-    if(!item->siblings) {
-      /* no siblings, check leaf */
-      sp_str * key = &(item->key);
-      if(sp_str_compare(key, &needle) == 0) {
-        if(out_value) { *out_value = item->value; }
-        return SP_SUCCESS;
-      }
-    } else if(item->siblings_limits.len > 0) {
-      /* iterate siblings */
-      sp_hash_bucket_item ** start = item->siblings;
-      sp_hash_bucket_item ** end = item->siblings + item->siblings_limits.len;
-      while(start < end) {
-        item = *start;
-        sp_str * key = &(item->key);
-        if(sp_str_compare(key, &needle) == 0)
-          if(out_value) { *out_value = item->value; }
-        return SP_SUCCESS;
-      }
-      start++;
+  size_t node_index = 0;
+  while(bucket->items[node_index].key.hash != hash) {
+    const sp_hash_bucket_item * node = bucket->items + node_index;
+    node_index = hash > node->key.hash ? node->right : node->left;
+    if(node_index == 0) { return SP_FAILURE; }
+  }
+
+  sp_hash_bucket_item * item = bucket->items + node_index;
+  if(sp_str_compare(&item->key, &needle) == 0) {
+    if(out_item) { *out_item = item; }
+    return SP_SUCCESS;
+  }
+
+  for(size_t i = 0; i < item->siblings_limits.len; i++) {
+    sp_hash_bucket_item * sibling = bucket->items + item->siblings[i];
+    if(sp_str_compare(&sibling->key, &needle) == 0) {
+      if(out_item) { *out_item = sibling; }
+      return SP_SUCCESS;
     }
   }
 
@@ -555,12 +780,131 @@ errno_t sp_hash_find_internal(const sp_hash_bucket * bucket, const char * s, siz
 }
 
 errno_t sp_hash_find(const sp_hash_table * self, const char * s, size_t s_len, void ** out_value) {
+  if(out_value) { *out_value = NULL; }
+  if(!s || s_len == 0) { return SP_FAILURE; }
+
+  sp_hash_bucket_item * item = NULL;
+  if(sp_hash_find_item(self->impl, s, s_len, sp_hash_str(s, s_len), NULL, &item) != SP_SUCCESS) { return SP_FAILURE; }
+
+  if(out_value) { *out_value = item->value; }
+  return SP_SUCCESS;
+}
+
+errno_t sp_hash_upsert(const sp_hash_table * self, const char * s, size_t s_len, void * value, void ** out_previous) {
+  if(out_previous) { *out_previous = NULL; }
+  if(!s || s_len == 0) { return SP_FAILURE; }
+
+  sp_hash_bucket_item * item = NULL;
+  if(sp_hash_find_item(self->impl, s, s_len, sp_hash_str(s, s_len), NULL, &item) == SP_SUCCESS) {
+    if(out_previous) { *out_previous = item->value; }
+    item->value = value;
+    return SP_SUCCESS;
+  }
+
+  return sp_hash_ensure(self, s, s_len, value, NULL);
+}
+
+/* The last item takes the removed one's place and the bucket's tree is
+ * relinked, which is cheap for chains this short. */
+static void sp_hash_bucket_remove_item(sp_hash_bucket * bucket, size_t item_index) {
+  assert(item_index < bucket->items_limits.len);
+
+  size_t last = bucket->items_limits.len - 1;
+  free(bucket->items[item_index].siblings), bucket->items[item_index].siblings = NULL;
+  if(item_index != last) { bucket->items[item_index] = bucket->items[last]; }
+  bucket->items_limits.len--;
+
+  for(size_t i = 0; i < bucket->items_limits.len; i++) {
+    sp_hash_bucket_item * item = bucket->items + i;
+    item->siblings_limits.len = 0;
+    item->right = 0;
+    item->left = 0;
+  }
+  for(size_t i = 1; i < bucket->items_limits.len; i++) {
+    sp_hash_bucket_insert_item(bucket, i);
+  }
+}
+
+errno_t sp_hash_remove(const sp_hash_table * self, const char * s, size_t s_len, void ** out_value) {
+  if(out_value) { *out_value = NULL; }
+  if(!s || s_len == 0) { return SP_FAILURE; }
+
   sp_hash_table_impl * impl = self->impl;
-  uint64_t hash = sp_hash_str(s, s_len);
-  uint64_t index = sp_hash_get_index(self, hash);
-  assert(index < impl->prime);
-  sp_hash_bucket * bucket = &impl->buckets[index];
-  return sp_hash_find_internal(bucket, s, s_len, hash, out_value);
+  sp_hash_bucket * bucket = NULL;
+  sp_hash_bucket_item * item = NULL;
+  if(sp_hash_find_item(impl, s, s_len, sp_hash_str(s, s_len), &bucket, &item) != SP_SUCCESS) { return SP_FAILURE; }
+
+  if(out_value) { *out_value = item->value; }
+  impl->strings_dead += item->key.len + 1;
+  impl->string_count--;
+  sp_hash_bucket_remove_item(bucket, (size_t)(item - bucket->items));
+
+  return SP_SUCCESS;
+}
+
+/* New buckets, then old ones still being moved. Each bucket is walked from
+ * its last item, the one removal moves, so removing the current key never
+ * skips another. */
+bool sp_hash_next(const sp_hash_table * self, sp_hash_iter * iter) {
+  const sp_hash_table_impl * impl = self->impl;
+  size_t buckets_len = impl->buckets_limits.len;
+  size_t total = buckets_len + (impl->old_buckets ? impl->old_buckets_len : 0);
+
+  for(; iter->position < total; iter->position++, iter->remaining = 0) {
+    const sp_hash_bucket * bucket = iter->position < buckets_len ? &impl->buckets[iter->position] : &impl->old_buckets[iter->position - buckets_len];
+    if(iter->remaining == 0) { iter->remaining = bucket->items_limits.len + 1; }
+    if(iter->remaining > 1) {
+      const sp_hash_bucket_item * item = &bucket->items[--iter->remaining - 1];
+      iter->key = &item->key;
+      iter->value = item->value;
+      return true;
+    }
+  }
+
+  iter->key = NULL;
+  iter->value = NULL;
+  return false;
+}
+
+/* chained and open walks hold nothing */
+static void sp_hash_end(const sp_hash_table * self, sp_hash_iter * iter) {
+  (void)self;
+  *iter = (sp_hash_iter){ 0 };
+}
+
+/* Copies the live keys' strings into one buffer with room to spare; the old
+ * buffers, and the removed keys' strings in them, are freed. */
+static void sp_hash_compact_strings(const sp_hash_table * self) {
+  sp_hash_table_impl * impl = self->impl;
+  if(impl->strings_dead == 0) { return; }
+
+  size_t live = 0;
+  sp_hash_iter iter = { 0 };
+  while(self->next(self, &iter)) { live += iter.key->len + 1; }
+  self->end(self, &iter);
+
+  sp_string_buffer * old_buffers = impl->buffers;
+  size_t capacity = live + live / 2;
+  if(capacity < SP_HASH_MIN_STRING_ALLOC) { capacity = SP_HASH_MIN_STRING_ALLOC; }
+  impl->buffers = sp_hash_buffer_alloc(capacity);
+  impl->current_buffer = impl->buffers;
+  impl->strings_alloc = capacity * 2;
+
+  while(self->next(self, &iter)) {
+    sp_str * key = (sp_str *)(uintptr_t)iter.key;
+    size_t out_len = 0;
+    key->str = sp_hash_move_string_to_strings(self, key->str, key->len, &out_len);
+    assert(out_len == key->len);
+  }
+  self->end(self, &iter);
+
+  sp_hash_buffers_free(old_buffers), old_buffers = NULL;
+  impl->strings_dead = 0;
+}
+
+void sp_hash_compact(const sp_hash_table * self) {
+  if(self->impl->old_buckets) { sp_hash_rehash_step(self, self->impl->old_buckets_len); }
+  sp_hash_compact_strings(self);
 }
 
 const char * sp_hash_move_string_to_strings(const sp_hash_table * self, const char * s, size_t s_len, size_t * out_len) {
@@ -574,28 +918,15 @@ const char * sp_hash_move_string_to_strings(const sp_hash_table * self, const ch
   sp_string_buffer * buffer = impl->current_buffer;
   size_t alloc_len = s_len + 1;
   if(buffer->len + alloc_len > buffer->capacity) {
-    // reallocate strings
-    size_t new_len = 0;
-    size_t new_capacity = SP_HASH_DEFAULT_STRING_ALLOC;
-    while(new_len + alloc_len > new_capacity) {
+    /* a new buffer, double the last, so small tables stay small */
+    size_t new_capacity = impl->strings_alloc;
+    while(alloc_len > new_capacity) {
       new_capacity *= 2;
     }
-    sp_string_buffer * new_buffer = buffer->next;
-    if(new_buffer == NULL) {
-      new_buffer = calloc(1, sizeof * new_buffer);
-      buffer->next = new_buffer;
-      if(!new_buffer) { goto err0; }
-    }
+    sp_string_buffer * new_buffer = sp_hash_buffer_alloc(new_capacity);
+    impl->strings_alloc = new_capacity * 2;
 
-    new_buffer->len = 0;
-    if(new_capacity > new_buffer->capacity) {
-      new_buffer->capacity = new_capacity;
-      char * temp = realloc(new_buffer->strings, new_capacity * sizeof * new_buffer->strings);
-      if(!temp) { goto err0; }
-      new_buffer->strings = temp;
-    }
-
-    impl->current_buffer->next = new_buffer;
+    buffer->next = new_buffer;
     impl->current_buffer = new_buffer;
     buffer = new_buffer;
   }
@@ -612,9 +943,6 @@ const char * sp_hash_move_string_to_strings(const sp_hash_table * self, const ch
   *out_len = n_len;
 
   return offset;
-
-err0:
-  abort();
 }
 
 char * sp_hash_print_stats(const sp_hash_table * self) {
@@ -624,6 +952,9 @@ char * sp_hash_print_stats(const sp_hash_table * self) {
   char * result = out;
   out += snprintf(out, max_buf_len - (size_t)(out - result), "Load factor: %f\n", (double)impl->string_count / (double)impl->buckets_limits.len);
   out += snprintf(out, max_buf_len - (size_t)(out - result), "Buckets: (%lu, %lu)\n", (size_t)impl->buckets_limits.capacity, (size_t)impl->buckets_limits.len);
+  if(impl->old_buckets) {
+    out += snprintf(out, max_buf_len - (size_t)(out - result), "Rehashing: %zu of %zu old buckets moved\n", impl->rehash_index, impl->old_buckets_len);
+  }
 
   sp_string_buffer * buffer = impl->buffers;
   int buffer_count = 0;
@@ -636,6 +967,7 @@ char * sp_hash_print_stats(const sp_hash_table * self) {
     buffer = buffer->next;
   }
   out += snprintf(out, max_buf_len - (size_t)(out - result), "Total buffer size: %lu\n", buffer_total_len);
+  out += snprintf(out, max_buf_len - (size_t)(out - result), "Removed key bytes: %zu\n", impl->strings_dead);
   int collisions = 0;
   int reallocs = 0;
   int max_items = 0;
@@ -644,7 +976,7 @@ char * sp_hash_print_stats(const sp_hash_table * self) {
   for(size_t i = 0; i < impl->buckets_limits.len; i++) {
     const sp_hash_bucket * bucket = &impl->buckets[i];
     total_items += bucket->items_limits.len;
-    if(bucket->prime) {
+    if(bucket->items) {
       max_items = (int)bucket->items_limits.len > max_items ? (int)bucket->items_limits.len : max_items;
       if(bucket->items_limits.len > 1) {
         if(bucket->items_limits.reallocs > 0) { reallocs++; };
@@ -680,3 +1012,1339 @@ char * sp_hash_print_stats(const sp_hash_table * self) {
   return result;
 }
 
+
+/* SDBM leaves the high bits of short keys mostly clear; fold them in before
+ * picking a slot (the high 57 bits) and a control byte (the low 7) */
+static inline uint64_t sp_hash_mix(uint64_t hash) {
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+static inline uint8_t sp_hash_h2(uint64_t mixed) {
+  return (uint8_t)(mixed & 0x7f);
+}
+
+/* a bit for each control byte in the group equal to ctrl */
+static inline uint32_t sp_hash_group_match(const uint8_t * group, uint8_t ctrl) {
+#if SP_HASH_HAVE_SSE2
+  __m128i bytes = _mm_loadu_si128((const __m128i *)(const void *)group);
+  return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)ctrl)));
+#else
+  uint32_t match = 0;
+  for(uint32_t i = 0; i < SP_HASH_GROUP_WIDTH; i++) {
+    if(group[i] == ctrl) { match |= 1u << i; }
+  }
+  return match;
+#endif
+}
+
+/* a bit for each empty or deleted control byte, the ones with the high bit set */
+static inline uint32_t sp_hash_group_match_free(const uint8_t * group) {
+#if SP_HASH_HAVE_SSE2
+  return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(const void *)group));
+#else
+  uint32_t match = 0;
+  for(uint32_t i = 0; i < SP_HASH_GROUP_WIDTH; i++) {
+    if(group[i] & 0x80) { match |= 1u << i; }
+  }
+  return match;
+#endif
+}
+
+static inline bool sp_hash_ctrl_is_full(uint8_t ctrl) {
+  return (ctrl & 0x80) == 0;
+}
+
+static inline size_t sp_hash_lowest_bit(uint32_t match) {
+  assert(match != 0);
+#if defined(__GNUC__)
+  return (size_t)__builtin_ctz(match);
+#else
+  size_t i = 0;
+  while(!(match & 1u)) { match >>= 1; i++; }
+  return i;
+#endif
+}
+
+static void sp_hash_open_alloc_slots(sp_hash_table_impl * impl, size_t capacity) {
+  assert(capacity >= SP_HASH_GROUP_WIDTH && (capacity & (capacity - 1)) == 0);
+
+  impl->ctrl = malloc(capacity + SP_HASH_GROUP_WIDTH);
+  impl->slots = calloc(capacity, sizeof * impl->slots);
+  if(!impl->ctrl || !impl->slots) { abort(); }
+  memset(impl->ctrl, SP_HASH_CTRL_EMPTY, capacity + SP_HASH_GROUP_WIDTH);
+
+  impl->slots_capacity = capacity;
+  /* at most 7/8 full, so every probe sequence reaches an empty slot */
+  impl->slots_growth_left = capacity - capacity / 8 - impl->string_count;
+}
+
+static inline void sp_hash_open_set_ctrl(sp_hash_table_impl * impl, size_t i, uint8_t ctrl) {
+  impl->ctrl[i] = ctrl;
+  /* groups starting near the end read the mirror instead of wrapping */
+  if(i < SP_HASH_GROUP_WIDTH) { impl->ctrl[impl->slots_capacity + i] = ctrl; }
+}
+
+/* Groups are probed at triangular strides, which visits every group of a
+ * power of two capacity before repeating. */
+static size_t sp_hash_open_find_free(const sp_hash_table_impl * impl, uint64_t mixed) {
+  size_t mask = impl->slots_capacity - 1;
+  size_t pos = (size_t)(mixed >> 7) & mask;
+  for(size_t stride = SP_HASH_GROUP_WIDTH; ; stride += SP_HASH_GROUP_WIDTH) {
+    uint32_t free_slots = sp_hash_group_match_free(impl->ctrl + pos);
+    if(free_slots != 0) { return (pos + sp_hash_lowest_bit(free_slots)) & mask; }
+    pos = (pos + stride) & mask;
+  }
+}
+
+static errno_t sp_hash_open_find_slot(const sp_hash_table_impl * impl, const char * s, size_t s_len, uint64_t hash, sp_hash_slot ** out_slot) {
+  uint64_t mixed = sp_hash_mix(hash);
+  uint8_t h2 = sp_hash_h2(mixed);
+  size_t mask = impl->slots_capacity - 1;
+  size_t pos = (size_t)(mixed >> 7) & mask;
+  for(size_t stride = SP_HASH_GROUP_WIDTH; ; stride += SP_HASH_GROUP_WIDTH) {
+    const uint8_t * group = impl->ctrl + pos;
+    for(uint32_t match = sp_hash_group_match(group, h2); match != 0; match &= match - 1) {
+      sp_hash_slot * slot = impl->slots + ((pos + sp_hash_lowest_bit(match)) & mask);
+      if(slot->key.hash == hash && slot->key.len == s_len && memcmp(slot->key.str, s, s_len) == 0) {
+        *out_slot = slot;
+        return SP_SUCCESS;
+      }
+    }
+    /* removed keys leave tombstones, so only an empty slot ends the search */
+    if(sp_hash_group_match(group, SP_HASH_CTRL_EMPTY) != 0) { return SP_FAILURE; }
+    pos = (pos + stride) & mask;
+  }
+}
+
+/* Moves each key into fresh slots by its stored hash, which leaves the
+ * tombstones behind; strings stay put. */
+static void sp_hash_open_resize(sp_hash_table_impl * impl, size_t capacity) {
+  size_t old_capacity = impl->slots_capacity;
+  uint8_t * old_ctrl = impl->ctrl;
+  sp_hash_slot * old_slots = impl->slots;
+
+  sp_hash_open_alloc_slots(impl, capacity);
+  for(size_t i = 0; i < old_capacity; i++) {
+    if(!sp_hash_ctrl_is_full(old_ctrl[i])) { continue; }
+
+    uint64_t mixed = sp_hash_mix(old_slots[i].key.hash);
+    size_t j = sp_hash_open_find_free(impl, mixed);
+    sp_hash_open_set_ctrl(impl, j, sp_hash_h2(mixed));
+    impl->slots[j] = old_slots[i];
+  }
+
+  free(old_ctrl), old_ctrl = NULL;
+  free(old_slots), old_slots = NULL;
+}
+
+static const sp_hash_table * sp_hash_open_ctor(const sp_hash_table * self, const sp_hash_table_options * options) {
+  sp_hash_table_impl * impl = calloc(1, sizeof * impl);
+  if(!impl) { abort(); }
+
+  /* room for the expected keys without growing */
+  size_t expected_keys = options ? options->expected_keys : 0;
+  size_t capacity = SP_HASH_OPEN_MIN_CAPACITY;
+  while(capacity - capacity / 8 < expected_keys && capacity <= SIZE_MAX / 4) { capacity *= 2; }
+
+  impl->engine = sphe_open;
+  sp_hash_strings_alloc(impl, options);
+  sp_hash_open_alloc_slots(impl, capacity);
+
+  sp_hash_table * table = (sp_hash_table *)(uintptr_t)self;
+  table->ensure = &sp_hash_open_ensure;
+  table->find = &sp_hash_open_find;
+  table->upsert = &sp_hash_open_upsert;
+  table->remove = &sp_hash_open_remove;
+  table->next = &sp_hash_open_next;
+  table->compact = &sp_hash_open_compact;
+  table->print_stats = &sp_hash_open_print_stats;
+  table->get_load_factor = &sp_hash_open_get_load_factor;
+  table->get_bucket_length = &sp_hash_open_get_capacity;
+  table->get_bucket_capacity = &sp_hash_open_get_capacity;
+  table->get_memory_usage = &sp_hash_open_get_memory_usage;
+  table->impl = impl;
+
+  return self;
+}
+
+static void sp_hash_open_dtor(const sp_hash_table * self, const sp_hash_free_item free_item_fn) {
+  sp_hash_table_impl * impl = self->impl;
+
+  if(free_item_fn != NULL) {
+    for(size_t i = 0; i < impl->slots_capacity; i++) {
+      if(sp_hash_ctrl_is_full(impl->ctrl[i]) && impl->slots[i].value) { free_item_fn(impl->slots[i].value); }
+    }
+  }
+
+  free(impl->ctrl), impl->ctrl = NULL;
+  free(impl->slots), impl->slots = NULL;
+  sp_hash_clear_strings(self);
+
+  free(impl), ((sp_hash_table *)(uintptr_t)self)->impl = NULL;
+}
+
+static errno_t sp_hash_open_ensure(const sp_hash_table * self, const char * s, size_t s_len, void * value, sp_str ** out_str) {
+  if(!s) { return SP_FAILURE; }
+  if(s_len <= 0) { return SP_FAILURE; }
+
+  assert(s_len <= SP_MAX_STRING_LEN);
+
+  sp_hash_table_impl * impl = self->impl;
+  uint64_t hash = sp_hash_str(s, s_len);
+
+  sp_hash_slot * slot = NULL;
+  if(sp_hash_open_find_slot(impl, s, s_len, hash, &slot) == SP_SUCCESS) {
+    if(out_str) { *out_str = &slot->key; }
+    return SP_SUCCESS;
+  }
+
+  if(impl->slots_growth_left == 0) {
+    /* mostly tombstones: clear them at the same size rather than doubling */
+    size_t max_keys = impl->slots_capacity - impl->slots_capacity / 8;
+    sp_hash_open_resize(impl, impl->string_count < max_keys / 2 ? impl->slots_capacity : impl->slots_capacity * 2);
+  }
+
+  uint64_t mixed = sp_hash_mix(hash);
+  size_t i = sp_hash_open_find_free(impl, mixed);
+  /* a reused tombstone already counts against growth */
+  if(impl->ctrl[i] == SP_HASH_CTRL_EMPTY) { impl->slots_growth_left--; }
+  sp_hash_open_set_ctrl(impl, i, sp_hash_h2(mixed));
+
+  size_t out_len = 0;
+  const char * s_cp = sp_hash_move_string_to_strings(self, s, s_len, &out_len);
+  slot = impl->slots + i;
+  sp_str_ref(s_cp, out_len, hash, &slot->key);
+  slot->value = value;
+  impl->string_count++;
+
+  if(out_str) { *out_str = &slot->key; }
+
+  return SP_SUCCESS;
+}
+
+static errno_t sp_hash_open_find(const sp_hash_table * self, const char * s, size_t s_len, void ** out_value) {
+  if(out_value) { *out_value = NULL; }
+  if(!s || s_len == 0) { return SP_FAILURE; }
+
+  sp_hash_slot * slot = NULL;
+  if(sp_hash_open_find_slot(self->impl, s, s_len, sp_hash_str(s, s_len), &slot) != SP_SUCCESS) { return SP_FAILURE; }
+
+  if(out_value) { *out_value = slot->value; }
+  return SP_SUCCESS;
+}
+
+static errno_t sp_hash_open_upsert(const sp_hash_table * self, const char * s, size_t s_len, void * value, void ** out_previous) {
+  if(out_previous) { *out_previous = NULL; }
+  if(!s || s_len == 0) { return SP_FAILURE; }
+
+  sp_hash_slot * slot = NULL;
+  if(sp_hash_open_find_slot(self->impl, s, s_len, sp_hash_str(s, s_len), &slot) == SP_SUCCESS) {
+    if(out_previous) { *out_previous = slot->value; }
+    slot->value = value;
+    return SP_SUCCESS;
+  }
+
+  return sp_hash_open_ensure(self, s, s_len, value, NULL);
+}
+
+/* A tombstone keeps probe sequences running through the slot intact; the
+ * next resize drops it. */
+static errno_t sp_hash_open_remove(const sp_hash_table * self, const char * s, size_t s_len, void ** out_value) {
+  if(out_value) { *out_value = NULL; }
+  if(!s || s_len == 0) { return SP_FAILURE; }
+
+  sp_hash_table_impl * impl = self->impl;
+  sp_hash_slot * slot = NULL;
+  if(sp_hash_open_find_slot(impl, s, s_len, sp_hash_str(s, s_len), &slot) != SP_SUCCESS) { return SP_FAILURE; }
+
+  if(out_value) { *out_value = slot->value; }
+  impl->strings_dead += slot->key.len + 1;
+  impl->string_count--;
+  sp_hash_open_set_ctrl(impl, (size_t)(slot - impl->slots), SP_HASH_CTRL_DELETED);
+  memset(slot, 0, sizeof * slot);
+
+  return SP_SUCCESS;
+}
+
+static bool sp_hash_open_next(const sp_hash_table * self, sp_hash_iter * iter) {
+  const sp_hash_table_impl * impl = self->impl;
+
+  for(; iter->position < impl->slots_capacity; iter->position++) {
+    if(!sp_hash_ctrl_is_full(impl->ctrl[iter->position])) { continue; }
+
+    const sp_hash_slot * slot = &impl->slots[iter->position++];
+    iter->key = &slot->key;
+    iter->value = slot->value;
+    return true;
+  }
+
+  iter->key = NULL;
+  iter->value = NULL;
+  return false;
+}
+
+static void sp_hash_open_compact(const sp_hash_table * self) {
+  sp_hash_open_resize(self->impl, self->impl->slots_capacity);
+  sp_hash_compact_strings(self);
+}
+
+static double sp_hash_open_get_load_factor(const sp_hash_table * self) {
+  return (double)self->impl->string_count / (double)self->impl->slots_capacity;
+}
+
+static size_t sp_hash_open_get_capacity(const sp_hash_table * self) {
+  return self->impl->slots_capacity;
+}
+
+static size_t sp_hash_open_get_memory_usage(const sp_hash_table * self) {
+  const sp_hash_table_impl * impl = self->impl;
+  size_t usage = sizeof * impl
+    + impl->slots_capacity * sizeof * impl->slots
+    + impl->slots_capacity + SP_HASH_GROUP_WIDTH;
+
+  return usage + sp_hash_strings_memory_usage(impl);
+}
+
+static char * sp_hash_open_print_stats(const sp_hash_table * self) {
+  static const size_t max_buf_len = 1 << 13;
+  const sp_hash_table_impl * impl = self->impl;
+  char * out = calloc(max_buf_len, sizeof * out);
+  if(!out) { abort(); }
+  char * result = out;
+
+  /* how far each key sits from its home slot, in groups */
+  size_t mask = impl->slots_capacity - 1, total_groups = 0, max_groups = 0, tombstones = 0;
+  for(size_t i = 0; i < impl->slots_capacity; i++) {
+    if(impl->ctrl[i] == SP_HASH_CTRL_DELETED) { tombstones++; }
+    if(!sp_hash_ctrl_is_full(impl->ctrl[i])) { continue; }
+    size_t home = (size_t)(sp_hash_mix(impl->slots[i].key.hash) >> 7) & mask;
+    size_t groups = ((i - home) & mask) / SP_HASH_GROUP_WIDTH;
+    total_groups += groups;
+    if(groups > max_groups) { max_groups = groups; }
+  }
+
+  out += snprintf(out, max_buf_len - (size_t)(out - result), "Load factor: %f\n", sp_hash_open_get_load_factor(self));
+  out += snprintf(out, max_buf_len - (size_t)(out - result), "Slots: %zu (%zu until growth, %zu tombstones)\n", impl->slots_capacity, impl->slots_growth_left, tombstones);
+  out += snprintf(out, max_buf_len - (size_t)(out - result), "Average probe displacement (groups): %f\n", impl->string_count > 0 ? (double)total_groups / (double)impl->string_count : 0.0);
+  out += snprintf(out, max_buf_len - (size_t)(out - result), "Max probe displacement (groups): %zu\n", max_groups);
+  out += snprintf(out, max_buf_len - (size_t)(out - result), "Memory: %zu\n", sp_hash_open_get_memory_usage(self));
+  out += snprintf(out, max_buf_len - (size_t)(out - result), "Removed key bytes: %zu\n", impl->strings_dead);
+  out += snprintf(out, max_buf_len - (size_t)(out - result), "Unique keys: %zu\n", impl->string_count);
+
+  return result;
+}
+
+static inline size_t sp_hash_concurrent_stripe(uint64_t mixed) {
+  /* bucket counts are multiples of the stripe count, so a bucket's keys
+   * always share a stripe */
+  return (size_t)(mixed & (SP_HASH_STRIPE_COUNT - 1));
+}
+
+static sp_hash_concurrent_array * sp_hash_concurrent_array_alloc(size_t bucket_count) {
+  assert(bucket_count >= SP_HASH_STRIPE_COUNT && (bucket_count & (bucket_count - 1)) == 0);
+  if(bucket_count > (SIZE_MAX - sizeof(sp_hash_concurrent_array)) / sizeof(_Atomic(sp_hash_link *))) { abort(); }
+
+  sp_hash_concurrent_array * array = calloc(1, sizeof * array + bucket_count * sizeof array->heads[0]);
+  if(!array) { abort(); }
+
+  array->mask = bucket_count - 1;
+  for(size_t i = 0; i < bucket_count; i++) { atomic_init(&array->heads[i], NULL); }
+
+  return array;
+}
+
+/* Frees an array's links; nodes belong to the table. */
+static void sp_hash_concurrent_array_free(sp_hash_concurrent_array * array, bool free_nodes, const sp_hash_free_item free_item_fn) {
+  for(size_t i = 0; i <= array->mask; i++) {
+    sp_hash_link * link = atomic_load_explicit(&array->heads[i], memory_order_relaxed);
+    while(link) {
+      sp_hash_link * next = atomic_load_explicit(&link->next, memory_order_relaxed);
+      if(free_nodes) {
+        void * value = atomic_load_explicit(&link->node->value, memory_order_relaxed);
+        if(free_item_fn && value) { free_item_fn(value); }
+        free(link->node);
+      }
+      free(link), link = next;
+    }
+  }
+  free(array);
+}
+
+/* Counts a lookup or walk in flight under the epoch it starts in, and
+ * returns that epoch's parity, for leave. */
+static inline size_t sp_hash_concurrent_enter(sp_hash_concurrent * concurrent, size_t slot) {
+  for(;;) {
+    size_t epoch = atomic_load_explicit(&concurrent->epoch, memory_order_acquire);
+    size_t parity = epoch & 1;
+    atomic_fetch_add_explicit(&concurrent->readers[slot].counts[parity], 1, memory_order_relaxed);
+    /* pairs with the fence in advance: either it sees this reader, or this
+     * reader sees the epoch it moved to */
+    atomic_thread_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(&concurrent->epoch, memory_order_relaxed) == epoch) { return parity; }
+    atomic_fetch_sub_explicit(&concurrent->readers[slot].counts[parity], 1, memory_order_release);
+  }
+}
+
+static inline void sp_hash_concurrent_leave(sp_hash_concurrent * concurrent, size_t slot, size_t parity) {
+  atomic_fetch_sub_explicit(&concurrent->readers[slot].counts[parity], 1, memory_order_release);
+}
+
+static void sp_hash_concurrent_free_limbo(sp_hash_limbo * limbo) {
+  while(limbo->links) {
+    sp_hash_link * next = limbo->links->retired_next;
+    free(limbo->links->node);
+    free(limbo->links), limbo->links = next;
+  }
+  while(limbo->arrays) {
+    sp_hash_concurrent_array * next = limbo->arrays->retired_next;
+    sp_hash_concurrent_array_free(limbo->arrays, false, NULL);
+    limbo->arrays = next;
+  }
+  limbo->link_count = 0;
+}
+
+/* Moves to the next epoch once no reader is left from the previous one, and
+ * hands back what was retired then: every reader still in flight loaded the
+ * array after it was unlinked. Callers hold the retire lock. */
+static bool sp_hash_concurrent_advance(sp_hash_concurrent * concurrent, sp_hash_limbo * out_freed) {
+  size_t epoch = atomic_load_explicit(&concurrent->epoch, memory_order_relaxed);
+  size_t parity = (epoch + 1) & 1;
+
+  atomic_thread_fence(memory_order_seq_cst);
+  for(size_t i = 0; i < SP_HASH_STRIPE_COUNT; i++) {
+    if(atomic_load_explicit(&concurrent->readers[i].counts[parity], memory_order_acquire) != 0) { return false; }
+  }
+  atomic_store_explicit(&concurrent->epoch, epoch + 1, memory_order_seq_cst);
+
+  sp_hash_limbo * limbo = &concurrent->limbo[(epoch + SP_HASH_EPOCH_COUNT - 1) % SP_HASH_EPOCH_COUNT];
+  *out_freed = *limbo;
+  concurrent->retired_count -= limbo->link_count;
+  *limbo = (sp_hash_limbo){ 0 };
+
+  return true;
+}
+
+/* Files a removed link, or a replaced array, under the current epoch, and
+ * every SP_HASH_RETIRED_MAX removals, or on growing, tries to move on; once
+ * a try fails, every retire tries again until one doesn't. What that frees
+ * is freed outside the lock. */
+static void sp_hash_concurrent_retire(sp_hash_concurrent * concurrent, sp_hash_link * link, sp_hash_concurrent_array * array) {
+  sp_hash_limbo freed = { 0 };
+
+  pthread_mutex_lock(&concurrent->retire_lock);
+  size_t epoch = atomic_load_explicit(&concurrent->epoch, memory_order_relaxed);
+  sp_hash_limbo * limbo = &concurrent->limbo[epoch % SP_HASH_EPOCH_COUNT];
+  if(link) {
+    link->retired_next = limbo->links;
+    limbo->links = link;
+    limbo->link_count++;
+    concurrent->retired_count++;
+    concurrent->retired_pending++;
+  }
+  if(array) {
+    array->retired_next = limbo->arrays;
+    limbo->arrays = array;
+  }
+  if((array || concurrent->retired_pending >= SP_HASH_RETIRED_MAX) && sp_hash_concurrent_advance(concurrent, &freed)) {
+    concurrent->retired_pending = 0;
+  }
+  pthread_mutex_unlock(&concurrent->retire_lock);
+
+  sp_hash_concurrent_free_limbo(&freed);
+}
+
+/* Frees what readers may have been holding; callers have the table to
+ * themselves. */
+static void sp_hash_concurrent_free_retired(sp_hash_concurrent * concurrent) {
+  for(size_t i = 0; i < SP_HASH_EPOCH_COUNT; i++) { sp_hash_concurrent_free_limbo(&concurrent->limbo[i]); }
+  concurrent->retired_count = 0;
+  concurrent->retired_pending = 0;
+}
+
+static const sp_hash_table * sp_hash_concurrent_ctor(const sp_hash_table * self, const sp_hash_table_options * options) {
+  sp_hash_table_impl * impl = calloc(1, sizeof * impl);
+  sp_hash_concurrent * concurrent = calloc(1, sizeof * concurrent);
+  if(!impl || !concurrent) { abort(); }
+
+  /* room for the expected keys under the load factor without growing */
+  size_t expected_keys = options ? options->expected_keys : 0;
+  size_t bucket_count = SP_HASH_STRIPE_COUNT;
+  while((double)bucket_count * sp_hash_default_load_factor < (double)expected_keys && bucket_count <= SIZE_MAX / 4) { bucket_count *= 2; }
+
+  atomic_init(&concurrent->array, sp_hash_concurrent_array_alloc(bucket_count));
+  atomic_init(&concurrent->key_count, 0);
+  atomic_init(&concurrent->epoch, 0);
+  if(pthread_mutex_init(&concurrent->retire_lock, NULL) != 0) { abort(); }
+  for(size_t i = 0; i < SP_HASH_STRIPE_COUNT; i++) {
+    if(pthread_mutex_init(&concurrent->stripes[i], NULL) != 0) { abort(); }
+    atomic_init(&concurrent->readers[i].counts[0], 0);
+    atomic_init(&concurrent->readers[i].counts[1], 0);
+  }
+
+  impl->engine = sphe_concurrent;
+  impl->concurrent = concurrent;
+
+  sp_hash_table * table = (sp_hash_table *)(uintptr_t)self;
+  table->ensure = &sp_hash_concurrent_ensure;
+  table->find = &sp_hash_concurrent_find;
+  table->upsert = &sp_hash_concurrent_upsert;
+  table->remove = &sp_hash_concurrent_remove;
+  table->next = &sp_hash_concurrent_next;
+  table->end = &sp_hash_concurrent_end;
+  table->compact = &sp_hash_concurrent_compact;
+  table->print_stats = &sp_hash_concurrent_print_stats;
+  table->get_load_factor = &sp_hash_concurrent_get_load_factor;
+  table->get_bucket_length = &sp_hash_concurrent_get_bucket_length;
+  table->get_bucket_capacity = &sp_hash_concurrent_get_bucket_length;
+  table->get_key_count = &sp_hash_concurrent_get_key_count;
+  table->get_memory_usage = &sp_hash_concurrent_get_memory_usage;
+  table->impl = impl;
+
+  return self;
+}
+
+static void sp_hash_concurrent_dtor(const sp_hash_table * self, const sp_hash_free_item free_item_fn) {
+  sp_hash_table_impl * impl = self->impl;
+  sp_hash_concurrent * concurrent = impl->concurrent;
+
+  sp_hash_concurrent_free_retired(concurrent);
+  sp_hash_concurrent_array_free(atomic_load_explicit(&concurrent->array, memory_order_relaxed), true, free_item_fn);
+  for(size_t i = 0; i < SP_HASH_STRIPE_COUNT; i++) {
+    pthread_mutex_destroy(&concurrent->stripes[i]);
+  }
+  pthread_mutex_destroy(&concurrent->retire_lock);
+
+  free(concurrent), impl->concurrent = NULL;
+  free(impl), ((sp_hash_table *)(uintptr_t)self)->impl = NULL;
+}
+
+static sp_hash_link * sp_hash_concurrent_find_link(const sp_hash_concurrent_array * array, const char * s, size_t s_len, uint64_t hash, uint64_t mixed) {
+  sp_hash_link * link = atomic_load_explicit(&array->heads[mixed & array->mask], memory_order_acquire);
+  for(; link; link = atomic_load_explicit(&link->next, memory_order_acquire)) {
+    const sp_str * key = &link->node->key;
+    if(key->hash == hash && key->len == s_len && memcmp(key->str, s, s_len) == 0) { return link; }
+  }
+
+  return NULL;
+}
+
+/* Takes every stripe, so no writer is mid-insert, and publishes a doubled
+ * array. Readers still walking the old one see all it held; it's handed
+ * back, for the caller to retire. */
+static sp_hash_concurrent_array * sp_hash_concurrent_grow(sp_hash_concurrent * concurrent, const sp_hash_concurrent_array * seen) {
+  for(size_t i = 0; i < SP_HASH_STRIPE_COUNT; i++) { pthread_mutex_lock(&concurrent->stripes[i]); }
+
+  sp_hash_concurrent_array * replaced = NULL;
+  sp_hash_concurrent_array * array = atomic_load_explicit(&concurrent->array, memory_order_relaxed);
+  if(array == seen && array->mask < SIZE_MAX / 4) {
+    sp_hash_concurrent_array * grown = sp_hash_concurrent_array_alloc((array->mask + 1) * 2);
+    for(size_t i = 0; i <= array->mask; i++) {
+      const sp_hash_link * link = atomic_load_explicit(&array->heads[i], memory_order_relaxed);
+      for(; link; link = atomic_load_explicit(&link->next, memory_order_relaxed)) {
+        sp_hash_link * copy = calloc(1, sizeof * copy);
+        if(!copy) { abort(); }
+
+        size_t j = (size_t)sp_hash_mix(link->node->key.hash) & grown->mask;
+        copy->node = link->node;
+        atomic_init(&copy->next, atomic_load_explicit(&grown->heads[j], memory_order_relaxed));
+        atomic_store_explicit(&grown->heads[j], copy, memory_order_relaxed);
+      }
+    }
+
+    atomic_store_explicit(&concurrent->array, grown, memory_order_release);
+    replaced = array;
+  }
+
+  for(size_t i = SP_HASH_STRIPE_COUNT; i > 0; i--) { pthread_mutex_unlock(&concurrent->stripes[i - 1]); }
+  return replaced;
+}
+
+/* Sets the key's value if asked, adding the key if it's missing; out_node
+ * is the key's node either way. Links are copied when the table grows, and
+ * the old ones freed, so only the node outlives the call. */
+static errno_t sp_hash_concurrent_insert(const sp_hash_table * self, const char * s, size_t s_len, void * value, bool replace, void ** out_previous, sp_hash_node ** out_node) {
+  if(!s) { return SP_FAILURE; }
+  if(s_len <= 0) { return SP_FAILURE; }
+
+  assert(s_len <= SP_MAX_STRING_LEN);
+
+  sp_hash_concurrent * concurrent = self->impl->concurrent;
+  uint64_t hash = sp_hash_str(s, s_len);
+  uint64_t mixed = sp_hash_mix(hash);
+
+  /* counted in flight, so seen isn't freed, or reused, under the check */
+  size_t slot = sp_hash_concurrent_stripe(mixed);
+  size_t parity = sp_hash_concurrent_enter(concurrent, slot);
+  const sp_hash_concurrent_array * seen = atomic_load_explicit(&concurrent->array, memory_order_acquire);
+  size_t key_count = atomic_load_explicit(&concurrent->key_count, memory_order_relaxed);
+  sp_hash_concurrent_array * replaced = NULL;
+  if((double)key_count > (double)(seen->mask + 1) * sp_hash_default_load_factor) { replaced = sp_hash_concurrent_grow(concurrent, seen); }
+  sp_hash_concurrent_leave(concurrent, slot, parity);
+  if(replaced) { sp_hash_concurrent_retire(concurrent, NULL, replaced); }
+
+  pthread_mutex_t * stripe = &concurrent->stripes[sp_hash_concurrent_stripe(mixed)];
+  pthread_mutex_lock(stripe);
+
+  /* growth needs every stripe, so this array stays current until unlock */
+  sp_hash_concurrent_array * array = atomic_load_explicit(&concurrent->array, memory_order_relaxed);
+  sp_hash_link * link = sp_hash_concurrent_find_link(array, s, s_len, hash, mixed);
+  if(link) {
+    void * previous = replace
+      ? atomic_exchange_explicit(&link->node->value, value, memory_order_acq_rel)
+      : atomic_load_explicit(&link->node->value, memory_order_relaxed);
+    if(out_previous) { *out_previous = replace ? previous : NULL; }
+    goto done;
+  }
+
+  sp_hash_node * node = malloc(sizeof * node + s_len + 1);
+  link = calloc(1, sizeof * link);
+  if(!node || !link) { abort(); }
+
+  memcpy(node->str, s, s_len);
+  node->str[s_len] = '\0';
+  sp_str_ref(node->str, s_len, hash, &node->key);
+  atomic_init(&node->value, value);
+
+  _Atomic(sp_hash_link *) * head = &array->heads[mixed & array->mask];
+  link->node = node;
+  atomic_init(&link->next, atomic_load_explicit(head, memory_order_relaxed));
+  /* publishes the node and its string along with the link */
+  atomic_store_explicit(head, link, memory_order_release);
+  atomic_fetch_add_explicit(&concurrent->key_count, 1, memory_order_relaxed);
+
+done:
+  if(out_node) { *out_node = link->node; }
+  pthread_mutex_unlock(stripe);
+  return SP_SUCCESS;
+}
+
+static errno_t sp_hash_concurrent_ensure(const sp_hash_table * self, const char * s, size_t s_len, void * value, sp_str ** out_str) {
+  sp_hash_node * node = NULL;
+  if(sp_hash_concurrent_insert(self, s, s_len, value, false, NULL, &node) != SP_SUCCESS) { return SP_FAILURE; }
+
+  if(out_str) { *out_str = &node->key; }
+  return SP_SUCCESS;
+}
+
+static errno_t sp_hash_concurrent_upsert(const sp_hash_table * self, const char * s, size_t s_len, void * value, void ** out_previous) {
+  if(out_previous) { *out_previous = NULL; }
+  return sp_hash_concurrent_insert(self, s, s_len, value, true, out_previous, NULL);
+}
+
+static errno_t sp_hash_concurrent_find(const sp_hash_table * self, const char * s, size_t s_len, void ** out_value) {
+  if(out_value) { *out_value = NULL; }
+  if(!s || s_len == 0) { return SP_FAILURE; }
+
+  sp_hash_concurrent * concurrent = self->impl->concurrent;
+  uint64_t hash = sp_hash_str(s, s_len);
+  uint64_t mixed = sp_hash_mix(hash);
+
+  size_t slot = sp_hash_concurrent_stripe(mixed);
+  size_t parity = sp_hash_concurrent_enter(concurrent, slot);
+  const sp_hash_concurrent_array * array = atomic_load_explicit(&concurrent->array, memory_order_acquire);
+  const sp_hash_link * link = sp_hash_concurrent_find_link(array, s, s_len, hash, mixed);
+  if(link && out_value) { *out_value = atomic_load_explicit(&link->node->value, memory_order_acquire); }
+  sp_hash_concurrent_leave(concurrent, slot, parity);
+
+  return link ? SP_SUCCESS : SP_FAILURE;
+}
+
+/* Unlinks the key from the current array. Its link keeps pointing on down
+ * the chain for readers still on it, and is retired, with the node, until
+ * none can be. */
+static errno_t sp_hash_concurrent_remove(const sp_hash_table * self, const char * s, size_t s_len, void ** out_value) {
+  if(out_value) { *out_value = NULL; }
+  if(!s || s_len == 0) { return SP_FAILURE; }
+
+  sp_hash_concurrent * concurrent = self->impl->concurrent;
+  uint64_t hash = sp_hash_str(s, s_len);
+  uint64_t mixed = sp_hash_mix(hash);
+
+  sp_hash_link * removed = NULL;
+  pthread_mutex_t * stripe = &concurrent->stripes[sp_hash_concurrent_stripe(mixed)];
+  pthread_mutex_lock(stripe);
+
+  sp_hash_concurrent_array * array = atomic_load_explicit(&concurrent->array, memory_order_relaxed);
+  _Atomic(sp_hash_link *) * prev = &array->heads[mixed & array->mask];
+  sp_hash_link * link = atomic_load_explicit(prev, memory_order_relaxed);
+  for(; link; prev = &link->next, link = atomic_load_explicit(prev, memory_order_relaxed)) {
+    const sp_str * key = &link->node->key;
+    if(key->hash != hash || key->len != s_len || memcmp(key->str, s, s_len) != 0) { continue; }
+
+    atomic_store_explicit(prev, atomic_load_explicit(&link->next, memory_order_relaxed), memory_order_release);
+    atomic_fetch_sub_explicit(&concurrent->key_count, 1, memory_order_relaxed);
+    if(out_value) { *out_value = atomic_load_explicit(&link->node->value, memory_order_relaxed); }
+
+    removed = link;
+    break;
+  }
+
+  pthread_mutex_unlock(stripe);
+
+  if(!removed) { return SP_FAILURE; }
+  sp_hash_concurrent_retire(concurrent, removed, NULL);
+  return SP_SUCCESS;
+}
+
+/* Walks the array that was current when the walk began, keeping the next
+ * link rather than the current one, so removing the current key doesn't end
+ * the walk. The walk counts as a lookup in flight until it runs out or end
+ * is called. */
+static bool sp_hash_concurrent_next(const sp_hash_table * self, sp_hash_iter * iter) {
+  sp_hash_concurrent * concurrent = self->impl->concurrent;
+  if(!iter->snapshot) {
+    /* ended already */
+    if(iter->position > 0) { return false; }
+
+    iter->epoch = sp_hash_concurrent_enter(concurrent, 0);
+    iter->snapshot = atomic_load_explicit(&concurrent->array, memory_order_acquire);
+  }
+  const sp_hash_concurrent_array * array = iter->snapshot;
+
+  const sp_hash_link * link = (const sp_hash_link *)(uintptr_t)iter->remaining;
+  while(!link && iter->position <= array->mask) {
+    link = atomic_load_explicit(&array->heads[iter->position++], memory_order_acquire);
+  }
+  if(!link) {
+    iter->key = NULL;
+    iter->value = NULL;
+    iter->snapshot = NULL;
+    iter->position = SIZE_MAX;
+    sp_hash_concurrent_leave(concurrent, 0, iter->epoch);
+    return false;
+  }
+
+  iter->key = &link->node->key;
+  iter->value = atomic_load_explicit(&link->node->value, memory_order_acquire);
+  iter->remaining = (size_t)(uintptr_t)atomic_load_explicit(&link->next, memory_order_acquire);
+  return true;
+}
+
+static void sp_hash_concurrent_end(const sp_hash_table * self, sp_hash_iter * iter) {
+  if(iter->snapshot) { sp_hash_concurrent_leave(self->impl->concurrent, 0, iter->epoch); }
+  *iter = (sp_hash_iter){ 0 };
+}
+
+static void sp_hash_concurrent_compact(const sp_hash_table * self) {
+  sp_hash_concurrent_free_retired(self->impl->concurrent);
+}
+
+static double sp_hash_concurrent_get_load_factor(const sp_hash_table * self) {
+  return (double)sp_hash_concurrent_get_key_count(self) / (double)sp_hash_concurrent_get_bucket_length(self);
+}
+
+static size_t sp_hash_concurrent_get_bucket_length(const sp_hash_table * self) {
+  sp_hash_concurrent * concurrent = self->impl->concurrent;
+
+  size_t parity = sp_hash_concurrent_enter(concurrent, 0);
+  size_t bucket_length = atomic_load_explicit(&concurrent->array, memory_order_acquire)->mask + 1;
+  sp_hash_concurrent_leave(concurrent, 0, parity);
+
+  return bucket_length;
+}
+
+static size_t sp_hash_concurrent_get_key_count(const sp_hash_table * self) {
+  return atomic_load_explicit(&self->impl->concurrent->key_count, memory_order_relaxed);
+}
+
+static size_t sp_hash_concurrent_array_memory_usage(const sp_hash_concurrent_array * array, bool count_nodes) {
+  size_t usage = sizeof * array + (array->mask + 1) * sizeof array->heads[0];
+  for(size_t i = 0; i <= array->mask; i++) {
+    const sp_hash_link * link = atomic_load_explicit(&array->heads[i], memory_order_acquire);
+    for(; link; link = atomic_load_explicit(&link->next, memory_order_acquire)) {
+      usage += sizeof * link;
+      if(count_nodes) { usage += sizeof * link->node + link->node->key.len + 1; }
+    }
+  }
+
+  return usage;
+}
+
+/* like the stats, a snapshot when writers are active */
+static size_t sp_hash_concurrent_get_memory_usage(const sp_hash_table * self) {
+  sp_hash_concurrent * concurrent = self->impl->concurrent;
+  size_t usage = sizeof * self->impl + sizeof * concurrent;
+
+  size_t parity = sp_hash_concurrent_enter(concurrent, 0);
+  usage += sp_hash_concurrent_array_memory_usage(atomic_load_explicit(&concurrent->array, memory_order_acquire), true);
+  sp_hash_concurrent_leave(concurrent, 0, parity);
+
+  /* retired lists only change, and are only freed from, under the lock */
+  pthread_mutex_lock(&concurrent->retire_lock);
+  for(size_t i = 0; i < SP_HASH_EPOCH_COUNT; i++) {
+    const sp_hash_concurrent_array * array = concurrent->limbo[i].arrays;
+    for(; array; array = array->retired_next) {
+      usage += sp_hash_concurrent_array_memory_usage(array, false);
+    }
+    const sp_hash_link * link = concurrent->limbo[i].links;
+    for(; link; link = link->retired_next) {
+      usage += sizeof * link + sizeof * link->node + link->node->key.len + 1;
+    }
+  }
+  pthread_mutex_unlock(&concurrent->retire_lock);
+
+  return usage;
+}
+
+static char * sp_hash_concurrent_print_stats(const sp_hash_table * self) {
+  static const size_t max_buf_len = 1 << 13;
+  sp_hash_concurrent * concurrent = self->impl->concurrent;
+  char * out = calloc(max_buf_len, sizeof * out);
+  if(!out) { abort(); }
+  char * result = out;
+
+  size_t parity = sp_hash_concurrent_enter(concurrent, 0);
+  const sp_hash_concurrent_array * array = atomic_load_explicit(&concurrent->array, memory_order_acquire);
+  size_t max_chain = 0, retired_arrays = 0, retired_links = 0;
+  for(size_t i = 0; i <= array->mask; i++) {
+    size_t chain = 0;
+    const sp_hash_link * link = atomic_load_explicit(&array->heads[i], memory_order_acquire);
+    for(; link; link = atomic_load_explicit(&link->next, memory_order_acquire)) { chain++; }
+    if(chain > max_chain) { max_chain = chain; }
+  }
+  size_t bucket_length = array->mask + 1;
+  sp_hash_concurrent_leave(concurrent, 0, parity);
+
+  pthread_mutex_lock(&concurrent->retire_lock);
+  for(size_t i = 0; i < SP_HASH_EPOCH_COUNT; i++) {
+    const sp_hash_concurrent_array * retired = concurrent->limbo[i].arrays;
+    for(; retired; retired = retired->retired_next) { retired_arrays++; }
+  }
+  retired_links = concurrent->retired_count;
+  size_t epoch = atomic_load_explicit(&concurrent->epoch, memory_order_relaxed);
+  pthread_mutex_unlock(&concurrent->retire_lock);
+
+  out += snprintf(out, max_buf_len - (size_t)(out - result), "Load factor: %f\n", sp_hash_concurrent_get_load_factor(self));
+  out += snprintf(out, max_buf_len - (size_t)(out - result), "Buckets: %zu (%d stripes)\n", bucket_length, SP_HASH_STRIPE_COUNT);
+  out += snprintf(out, max_buf_len - (size_t)(out - result), "Max bucket chain count: %zu\n", max_chain);
+  out += snprintf(out, max_buf_len - (size_t)(out - result), "Retired, awaiting readers: %zu arrays, %zu keys (epoch %zu)\n", retired_arrays, retired_links, epoch);
+  out += snprintf(out, max_buf_len - (size_t)(out - result), "Memory: %zu\n", sp_hash_concurrent_get_memory_usage(self));
+  out += snprintf(out, max_buf_len - (size_t)(out - result), "Unique keys: %zu\n", sp_hash_concurrent_get_key_count(self));
+
+  return result;
+}
+
+static double sp_hash_seconds(void) {
+  struct timespec now = { 0 };
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+#define SP_HASH_BENCH_KEY_LEN 32
+
+static void sp_hash_bench_engine(FILE * out, const sp_hash_table_options * options, const char * name, const char * keys, const char * misses, const size_t * order, size_t key_count, size_t rounds) {
+  const sp_hash_table * table = sp_hash_table_acquire();
+  sp_hash_table_ctor_ex(table, options);
+
+  /* each ensure is timed on its own for the worst case, which is what a
+   * frame notices */
+  double ensure_total = 0, ensure_worst = 0;
+  for(size_t i = 0; i < key_count; i++) {
+    const char * key = keys + i * SP_HASH_BENCH_KEY_LEN;
+    double before = sp_hash_seconds();
+    table->ensure(table, key, strnlen(key, SP_HASH_BENCH_KEY_LEN), (void *)(uintptr_t)(i + 1), NULL);
+    double elapsed = sp_hash_seconds() - before;
+    ensure_total += elapsed;
+    if(elapsed > ensure_worst) { ensure_worst = elapsed; }
+  }
+  double inserted = sp_hash_seconds();
+
+  size_t found = 0;
+  for(size_t r = 0; r < rounds; r++) {
+    for(size_t i = 0; i < key_count; i++) {
+      const char * key = keys + order[i] * SP_HASH_BENCH_KEY_LEN;
+      void * value = NULL;
+      if(table->find(table, key, strnlen(key, SP_HASH_BENCH_KEY_LEN), &value) == SP_SUCCESS && value == (void *)(uintptr_t)(order[i] + 1)) { found++; }
+    }
+  }
+  double hit = sp_hash_seconds();
+
+  size_t missed = 0;
+  for(size_t r = 0; r < rounds; r++) {
+    for(size_t i = 0; i < key_count; i++) {
+      const char * key = misses + order[i] * SP_HASH_BENCH_KEY_LEN;
+      if(table->find(table, key, strnlen(key, SP_HASH_BENCH_KEY_LEN), NULL) != SP_SUCCESS) { missed++; }
+    }
+  }
+  double miss = sp_hash_seconds();
+
+  double lookups = (double)key_count * (double)rounds;
+  fprintf(out, "%-10s %10zu %12.1f %12.1f %12.1f %12.1f %14zu%s\n", name, table->get_key_count(table),
+      ensure_total * 1e9 / (double)key_count, ensure_worst * 1e6, (hit - inserted) * 1e9 / lookups, (miss - hit) * 1e9 / lookups,
+      table->get_memory_usage(table), found == key_count * rounds && missed == key_count * rounds ? "" : " (lookups failed)");
+
+  table->release(table, NULL);
+}
+
+void sp_hash_bench(FILE * out, size_t key_count, size_t rounds) {
+  if(!out || key_count == 0 || rounds == 0) { return; }
+
+  char * keys = calloc(key_count, SP_HASH_BENCH_KEY_LEN);
+  char * misses = calloc(key_count, SP_HASH_BENCH_KEY_LEN);
+  size_t * order = calloc(key_count, sizeof * order);
+  if(!keys || !misses || !order) { abort(); }
+
+  /* asset-like keys, looked up in a shuffled order */
+  uint64_t state = 0x9e3779b97f4a7c15ull;
+  for(size_t i = 0; i < key_count; i++) {
+    snprintf(keys + i * SP_HASH_BENCH_KEY_LEN, SP_HASH_BENCH_KEY_LEN, "res/asset.%zu", i);
+    snprintf(misses + i * SP_HASH_BENCH_KEY_LEN, SP_HASH_BENCH_KEY_LEN, "res/missing.%zu", i);
+    order[i] = i;
+  }
+  for(size_t i = key_count - 1; i > 0; i--) {
+    state ^= state << 13, state ^= state >> 7, state ^= state << 17;
+    size_t j = (size_t)(state % (i + 1));
+    size_t temp = order[i];
+    order[i] = order[j];
+    order[j] = temp;
+  }
+
+  fprintf(out, "%-10s %10s %12s %12s %12s %12s %14s\n", "engine", "keys", "ensure ns", "worst us", "hit ns", "miss ns", "memory bytes");
+  sp_hash_table_options chained = { .engine = sphe_chained };
+  sp_hash_table_options open = { .engine = sphe_open };
+  sp_hash_table_options concurrent = { .engine = sphe_concurrent };
+  sp_hash_bench_engine(out, &chained, "chained", keys, misses, order, key_count, rounds);
+  sp_hash_bench_engine(out, &open, "open", keys, misses, order, key_count, rounds);
+  sp_hash_bench_engine(out, &concurrent, "concurrent", keys, misses, order, key_count, rounds);
+
+  free(order), order = NULL;
+  free(misses), misses = NULL;
+  free(keys), keys = NULL;
+}
+
+static void sp_hash_engine_tests(sp_hash_engine engine) {
+  sp_hash_table_options options = { .engine = engine };
+  const sp_hash_table * table = sp_hash_table_acquire();
+  sp_hash_table_ctor_ex(table, &options);
+
+  char key[32] = { 0 };
+  for(size_t i = 0; i < 1000; i++) {
+    int key_len = snprintf(key, sizeof key, "key.%zu", i);
+    sp_str * str = NULL;
+    assert(table->ensure(table, key, (size_t)key_len, (void *)(uintptr_t)(i + 1), &str) == SP_SUCCESS);
+    assert(str && str->str != key && str->len == (size_t)key_len && strcmp(str->str, key) == 0);
+
+    /* earlier keys stay findable while the table grows */
+    key_len = snprintf(key, sizeof key, "key.%zu", i / 2);
+    void * value = NULL;
+    assert(table->find(table, key, (size_t)key_len, &value) == SP_SUCCESS && value == (void *)(uintptr_t)(i / 2 + 1));
+  }
+  assert(table->get_key_count(table) == 1000);
+
+  /* ensuring a key again keeps the first value */
+  assert(table->ensure(table, "key.7", strlen("key.7"), NULL, NULL) == SP_SUCCESS);
+  assert(table->get_key_count(table) == 1000);
+
+  for(size_t i = 0; i < 1000; i++) {
+    int key_len = snprintf(key, sizeof key, "key.%zu", i);
+    void * value = NULL;
+    assert(table->find(table, key, (size_t)key_len, &value) == SP_SUCCESS && value == (void *)(uintptr_t)(i + 1));
+  }
+
+  void * value = (void *)(uintptr_t)1;
+  assert(table->find(table, "key.1000", strlen("key.1000"), &value) == SP_FAILURE && value == NULL);
+  assert(table->find(table, "key.", strlen("key."), NULL) == SP_FAILURE);
+  assert(table->get_load_factor(table) > 0.0 && table->get_memory_usage(table) > 0);
+
+  table->release(table, NULL);
+}
+
+/* removal, upsert and iteration, with the churn an asset cache sees */
+static void sp_hash_remove_tests(sp_hash_engine engine) {
+  sp_hash_table_options options = { .engine = engine };
+  const sp_hash_table * table = sp_hash_table_acquire();
+  sp_hash_table_ctor_ex(table, &options);
+
+  char key[32] = { 0 };
+  for(size_t i = 0; i < 1000; i++) {
+    int key_len = snprintf(key, sizeof key, "key.%zu", i);
+    assert(table->ensure(table, key, (size_t)key_len, (void *)(uintptr_t)(i + 1), NULL) == SP_SUCCESS);
+  }
+
+  for(size_t i = 1; i < 1000; i += 2) {
+    int key_len = snprintf(key, sizeof key, "key.%zu", i);
+    void * value = NULL;
+    assert(table->remove(table, key, (size_t)key_len, &value) == SP_SUCCESS && value == (void *)(uintptr_t)(i + 1));
+    assert(table->remove(table, key, (size_t)key_len, &value) == SP_FAILURE && value == NULL);
+  }
+  assert(table->get_key_count(table) == 500);
+
+  for(size_t i = 0; i < 1000; i++) {
+    int key_len = snprintf(key, sizeof key, "key.%zu", i);
+    void * value = NULL;
+    errno_t found = table->find(table, key, (size_t)key_len, &value);
+    assert(i % 2 == 0 ? found == SP_SUCCESS && value == (void *)(uintptr_t)(i + 1) : found == SP_FAILURE);
+  }
+
+  void * previous = NULL, * value = NULL;
+  assert(table->upsert(table, "key.0", strlen("key.0"), (void *)(uintptr_t)42, &previous) == SP_SUCCESS && previous == (void *)(uintptr_t)1);
+  assert(table->find(table, "key.0", strlen("key.0"), &value) == SP_SUCCESS && value == (void *)(uintptr_t)42);
+  assert(table->upsert(table, "key.1", strlen("key.1"), (void *)(uintptr_t)2, &previous) == SP_SUCCESS && previous == NULL);
+  assert(table->get_key_count(table) == 501);
+
+  size_t seen = 0;
+  sp_hash_iter iter = { 0 };
+  while(table->next(table, &iter)) {
+    assert(table->find(table, iter.key->str, iter.key->len, &value) == SP_SUCCESS && value == iter.value);
+    seen++;
+  }
+  assert(seen == 501 && iter.key == NULL && !table->next(table, &iter));
+  table->end(table, &iter);
+
+  /* churned keys' strings are reclaimed by compact, or as they go in
+   * concurrent tables */
+  for(size_t round = 0; round < 8; round++) {
+    for(size_t i = 0; i < 500; i++) {
+      int key_len = snprintf(key, sizeof key, "churn.%zu.%zu", round, i);
+      assert(table->ensure(table, key, (size_t)key_len, NULL, NULL) == SP_SUCCESS);
+    }
+    for(size_t i = 0; i < 500; i++) {
+      int key_len = snprintf(key, sizeof key, "churn.%zu.%zu", round, i);
+      assert(table->remove(table, key, (size_t)key_len, NULL) == SP_SUCCESS);
+    }
+  }
+  assert(table->get_key_count(table) == 501);
+
+  size_t memory = table->get_memory_usage(table);
+  table->compact(table);
+  assert(engine == sphe_concurrent ? table->get_memory_usage(table) <= memory : table->get_memory_usage(table) < memory);
+  for(size_t i = 0; i < 1000; i += 2) {
+    int key_len = snprintf(key, sizeof key, "key.%zu", i);
+    sp_str * str = NULL;
+    assert(table->ensure(table, key, (size_t)key_len, NULL, &str) == SP_SUCCESS && strcmp(str->str, key) == 0);
+  }
+  assert(table->get_key_count(table) == 501);
+
+  /* removing the current key doesn't disturb the walk */
+  seen = 0;
+  while(table->next(table, &iter)) {
+    assert(table->remove(table, iter.key->str, iter.key->len, NULL) == SP_SUCCESS);
+    seen++;
+  }
+  table->end(table, &iter);
+  assert(seen == 501 && table->get_key_count(table) == 0);
+
+  /* walks stopped early are ended the same way, and start over after */
+  assert(table->ensure(table, "key.0", strlen("key.0"), NULL, NULL) == SP_SUCCESS);
+  assert(table->next(table, &iter) && iter.key);
+  table->end(table, &iter);
+  assert(iter.key == NULL && iter.position == 0 && table->next(table, &iter));
+  table->end(table, &iter);
+  assert(table->remove(table, "key.0", strlen("key.0"), NULL) == SP_SUCCESS);
+
+  for(size_t i = 0; i < 1000; i++) {
+    int key_len = snprintf(key, sizeof key, "key.%zu", i);
+    assert(table->ensure(table, key, (size_t)key_len, (void *)(uintptr_t)(i + 1), NULL) == SP_SUCCESS);
+  }
+  for(size_t i = 0; i < 1000; i++) {
+    int key_len = snprintf(key, sizeof key, "key.%zu", i);
+    assert(table->find(table, key, (size_t)key_len, &value) == SP_SUCCESS && value == (void *)(uintptr_t)(i + 1));
+  }
+  assert(table->get_key_count(table) == 1000);
+
+  table->release(table, NULL);
+}
+
+/* hinted tables hold their keys without growing; unhinted ones start small */
+static void sp_hash_capacity_tests(sp_hash_engine engine) {
+  static const char * keys[] = { "pr.number", "print.char", "deja.sans", "open.font.license", "deja.license" };
+  static const size_t keys_len = sizeof keys / sizeof keys[0];
+
+  sp_hash_table_options options = { .expected_keys = 1000, .expected_string_bytes = 1000 * 8, .engine = engine };
+  const sp_hash_table * table = sp_hash_table_acquire();
+  sp_hash_table_ctor_ex(table, &options);
+
+  size_t buckets = table->get_bucket_length(table);
+  size_t memory = table->get_memory_usage(table);
+  char key[32] = { 0 };
+  for(size_t i = 0; i < 1000; i++) {
+    int key_len = snprintf(key, sizeof key, "key.%zu", i);
+    assert(table->ensure(table, key, (size_t)key_len, NULL, NULL) == SP_SUCCESS);
+  }
+  assert(table->get_bucket_length(table) == buckets);
+  /* open tables allocate everything up front; chained buckets on first use */
+  assert(engine != sphe_open || table->get_memory_usage(table) == memory);
+  table->release(table, NULL);
+
+  options = (sp_hash_table_options){ .engine = engine };
+  table = sp_hash_table_acquire();
+  sp_hash_table_ctor_ex(table, &options);
+  for(size_t i = 0; i < keys_len; i++) {
+    assert(table->ensure(table, keys[i], strlen(keys[i]), NULL, NULL) == SP_SUCCESS);
+  }
+  assert(table->get_memory_usage(table) < 16 * 1024);
+  table->release(table, NULL);
+}
+
+#define SP_HASH_TEST_THREADS 4
+#define SP_HASH_TEST_THREAD_KEYS 2000
+
+typedef struct sp_hash_test_worker {
+  const sp_hash_table * table;
+  size_t index;
+  size_t failures;
+  const atomic_bool * stop;
+} sp_hash_test_worker;
+
+/* Writers overlap each other's keys by half; readers look up keys that were
+ * there from the start, which must never go missing while the table grows. */
+static void * sp_hash_test_writer(void * arg) {
+  sp_hash_test_worker * worker = arg;
+  char key[32] = { 0 };
+  for(size_t i = 0; i < SP_HASH_TEST_THREAD_KEYS; i++) {
+    size_t n = worker->index * SP_HASH_TEST_THREAD_KEYS / 2 + i;
+    int key_len = snprintf(key, sizeof key, "shared.%zu", n);
+    sp_str * str = NULL;
+    if(worker->table->ensure(worker->table, key, (size_t)key_len, (void *)(uintptr_t)(n + 1), &str) != SP_SUCCESS || strcmp(str->str, key) != 0) { worker->failures++; }
+  }
+
+  return NULL;
+}
+
+static void * sp_hash_test_reader(void * arg) {
+  sp_hash_test_worker * worker = arg;
+  char key[32] = { 0 };
+  for(size_t round = 0; round < 8; round++) {
+    for(size_t i = 0; i < 500; i++) {
+      int key_len = snprintf(key, sizeof key, "key.%zu", i);
+      void * value = NULL;
+      if(worker->table->find(worker->table, key, (size_t)key_len, &value) != SP_SUCCESS || value != (void *)(uintptr_t)(i + 1)) { worker->failures++; }
+    }
+  }
+
+  return NULL;
+}
+
+/* removes and re-adds its own keys, so retired links get freed under readers */
+static void * sp_hash_test_churner(void * arg) {
+  sp_hash_test_worker * worker = arg;
+  char key[32] = { 0 };
+  for(size_t round = 0; round < 8; round++) {
+    for(size_t i = 0; i < 250; i++) {
+      int key_len = snprintf(key, sizeof key, "churn.%zu.%zu", worker->index, i);
+      if(worker->table->ensure(worker->table, key, (size_t)key_len, (void *)(uintptr_t)(i + 1), NULL) != SP_SUCCESS) { worker->failures++; }
+    }
+    for(size_t i = 0; i < 250; i++) {
+      int key_len = snprintf(key, sizeof key, "churn.%zu.%zu", worker->index, i);
+      if(worker->table->remove(worker->table, key, (size_t)key_len, NULL) != SP_SUCCESS) { worker->failures++; }
+    }
+  }
+
+  return NULL;
+}
+
+/* walks see every key that stays put, whatever else comes and goes */
+static void * sp_hash_test_walker(void * arg) {
+  sp_hash_test_worker * worker = arg;
+  for(size_t round = 0; round < 8; round++) {
+    size_t seen = 0;
+    sp_hash_iter iter = { 0 };
+    while(worker->table->next(worker->table, &iter)) {
+      if(strncmp(iter.key->str, "key.", strlen("key.")) == 0) { seen++; }
+    }
+    worker->table->end(worker->table, &iter);
+    if(seen != 500) { worker->failures++; }
+  }
+
+  return NULL;
+}
+
+/* finds, back to back, until told to stop */
+static void * sp_hash_test_looker(void * arg) {
+  sp_hash_test_worker * worker = arg;
+  char key[32] = { 0 };
+  for(size_t i = 0; !atomic_load(worker->stop); i = (i + 1) % 4000) {
+    int key_len = snprintf(key, sizeof key, "grown.%zu", i);
+    if(worker->table->find(worker->table, key, (size_t)key_len, NULL) != SP_SUCCESS) { worker->failures++; }
+  }
+
+  return NULL;
+}
+
+static void sp_hash_concurrent_tests(void) {
+  sp_hash_table_options options = { .engine = sphe_concurrent };
+  const sp_hash_table * table = sp_hash_table_acquire();
+  sp_hash_table_ctor_ex(table, &options);
+
+  char key[32] = { 0 };
+  for(size_t i = 0; i < 500; i++) {
+    int key_len = snprintf(key, sizeof key, "key.%zu", i);
+    assert(table->ensure(table, key, (size_t)key_len, (void *)(uintptr_t)(i + 1), NULL) == SP_SUCCESS);
+  }
+
+  pthread_t threads[SP_HASH_TEST_THREADS * 2];
+  sp_hash_test_worker workers[SP_HASH_TEST_THREADS * 2];
+  for(size_t i = 0; i < SP_HASH_TEST_THREADS * 2; i++) {
+    workers[i] = (sp_hash_test_worker){ .table = table, .index = i / 2 };
+    int res = pthread_create(&threads[i], NULL, i % 2 == 0 ? &sp_hash_test_writer : &sp_hash_test_reader, &workers[i]);
+    assert(res == 0);
+  }
+  for(size_t i = 0; i < SP_HASH_TEST_THREADS * 2; i++) {
+    pthread_join(threads[i], NULL);
+    assert(workers[i].failures == 0);
+  }
+
+  size_t shared_keys = (SP_HASH_TEST_THREADS + 1) * SP_HASH_TEST_THREAD_KEYS / 2;
+  assert(table->get_key_count(table) == 500 + shared_keys);
+  for(size_t i = 0; i < shared_keys; i++) {
+    int key_len = snprintf(key, sizeof key, "shared.%zu", i);
+    void * value = NULL;
+    assert(table->find(table, key, (size_t)key_len, &value) == SP_SUCCESS && value == (void *)(uintptr_t)(i + 1));
+  }
+
+  /* churn alongside finds and walks, freeing what was retired as it goes */
+  pthread_t churn_threads[SP_HASH_TEST_THREADS * 2];
+  sp_hash_test_worker churn_workers[SP_HASH_TEST_THREADS * 2];
+  for(size_t i = 0; i < SP_HASH_TEST_THREADS * 2; i++) {
+    churn_workers[i] = (sp_hash_test_worker){ .table = table, .index = i / 2 };
+    void * (*start)(void *) = i % 2 == 0 ? &sp_hash_test_churner : i % 4 == 1 ? &sp_hash_test_reader : &sp_hash_test_walker;
+    int res = pthread_create(&churn_threads[i], NULL, start, &churn_workers[i]);
+    assert(res == 0);
+  }
+  for(size_t i = 0; i < SP_HASH_TEST_THREADS * 2; i++) {
+    pthread_join(churn_threads[i], NULL);
+    assert(churn_workers[i].failures == 0);
+  }
+  assert(table->get_key_count(table) == 500 + shared_keys);
+
+  table->release(table, NULL);
+}
+
+static bool sp_hash_test_no_retired_arrays(const sp_hash_concurrent * concurrent) {
+  for(size_t i = 0; i < SP_HASH_EPOCH_COUNT; i++) {
+    if(concurrent->limbo[i].arrays) { return false; }
+  }
+  return true;
+}
+
+/* removes and re-adds one key count times */
+static void sp_hash_test_churn(const sp_hash_table * table, size_t count) {
+  for(size_t i = 0; i < count; i++) {
+    assert(table->ensure(table, "churn", strlen("churn"), NULL, NULL) == SP_SUCCESS);
+    assert(table->remove(table, "churn", strlen("churn"), NULL) == SP_SUCCESS);
+  }
+}
+
+/* retired links are freed an epoch or two later, lookups or not, and walks
+ * keep the array they started on until they end */
+static void sp_hash_retired_tests(void) {
+  sp_hash_table_options options = { .engine = sphe_concurrent };
+  const sp_hash_table * table = sp_hash_table_acquire();
+  sp_hash_table_ctor_ex(table, &options);
+  sp_hash_concurrent * concurrent = table->impl->concurrent;
+
+  char key[32] = { 0 };
+  for(size_t i = 0; i < 4000; i++) {
+    int key_len = snprintf(key, sizeof key, "churn.%zu", i);
+    assert(table->ensure(table, key, (size_t)key_len, NULL, NULL) == SP_SUCCESS);
+    assert(table->remove(table, key, (size_t)key_len, NULL) == SP_SUCCESS);
+    assert(concurrent->retired_count < 2 * SP_HASH_RETIRED_MAX);
+  }
+  assert(table->get_key_count(table) == 0);
+
+  for(size_t i = 0; i < 100; i++) {
+    int key_len = snprintf(key, sizeof key, "key.%zu", i);
+    assert(table->ensure(table, key, (size_t)key_len, (void *)(uintptr_t)(i + 1), NULL) == SP_SUCCESS);
+  }
+
+  /* grows and removals mid-walk: the walk still sees each key once, and
+   * holds the epoch back, so nothing it could reach is freed */
+  bool seen[100] = { false };
+  size_t buckets = table->get_bucket_length(table);
+  size_t epoch = atomic_load(&concurrent->epoch);
+  sp_hash_iter iter = { 0 };
+  assert(table->next(table, &iter));
+  for(size_t i = 0; i < 4000; i++) {
+    int key_len = snprintf(key, sizeof key, "grown.%zu", i);
+    assert(table->ensure(table, key, (size_t)key_len, NULL, NULL) == SP_SUCCESS);
+  }
+  assert(table->get_bucket_length(table) > buckets);
+  for(size_t i = 0; i < 100; i += 2) {
+    int key_len = snprintf(key, sizeof key, "key.%zu", i);
+    assert(table->remove(table, key, (size_t)key_len, NULL) == SP_SUCCESS);
+  }
+  sp_hash_test_churn(table, 4 * SP_HASH_RETIRED_MAX);
+  assert(atomic_load(&concurrent->epoch) <= epoch + 1);
+  assert(concurrent->retired_count >= 50 + 4 * SP_HASH_RETIRED_MAX && !sp_hash_test_no_retired_arrays(concurrent));
+  do {
+    if(strncmp(iter.key->str, "key.", strlen("key.")) != 0) { continue; }
+    size_t i = strtoul(iter.key->str + strlen("key."), NULL, 10);
+    assert(i < 100 && !seen[i]);
+    seen[i] = true;
+  } while(table->next(table, &iter));
+  for(size_t i = 0; i < 100; i++) { assert(seen[i]); }
+  assert(!table->next(table, &iter));
+  table->end(table, &iter);
+
+  /* the walk is over, so the backlog goes within a few epochs */
+  sp_hash_test_churn(table, 4 * SP_HASH_RETIRED_MAX);
+  assert(concurrent->retired_count < 2 * SP_HASH_RETIRED_MAX && sp_hash_test_no_retired_arrays(concurrent));
+  assert(table->get_key_count(table) == 4050);
+
+  /* and a walk stopped early lets go once it's ended */
+  assert(table->next(table, &iter));
+  sp_hash_test_churn(table, 4 * SP_HASH_RETIRED_MAX);
+  assert(concurrent->retired_count >= 4 * SP_HASH_RETIRED_MAX);
+  table->end(table, &iter);
+  sp_hash_test_churn(table, 4 * SP_HASH_RETIRED_MAX);
+  assert(concurrent->retired_count < 2 * SP_HASH_RETIRED_MAX);
+
+  /* lookups going on all the while don't hold the epoch back */
+  atomic_bool stop = false;
+  pthread_t threads[SP_HASH_TEST_THREADS];
+  sp_hash_test_worker workers[SP_HASH_TEST_THREADS];
+  for(size_t i = 0; i < SP_HASH_TEST_THREADS; i++) {
+    workers[i] = (sp_hash_test_worker){ .table = table, .index = i, .stop = &stop };
+    int res = pthread_create(&threads[i], NULL, &sp_hash_test_looker, &workers[i]);
+    assert(res == 0);
+  }
+  epoch = atomic_load(&concurrent->epoch);
+  struct timespec pause = { .tv_sec = 0, .tv_nsec = 100000 };
+  for(size_t i = 0; i < 100; i++) {
+    /* a looker put off mid-find holds its epoch until it runs again */
+    sp_hash_test_churn(table, SP_HASH_RETIRED_MAX);
+    nanosleep(&pause, NULL);
+  }
+  assert(atomic_load(&concurrent->epoch) >= epoch + 10);
+  atomic_store(&stop, true);
+  for(size_t i = 0; i < SP_HASH_TEST_THREADS; i++) {
+    pthread_join(threads[i], NULL);
+    assert(workers[i].failures == 0);
+  }
+  sp_hash_test_churn(table, 4 * SP_HASH_RETIRED_MAX);
+  assert(concurrent->retired_count < 2 * SP_HASH_RETIRED_MAX && sp_hash_test_no_retired_arrays(concurrent));
+
+  table->release(table, NULL);
+}
+
+static void sp_hash_group_tests() {
+  uint8_t group[SP_HASH_GROUP_WIDTH];
+  memset(group, SP_HASH_CTRL_EMPTY, sizeof group);
+  group[0] = 0x11, group[5] = 0x11, group[15] = 0x7f;
+
+  assert(sp_hash_group_match(group, 0x11) == ((1u << 0) | (1u << 5)));
+  assert(sp_hash_group_match(group, 0x7f) == 1u << 15);
+  assert(sp_hash_group_match(group, 0x12) == 0);
+  assert(sp_hash_lowest_bit(sp_hash_group_match(group, SP_HASH_CTRL_EMPTY)) == 1);
+
+  group[1] = SP_HASH_CTRL_DELETED;
+  assert(sp_hash_group_match_free(group) == (0xffffu & ~((1u << 0) | (1u << 5) | (1u << 15))));
+}
+
+void sp_hash_tests(void) {
+  sp_hash_group_tests();
+  sp_hash_engine_tests(sphe_chained);
+  sp_hash_engine_tests(sphe_open);
+  sp_hash_capacity_tests(sphe_chained);
+  sp_hash_capacity_tests(sphe_open);
+  sp_hash_remove_tests(sphe_chained);
+  sp_hash_remove_tests(sphe_open);
+  sp_hash_engine_tests(sphe_concurrent);
+  sp_hash_capacity_tests(sphe_concurrent);
+  sp_hash_remove_tests(sphe_concurrent);
+  sp_hash_concurrent_tests();
+  sp_hash_retired_tests();
+}
@@ -0,0 +1,150 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/sp_lz.h"
+
+#define SP_LZ_MIN_MATCH 4
+#define SP_LZ_MAX_OFFSET 65535
+#define SP_LZ_HASH_BITS 14
+#define SP_LZ_LAST_LITERALS 5 /* the block always ends with literals */
+#define SP_LZ_MF_LIMIT 12 /* no match may start this close to the end */
+
+static uint32_t sp_lz_read32(const unsigned char * p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof v);
+  return v;
+}
+
+static uint32_t sp_lz_hash(uint32_t v) {
+  return (v * 2654435761u) >> (32 - SP_LZ_HASH_BITS);
+}
+
+static unsigned char * sp_lz_write_len(unsigned char * op, size_t len) {
+  while(len >= 255) { *op++ = 255; len -= 255; }
+  *op++ = (unsigned char)len;
+  return op;
+}
+
+size_t sp_lz_compress_bound(size_t source_len) {
+  return source_len + (source_len / 255) + 16;
+}
+
+errno_t sp_lz_compress(const unsigned char * source, size_t source_len, unsigned char * dest, size_t dest_len, size_t * out_len) {
+  if(!source || !dest) { return SP_FAILURE; }
+  if(dest_len < sp_lz_compress_bound(source_len)) { return SP_FAILURE; }
+
+  /* positions are stored +1 so a zeroed slot means "empty" */
+  uint32_t * table = calloc(1u << SP_LZ_HASH_BITS, sizeof * table);
+  if(!table) { abort(); }
+
+  const unsigned char * ip = source;
+  const unsigned char * anchor = source;
+  const unsigned char * const end = source + source_len;
+  unsigned char * op = dest;
+
+  if(source_len > SP_LZ_MF_LIMIT) {
+    const unsigned char * const match_limit = end - SP_LZ_LAST_LITERALS;
+    const unsigned char * const search_limit = end - SP_LZ_MF_LIMIT;
+
+    while(ip < search_limit) {
+      uint32_t seq = sp_lz_read32(ip);
+      uint32_t h = sp_lz_hash(seq);
+      size_t candidate = table[h];
+      table[h] = (uint32_t)(ip - source) + 1;
+
+      if(candidate == 0) { ip++; continue; }
+      const unsigned char * ref = source + candidate - 1;
+      if((size_t)(ip - ref) > SP_LZ_MAX_OFFSET || sp_lz_read32(ref) != seq) { ip++; continue; }
+
+      /* extend the match, stopping short of the trailing literals */
+      const unsigned char * mp = ip + SP_LZ_MIN_MATCH;
+      const unsigned char * rp = ref + SP_LZ_MIN_MATCH;
+      while(mp < match_limit && *mp == *rp) { mp++, rp++; }
+
+      size_t literal_len = (size_t)(ip - anchor);
+      size_t match_len = (size_t)(mp - ip) - SP_LZ_MIN_MATCH;
+      uint16_t offset = (uint16_t)(ip - ref);
+
+      unsigned char * token = op++;
+      *token = (unsigned char)(((literal_len < 15 ? literal_len : 15) << 4) | (match_len < 15 ? match_len : 15));
+      if(literal_len >= 15) { op = sp_lz_write_len(op, literal_len - 15); }
+      memcpy(op, anchor, literal_len), op += literal_len;
+
+      *op++ = (unsigned char)(offset & 0xff);
+      *op++ = (unsigned char)(offset >> 8);
+      if(match_len >= 15) { op = sp_lz_write_len(op, match_len - 15); }
+
+      ip = anchor = mp;
+    }
+  }
+
+  /* final sequence: literals only */
+  size_t literal_len = (size_t)(end - anchor);
+  *op++ = (unsigned char)((literal_len < 15 ? literal_len : 15) << 4);
+  if(literal_len >= 15) { op = sp_lz_write_len(op, literal_len - 15); }
+  if(literal_len > 0) { memcpy(op, anchor, literal_len), op += literal_len; }
+
+  free(table), table = NULL;
+
+  assert((size_t)(op - dest) <= dest_len);
+  if(out_len) { *out_len = (size_t)(op - dest); }
+
+  return SP_SUCCESS;
+}
+
+static bool sp_lz_read_len(const unsigned char ** ip, const unsigned char * end, size_t * len) {
+  unsigned char b = 0;
+  do {
+    if(*ip >= end) { return false; }
+    b = *(*ip)++;
+    if(*len > SIZE_MAX - b) { return false; }
+    *len += b;
+  } while(b == 255);
+  return true;
+}
+
+errno_t sp_lz_decompress(const unsigned char * source, size_t source_len, unsigned char * dest, size_t dest_len, size_t * out_len) {
+  if(!source || (!dest && dest_len > 0)) { return SP_FAILURE; }
+
+  const unsigned char * ip = source;
+  const unsigned char * const end = source + source_len;
+  unsigned char * op = dest;
+  unsigned char * const op_end = dest + dest_len;
+
+  /* every read and write is bounds checked; the input is untrusted */
+  while(ip < end) {
+    unsigned char token = *ip++;
+
+    size_t literal_len = token >> 4;
+    if(literal_len == 15 && !sp_lz_read_len(&ip, end, &literal_len)) { goto err0; }
+    if(literal_len > (size_t)(end - ip) || literal_len > (size_t)(op_end - op)) { goto err0; }
+    memcpy(op, ip, literal_len), op += literal_len, ip += literal_len;
+
+    /* the last sequence has no match */
+    if(ip == end) { break; }
+
+    if(end - ip < 2) { goto err0; }
+    size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+    ip += 2;
+    if(offset == 0 || offset > (size_t)(op - dest)) { goto err0; }
+
+    size_t match_len = token & 0x0f;
+    if(match_len == 15 && !sp_lz_read_len(&ip, end, &match_len)) { goto err0; }
+    match_len += SP_LZ_MIN_MATCH;
+    if(match_len > (size_t)(op_end - op)) { goto err0; }
+
+    /* matches may overlap their own output; copy forward byte by byte */
+    const unsigned char * ref = op - offset;
+    for(size_t i = 0; i < match_len; i++) { op[i] = ref[i]; }
+    op += match_len;
+  }
+
+  if(out_len) { *out_len = (size_t)(op - dest); }
+  return SP_SUCCESS;
+
+err0:
+  return SP_FAILURE;
+}
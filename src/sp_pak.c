@@ -4,24 +4,33 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
 #include <sodium.h>
 #include <assert.h>
 #include <memory.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
 
 #include "../include/sp_z.h"
+#include "../include/sp_lz.h"
+#include "../include/sp_dict.h"
+#include "../include/sp_crc.h"
 #include "../include/sp_limits.h"
 #include "../include/sp_error.h"
 #include "../include/sp_pak.h"
 #include "../include/sp_math.h"
-#include "../include/sp_hash.h"
 
 const unsigned long SP_CONTENT_OFFSET = 0x100;
 
 const uint16_t SP_PACK_MAJOR_VERSION = 0;
 const uint16_t SP_PACK_MINOR_VERSION = 0;
-const uint16_t SP_PACK_REVISION_VERSION = 1;
+const uint16_t SP_PACK_REVISION_VERSION = 9; /* 2: per-entry codec, 3: chunk hashes, 4: sorted index, 5: perfect hash, 6: appended segments, 7: preset dictionary, 8: block-compressed entries, 9: integrity modes */
 const uint16_t SP_PACK_SUBREVISION_VERSION = 0;
 
 /* A spooky pak file (SPDB) is a serialization format for spooky resources:
@@ -34,13 +43,71 @@ const uint16_t SP_PACK_SUBREVISION_VERSION = 0;
  *  |   0x010 |            8 | version (4x16bit) | { 0x0001, 0x0002, 0x0003, 0x0004 }
  *  |   0x018 |            8 | content offset    | offset of pak contents, defaults to 0x100
  *  |   0x020 |            8 | content length    | length of the pak file binary-encoded content excluding the header, version, hash, and footer
- *  |   0x028 |           32 | content hash      | hash of the binary-encoded content, starting at offset {content_offset} and including the magic
- *  |     ??? |          216 | [empty]           | Empty space for future properties
+ *  |   0x028 |            8 | index entries     | number of index entries
+ *  |   0x030 |            8 | index offset      | offset of the index, immediately after the content
+ *  |   0x038 |            8 | index length      | length of the index
+ *  |   0x040 |           32 | content hash      | hash of the binary-encoded content, starting at offset {content_offset} and including the magic;
+ *  |         |              |                   | for chunked paks, the root hash of the chunk hash table instead
+ *  |   0x060 |            8 | [reserved]        | zero
+ *  |   0x068 |            8 | chunk size        | 0 for a single flat content hash, otherwise the content is hashed in chunks of this size
+ *  |   0x070 |            8 | chunk count       | number of chunk hashes
+ *  |   0x078 |            8 | chunk table       | offset of the chunk hash table (chunk count x 32 bytes), immediately after the perfect hash
+ *  |   0x080 |            8 | perfect hash      | offset of the perfect hash section, immediately after the index; 0 when absent
+ *  |   0x088 |            8 | perfect hash len  | length of the perfect hash section
+ *  |   0x090 |            8 | segment count     | number of segments appended since the pak was created
+ *  |   0x098 |            8 | segment table     | offset of the segment table, immediately after the chunk table (or perfect hash)
+ *  |   0x0a0 |            8 | dictionary        | offset of the preset dictionary, at the start of the content; 0 when absent
+ *  |   0x0a8 |            8 | dictionary len    | length of the preset dictionary
+ *  |   0x0b0 |            8 | integrity         | sp_pack_integrity of every hash in the pak
+ *  |   0x0b8 |           72 | [empty]           | Empty space for future properties
  *  |   0x100 |            8 | magic             | magic header preceeding content
  *  |   0x108 |          ??? | content entries   | binary-encoded content
  *  |EOF-0x18 |            8 | total pak length  | length of the complete pak file, starting from the header through the footer
  *  |EOF-0x10 |           16 | spooky footer     | { 0xf0, 0x9f, 0x8e, 0x83, '!YKOOPS', 0xf0, 0x9f, 0x8e, 0x83, '\0' }
  *
+ * The index is index entries fixed-width 32-byte records, sorted by
+ * key hash (64-bit FNV-1a), followed by a pool of NULL-terminated keys:
+ *
+ *  | offset | size (bytes) | info
+ *  |   0x00 |            8 | key hash
+ *  |   0x08 |            8 | entry offset, relative to the start of the pak
+ *  |   0x10 |            8 | entry length
+ *  |   0x18 |            4 | key offset in the string pool
+ *  |   0x1c |            4 | key length, excluding the NULL terminator
+ *
+ * Content is written once however many keys it's packed under: records of
+ * entries with the same decompressed hash share an entry offset and length,
+ * and the entry itself carries the first key and path it was written for.
+ *
+ * The perfect hash section maps every key in the index to its record in a
+ * single probe. Slot and bucket counts are uint32_t; a bucket's displacement
+ * is either a seed for the slot hash or, with the high bit set, the slot
+ * itself:
+ *
+ *  | offset | size (bytes) | info
+ *  |   0x00 |            4 | slot count, equal to the index entries
+ *  |   0x04 |            4 | bucket count
+ *  |   0x08 |  4 x buckets | displacement per bucket, bucket = key hash % bucket count
+ *  |    ??? |    4 x slots | index record per slot
+ *
+ * Appending entries to a pak (sp_pack_append) writes a new segment at the
+ * end of the file: the magic, the new entries, then a fresh index, perfect
+ * hash, chunk table, segment table, and trailer; the header is rewritten to
+ * point at them. The previous index and trailer are left behind as garbage
+ * until sp_pack_compact rewrites the pak. The content hash and chunk table
+ * only cover the original content; each appended segment has a hash of its
+ * own in the segment table:
+ *
+ *  | offset | size (bytes) | info
+ *  |   0x00 |            8 | segment offset, relative to the start of the pak
+ *  |   0x08 |            8 | segment length, including its magic
+ *  |   0x10 |           32 | hash of the segment
+ *
+ * Every hash in the pak (content, chunks, segments, and each entry's) is a
+ * 32-byte field whose contents depend on the integrity mode: a BLAKE2b
+ * digest, a CRC32C in the first four bytes and zeros after, or all zeros
+ * when nothing is checked. Paks without integrity are never chunked.
+ *
  * Data saved in little endian format
  *
  * unpack example:
@@ -49,8 +116,41 @@ const uint16_t SP_PACK_SUBREVISION_VERSION = 0;
 
 #define SP_HEADER_LEN 16
 #define SP_FOOTER_LEN 16
+#define SP_TRAILER_LEN (sizeof(uint64_t) + SP_FOOTER_LEN) /* pak length + footer */
+
+#define SP_CHUNK_HEADER_OFFSET 0x68
+#define SP_INDEX_RECORD_LEN 32
+#define SP_PERFECT_HASH_HEADER_OFFSET 0x80
+#define SP_PERFECT_HASH_DIRECT ((uint32_t)1 << 31)
+#define SP_PERFECT_HASH_MAX_SLOTS ((uint64_t)INT32_MAX)
+#define SP_PERFECT_HASH_MAX_SEED ((uint32_t)1 << 24)
+#define SP_SEGMENT_HEADER_OFFSET 0x90
+#define SP_SEGMENT_RECORD_LEN (16 + crypto_generichash_BYTES)
+#define SP_DICTIONARY_HEADER_OFFSET 0xa0
+#define SP_INTEGRITY_HEADER_OFFSET 0xb0
+/* the dictionary, when there is one, leads the content right after its magic,
+ * so the content hash covers it */
+#define SP_DICTIONARY_OFFSET (SP_CONTENT_OFFSET + sizeof SP_ITEM_MAGIC)
+/* entries up to this size are sampled for, and encoded with, the dictionary */
+#define SP_PACK_DICTIONARY_ENTRY_MAX ((size_t)64 << 10)
+#define SP_PACK_DICTIONARY_MIN_SAMPLES 8
+#define SP_PACK_DICTIONARY_SAMPLE_FACTOR 100 /* sample bytes per dictionary byte */
+/* Large entries are deflated as independent blocks, so a full load can
+ * inflate them in parallel and a cursor only inflates the blocks it reads.
+ * Payload layout: BLOCK SIZE (uint32_t), BLOCK COUNT (uint32_t), an encoded
+ * length per block (uint32_t, SP_PACK_BLOCK_STORED set for stored blocks),
+ * then the blocks themselves. */
+#define SP_PACK_BLOCK_SIZE ((uint32_t)1 << 18)
+#define SP_PACK_BLOCK_ENTRY_MIN ((size_t)1 << 20) /* spc_auto blocks entries from this size up */
+#define SP_PACK_BLOCK_STORED ((uint32_t)1 << 31)
+#define SP_PACK_BLOCK_HEADER_LEN 8
+#define SP_PACK_HASH_WINDOW ((size_t)1 << 16)
+#define SP_PACK_PREAMBLE_LEN (0x100 + 8) /* header fields through the content magic */
 
 static const size_t MAX_PACK_STRING_LEN = 4096;
+/* the longest an entry can run before its payload: type, codec, lengths,
+ * hashes and strings */
+#define SP_PACK_ENTRY_HEADER_MAX (18 + 2 * (1 + crypto_generichash_BYTES) + 2 * (sizeof(uint64_t) + MAX_PACK_STRING_LEN + 1))
 static const unsigned char SP_PUMPKIN[4] = { 0xf0, 0x9f, 0x8e, 0x83 };
 
 static const unsigned char SP_HEADER[SP_HEADER_LEN] = { 0xf0, 0x9f, 0x8e, 0x83, 'S', 'P', 'O', 'O', 'K', 'Y', '!', 0xf0, 0x9f, 0x8e, 0x83, '\n' };
@@ -75,18 +175,34 @@ typedef enum sp_pack_item_type /* unsigned char */ {
   spit_eof = UCHAR_MAX
 } sp_pack_item_type;
 
-typedef struct sp_pack_item_bin_file {
+/* Cursor-based serializer: fields are encoded little endian into a growable
+ * memory buffer, which reaches stdio in one block per flush. */
+typedef struct sp_pack_writer {
+  unsigned char * data;
+  size_t len;
+  size_t cap;
+} sp_pack_writer;
+
+/* Bounds-checked cursor over bytes already in memory, either the pak mapping
+ * or a single buffered read; getters fail rather than read past the end. */
+typedef struct sp_pack_view {
+  const unsigned char * data;
+  size_t len;
+  size_t pos;
+} sp_pack_view;
+
+/* A parsed entry; every pointer refers into the bytes it was parsed from. */
+typedef struct sp_pack_entry_view {
+  const unsigned char * decompressed_hash;
+  const unsigned char * compressed_hash;
+  const char * file_path;
+  const char * key;
+  const unsigned char * payload;
   uint64_t decompressed_len;
   uint64_t compressed_len;
-  unsigned char decompressed_hash[crypto_generichash_BYTES];
-  unsigned char compressed_hash[crypto_generichash_BYTES];
-  char * file_path;
-  char * key;
-  char * data;
-  size_t data_len;
-  sp_pack_item_type type;
-  char padding[4]; /* non-portable */
-} sp_pack_item_bin_file;
+  sp_pack_codec codec;
+  char padding[4]; /* not portable */
+} sp_pack_entry_view;
 
 typedef struct sp_pack_version {
   uint16_t major;
@@ -104,17 +220,215 @@ typedef struct sp_pack_file {
   uint64_t index_offset;
   uint64_t index_len;
   unsigned char hash[crypto_generichash_BYTES];
+  sp_pack_integrity integrity;
+  char padding[4]; /* not portable */
 } sp_pack_file;
 
 typedef struct sp_pack_index_entry {
   char * name;
   uint64_t offset;
   uint64_t len;
+  uint64_t hash;
+  size_t order; /* position in the content */
 } sp_pack_index_entry;
 
+typedef struct sp_pack_encoded_entry {
+  unsigned char decompressed_hash[crypto_generichash_BYTES];
+  unsigned char compressed_hash[crypto_generichash_BYTES];
+  /* BLAKE2b of the source whatever the integrity mode; content identity for
+   * deduplication */
+  unsigned char content_hash[crypto_generichash_BYTES];
+  unsigned char * data; /* the source file */
+  unsigned char * encoded; /* NULL when stored */
+  size_t data_len;
+  size_t encoded_len;
+  sp_pack_codec codec;
+  bool is_done;
+  bool is_valid;
+  char padding[2]; /* not portable */
+} sp_pack_encoded_entry;
+
+/* Content already written, by decompressed hash; a free slot has no len. */
+typedef struct sp_pack_blob {
+  unsigned char hash[crypto_generichash_BYTES];
+  uint64_t data_len;
+  uint64_t offset;
+  uint64_t len;
+} sp_pack_blob;
+
+typedef struct sp_pack_blobs {
+  sp_pack_blob * slots; /* linear probing */
+  size_t capacity; /* a power of two, at least twice the entries */
+} sp_pack_blobs;
+
+typedef struct sp_pack_section {
+  uint64_t offset; /* relative to the start of the pak; 0 when absent */
+  uint64_t len;
+} sp_pack_section;
+
+typedef struct sp_pack_perfect_hash_key {
+  uint64_t hash;
+  uint32_t record;
+  uint32_t bucket;
+  uint32_t bucket_len;
+  char padding[4]; /* not portable */
+} sp_pack_perfect_hash_key;
+
+typedef struct sp_pack_chunks {
+  uint64_t chunk_size; /* 0 when the pak has a single flat content hash */
+  uint64_t chunk_count;
+  uint64_t table_offset; /* relative to the start of the pak */
+} sp_pack_chunks;
+
+typedef struct sp_pack_segments {
+  uint64_t segment_count; /* 0 until something is appended */
+  uint64_t table_offset; /* relative to the start of the pak */
+} sp_pack_segments;
+
+/* An item plus its cache bookkeeping; pub comes first, so the public pointer
+ * handed to callers is also the cache item. */
+typedef struct sp_pack_cache_item {
+  sp_pack_item_file pub;
+  /* LRU links, only set while unreferenced; detached list links once the
+   * item's been replaced */
+  struct sp_pack_cache_item * prev;
+  struct sp_pack_cache_item * next;
+  uint64_t refs;
+  bool is_pinned; /* found, so resident until the reader is freed */
+  bool is_reloaded; /* hot-reloaded bytes can't be re-read, so aren't evicted */
+  bool is_detached; /* replaced by a reload; freed with its last reference */
+  bool is_cached; /* on the LRU list */
+  bool is_counted; /* data is counted against the budget */
+  bool is_loading; /* being read and decoded, outside the reader lock */
+  char padding[2]; /* not portable */
+} sp_pack_cache_item;
+
+/* Threads that help inflate the blocks of large entries, started by the
+ * first one and kept until the reader is freed. They take one payload at a
+ * time, posted by the loading thread, which decodes alongside them. */
+typedef struct sp_pack_block_workers {
+  pthread_mutex_t lock;
+  pthread_cond_t work; /* a job was posted, or the workers are stopping */
+  pthread_cond_t done; /* a worker left its job */
+  struct sp_pack_block_pool * job; /* NULL when idle */
+  uint64_t job_id;
+  pthread_t * threads;
+  size_t thread_count;
+  size_t active; /* workers inside job */
+  bool is_started;
+  bool is_stopping;
+  char padding[6]; /* not portable */
+} sp_pack_block_workers;
+
+#define SP_PACK_SPARE_Z 4
+
+typedef struct sp_pack_reader {
+  /* guards items and the cache between the main thread and the stream; loads
+   * drop it while they read and decode */
+  pthread_mutex_t lock;
+  pthread_cond_t loaded; /* an item finished loading */
+  /* guards fp's position and lazy verification */
+  pthread_mutex_t io_lock;
+  FILE * fp;
+  /* read-only mapping of the whole file (exe + pak, or pak); NULL if the
+   * file could not be mapped, in which case entries are read through fp */
+  const unsigned char * map;
+  size_t map_len;
+  long pak_offset;
+  uint64_t content_offset;
+  uint64_t content_len;
+  uint64_t index_entries;
+  uint64_t index_offset;
+  uint64_t index_len;
+  /* the sorted index and perfect hash, read in one go (or pointing into the
+   * mapping) */
+  const unsigned char * index;
+  const unsigned char * perfect_hash; /* NULL when the pak has none */
+  unsigned char * index_buf;
+  /* one item per index record, created on first find */
+  sp_pack_cache_item ** items;
+  /* records sharing deduplicated content share the item of the first record
+   * at their offset; NULL when the pak has no aliases */
+  uint64_t * aliases;
+  /* decompressed bytes held by items, and the LRU of unreferenced ones
+   * (head is the most recently released); 0 budget never evicts */
+  uint64_t cache_budget;
+  uint64_t cache_resident;
+  sp_pack_cache_item * lru_head;
+  sp_pack_cache_item * lru_tail;
+  sp_pack_cache_item * detached; /* replaced items still referenced or found */
+  /* inflate states kept between loads, each with the dictionary set */
+  sp_z * spare_z[SP_PACK_SPARE_Z];
+  size_t spare_z_count;
+  unsigned char * dictionary; /* NULL when there is none */
+  size_t dictionary_len;
+  sp_pack_block_workers workers;
+  /* lazy verification; NULL when the content was verified up front */
+  sp_pack_chunks chunks;
+  unsigned char * chunk_hashes;
+  bool * chunk_verified;
+  /* appended segment table; segments are always verified at open */
+  unsigned char * segments;
+  uint64_t segment_count;
+  sp_pack_integrity integrity;
+  char padding[4]; /* not portable */
+} sp_pack_reader;
+
+typedef struct sp_pack_stream_request {
+  struct sp_pack_stream_request * next;
+  char * key;
+  size_t key_len;
+  sp_pack_stream_callback callback;
+  void * user_data;
+  sp_pack_item_file * file;
+  errno_t result;
+  char padding[4]; /* not portable */
+} sp_pack_stream_request;
+
+/* One worker loads requests in order; finished requests are pushed onto a
+ * lock-free stack that the owning thread takes whole when it drains. */
+typedef struct sp_pack_stream {
+  pthread_mutex_t lock; /* guards the request queue */
+  pthread_cond_t cond;
+  pthread_t worker;
+  sp_pack_reader * reader;
+  sp_pack_stream_request * requests;
+  sp_pack_stream_request * requests_tail;
+  _Atomic(sp_pack_stream_request *) completions;
+  bool is_stopping;
+  char padding[7]; /* not portable */
+} sp_pack_stream;
+
+typedef struct sp_pack_blocks {
+  uint64_t * offsets; /* block_count + 1, relative to the first block */
+  uint32_t * lens; /* encoded lengths, as in the table */
+  uint64_t data_offset; /* first block, relative to the payload */
+  uint64_t decompressed_len;
+  uint32_t block_size;
+  uint32_t block_count;
+} sp_pack_blocks;
+
+/* Blocked entries are read a block at a time, through one cached block;
+ * anything else is held whole in file. Either way the cursor only reads
+ * what it took at open, so reloads and evictions can't move it. */
+typedef struct sp_pack_cursor {
+  sp_pack_reader * reader;
+  sp_pack_item_file * file; /* acquired; NULL for blocked entries */
+  const unsigned char * data; /* file's bytes, kept by the cursor's reference */
+  sp_z * z;
+  sp_pack_blocks blocks;
+  uint64_t blocks_offset; /* the first block, relative to the start of the pak */
+  unsigned char * block;
+  uint64_t block_index; /* of block; UINT64_MAX when it holds none */
+  unsigned char * encoded; /* read buffer when the pak isn't mapped */
+  uint64_t len;
+  uint64_t pos;
+} sp_pack_cursor;
+
 
 static char * sp_pack_encode_binary_data(const unsigned char * bin_data, size_t bin_data_len);
-static void sp_pack_print_file_stats(FILE * fp);
+static void sp_pack_print_file_stats(const sp_pack_entry_view * entry);
+static int sp_pack_range_compare(const void * a, const void * b);
 
 /* Writers */
 static bool sp_write_raw(void * value, size_t len, FILE * fp);
@@ -130,13 +444,14 @@ static bool sp_write_int64(int64_t value, FILE * fp, uint64_t * content_len);
 static bool sp_write_bool(bool value, FILE * fp, uint64_t * content_len);
 static bool sp_write_float(float value, FILE * fp, uint64_t * content_len);
 
-static bool sp_write_item_type(sp_pack_item_type type, FILE * fp, uint64_t * content_len);
-static bool sp_write_file(const char * file_path, const char * key, FILE * fp, uint64_t * content_len);
+static bool sp_write_encoded_entry(const char * file_path, const char * key, const sp_pack_encoded_entry * entry, FILE * fp, uint64_t * content_len);
 static bool sp_write_string(const char * value, FILE * fp, uint64_t * content_len);
 static bool sp_write_fixed_width_string(const char * value, size_t fixed_width, FILE * fp, uint64_t * content_len);
-static bool sp_write_version(sp_pack_version version, FILE * fp, uint64_t * content_len);
-static bool sp_write_index_entry(sp_pack_index_entry * entry, FILE * fp, uint64_t * content_len);
-static bool sp_write_hash(const unsigned char * buf, size_t buf_len, FILE * fp, uint64_t * content_len);
+static void sp_write_header(sp_pack_writer * writer, const sp_pack_file * spf, const sp_pack_chunks * chunks, const sp_pack_section * perfect_hash, const sp_pack_segments * segments, const sp_pack_section * dictionary);
+static bool sp_write_tail(FILE * fp, long pak_offset, sp_pack_file * spf, sp_pack_chunks * chunks, unsigned char * chunk_hashes, sp_pack_section * perfect_hash, sp_pack_segments * segments, unsigned char * segment_table, const sp_pack_section * dictionary, sp_pack_index_entry * entries, size_t entries_len);
+static bool sp_pack_finish(FILE * fp, sp_pack_file * spf, const sp_pack_section * dictionary, sp_pack_index_entry * entries, size_t entries_len, const sp_pack_create_options * options);
+static bool sp_write_index(sp_pack_index_entry * entries, size_t entries_len, FILE * fp, uint64_t * index_entries, uint64_t * index_len);
+static bool sp_write_perfect_hash(const sp_pack_index_entry * entries, size_t entries_len, uint64_t index_entries, FILE * fp, uint64_t * perfect_hash_len);
 
 /* Readers */
 static bool sp_read_raw(FILE * fp, size_t len, void * buf);
@@ -151,16 +466,73 @@ static bool sp_read_int64(FILE * fp, int64_t * value);
 static bool sp_read_bool(FILE * fp, bool * value);
 // TODO: read_float
 
-static bool sp_read_item_type(FILE * fp, sp_pack_item_type * item_type);
-static bool sp_read_file(FILE * fp, sp_pack_item_bin_file * file);
-static bool sp_read_string(FILE * fp, char ** value, size_t * value_len);
 // TODO: read_fixed_width_string
-static bool sp_read_version(FILE * fp, sp_pack_version *version);
-static bool sp_read_index_entry(FILE * fp, sp_pack_index_entry * entry);
-static bool sp_read_hash(FILE * fp, unsigned char * buf, size_t buf_len);
 
 static bool sp_read_footer(FILE * fp);
-static bool sp_read_header(FILE * fp);
+
+/* Memory writer and view */
+static unsigned char * sp_pack_writer_reserve(sp_pack_writer * writer, size_t len);
+static void sp_pack_writer_put_raw(sp_pack_writer * writer, const void * value, size_t len);
+static void sp_pack_writer_put_zeros(sp_pack_writer * writer, size_t len);
+static void sp_pack_writer_put_uint8(sp_pack_writer * writer, uint8_t value);
+static void sp_pack_writer_put_uint16(sp_pack_writer * writer, uint16_t value);
+static void sp_pack_writer_put_uint32(sp_pack_writer * writer, uint32_t value);
+static void sp_pack_writer_put_uint64(sp_pack_writer * writer, uint64_t value);
+static void sp_pack_writer_put_hash(sp_pack_writer * writer, const unsigned char * hash);
+static void sp_pack_writer_put_string(sp_pack_writer * writer, const char * value);
+static bool sp_pack_writer_flush(sp_pack_writer * writer, FILE * fp, uint64_t * content_len);
+static void sp_pack_writer_free(sp_pack_writer * writer);
+
+static bool sp_pack_view_get_raw(sp_pack_view * view, size_t len, const unsigned char ** out);
+static bool sp_pack_view_get_uint8(sp_pack_view * view, uint8_t * value);
+static bool sp_pack_view_get_uint16(sp_pack_view * view, uint16_t * value);
+static bool sp_pack_view_get_uint32(sp_pack_view * view, uint32_t * value);
+static bool sp_pack_view_get_uint64(sp_pack_view * view, uint64_t * value);
+static bool sp_pack_view_get_hash(sp_pack_view * view, const unsigned char ** hash);
+static bool sp_pack_view_get_string(sp_pack_view * view, const char ** value, size_t * value_len);
+
+static bool sp_pack_parse_entry_header(const unsigned char * data, size_t len, sp_pack_entry_view * entry, size_t * header_len);
+static bool sp_pack_parse_entry(const unsigned char * data, size_t len, sp_pack_entry_view * entry);
+static bool sp_pack_decode_entry(sp_z * z, sp_pack_block_workers * workers, sp_pack_integrity integrity, const sp_pack_entry_view * entry, unsigned char ** out_data);
+
+static bool sp_pack_encode(sp_z * z, sp_pack_codec * codec, const unsigned char * src, size_t src_len, unsigned char ** out, size_t * out_len);
+static bool sp_pack_decode(sp_z * z, sp_pack_block_workers * workers, sp_pack_codec codec, const unsigned char * src, size_t src_len, unsigned char * dest, size_t dest_len);
+static bool sp_pack_read_source(const char * file_path, unsigned char ** out, size_t * out_len);
+static bool sp_pack_encode_entry(sp_z * z, const char * file_path, sp_pack_codec codec, sp_pack_integrity integrity, sp_pack_encoded_entry * out);
+static bool sp_pack_write_entries(FILE * fp, const sp_pack_content_entry * content, size_t content_len, size_t jobs, sp_pack_integrity integrity, const unsigned char * dictionary, size_t dictionary_len, sp_pack_index_entry * entries, uint64_t * written_len);
+
+static size_t sp_pack_default_jobs(void);
+static size_t sp_pack_resolve_jobs(size_t jobs, size_t work);
+static void sp_pack_digest(sp_pack_integrity integrity, const unsigned char * data, size_t len, unsigned char * out);
+static bool sp_pack_hash_range(FILE * fp, sp_pack_integrity integrity, uint64_t offset, uint64_t len, unsigned char * out);
+static bool sp_pack_hash_chunks(FILE * fp, sp_pack_integrity integrity, uint64_t base, uint64_t len, uint64_t chunk_size, size_t jobs, unsigned char * hashes, bool compare);
+static uint64_t sp_pack_trailer_offset(const sp_pack_file * spf, const sp_pack_chunks * chunks, const sp_pack_section * perfect_hash, const sp_pack_segments * segments);
+static errno_t sp_pack_read_trailer(FILE * fp, long * pak_offset, uint64_t * pak_len);
+static errno_t sp_pack_read_layout(FILE * fp, long * pak_offset, sp_pack_file * spf, sp_pack_chunks * chunks, sp_pack_section * perfect_hash, sp_pack_segments * segments, sp_pack_section * dictionary);
+static unsigned char * sp_pack_read_chunk_table(FILE * fp, long pak_offset, const sp_pack_file * spf, const sp_pack_chunks * chunks);
+static errno_t sp_pack_read_segments(FILE * fp, long pak_offset, const sp_pack_file * spf, const sp_pack_segments * segments, unsigned char ** out_table);
+static bool sp_pack_range_is_content(uint64_t content_offset, uint64_t content_len, const unsigned char * segments, uint64_t segment_count, uint64_t offset, uint64_t len);
+static errno_t sp_pack_read_dictionary(FILE * fp, long pak_offset, const sp_pack_section * dictionary, unsigned char ** out_dictionary);
+static bool sp_pack_train_dictionary(const sp_pack_content_entry * content, size_t content_len, size_t dictionary_size, unsigned char ** out_dictionary, size_t * out_len);
+static errno_t sp_pack_read_index_entries(FILE * fp, long pak_offset, const sp_pack_file * spf, sp_pack_index_entry * entries);
+static bool sp_pack_check_content(FILE * fp, long pak_offset, const sp_pack_file * spf, const sp_pack_chunks * chunks, size_t jobs);
+static bool sp_pack_reader_verify_range(sp_pack_reader * reader, uint64_t offset, uint64_t len);
+static bool sp_pack_reader_match(const sp_pack_reader * reader, uint64_t i, const char * key, size_t key_len, uint64_t * offset, uint64_t * len);
+static bool sp_pack_reader_lookup(const sp_pack_reader * reader, const char * key, size_t key_len, uint64_t * out_record, uint64_t * offset, uint64_t * len);
+
+static errno_t sp_pack_reader_map(sp_pack_reader * reader);
+static errno_t sp_pack_reader_load_item(sp_pack_reader * reader, sp_pack_cache_item * item);
+static const unsigned char * sp_pack_reader_read_range(sp_pack_reader * reader, uint64_t offset, uint64_t len, unsigned char ** buf);
+static uint64_t * sp_pack_reader_find_aliases(const unsigned char * index, uint64_t index_entries);
+static sp_pack_cache_item * sp_pack_reader_get_item(sp_pack_reader * reader, uint64_t record, uint64_t offset, uint64_t len);
+static sp_pack_cache_item * sp_pack_reader_unalias(sp_pack_reader * reader, uint64_t record);
+static void sp_pack_cache_unlink(sp_pack_reader * reader, sp_pack_cache_item * item);
+static void sp_pack_cache_unref(sp_pack_reader * reader, sp_pack_cache_item * item);
+static void sp_pack_cache_drop(sp_pack_reader * reader, sp_pack_cache_item * item);
+static void sp_pack_cache_detach(sp_pack_reader * reader, sp_pack_cache_item * item);
+static void sp_pack_cache_item_free(sp_pack_reader * reader, sp_pack_cache_item * item);
+static void sp_pack_cache_trim(sp_pack_reader * reader);
+static void * sp_pack_stream_worker(void * arg);
 
 static bool sp_write_raw(void * value, size_t len, FILE * fp) {
   assert(fp && value);
@@ -180,1162 +552,3794 @@ static bool sp_read_raw(FILE * fp, size_t len, void * buf) {
 
   if(feof(fp) != 0) return false;
   size_t hir = fread(buf, sizeof(unsigned char), len, fp);
-  assert(hir);
 
-  return hir > 0 && ferror(fp) == 0;
+  return hir == len && ferror(fp) == 0;
 }
 
-static bool sp_write_hash(const unsigned char * buf, size_t buf_len, FILE * fp, uint64_t * content_len) {
-  unsigned char hash[crypto_generichash_BYTES] = { 0 };
+static uint32_t sp_pack_load_uint32(const unsigned char * p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t sp_pack_load_uint64(const unsigned char * p) {
+  return (uint64_t)sp_pack_load_uint32(p) | ((uint64_t)sp_pack_load_uint32(p + 4) << 32);
+}
+
+static void sp_pack_store_uint32(unsigned char * p, uint32_t value) {
+  p[0] = (unsigned char)(value & 0xff);
+  p[1] = (unsigned char)((value >> 8) & 0xff);
+  p[2] = (unsigned char)((value >> 16) & 0xff);
+  p[3] = (unsigned char)((value >> 24) & 0xff);
+}
+
+static void sp_pack_store_uint64(unsigned char * p, uint64_t value) {
+  sp_pack_store_uint32(p, (uint32_t)(value & 0xffffffff));
+  sp_pack_store_uint32(p + 4, (uint32_t)(value >> 32));
+}
+
+/* Reserve len bytes at the writer's cursor and advance past them. */
+static unsigned char * sp_pack_writer_reserve(sp_pack_writer * writer, size_t len) {
+  assert(writer);
 
-  if(!sp_write_item_type(spit_hash, fp, content_len)) { abort(); }
-  /* generate hash from buffer: */
-  crypto_generichash(hash, crypto_generichash_BYTES, buf, buf_len, NULL, 0);
+  if(len > SIZE_MAX - writer->len) { abort(); }
+  if(writer->len + len > writer->cap) {
+    size_t cap = writer->cap > 0 ? writer->cap : 256;
+    while(cap < writer->len + len) {
+      if(cap > SIZE_MAX / 2) { cap = writer->len + len; break; }
+      cap *= 2;
+    }
+
+    unsigned char * data = realloc(writer->data, cap);
+    if(!data) { abort(); }
 
-  /* write generated hash to fp: */
-  bool res = sp_write_raw(hash, crypto_generichash_BYTES, fp);
-  if(res) {
-    if(content_len != NULL) { (*content_len) += crypto_generichash_BYTES; }
+    writer->data = data;
+    writer->cap = cap;
   }
 
-  return res;
+  unsigned char * p = writer->data + writer->len;
+  writer->len += len;
+
+  return p;
 }
 
-static bool sp_read_hash(FILE * fp, unsigned char * buf, size_t buf_len) {
-  assert(buf && buf_len == crypto_generichash_BYTES);
-  sp_pack_item_type type = spit_unspecified;
-  sp_read_item_type(fp, &type);
+static void sp_pack_writer_put_raw(sp_pack_writer * writer, const void * value, size_t len) {
+  if(len == 0) { return; }
+  memcpy(sp_pack_writer_reserve(writer, len), value, len);
+}
+
+static void sp_pack_writer_put_zeros(sp_pack_writer * writer, size_t len) {
+  if(len == 0) { return; }
+  memset(sp_pack_writer_reserve(writer, len), 0, len);
+}
 
-  assert(type == spit_hash);
-  if(type != spit_hash) { abort(); }
+static void sp_pack_writer_put_uint8(sp_pack_writer * writer, uint8_t value) {
+  *sp_pack_writer_reserve(writer, sizeof value) = value;
+}
 
-  assert(buf_len == crypto_generichash_BYTES);
+static void sp_pack_writer_put_uint16(sp_pack_writer * writer, uint16_t value) {
+  unsigned char * p = sp_pack_writer_reserve(writer, sizeof value);
 
-  return sp_read_raw(fp, buf_len, buf);
+  /* little endian */
+  p[0] = (unsigned char)(value & 0xff);
+  p[1] = (unsigned char)(value >> 8);
 }
 
-static bool sp_write_item_type(sp_pack_item_type type, FILE * fp, uint64_t * content_len) {
-  assert(fp != NULL);
-  assert(type >= spit_unspecified && type <= spit_eof);
-  assert(type >= 0 && type <= UCHAR_MAX);
-  assert(type >= 0);
-  return sp_write_uint8((unsigned char)type, fp, content_len);
+static void sp_pack_writer_put_uint32(sp_pack_writer * writer, uint32_t value) {
+  sp_pack_store_uint32(sp_pack_writer_reserve(writer, sizeof value), value);
 }
 
-static bool sp_read_item_type(FILE * fp, sp_pack_item_type * type) {
-  unsigned char value = 0;
-  bool res = sp_read_uint8(fp, &value);
-  assert(res);
-  *type = (sp_pack_item_type)value;
-  return res;
+static void sp_pack_writer_put_uint64(sp_pack_writer * writer, uint64_t value) {
+  sp_pack_store_uint64(sp_pack_writer_reserve(writer, sizeof value), value);
+}
+
+static void sp_pack_writer_put_hash(sp_pack_writer * writer, const unsigned char * hash) {
+  sp_pack_writer_put_uint8(writer, (uint8_t)spit_hash);
+  sp_pack_writer_put_raw(writer, hash, crypto_generichash_BYTES);
 }
 
-static bool sp_read_string(FILE * fp, char ** value, size_t * value_len) {
-  assert(fp && value && value_len);
+/* length (uint64, little endian), the string, NULL terminator */
+static void sp_pack_writer_put_string(sp_pack_writer * writer, const char * value) {
+  assert(value);
 
-  uint64_t len = 0;
-  if(!sp_read_uint64(fp, &len)) { return false; }
+  size_t len = strnlen(value, MAX_PACK_STRING_LEN);
+  sp_pack_writer_put_uint64(writer, (uint64_t)len);
+  sp_pack_writer_put_raw(writer, value, len);
+  sp_pack_writer_put_uint8(writer, '\0');
+}
 
-  assert(len <= SIZE_MAX);
-  assert(len <= SP_MAX_STRING_LEN);
+/* Hand everything written so far to stdio in one block and rewind the cursor. */
+static bool sp_pack_writer_flush(sp_pack_writer * writer, FILE * fp, uint64_t * content_len) {
+  assert(writer && fp);
 
-  *value = NULL;
-  *value_len = (size_t)len;
-  if(len > 0) {
-    *value = calloc(len, sizeof ** value);
-    assert(*value);
-    if(!*value) { abort(); }
-    if(!sp_read_raw(fp, len + 1 /* NULL terminator */, *value)) { return false; }
-  }
+  if(writer->len == 0) { return true; }
+  if(!sp_write_raw(writer->data, writer->len, fp)) { return false; }
+  if(content_len != NULL) { *content_len += writer->len; }
+  writer->len = 0;
 
   return true;
 }
 
-static bool sp_read_file(FILE * fp, sp_pack_item_bin_file * file) {
-  assert(fp);
+static void sp_pack_writer_free(sp_pack_writer * writer) {
+  free(writer->data), writer->data = NULL;
+  writer->len = writer->cap = 0;
+}
 
-  /* READ TYPE: (assert spit_bin_file)
-   * READ DECOMPRESSED LEN (uint64_t)
-   * READ COMPRESSED LEN (uint64_t)
-   * READ DECOMPRESSED CONTENT HASH
-   * READ COMPRESSED CONTENT HASH
-   * READ FILE PATH
-   * READ KEY
-   * READ CONTENT
-   */
+static bool sp_pack_view_get_raw(sp_pack_view * view, size_t len, const unsigned char ** out) {
+  assert(view && out);
 
-  unsigned char decompressed_hash[crypto_generichash_BYTES] = { 0 };
-  unsigned char compressed_hash[crypto_generichash_BYTES] = { 0 };
-  unsigned char read_compressed_hash[crypto_generichash_BYTES] = { 0 };
-  unsigned char read_decompressed_hash[crypto_generichash_BYTES] = { 0 };
+  if(len > view->len - view->pos) { return false; }
+  *out = view->data + view->pos;
+  view->pos += len;
 
-  sp_pack_item_type type = spit_unspecified;
-  /* write the type (bin-file) to the stream: */
-  if(!sp_read_item_type(fp, &type)) { return false; }
-  assert(type == spit_bin_file);
-  if(type != spit_bin_file) { return false; }
+  return true;
+}
 
-  uint64_t decompressed_len = 0, compressed_len = 0;
+static bool sp_pack_view_get_uint8(sp_pack_view * view, uint8_t * value) {
+  const unsigned char * p = NULL;
+  if(!sp_pack_view_get_raw(view, sizeof * value, &p)) { return false; }
+  *value = p[0];
+  return true;
+}
 
-  if(!sp_read_uint64(fp, &decompressed_len)) { return false; }
-  if(!sp_read_uint64(fp, &compressed_len)) { return false; }
+static bool sp_pack_view_get_uint16(sp_pack_view * view, uint16_t * value) {
+  const unsigned char * p = NULL;
+  if(!sp_pack_view_get_raw(view, sizeof * value, &p)) { return false; }
+  *value = (uint16_t)(p[0] | (p[1] << 8));
+  return true;
+}
 
-  /* READ DECOMPRESSED CONTENT HASH */
-  if(!sp_read_hash(fp, decompressed_hash, crypto_generichash_BYTES)) { return false; };
+static bool sp_pack_view_get_uint32(sp_pack_view * view, uint32_t * value) {
+  const unsigned char * p = NULL;
+  if(!sp_pack_view_get_raw(view, sizeof * value, &p)) { return false; }
+  *value = sp_pack_load_uint32(p);
+  return true;
+}
 
-  /* READ COMPRESSED CONTENT HASH */
-  if(!sp_read_hash(fp, compressed_hash, crypto_generichash_BYTES)) { return false; };
+static bool sp_pack_view_get_uint64(sp_pack_view * view, uint64_t * value) {
+  const unsigned char * p = NULL;
+  if(!sp_pack_view_get_raw(view, sizeof * value, &p)) { return false; }
+  *value = sp_pack_load_uint64(p);
+  return true;
+}
 
-  /* READ FILE PATH */
-  char * file_path = NULL; /* need to free */
-  size_t file_path_len = 0;
-  if(!sp_read_string(fp, &file_path, &file_path_len)) { return false; }
+static bool sp_pack_view_get_hash(sp_pack_view * view, const unsigned char ** hash) {
+  uint8_t type = 0;
+  if(!sp_pack_view_get_uint8(view, &type) || type != spit_hash) { return false; }
+  return sp_pack_view_get_raw(view, crypto_generichash_BYTES, hash);
+}
 
-  /* READ KEY */
-  char * key = NULL; /* need to free */
-  size_t key_len = 0;
-  if(!sp_read_string(fp, &key, &key_len)) { return false; }
+/* Strings are returned in place; they're NULL terminated in the pak. */
+static bool sp_pack_view_get_string(sp_pack_view * view, const char ** value, size_t * value_len) {
+  const unsigned char * p = NULL;
+  uint64_t stored_len = 0;
+  if(!sp_pack_view_get_uint64(view, &stored_len)) { return false; }
+  if(stored_len > MAX_PACK_STRING_LEN) { return false; }
+  size_t len = (size_t)stored_len;
 
-  /* READ CONTENT */
-  unsigned char * compressed_data = calloc(compressed_len, sizeof * compressed_data);
-  if(!compressed_data) { abort(); }
-  unsigned char * compressed_data_head = compressed_data;
+  if(!sp_pack_view_get_raw(view, len + 1 /* NULL terminator */, &p)) { return false; }
+  if(p[len] != '\0') { return false; }
 
-  if(!sp_read_raw(fp, compressed_len, compressed_data)) {
-    free(compressed_data), compressed_data = NULL;
-    return false;
-  }
+  *value = (const char *)p;
+  *value_len = len;
 
-  crypto_generichash(read_compressed_hash, crypto_generichash_BYTES, compressed_data_head, compressed_len, NULL, 0);
+  return true;
+}
 
-  for(size_t i = 0; i < crypto_generichash_BYTES; i++) {
-    if(read_compressed_hash[i] != compressed_hash[i]) {
-      fprintf(stderr, "Failed to verify compressed content hash.\n");
-      return false;
-    }
+const char * sp_pack_codec_name(sp_pack_codec codec) {
+  switch(codec) {
+    case spc_auto: return "auto";
+    case spc_stored: return "stored";
+    case spc_zlib: return "zlib";
+    case spc_lz: return "lz";
+    case spc_zlib_dict: return "zlib+dict";
+    case spc_zlib_blocks: return "zlib+blocks";
+    default: return "unknown";
   }
+}
 
-  unsigned char * decompressed_data = calloc(decompressed_len, sizeof * decompressed_data);
-  if(!decompressed_data) {
-    free(compressed_data), compressed_data = NULL;
-    abort();
+const char * sp_pack_integrity_name(sp_pack_integrity integrity) {
+  switch(integrity) {
+    case spi_blake2b: return "blake2b";
+    case spi_crc32c: return "crc32c";
+    case spi_none: return "none";
+    default: return "unknown";
   }
-  unsigned char * decompressed_data_head = decompressed_data;
+}
 
-  FILE * deflated_fp = fmemopen(compressed_data, compressed_len, "rb");
-  SP_SET_BINARY_MODE(deflated_fp);
-  char * decompressed_data_copy = NULL;
-  {
-    FILE * inflated_fp = fmemopen(decompressed_data, decompressed_len, "rb+");
-    SP_SET_BINARY_MODE(inflated_fp);
-    size_t inflated_buf_len = 0;
+/* A hash field's worth of digest: BLAKE2b, a CRC32C in the first four bytes,
+ * or zeros, by the pak's integrity mode. */
+static void sp_pack_digest(sp_pack_integrity integrity, const unsigned char * data, size_t len, unsigned char * out) {
+  switch(integrity) {
+    case spi_blake2b:
+      crypto_generichash(out, crypto_generichash_BYTES, data, len, NULL, 0);
+      break;
+    case spi_crc32c:
+      memset(out, 0, crypto_generichash_BYTES);
+      sp_pack_store_uint32(out, sp_crc32c(0, data, len));
+      break;
+    case spi_none:
+    default:
+      memset(out, 0, crypto_generichash_BYTES);
+      break;
+  }
+}
 
-    if(sp_inflate_file(deflated_fp, inflated_fp, &inflated_buf_len) != SP_SUCCESS) {
-      fprintf(stderr, "Failed to inflate [%s] at '%s' (%lu, %lu) <", key, file_path, (size_t)compressed_len, (size_t)decompressed_len);
-      sp_pack_dump_hash(stderr, compressed_hash, sizeof compressed_hash);
-      fprintf(stderr, ">\n");
-      fflush(stderr);
-      abort();
-    }
+static void sp_pack_blocks_free(sp_pack_blocks * blocks) {
+  free(blocks->offsets), blocks->offsets = NULL;
+  free(blocks->lens), blocks->lens = NULL;
+}
 
-    fseek(inflated_fp, 0, SEEK_SET);
-    assert(inflated_buf_len == decompressed_len);
+static size_t sp_pack_block_len(const sp_pack_blocks * blocks, uint64_t i) {
+  uint64_t start = i * blocks->block_size;
+  uint64_t len = blocks->decompressed_len - start;
+  return (size_t)(len < blocks->block_size ? len : blocks->block_size);
+}
 
-    crypto_generichash(read_decompressed_hash, crypto_generichash_BYTES, decompressed_data_head, decompressed_len, NULL, 0);
+/* Parse the block table at the start of a payload. Only the header and table
+ * need to be in src; compressed_len is the whole payload's. */
+static bool sp_pack_parse_blocks(const unsigned char * src, size_t src_len, uint64_t compressed_len, uint64_t decompressed_len, sp_pack_blocks * blocks) {
+  assert(src && blocks);
+
+  memset(blocks, 0, sizeof * blocks);
+  if(src_len < SP_PACK_BLOCK_HEADER_LEN) { return false; }
+
+  uint32_t block_size = sp_pack_load_uint32(src);
+  uint32_t block_count = sp_pack_load_uint32(src + 4);
+  if(block_size == 0 || decompressed_len == 0) { return false; }
+  if(block_count != (decompressed_len + block_size - 1) / block_size) { return false; }
+
+  uint64_t data_offset = SP_PACK_BLOCK_HEADER_LEN + (uint64_t)block_count * sizeof(uint32_t);
+  if(data_offset > src_len || data_offset > compressed_len) { return false; }
+
+  blocks->block_size = block_size;
+  blocks->block_count = block_count;
+  blocks->data_offset = data_offset;
+  blocks->decompressed_len = decompressed_len;
+  blocks->offsets = calloc((size_t)block_count + 1, sizeof * blocks->offsets);
+  blocks->lens = calloc(block_count, sizeof * blocks->lens);
+  if(!blocks->offsets || !blocks->lens) { abort(); }
+
+  uint64_t offset = 0;
+  for(uint32_t i = 0; i < block_count; i++) {
+    uint32_t len = sp_pack_load_uint32(src + SP_PACK_BLOCK_HEADER_LEN + (size_t)i * sizeof(uint32_t));
+    uint32_t encoded_len = len & ~SP_PACK_BLOCK_STORED;
+    /* stored blocks are exactly as long as their content */
+    if((len & SP_PACK_BLOCK_STORED) && encoded_len != sp_pack_block_len(blocks, i)) { goto err0; }
+
+    blocks->lens[i] = len;
+    blocks->offsets[i] = offset;
+    offset += encoded_len;
+  }
+  blocks->offsets[block_count] = offset;
 
-    for(size_t i = 0; i < sizeof read_decompressed_hash / sizeof read_decompressed_hash[0]; i++) {
-      if(read_decompressed_hash[i] != decompressed_hash[i]) {
-        fprintf(stderr, "Failed to verify decompressed content hash.\n");
-        return false;
-      }
-    }
+  if(offset != compressed_len - data_offset) { goto err0; }
 
-    fseek(inflated_fp, 0, SEEK_SET);
-    decompressed_data_copy = calloc(decompressed_len, sizeof * decompressed_data_copy );
-    if(!decompressed_data_copy) { abort(); }
-    memmove(decompressed_data_copy, decompressed_data, decompressed_len);
+  return true;
 
-    fclose(inflated_fp);
-  }
-  fclose(deflated_fp);
+err0:
+  sp_pack_blocks_free(blocks);
+  return false;
+}
 
-  free(compressed_data), compressed_data = NULL;
-  free(decompressed_data), decompressed_data = NULL;
+static bool sp_pack_decode_block(sp_z * z, const sp_pack_blocks * blocks, uint64_t i, const unsigned char * src, unsigned char * dest) {
+  size_t src_len = (size_t)(blocks->offsets[i + 1] - blocks->offsets[i]);
+  size_t dest_len = sp_pack_block_len(blocks, i);
 
-  file->type = type;
-  file->decompressed_len = decompressed_len;
-  file->compressed_len = compressed_len;
-  memmove(file->decompressed_hash, decompressed_hash, crypto_generichash_BYTES);
-  memmove(file->compressed_hash, compressed_hash, crypto_generichash_BYTES);
-  file->file_path = file_path;
-  file->key = key;
-  file->data = decompressed_data_copy;
-  file->data_len = (size_t)decompressed_len;
-  return true;
+  if(blocks->lens[i] & SP_PACK_BLOCK_STORED) {
+    memcpy(dest, src, dest_len);
+    return true;
+  }
+
+  size_t decoded_len = 0;
+  if(sp_z_inflate(z, src, src_len, dest, dest_len, &decoded_len) != SP_SUCCESS) { return false; }
+  return decoded_len == dest_len;
 }
 
-static bool sp_write_file(const char * file_path, const char * key, FILE * fp, uint64_t * content_len) {
-  assert(file_path != NULL && fp != NULL);
+static bool sp_pack_encode_blocks(sp_z * z, const unsigned char * src, size_t src_len, unsigned char ** out, size_t * out_len) {
+  assert(src && src_len > 0 && out && out_len);
 
-  unsigned char * inflated_buf = NULL;
-  unsigned char * deflated_buf = NULL;
+  uint64_t block_count = (src_len + SP_PACK_BLOCK_SIZE - 1) / SP_PACK_BLOCK_SIZE;
+  if(block_count > UINT32_MAX) { return false; }
 
-  FILE * src_file = fopen(file_path, "rb");
-  SP_SET_BINARY_MODE(src_file);
-  if(src_file != NULL) {
-    if(fseek(src_file, 0L, SEEK_END) == 0) {
-      long inflated_buf_len = ftell(src_file);
-      if(inflated_buf_len == -1) { abort(); }
-      assert(inflated_buf_len < LONG_MAX);
-
-      inflated_buf = calloc((size_t)inflated_buf_len, sizeof * inflated_buf);
-      if(!inflated_buf) { abort(); }
-      deflated_buf = calloc((size_t)inflated_buf_len, sizeof * deflated_buf);
-      if(!deflated_buf) { abort(); }
-
-      if(fseek(src_file, 0L, SEEK_SET) != 0) { abort(); }
-
-      size_t new_len = fread(inflated_buf, sizeof(unsigned char), (size_t)inflated_buf_len, src_file);
-      assert((size_t)new_len == (size_t)inflated_buf_len);
-      if(ferror(src_file) != 0) {
-        abort();
-      } else {
-        {
-          FILE * inflated_fp = fmemopen(inflated_buf, new_len, "rb");
-          SP_SET_BINARY_MODE(inflated_fp);
-          fseek(inflated_fp, 0, SEEK_SET);
-          {
-            unsigned char * deflated_buf_head = deflated_buf;
-            FILE * deflated_fp = fmemopen(deflated_buf, new_len, "rb+");
-            SP_SET_BINARY_MODE(deflated_fp);
-            fseek(deflated_fp, 0, SEEK_SET);
-            size_t deflated_buf_len = 0;
-
-            /* compress the file: */
-            if(sp_deflate_file(inflated_fp, deflated_fp, &deflated_buf_len) != SP_SUCCESS) { abort(); };
-
-            /* File format:
-             * - Type (spit_bin_file)
-             * - Decompressed len (uint64_t)
-             * - Compressed len (uint64_t)
-             * - Decompressed content hash
-             * - Compresed content hash
-             * - Path (string)
-             * - Key (string)
-             * - Content
-             */
-
-            /* TYPE: */
-            /* write the type (bin-file) to the stream: */
-            sp_write_item_type(spit_bin_file, fp, content_len);
-
-            /* DECOMPRESSED SIZE: */
-            /* write the decompressed (inflated) file size to the stream */
-            sp_write_uint64(new_len, fp, content_len);
-
-            /* COMPRESSED SIZE: */
-            /* write the compressed file length to the stream: */
-            sp_write_uint64(deflated_buf_len, fp, content_len);
-
-            fseek(deflated_fp, 0, SEEK_SET);
-
-            /* DECOMPRESSED HASH: */
-            sp_write_hash(inflated_buf, new_len, fp, content_len);
-
-            /* COMPRESSED HASH: */
-            sp_write_hash(deflated_buf_head, (size_t)deflated_buf_len, fp, content_len);
-
-            /* FILE PATH: */
-            sp_write_string(file_path, fp, content_len);
-
-            /* KEY: */
-            sp_write_string(key, fp, content_len);
-
-            /* CONTENT */
-            fseek(deflated_fp, 0, SEEK_SET);
-            sp_write_raw(deflated_buf_head, deflated_buf_len, fp);
-            if(content_len != NULL) { *content_len += deflated_buf_len; }
-
-            fclose(deflated_fp);
-          }
-          fclose(inflated_fp);
-        }
-      }
+  size_t header_len = SP_PACK_BLOCK_HEADER_LEN + (size_t)block_count * sizeof(uint32_t);
+  size_t bound = header_len + (size_t)block_count * sp_deflate_bound(SP_PACK_BLOCK_SIZE);
+  unsigned char * encoded = malloc(bound);
+  if(!encoded) { abort(); }
+
+  sp_pack_store_uint32(encoded, SP_PACK_BLOCK_SIZE);
+  sp_pack_store_uint32(encoded + 4, (uint32_t)block_count);
+
+  size_t pos = header_len;
+  for(uint64_t i = 0; i < block_count; i++) {
+    size_t start = (size_t)i * SP_PACK_BLOCK_SIZE;
+    size_t len = src_len - start < SP_PACK_BLOCK_SIZE ? src_len - start : SP_PACK_BLOCK_SIZE;
+
+    size_t block_len = 0;
+    if(sp_z_deflate(z, src + start, len, encoded + pos, bound - pos, &block_len) != SP_SUCCESS) {
+      free(encoded), encoded = NULL;
+      return false;
+    }
+
+    uint32_t record = (uint32_t)block_len;
+    if(block_len >= len) {
+      /* incompressible blocks are stored, like incompressible entries */
+      memcpy(encoded + pos, src + start, len);
+      block_len = len;
+      record = (uint32_t)len | SP_PACK_BLOCK_STORED;
     }
-    fclose(src_file);
+
+    sp_pack_store_uint32(encoded + SP_PACK_BLOCK_HEADER_LEN + (size_t)i * sizeof(uint32_t), record);
+    pos += block_len;
   }
 
-  free(inflated_buf), inflated_buf = NULL;
-  free(deflated_buf), deflated_buf = NULL;
+  *out = encoded;
+  *out_len = pos;
 
   return true;
 }
 
-bool sp_write_index_entry(sp_pack_index_entry * entry, FILE * fp, uint64_t * content_len) {
-  assert(entry && fp);
-
-  if(!sp_write_string(entry->name, fp, content_len)) { goto err; }
-  if(!sp_write_uint64(entry->offset, fp, content_len)) { goto err; }
-  if(!sp_write_uint64(entry->len, fp, content_len)) { goto err; }
-
-  return true;
-err:
-  return false;
+typedef struct sp_pack_block_pool {
+  pthread_mutex_t lock;
+  const sp_pack_blocks * blocks;
+  const unsigned char * data; /* the first block */
+  unsigned char * dest;
+  uint64_t next;
+  bool is_valid;
+  char padding[7]; /* not portable */
+} sp_pack_block_pool;
+
+static void sp_pack_block_pool_run(sp_pack_block_pool * pool, sp_z * z) {
+  const sp_pack_blocks * blocks = pool->blocks;
+
+  for(;;) {
+    pthread_mutex_lock(&pool->lock);
+    if(!pool->is_valid || pool->next >= blocks->block_count) {
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+    uint64_t i = pool->next++;
+    pthread_mutex_unlock(&pool->lock);
+
+    unsigned char * dest = pool->dest + i * blocks->block_size;
+    if(!sp_pack_decode_block(z, blocks, i, pool->data + blocks->offsets[i], dest)) {
+      pthread_mutex_lock(&pool->lock);
+      pool->is_valid = false;
+      pthread_mutex_unlock(&pool->lock);
+    }
+  }
 }
 
-bool sp_read_index_entry(FILE * fp, sp_pack_index_entry * entry) {
-  assert(fp && entry);
+static void * sp_pack_block_worker(void * arg) {
+  sp_pack_block_workers * workers = arg;
 
-  size_t name_len = 0;
-  if(!sp_read_string(fp, &(entry->name), &name_len)) { goto err; }
-  if(!sp_read_uint64(fp, &(entry->offset))) { goto err; }
-  if(!sp_read_uint64(fp, &(entry->len))) { goto err; }
+  /* each worker inflates with its own streams, kept between jobs */
+  sp_z * z = sp_z_create();
+  uint64_t seen = 0;
 
-  return true;
+  pthread_mutex_lock(&workers->lock);
+  for(;;) {
+    while(!workers->is_stopping && workers->job_id == seen) {
+      pthread_cond_wait(&workers->work, &workers->lock);
+    }
+    if(workers->is_stopping) { break; }
+
+    /* a job that finished before this worker woke is skipped */
+    seen = workers->job_id;
+    sp_pack_block_pool * job = workers->job;
+    if(!job) { continue; }
+
+    workers->active++;
+    pthread_mutex_unlock(&workers->lock);
+    sp_pack_block_pool_run(job, z);
+    pthread_mutex_lock(&workers->lock);
+    if(--workers->active == 0) { pthread_cond_broadcast(&workers->done); }
+  }
+  pthread_mutex_unlock(&workers->lock);
 
-err:
-  return false;
+  sp_z_free(z), z = NULL;
+  return NULL;
 }
 
-static bool sp_write_char(char value, FILE * fp, uint64_t * content_len) {
-  if(content_len != NULL) { *content_len += sizeof value; }
-  return sp_write_raw(&value, sizeof value, fp);
+static void sp_pack_block_workers_init(sp_pack_block_workers * workers) {
+  memset(workers, 0, sizeof * workers);
+  pthread_mutex_init(&workers->lock, NULL);
+  pthread_cond_init(&workers->work, NULL);
+  pthread_cond_init(&workers->done, NULL);
 }
 
-static bool sp_write_uint8(uint8_t value, FILE * fp, uint64_t * content_len) {
-  if(content_len != NULL) { *content_len += sizeof value; }
-  return sp_write_raw(&value, sizeof value, fp);
-}
+/* Called with the workers locked; the loading thread is a worker too, so one
+ * fewer than the CPUs are started, and a failed start just leaves fewer. */
+static void sp_pack_block_workers_start(sp_pack_block_workers * workers) {
+  if(workers->is_started) { return; }
+  workers->is_started = true;
 
-static bool sp_write_int8(int8_t value, FILE * fp, uint64_t * content_len) {
-  if(content_len != NULL) { *content_len += sizeof value; }
-  return sp_write_raw(&value, sizeof value, fp);
+  size_t count = sp_pack_resolve_jobs(0, SIZE_MAX) - 1;
+  if(count == 0) { return; }
+
+  workers->threads = calloc(count, sizeof * workers->threads);
+  if(!workers->threads) { abort(); }
+  for(; workers->thread_count < count; workers->thread_count++) {
+    if(pthread_create(workers->threads + workers->thread_count, NULL, sp_pack_block_worker, workers) != 0) { break; }
+  }
 }
 
-static bool sp_write_uint16(uint16_t value, FILE * fp, uint64_t * content_len) {
-  if(content_len != NULL) { *content_len += sizeof value; }
-  uint8_t bytes[sizeof value] = { 0 };
+static void sp_pack_block_workers_free(sp_pack_block_workers * workers) {
+  pthread_mutex_lock(&workers->lock);
+  workers->is_stopping = true;
+  pthread_cond_broadcast(&workers->work);
+  pthread_mutex_unlock(&workers->lock);
 
-  /* little endian */
-  bytes[0] = (uint8_t)(value & 0x00ff);
-  bytes[1] = (uint8_t)(value >> 8);
+  for(size_t i = 0; i < workers->thread_count; i++) {
+    pthread_join(workers->threads[i], NULL);
+  }
+  free(workers->threads), workers->threads = NULL;
+  workers->thread_count = 0;
 
-  return sp_write_raw(bytes, sizeof value, fp);
+  pthread_cond_destroy(&workers->done);
+  pthread_cond_destroy(&workers->work);
+  pthread_mutex_destroy(&workers->lock);
 }
 
-static bool sp_write_int16(int16_t value, FILE * fp, uint64_t * content_len) {
-  if(content_len != NULL) { *content_len += sizeof value; }
-
-  int8_t bytes[sizeof value] = { 0 };
+/* Payloads with fewer blocks aren't worth waking the workers for. */
+#define SP_PACK_BLOCK_SHARE_MIN 4
+
+/* Inflate every block of a payload with z, sharing the blocks out to the
+ * workers when there are enough of them. Workers already busy with another
+ * load's payload, or NULL workers, leave the calling thread to decode alone. */
+static bool sp_pack_decode_blocks(sp_z * z, sp_pack_block_workers * workers, const unsigned char * src, size_t src_len, unsigned char * dest, size_t dest_len) {
+  sp_pack_blocks blocks = { 0 };
+  if(!sp_pack_parse_blocks(src, src_len, src_len, dest_len, &blocks)) { return false; }
+
+  sp_pack_block_pool pool = {
+    .blocks = &blocks,
+    .data = src + blocks.data_offset,
+    .dest = dest,
+    .next = 0,
+    .is_valid = true
+  };
+  pthread_mutex_init(&pool.lock, NULL);
+
+  bool is_shared = false;
+  if(workers && blocks.block_count >= SP_PACK_BLOCK_SHARE_MIN) {
+    pthread_mutex_lock(&workers->lock);
+    sp_pack_block_workers_start(workers);
+    if(!workers->job && workers->thread_count > 0) {
+      workers->job = &pool;
+      workers->job_id++;
+      is_shared = true;
+      pthread_cond_broadcast(&workers->work);
+    }
+    pthread_mutex_unlock(&workers->lock);
+  }
 
-  /* little endian */
-  bytes[0] = (int8_t)(value & 0x00ff);
-  bytes[1] = (int8_t)(value >> 8);
+  sp_pack_block_pool_run(&pool, z);
 
-  return sp_write_raw(bytes, sizeof value, fp);
-}
+  if(is_shared) {
+    /* no worker joins once the job is withdrawn; wait out those that did */
+    pthread_mutex_lock(&workers->lock);
+    workers->job = NULL;
+    while(workers->active > 0) { pthread_cond_wait(&workers->done, &workers->lock); }
+    pthread_mutex_unlock(&workers->lock);
+  }
 
-bool sp_write_uint32(uint32_t value, FILE * fp, uint64_t * content_len) {
-  if(content_len != NULL) { *content_len += sizeof value; }
-  uint16_t lo = value & 0xffff;
-  uint16_t hi = (uint16_t)((value >> 16) & 0xffff);
+  pthread_mutex_destroy(&pool.lock);
+  sp_pack_blocks_free(&blocks);
 
-  /* little endian */
-  return sp_write_raw(&lo, sizeof lo, fp)
-    && sp_write_raw(&hi, sizeof hi, fp);
+  return pool.is_valid;
 }
 
-static bool sp_write_int32(int32_t value, FILE * fp, uint64_t * content_len) {
-  if(content_len != NULL) { *content_len += sizeof value; }
-  int16_t lo = (int16_t)(value & 0xffff);
-  int16_t hi = (int16_t)((value >> 16) & 0xffff);
+/* Encoded payloads must save at least 1/SP_PACK_MIN_SAVINGS of the entry,
+ * otherwise spc_auto stores the entry as-is. */
+#define SP_PACK_MIN_SAVINGS 16
+
+static bool sp_pack_encode(sp_z * z, sp_pack_codec * codec, const unsigned char * src, size_t src_len, unsigned char ** out, size_t * out_len) {
+  assert(codec && out && out_len);
+  assert(src || src_len == 0);
+
+  *out = NULL;
+  *out_len = 0;
+
+  sp_pack_codec requested = *codec;
+  bool is_auto = requested == spc_auto;
+  if(src_len == 0) { requested = spc_stored; }
+  /* large entries are blocked so they can be read without inflating them whole */
+  if(is_auto && src_len >= SP_PACK_BLOCK_ENTRY_MIN) { requested = spc_zlib_blocks; }
+  /* small entries are where the pak's shared dictionary pays */
+  if(is_auto && sp_z_has_dictionary(z) && src_len <= SP_PACK_DICTIONARY_ENTRY_MAX) { requested = spc_zlib_dict; }
+  if(requested == spc_zlib_dict && !sp_z_has_dictionary(z)) { requested = spc_zlib; }
+
+  size_t encoded_len = 0;
+  unsigned char * encoded = NULL;
+  switch(requested) {
+    case spc_stored:
+      break;
+    case spc_auto:
+    case spc_zlib:
+    case spc_zlib_dict:
+      {
+        size_t bound = sp_deflate_bound(src_len);
+        encoded = malloc(bound);
+        if(!encoded) { abort(); }
+        errno_t res = requested == spc_zlib_dict
+          ? sp_z_deflate_dict(z, src, src_len, encoded, bound, &encoded_len)
+          : sp_z_deflate(z, src, src_len, encoded, bound, &encoded_len);
+        if(res != SP_SUCCESS) {
+          free(encoded), encoded = NULL;
+          return false;
+        }
+      }
+      break;
+    case spc_zlib_blocks:
+      if(!sp_pack_encode_blocks(z, src, src_len, &encoded, &encoded_len)) { return false; }
+      break;
+    case spc_lz:
+      {
+        size_t bound = sp_lz_compress_bound(src_len);
+        encoded = malloc(bound);
+        if(!encoded) { abort(); }
+        if(sp_lz_compress(src, src_len, encoded, bound, &encoded_len) != SP_SUCCESS) {
+          free(encoded), encoded = NULL;
+          return false;
+        }
+      }
+      break;
+    default:
+      return false;
+  }
 
-  /* little endian */
-  return sp_write_raw(&lo, sizeof lo, fp)
-    && sp_write_raw(&hi, sizeof hi, fp);
-}
+  bool keep = encoded != NULL && encoded_len < src_len;
+  if(keep && is_auto) {
+    keep = encoded_len + (encoded_len / SP_PACK_MIN_SAVINGS) < src_len;
+  }
 
-static bool sp_write_uint64(uint64_t value, FILE * fp, uint64_t * content_len) {
-  if(content_len != NULL) { *content_len += sizeof value; }
-  uint32_t lo = value & 0xffffffff;
-  uint32_t hi =(uint32_t)((value >> 32) & 0xffffffff);
+  if(!keep) {
+    /* never ship an encoding that is larger than the entry itself */
+    free(encoded), encoded = NULL;
+    *codec = spc_stored;
+    *out_len = src_len;
+    return true;
+  }
 
-  /* little endian */
-  return sp_write_raw(&lo, sizeof lo, fp)
-    && sp_write_raw(&hi, sizeof hi, fp);
-}
+  *codec = requested == spc_auto ? spc_zlib : requested;
+  *out = encoded;
+  *out_len = encoded_len;
 
-static bool sp_write_int64(int64_t value, FILE * fp, uint64_t * content_len) {
-  if(content_len != NULL) { *content_len += sizeof value; }
-  int32_t lo = (int32_t)(value & 0xffffffff);
-  int32_t hi = (int32_t)((value >> 32) & 0xffffffff);
+  return true;
+}
 
-  /* little endian */
-  return sp_write_raw(&lo, sizeof lo, fp)
-    && sp_write_raw(&hi, sizeof hi, fp);
+static bool sp_pack_decode(sp_z * z, sp_pack_block_workers * workers, sp_pack_codec codec, const unsigned char * src, size_t src_len, unsigned char * dest, size_t dest_len) {
+  size_t decoded_len = 0;
+  switch(codec) {
+    case spc_stored:
+      if(src_len != dest_len) { return false; }
+      if(dest_len > 0) { memcpy(dest, src, dest_len); }
+      return true;
+    case spc_zlib:
+      if(sp_z_inflate(z, src, src_len, dest, dest_len, &decoded_len) != SP_SUCCESS) { return false; }
+      return decoded_len == dest_len;
+    case spc_lz:
+      if(sp_lz_decompress(src, src_len, dest, dest_len, &decoded_len) != SP_SUCCESS) { return false; }
+      return decoded_len == dest_len;
+    case spc_zlib_dict:
+      if(sp_z_inflate_dict(z, src, src_len, dest, dest_len, &decoded_len) != SP_SUCCESS) { return false; }
+      return decoded_len == dest_len;
+    case spc_zlib_blocks:
+      return sp_pack_decode_blocks(z, workers, src, src_len, dest, dest_len);
+    case spc_auto:
+    default:
+      return false;
+  }
 }
 
-static bool sp_write_bool(bool value, FILE * fp, uint64_t * content_len) {
-  static const uint32_t sp_true = 0x11111111;
-  static const uint32_t sp_false = 0x00000000;
+/* Parse an entry's fields up to its payload, which need not be in data;
+ * header_len is where the payload starts. */
+static bool sp_pack_parse_entry_header(const unsigned char * data, size_t len, sp_pack_entry_view * entry, size_t * header_len) {
+  assert(data && entry && header_len);
 
-  return sp_write_uint32(value ? sp_true : sp_false, fp, content_len);
-}
+  /* Entry layout, see sp_write_encoded_entry:
+   * TYPE (spit_bin_file), CODEC (uint8_t), DECOMPRESSED LEN (uint64_t),
+   * COMPRESSED LEN (uint64_t), DECOMPRESSED HASH, COMPRESSED HASH,
+   * FILE PATH, KEY, CONTENT
+   */
+  sp_pack_view view = { .data = data, .len = len, .pos = 0 };
 
-static bool sp_read_bool(FILE * fp, bool * value) {
-  static const uint32_t sp_true = 0x11111111;
+  uint8_t type = 0, codec = 0;
+  size_t file_path_len = 0, key_len = 0;
 
-  uint32_t b;
-  bool res = sp_read_uint32(fp, &b);
-  assert(res);
+  bool ok = sp_pack_view_get_uint8(&view, &type)
+    && type == spit_bin_file
+    && sp_pack_view_get_uint8(&view, &codec)
+    && sp_pack_view_get_uint64(&view, &entry->decompressed_len)
+    && sp_pack_view_get_uint64(&view, &entry->compressed_len)
+    && sp_pack_view_get_hash(&view, &entry->decompressed_hash)
+    && sp_pack_view_get_hash(&view, &entry->compressed_hash)
+    && sp_pack_view_get_string(&view, &entry->file_path, &file_path_len)
+    && sp_pack_view_get_string(&view, &entry->key, &key_len);
+  if(!ok) { return false; }
 
-  *value = b == sp_true;
+  if(entry->decompressed_len > SIZE_MAX - 1) { return false; }
 
-  return res;
+  entry->codec = (sp_pack_codec)codec;
+  entry->payload = view.data + view.pos;
+  *header_len = view.pos;
+
+  return true;
 }
 
-static bool sp_write_string(const char * value, FILE * fp, uint64_t * content_len) {
-  static const char * empty = "";
-  static const char nullstr = '\0';
+static bool sp_pack_parse_entry(const unsigned char * data, size_t len, sp_pack_entry_view * entry) {
+  size_t header_len = 0;
+  if(!sp_pack_parse_entry_header(data, len, entry, &header_len)) { return false; }
+  return entry->compressed_len <= len - header_len;
+}
 
-  /* String Format:
-   * - Len (size_t)
-   * - String (null-terminated)
-   */
-  int expected = 0;
-  size_t res = 0, len = 0;
-  if(value) {
-    len = strnlen(value, MAX_PACK_STRING_LEN);
-    res += fwrite(&len, sizeof(char), sizeof len, fp);
-    if(ferror(fp) != 0) return false;
+/* Verify an entry's payload and decode it. Stored entries need no copy:
+ * *out_data is left NULL and the payload is the content. */
+static bool sp_pack_decode_entry(sp_z * z, sp_pack_block_workers * workers, sp_pack_integrity integrity, const sp_pack_entry_view * entry, unsigned char ** out_data) {
+  assert(entry && out_data);
 
-    expected += (int)((sizeof len) * 1);
-    if(len > 0) {
-      res += fwrite(value, sizeof(char), len, fp);
-      if(ferror(fp) != 0) return false;
+  unsigned char read_hash[crypto_generichash_BYTES] = { 0 };
+  *out_data = NULL;
 
-      expected += (int)(sizeof(char) * len);
-    } else {
-      res += fwrite(empty, sizeof(char), len, fp);
-      if(ferror(fp) != 0) return false;
+  sp_pack_digest(integrity, entry->payload, (size_t)entry->compressed_len, read_hash);
+  if(memcmp(read_hash, entry->compressed_hash, crypto_generichash_BYTES) != 0) {
+    fprintf(stderr, "Failed to verify compressed content hash.\n");
+    return false;
+  }
 
-      expected += (int)(sizeof(char) * len);
+  if(entry->codec == spc_stored) {
+    if(entry->compressed_len != entry->decompressed_len
+        || memcmp(entry->compressed_hash, entry->decompressed_hash, crypto_generichash_BYTES) != 0) {
+      fprintf(stderr, "Failed to verify decompressed content hash.\n");
+      return false;
     }
-  } else {
-    res += fwrite(&len, sizeof(char), len, fp);
-    if(ferror(fp) != 0) return false;
-
-    expected += (int)((sizeof(char) * len));
+    return true;
   }
-  res += fwrite(&nullstr, sizeof(char), sizeof nullstr, fp);
-  if(ferror(fp) != 0) return false;
 
-  expected += (int)((sizeof nullstr) * 1);
-  assert(res == (size_t)expected);
+  /* decode once, straight into the buffer handed to the caller */
+  unsigned char * data = calloc((size_t)entry->decompressed_len + 1, sizeof * data);
+  if(!data) { abort(); }
 
-  if(content_len != NULL) { *content_len += (uint64_t)expected; }
+  if(!sp_pack_decode(z, workers, entry->codec, entry->payload, (size_t)entry->compressed_len, data, (size_t)entry->decompressed_len)) {
+    fprintf(stderr, "Failed to decode [%s] at '%s' (%s, %lu, %lu) <", entry->key, entry->file_path, sp_pack_codec_name(entry->codec), (size_t)entry->compressed_len, (size_t)entry->decompressed_len);
+    sp_pack_dump_hash(stderr, entry->compressed_hash, crypto_generichash_BYTES);
+    fprintf(stderr, ">\n");
+    free(data), data = NULL;
+    return false;
+  }
 
-  return res == (size_t)expected && ferror(fp) == 0;
-}
+  sp_pack_digest(integrity, data, (size_t)entry->decompressed_len, read_hash);
+  if(memcmp(read_hash, entry->decompressed_hash, crypto_generichash_BYTES) != 0) {
+    fprintf(stderr, "Failed to verify decompressed content hash.\n");
+    free(data), data = NULL;
+    return false;
+  }
+
+  *out_data = data;
+  return true;
+}
+
+/* Read a resource's source file whole; the buffer is NULL terminated. */
+static bool sp_pack_read_source(const char * file_path, unsigned char ** out, size_t * out_len) {
+  assert(file_path != NULL && out != NULL && out_len != NULL);
+
+  FILE * src_file = fopen(file_path, "rb");
+  if(!src_file) {
+    fprintf(stderr, "Unable to open resource '%s'\n", file_path);
+    return false;
+  }
+  SP_SET_BINARY_MODE(src_file);
+
+  if(fseek(src_file, 0L, SEEK_END) != 0) { goto err0; }
+  long inflated_buf_len = ftell(src_file);
+  if(inflated_buf_len == -1) { goto err0; }
+  assert(inflated_buf_len < LONG_MAX);
+  if(fseek(src_file, 0L, SEEK_SET) != 0) { goto err0; }
+
+  unsigned char * inflated_buf = calloc((size_t)inflated_buf_len + 1, sizeof * inflated_buf);
+  if(!inflated_buf) { abort(); }
+
+  size_t new_len = fread(inflated_buf, sizeof(unsigned char), (size_t)inflated_buf_len, src_file);
+  if(new_len != (size_t)inflated_buf_len || ferror(src_file) != 0) {
+    free(inflated_buf), inflated_buf = NULL;
+    goto err0;
+  }
+  fclose(src_file);
+
+  *out = inflated_buf;
+  *out_len = new_len;
+  return true;
+
+err0:
+  fprintf(stderr, "Unable to read resource '%s'\n", file_path);
+  fclose(src_file);
+  return false;
+}
+
+static bool sp_pack_encode_entry(sp_z * z, const char * file_path, sp_pack_codec codec, sp_pack_integrity integrity, sp_pack_encoded_entry * out) {
+  assert(file_path != NULL && out != NULL);
+
+  unsigned char * inflated_buf = NULL;
+  size_t new_len = 0;
+  if(!sp_pack_read_source(file_path, &inflated_buf, &new_len)) { return false; }
+
+  /* encode the file; stored entries are written straight from the source */
+  unsigned char * deflated_buf = NULL;
+  size_t deflated_buf_len = 0;
+  if(!sp_pack_encode(z, &codec, inflated_buf, new_len, &deflated_buf, &deflated_buf_len)) {
+    free(inflated_buf), inflated_buf = NULL;
+    return false;
+  }
+
+  out->data = inflated_buf;
+  out->data_len = new_len;
+  out->encoded = deflated_buf;
+  out->encoded_len = deflated_buf_len;
+  out->codec = codec;
+
+  crypto_generichash(out->content_hash, crypto_generichash_BYTES, out->data, out->data_len, NULL, 0);
+  if(integrity == spi_blake2b) {
+    memmove(out->decompressed_hash, out->content_hash, crypto_generichash_BYTES);
+  } else {
+    sp_pack_digest(integrity, out->data, out->data_len, out->decompressed_hash);
+  }
+  if(out->codec == spc_stored) {
+    memmove(out->compressed_hash, out->decompressed_hash, crypto_generichash_BYTES);
+  } else {
+    sp_pack_digest(integrity, out->encoded, out->encoded_len, out->compressed_hash);
+  }
+
+  return true;
+}
+
+static void sp_pack_encoded_entry_free(sp_pack_encoded_entry * entry) {
+  free(entry->data), entry->data = NULL;
+  free(entry->encoded), entry->encoded = NULL;
+  entry->data_len = entry->encoded_len = 0;
+}
+
+static bool sp_write_encoded_entry(const char * file_path, const char * key, const sp_pack_encoded_entry * entry, FILE * fp, uint64_t * content_len) {
+  assert(file_path != NULL && entry != NULL && fp != NULL);
+
+  const unsigned char * payload = entry->codec == spc_stored ? entry->data : entry->encoded;
+
+  /* File format:
+   * - Type (spit_bin_file)
+   * - Codec (uint8_t, sp_pack_codec)
+   * - Decompressed len (uint64_t)
+   * - Compressed len (uint64_t); equal to the decompressed len when stored
+   * - Decompressed content hash
+   * - Compresed content hash
+   * - Path (string)
+   * - Key (string)
+   * - Content
+   */
+
+  /* The preamble is encoded in memory and written with the payload in two
+   * blocks, rather than a stdio call per field. */
+  sp_pack_writer writer = { 0 };
+
+  /* TYPE: */
+  sp_pack_writer_put_uint8(&writer, (uint8_t)spit_bin_file);
+
+  /* CODEC: */
+  assert(entry->codec > spc_auto && entry->codec <= UCHAR_MAX);
+  sp_pack_writer_put_uint8(&writer, (uint8_t)entry->codec);
+
+  /* DECOMPRESSED SIZE: */
+  sp_pack_writer_put_uint64(&writer, entry->data_len);
+
+  /* COMPRESSED SIZE: */
+  sp_pack_writer_put_uint64(&writer, entry->encoded_len);
+
+  /* DECOMPRESSED HASH: */
+  sp_pack_writer_put_hash(&writer, entry->decompressed_hash);
+
+  /* COMPRESSED HASH: */
+  sp_pack_writer_put_hash(&writer, entry->compressed_hash);
+
+  /* FILE PATH: */
+  sp_pack_writer_put_string(&writer, file_path);
+
+  /* KEY: */
+  sp_pack_writer_put_string(&writer, key);
+
+  bool res = sp_pack_writer_flush(&writer, fp, content_len);
+  sp_pack_writer_free(&writer);
+
+  /* CONTENT */
+  if(res && entry->encoded_len > 0) {
+    res = sp_write_raw((void *)(uintptr_t)payload, entry->encoded_len, fp);
+    if(res && content_len != NULL) { *content_len += entry->encoded_len; }
+  }
+
+  return res && ferror(fp) == 0;
+}
+
+/* Entries are encoded (read, compressed and hashed) by a pool of workers and
+ * written by the calling thread strictly in content order, so the pak is
+ * byte-identical whatever the job count. Workers may run at most `window`
+ * entries ahead of the writer, bounding the memory held by encoded entries. */
+typedef struct sp_pack_build_pool {
+  pthread_mutex_t lock;
+  pthread_cond_t done; /* an entry finished encoding */
+  pthread_cond_t room; /* the writer advanced */
+  const sp_pack_content_entry * content;
+  sp_pack_encoded_entry * encoded;
+  const unsigned char * dictionary; /* NULL when the pak has none */
+  size_t dictionary_len;
+  size_t content_len;
+  size_t next; /* next entry to claim */
+  size_t written; /* entries handed to the writer */
+  size_t window;
+  sp_pack_integrity integrity;
+  char padding[4]; /* not portable */
+} sp_pack_build_pool;
+
+static void * sp_pack_build_worker(void * arg) {
+  sp_pack_build_pool * pool = arg;
+  sp_z * z = sp_z_create();
+  sp_z_set_dictionary(z, pool->dictionary, pool->dictionary_len);
+
+  for(;;) {
+    pthread_mutex_lock(&pool->lock);
+    while(pool->next < pool->content_len && pool->next >= pool->written + pool->window) {
+      pthread_cond_wait(&pool->room, &pool->lock);
+    }
+    if(pool->next >= pool->content_len) {
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+    size_t i = pool->next++;
+    pthread_mutex_unlock(&pool->lock);
+
+    const sp_pack_content_entry * e = pool->content + i;
+    sp_pack_encoded_entry * out = pool->encoded + i;
+    bool is_valid = sp_pack_encode_entry(z, e->path, e->codec, pool->integrity, out);
+
+    pthread_mutex_lock(&pool->lock);
+    out->is_valid = is_valid;
+    out->is_done = true;
+    pthread_cond_broadcast(&pool->done);
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  sp_z_free(z), z = NULL;
+  return NULL;
+}
+
+static void sp_pack_blobs_init(sp_pack_blobs * blobs, size_t entries) {
+  blobs->capacity = 16;
+  while(blobs->capacity < entries * 2) { blobs->capacity *= 2; }
+  blobs->slots = calloc(blobs->capacity, sizeof * blobs->slots);
+  if(!blobs->slots) { abort(); }
+}
+
+static void sp_pack_blobs_free(sp_pack_blobs * blobs) {
+  free(blobs->slots), blobs->slots = NULL;
+  blobs->capacity = 0;
+}
+
+/* The slot holding content with this hash, or the free slot it goes in. The
+ * hash is BLAKE2b, so its leading bytes are as good a slot hash as any. */
+static sp_pack_blob * sp_pack_blobs_find(sp_pack_blobs * blobs, const unsigned char * hash, uint64_t data_len) {
+  size_t mask = blobs->capacity - 1;
+  size_t i = (size_t)sp_pack_load_uint64(hash) & mask;
+  for(;;) {
+    sp_pack_blob * blob = blobs->slots + i;
+    if(blob->len == 0) { return blob; }
+    if(blob->data_len == data_len && memcmp(blob->hash, hash, crypto_generichash_BYTES) == 0) { return blob; }
+    i = (i + 1) & mask;
+  }
+}
+
+static void sp_pack_blob_set(sp_pack_blob * blob, const unsigned char * hash, uint64_t data_len, uint64_t offset, uint64_t len) {
+  assert(len > 0);
+  memmove(blob->hash, hash, crypto_generichash_BYTES);
+  blob->data_len = data_len;
+  blob->offset = offset;
+  blob->len = len;
+}
+
+/* Content that was already written isn't written again: the index entry
+ * points at the earlier copy, whatever codec this one asked for. */
+static bool sp_pack_commit_entry(FILE * fp, const sp_pack_content_entry * e, const sp_pack_encoded_entry * encoded, sp_pack_blobs * blobs, sp_pack_index_entry * entry, uint64_t * content_len) {
+  sp_pack_blob * blob = sp_pack_blobs_find(blobs, encoded->content_hash, encoded->data_len);
+  if(blob->len == 0) {
+    long offset = ftell(fp);
+    assert(offset > 0);
+
+    uint64_t entry_start = *content_len;
+    /* write the content entry... */
+    if(!sp_write_encoded_entry(e->path, e->name, encoded, fp, content_len)) { return false; }
+    sp_pack_blob_set(blob, encoded->content_hash, encoded->data_len, (uint64_t)offset, *content_len - entry_start);
+  }
+
+  /* ... and setup the index entry */
+  entry->name = strndup(e->name, SP_MAX_STRING_LEN);
+  if(!entry->name) { abort(); }
+  entry->offset = blob->offset;
+  entry->len = blob->len;
+
+  return true;
+}
+
+/* Samples the small entries that may be encoded with a dictionary and trains
+ * one on them; false when there are too few to be worth it. */
+static bool sp_pack_train_dictionary(const sp_pack_content_entry * content, size_t content_len, size_t dictionary_size, unsigned char ** out_dictionary, size_t * out_len) {
+  *out_dictionary = NULL;
+  *out_len = 0;
+
+  if(dictionary_size > SP_DICT_MAX_LEN) { dictionary_size = SP_DICT_MAX_LEN; }
+  size_t sample_budget = dictionary_size * SP_PACK_DICTIONARY_SAMPLE_FACTOR;
+
+  unsigned char ** samples = calloc(content_len, sizeof * samples);
+  size_t * sample_lens = calloc(content_len, sizeof * sample_lens);
+  if(!samples || !sample_lens) { abort(); }
+
+  size_t sample_count = 0, sampled = 0;
+  for(size_t i = 0; i < content_len && sampled < sample_budget; i++) {
+    if(content[i].codec != spc_auto && content[i].codec != spc_zlib_dict) { continue; }
+
+    struct stat st = { 0 };
+    if(stat(content[i].path, &st) != 0 || st.st_size <= 0 || (uint64_t)st.st_size > SP_PACK_DICTIONARY_ENTRY_MAX) { continue; }
+    if(!sp_pack_read_source(content[i].path, samples + sample_count, sample_lens + sample_count)) { continue; }
+
+    sampled += sample_lens[sample_count];
+    sample_count++;
+  }
+
+  bool ret = false;
+  if(sample_count >= SP_PACK_DICTIONARY_MIN_SAMPLES) {
+    unsigned char * dictionary = malloc(dictionary_size);
+    if(!dictionary) { abort(); }
+
+    size_t len = 0;
+    if(sp_dict_train((const unsigned char * const *)samples, sample_lens, sample_count, dictionary, dictionary_size, &len) == SP_SUCCESS) {
+      *out_dictionary = dictionary;
+      *out_len = len;
+      ret = true;
+    } else {
+      free(dictionary), dictionary = NULL;
+    }
+  }
+
+  for(size_t i = 0; i < sample_count; i++) {
+    free(samples[i]), samples[i] = NULL;
+  }
+  free(sample_lens), sample_lens = NULL;
+  free(samples), samples = NULL;
+
+  return ret;
+}
+
+static size_t sp_pack_default_jobs(void) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return cpus > 0 ? (size_t)cpus : 1;
+}
+
+static bool sp_pack_write_entries(FILE * fp, const sp_pack_content_entry * content, size_t content_len, size_t jobs, sp_pack_integrity integrity, const unsigned char * dictionary, size_t dictionary_len, sp_pack_index_entry * entries, uint64_t * written_len) {
+  jobs = sp_pack_resolve_jobs(jobs, content_len);
+
+  sp_pack_encoded_entry * encoded = calloc(content_len, sizeof * encoded);
+  if(!encoded) { abort(); }
+
+  sp_pack_blobs blobs = { 0 };
+  sp_pack_blobs_init(&blobs, content_len);
+
+  bool ret = true;
+  if(jobs <= 1) {
+    /* serial path; same encode and write steps, on the calling thread */
+    sp_z * z = sp_z_create();
+    sp_z_set_dictionary(z, dictionary, dictionary_len);
+    for(size_t i = 0; i < content_len && ret; i++) {
+      ret = sp_pack_encode_entry(z, content[i].path, content[i].codec, integrity, encoded + i)
+        && sp_pack_commit_entry(fp, content + i, encoded + i, &blobs, entries + i, written_len);
+      sp_pack_encoded_entry_free(encoded + i);
+    }
+
+    sp_z_free(z), z = NULL;
+    sp_pack_blobs_free(&blobs);
+    free(encoded), encoded = NULL;
+    return ret;
+  }
+
+  sp_pack_build_pool pool = {
+    .content = content,
+    .encoded = encoded,
+    .dictionary = dictionary,
+    .dictionary_len = dictionary_len,
+    .content_len = content_len,
+    .next = 0,
+    .written = 0,
+    .window = jobs * 4,
+    .integrity = integrity
+  };
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.done, NULL);
+  pthread_cond_init(&pool.room, NULL);
+
+  pthread_t * workers = calloc(jobs, sizeof * workers);
+  if(!workers) { abort(); }
+
+  size_t started = 0;
+  for(; started < jobs; started++) {
+    if(pthread_create(workers + started, NULL, sp_pack_build_worker, &pool) != 0) { break; }
+  }
+  /* no workers at all; we can't make progress */
+  if(started == 0) { abort(); }
+
+  for(size_t i = 0; i < content_len; i++) {
+    pthread_mutex_lock(&pool.lock);
+    while(!encoded[i].is_done) { pthread_cond_wait(&pool.done, &pool.lock); }
+    pthread_mutex_unlock(&pool.lock);
+
+    /* keep draining after a failure so the workers can finish */
+    if(ret) {
+      ret = encoded[i].is_valid
+        && sp_pack_commit_entry(fp, content + i, encoded + i, &blobs, entries + i, written_len);
+    }
+    sp_pack_encoded_entry_free(encoded + i);
+
+    pthread_mutex_lock(&pool.lock);
+    pool.written = i + 1;
+    pthread_cond_broadcast(&pool.room);
+    pthread_mutex_unlock(&pool.lock);
+  }
+
+  for(size_t i = 0; i < started; i++) {
+    pthread_join(workers[i], NULL);
+  }
+
+  pthread_cond_destroy(&pool.room);
+  pthread_cond_destroy(&pool.done);
+  pthread_mutex_destroy(&pool.lock);
+
+  sp_pack_blobs_free(&blobs);
+  free(workers), workers = NULL;
+  free(encoded), encoded = NULL;
+
+  return ret;
+}
+
+/* 64-bit FNV-1a over the key bytes. This is part of the on-disk format (the
+ * index is sorted by it), so it must not change within a revision. */
+static uint64_t sp_pack_key_hash(const char * key, size_t key_len) {
+  uint64_t hash = 0xcbf29ce484222325u;
+  for(size_t i = 0; i < key_len; i++) {
+    hash ^= (unsigned char)key[i];
+    hash *= 0x100000001b3u;
+  }
+  return hash;
+}
+
+static bool sp_pack_index_entry_is_duplicate(const sp_pack_index_entry * entries, size_t i) {
+  return i > 0 && entries[i].hash == entries[i - 1].hash && strcmp(entries[i].name, entries[i - 1].name) == 0;
+}
+
+static uint32_t sp_pack_perfect_hash_slot(uint64_t key_hash, uint32_t seed, uint32_t slots) {
+  /* splitmix64 finalizer over the key hash, displaced by the bucket's seed */
+  uint64_t x = key_hash ^ ((uint64_t)seed * 0x9e3779b97f4a7c15u);
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9u;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebu;
+  x ^= x >> 31;
+  return (uint32_t)(x % slots);
+}
+
+static int sp_pack_perfect_hash_key_compare(const void * a, const void * b) {
+  const sp_pack_perfect_hash_key * left = a;
+  const sp_pack_perfect_hash_key * right = b;
+
+  /* largest buckets are placed first, while the table is still mostly empty */
+  if(left->bucket_len != right->bucket_len) { return left->bucket_len > right->bucket_len ? -1 : 1; }
+  return left->bucket < right->bucket ? -1 : (left->bucket > right->bucket ? 1 : 0);
+}
+
+/* Hash and displace: keys are grouped into buckets by key hash; each bucket
+ * gets the first seed that moves all of its keys into free slots, and
+ * single-key buckets take the remaining slots directly. The index records
+ * are left untouched, so a pak without this section still binary searches. */
+static bool sp_write_perfect_hash(const sp_pack_index_entry * entries, size_t entries_len, uint64_t index_entries, FILE * fp, uint64_t * perfect_hash_len) {
+  assert(entries && fp && perfect_hash_len);
+
+  *perfect_hash_len = 0;
+  if(index_entries == 0 || index_entries > SP_PERFECT_HASH_MAX_SLOTS) { return true; }
+
+  uint32_t slots = (uint32_t)index_entries;
+  uint32_t buckets = slots;
+
+  sp_pack_perfect_hash_key * keys = calloc(slots, sizeof * keys);
+  uint32_t * bucket_lens = calloc(buckets, sizeof * bucket_lens);
+  uint32_t * displacements = calloc(buckets, sizeof * displacements);
+  uint32_t * records = calloc(slots, sizeof * records);
+  bool * is_used = calloc(slots, sizeof * is_used);
+  uint32_t * candidates = calloc(slots, sizeof * candidates);
+  if(!keys || !bucket_lens || !displacements || !records || !is_used || !candidates) { abort(); }
+
+  uint32_t record = 0;
+  for(size_t i = 0; i < entries_len; i++) {
+    if(sp_pack_index_entry_is_duplicate(entries, i)) { continue; }
+
+    assert(record < slots);
+    keys[record].hash = entries[i].hash;
+    keys[record].record = record;
+    keys[record].bucket = (uint32_t)(entries[i].hash % buckets);
+    bucket_lens[keys[record].bucket]++;
+    record++;
+  }
+  assert(record == slots);
+
+  for(uint32_t i = 0; i < slots; i++) {
+    keys[i].bucket_len = bucket_lens[keys[i].bucket];
+  }
+  qsort(keys, slots, sizeof * keys, &sp_pack_perfect_hash_key_compare);
+
+  bool is_placed = true;
+  uint32_t i = 0;
+  for(; i < slots && keys[i].bucket_len > 1; i += keys[i].bucket_len) {
+    uint32_t len = keys[i].bucket_len;
+
+    uint32_t seed = 1;
+    for(; seed < SP_PERFECT_HASH_MAX_SEED; seed++) {
+      uint32_t j = 0;
+      for(; j < len; j++) {
+        uint32_t slot = sp_pack_perfect_hash_slot(keys[i + j].hash, seed, slots);
+        if(is_used[slot]) { break; }
+
+        uint32_t k = 0;
+        while(k < j && candidates[k] != slot) { k++; }
+        if(k < j) { break; }
+
+        candidates[j] = slot;
+      }
+      if(j == len) { break; }
+    }
+
+    /* only two keys with the same 64-bit hash can't be placed; leave the
+     * section out and let readers fall back to the sorted index */
+    if(seed == SP_PERFECT_HASH_MAX_SEED) {
+      is_placed = false;
+      break;
+    }
+
+    for(uint32_t j = 0; j < len; j++) {
+      is_used[candidates[j]] = true;
+      records[candidates[j]] = keys[i + j].record;
+    }
+    displacements[keys[i].bucket] = seed;
+  }
+
+  bool ret = true;
+  if(is_placed) {
+    uint32_t slot = 0;
+    for(; i < slots; i++) {
+      while(is_used[slot]) { slot++; }
+      is_used[slot] = true;
+      records[slot] = keys[i].record;
+      displacements[keys[i].bucket] = SP_PERFECT_HASH_DIRECT | slot;
+    }
+
+    sp_pack_writer writer = { 0 };
+    sp_pack_writer_put_uint32(&writer, slots);
+    sp_pack_writer_put_uint32(&writer, buckets);
+    for(uint32_t b = 0; b < buckets; b++) {
+      sp_pack_writer_put_uint32(&writer, displacements[b]);
+    }
+    for(uint32_t s = 0; s < slots; s++) {
+      sp_pack_writer_put_uint32(&writer, records[s]);
+    }
+    ret = sp_pack_writer_flush(&writer, fp, perfect_hash_len);
+    sp_pack_writer_free(&writer);
+  }
+
+  free(candidates), candidates = NULL;
+  free(is_used), is_used = NULL;
+  free(records), records = NULL;
+  free(displacements), displacements = NULL;
+  free(bucket_lens), bucket_lens = NULL;
+  free(keys), keys = NULL;
+
+  return ret;
+}
+
+static int sp_pack_index_entry_compare(const void * a, const void * b) {
+  const sp_pack_index_entry * left = a;
+  const sp_pack_index_entry * right = b;
+
+  if(left->hash != right->hash) { return left->hash < right->hash ? -1 : 1; }
+
+  int cmp = strcmp(left->name, right->name);
+  if(cmp != 0) { return cmp; }
+
+  /* equal keys stay in content order so the first one wins */
+  return left->order < right->order ? -1 : (left->order > right->order ? 1 : 0);
+}
+
+static bool sp_write_index(sp_pack_index_entry * entries, size_t entries_len, FILE * fp, uint64_t * index_entries, uint64_t * index_len) {
+  assert(entries && fp && index_entries && index_len);
+
+  for(size_t i = 0; i < entries_len; i++) {
+    entries[i].hash = sp_pack_key_hash(entries[i].name, strlen(entries[i].name));
+    entries[i].order = i;
+  }
+  qsort(entries, entries_len, sizeof * entries, &sp_pack_index_entry_compare);
+
+  /* Records: key hash, entry offset and length (uint64_t), then the key's
+   * offset in the string pool and its length (uint32_t). Later duplicates of
+   * a key are left out of the index. */
+  sp_pack_writer records = { 0 };
+  sp_pack_writer pool = { 0 };
+
+  bool ret = true;
+  *index_entries = 0;
+  for(size_t i = 0; i < entries_len; i++) {
+    const sp_pack_index_entry * e = entries + i;
+    if(sp_pack_index_entry_is_duplicate(entries, i)) { continue; }
+
+    size_t name_len = strlen(e->name);
+    if(pool.len > UINT32_MAX || name_len > UINT32_MAX) {
+      ret = false;
+      break;
+    }
+
+    sp_pack_writer_put_uint64(&records, e->hash);
+    sp_pack_writer_put_uint64(&records, e->offset);
+    sp_pack_writer_put_uint64(&records, e->len);
+    sp_pack_writer_put_uint32(&records, (uint32_t)pool.len);
+    sp_pack_writer_put_uint32(&records, (uint32_t)name_len);
+
+    /* String pool: each key, NULL terminated */
+    sp_pack_writer_put_raw(&pool, e->name, name_len + 1);
+
+    (*index_entries)++;
+  }
+
+  ret = ret
+    && sp_pack_writer_flush(&records, fp, index_len)
+    && sp_pack_writer_flush(&pool, fp, index_len);
+
+  sp_pack_writer_free(&pool);
+  sp_pack_writer_free(&records);
+
+  return ret;
+}
+
+/* Compare key against index record i, bounds checking the record's key and
+ * content range; records are validated as they're used rather than at open. */
+static bool sp_pack_reader_match(const sp_pack_reader * reader, uint64_t i, const char * key, size_t key_len, uint64_t * offset, uint64_t * len) {
+  const unsigned char * record = reader->index + i * SP_INDEX_RECORD_LEN;
+  const unsigned char * pool = reader->index + reader->index_entries * SP_INDEX_RECORD_LEN;
+  uint64_t pool_len = reader->index_len - reader->index_entries * SP_INDEX_RECORD_LEN;
+
+  uint64_t name_offset = sp_pack_load_uint32(record + 24);
+  uint64_t name_len = sp_pack_load_uint32(record + 28);
+  if(name_offset + name_len >= pool_len) { return false; }
+  if(name_len != key_len || memcmp(pool + name_offset, key, key_len) != 0) { return false; }
+
+  *offset = sp_pack_load_uint64(record + 8);
+  *len = sp_pack_load_uint64(record + 16);
+  if(!sp_pack_range_is_content(reader->content_offset, reader->content_len, reader->segments, reader->segment_count, *offset, *len)) { return false; }
+
+  return true;
+}
+
+/* Resolve key to its index record: one probe through the perfect hash when
+ * the pak has one, otherwise a binary search of the sorted records. */
+static bool sp_pack_reader_lookup(const sp_pack_reader * reader, const char * key, size_t key_len, uint64_t * out_record, uint64_t * offset, uint64_t * len) {
+  if(!reader->index || reader->index_entries == 0) { return false; }
+
+  const unsigned char * records = reader->index;
+  uint64_t hash = sp_pack_key_hash(key, key_len);
+
+  if(reader->perfect_hash) {
+    const unsigned char * ph = reader->perfect_hash;
+    uint32_t slots = sp_pack_load_uint32(ph);
+    uint32_t buckets = sp_pack_load_uint32(ph + 4);
+
+    uint32_t displacement = sp_pack_load_uint32(ph + 8 + (uint64_t)(hash % buckets) * 4);
+    uint32_t slot = (displacement & SP_PERFECT_HASH_DIRECT)
+      ? displacement & ~SP_PERFECT_HASH_DIRECT
+      : sp_pack_perfect_hash_slot(hash, displacement, slots);
+    if(slot >= slots) { return false; }
+
+    uint64_t i = sp_pack_load_uint32(ph + 8 + (uint64_t)buckets * 4 + (uint64_t)slot * 4);
+    if(i >= reader->index_entries) { return false; }
+    if(sp_pack_load_uint64(records + i * SP_INDEX_RECORD_LEN) != hash) { return false; }
+    if(!sp_pack_reader_match(reader, i, key, key_len, offset, len)) { return false; }
+
+    *out_record = i;
+    return true;
+  }
+
+  uint64_t lo = 0, hi = reader->index_entries;
+  while(lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if(sp_pack_load_uint64(records + mid * SP_INDEX_RECORD_LEN) < hash) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  for(uint64_t i = lo; i < reader->index_entries; i++) {
+    if(sp_pack_load_uint64(records + i * SP_INDEX_RECORD_LEN) != hash) { break; }
+    if(!sp_pack_reader_match(reader, i, key, key_len, offset, len)) { continue; }
+
+    *out_record = i;
+    return true;
+  }
+
+  return false;
+}
+
+static bool sp_write_char(char value, FILE * fp, uint64_t * content_len) {
+  if(content_len != NULL) { *content_len += sizeof value; }
+  return sp_write_raw(&value, sizeof value, fp);
+}
+
+static bool sp_write_uint8(uint8_t value, FILE * fp, uint64_t * content_len) {
+  if(content_len != NULL) { *content_len += sizeof value; }
+  return sp_write_raw(&value, sizeof value, fp);
+}
+
+static bool sp_write_int8(int8_t value, FILE * fp, uint64_t * content_len) {
+  if(content_len != NULL) { *content_len += sizeof value; }
+  return sp_write_raw(&value, sizeof value, fp);
+}
+
+static bool sp_write_uint16(uint16_t value, FILE * fp, uint64_t * content_len) {
+  if(content_len != NULL) { *content_len += sizeof value; }
+  uint8_t bytes[sizeof value] = { 0 };
+
+  /* little endian */
+  bytes[0] = (uint8_t)(value & 0x00ff);
+  bytes[1] = (uint8_t)(value >> 8);
+
+  return sp_write_raw(bytes, sizeof value, fp);
+}
+
+static bool sp_write_int16(int16_t value, FILE * fp, uint64_t * content_len) {
+  if(content_len != NULL) { *content_len += sizeof value; }
+
+  int8_t bytes[sizeof value] = { 0 };
+
+  /* little endian */
+  bytes[0] = (int8_t)(value & 0x00ff);
+  bytes[1] = (int8_t)(value >> 8);
+
+  return sp_write_raw(bytes, sizeof value, fp);
+}
+
+bool sp_write_uint32(uint32_t value, FILE * fp, uint64_t * content_len) {
+  if(content_len != NULL) { *content_len += sizeof value; }
+  uint16_t lo = value & 0xffff;
+  uint16_t hi = (uint16_t)((value >> 16) & 0xffff);
+
+  /* little endian */
+  return sp_write_raw(&lo, sizeof lo, fp)
+    && sp_write_raw(&hi, sizeof hi, fp);
+}
+
+static bool sp_write_int32(int32_t value, FILE * fp, uint64_t * content_len) {
+  if(content_len != NULL) { *content_len += sizeof value; }
+  int16_t lo = (int16_t)(value & 0xffff);
+  int16_t hi = (int16_t)((value >> 16) & 0xffff);
+
+  /* little endian */
+  return sp_write_raw(&lo, sizeof lo, fp)
+    && sp_write_raw(&hi, sizeof hi, fp);
+}
+
+static bool sp_write_uint64(uint64_t value, FILE * fp, uint64_t * content_len) {
+  if(content_len != NULL) { *content_len += sizeof value; }
+  uint32_t lo = value & 0xffffffff;
+  uint32_t hi =(uint32_t)((value >> 32) & 0xffffffff);
+
+  /* little endian */
+  return sp_write_raw(&lo, sizeof lo, fp)
+    && sp_write_raw(&hi, sizeof hi, fp);
+}
+
+static bool sp_write_int64(int64_t value, FILE * fp, uint64_t * content_len) {
+  if(content_len != NULL) { *content_len += sizeof value; }
+  int32_t lo = (int32_t)(value & 0xffffffff);
+  int32_t hi = (int32_t)((value >> 32) & 0xffffffff);
+
+  /* little endian */
+  return sp_write_raw(&lo, sizeof lo, fp)
+    && sp_write_raw(&hi, sizeof hi, fp);
+}
+
+static bool sp_write_bool(bool value, FILE * fp, uint64_t * content_len) {
+  static const uint32_t sp_true = 0x11111111;
+  static const uint32_t sp_false = 0x00000000;
+
+  return sp_write_uint32(value ? sp_true : sp_false, fp, content_len);
+}
+
+static bool sp_read_bool(FILE * fp, bool * value) {
+  static const uint32_t sp_true = 0x11111111;
+
+  uint32_t b;
+  bool res = sp_read_uint32(fp, &b);
+  assert(res);
+
+  *value = b == sp_true;
+
+  return res;
+}
+
+static bool sp_write_string(const char * value, FILE * fp, uint64_t * content_len) {
+  static const char * empty = "";
+  static const char nullstr = '\0';
+
+  /* String Format:
+   * - Len (size_t)
+   * - String (null-terminated)
+   */
+  int expected = 0;
+  size_t res = 0, len = 0;
+  if(value) {
+    len = strnlen(value, MAX_PACK_STRING_LEN);
+    res += fwrite(&len, sizeof(char), sizeof len, fp);
+    if(ferror(fp) != 0) return false;
+
+    expected += (int)((sizeof len) * 1);
+    if(len > 0) {
+      res += fwrite(value, sizeof(char), len, fp);
+      if(ferror(fp) != 0) return false;
+
+      expected += (int)(sizeof(char) * len);
+    } else {
+      res += fwrite(empty, sizeof(char), len, fp);
+      if(ferror(fp) != 0) return false;
+
+      expected += (int)(sizeof(char) * len);
+    }
+  } else {
+    res += fwrite(&len, sizeof(char), len, fp);
+    if(ferror(fp) != 0) return false;
+
+    expected += (int)((sizeof(char) * len));
+  }
+  res += fwrite(&nullstr, sizeof(char), sizeof nullstr, fp);
+  if(ferror(fp) != 0) return false;
+
+  expected += (int)((sizeof nullstr) * 1);
+  assert(res == (size_t)expected);
+
+  if(content_len != NULL) { *content_len += (uint64_t)expected; }
+
+  return res == (size_t)expected && ferror(fp) == 0;
+}
+
+static bool sp_write_fixed_width_string(const char * value, size_t fixed_width, FILE * fp, uint64_t * content_len) {
+  static char nullstr = '\0';
+
+  assert(fixed_width > 0 && fixed_width <= MAX_PACK_STRING_LEN);
+  assert(value);
+
+  char * buf = malloc(fixed_width * sizeof(char));
+  if(!buf) goto err0;
+
+  memset(buf, 0, fixed_width * sizeof(char));
+  size_t len = strnlen(value, MAX_PACK_STRING_LEN);
+  size_t min = (fixed_width < len ? fixed_width : len);
+  memcpy(buf, value, min * sizeof(char));
+
+  size_t rmin = 0, rbuf = 0, rnull = 0;
+
+  rmin = fwrite(&min, sizeof(char), sizeof min, fp);
+  if(rmin != (sizeof min) * 1) goto err1;
+
+  rbuf = fwrite(buf, sizeof(char), min, fp);
+  if((size_t)rbuf != sizeof(char) * min) goto err1;
+
+  rnull =  fwrite(&nullstr, sizeof nullstr, 1, fp);
+  if(rnull != 1) goto err1;
+
+  free(buf), buf = NULL;
+
+  if(content_len != NULL) { *content_len += rmin + rbuf + rnull; }
+
+  assert((size_t)(rmin + rbuf + rnull) == (sizeof min) + (sizeof(char)) * min + (1));
+
+  return true;
+
+err1:
+  free(buf), buf = NULL;
+
+err0:
+  return false;
+}
+
+static bool sp_write_float(float value, FILE * fp, uint64_t * content_len) {
+#define BUF_MAX 256
+  char buf[BUF_MAX] = { 0 };
+  int len = snprintf((char *)buf, BUF_MAX - 1, "%.9g", value);
+  assert(len > 0 && len < BUF_MAX);
+#undef BUF_MAX
+  buf[len] = '\0';
+
+  return sp_write_string(buf, fp, content_len);
+}
+
+static bool sp_read_char(FILE * fp, char * value) {
+  if(feof(fp) != 0) return false;
+
+  char c;
+  size_t hir = fread(&c, sizeof c, 1, fp);
+  assert(hir == sizeof *value);
+
+  *value = c;
+
+  return hir == sizeof *value && ferror(fp) == 0;
+}
+
+static bool sp_read_uint8(FILE * fp, uint8_t * value) {
+  (void)sp_read_char;
+
+  if(feof(fp) != 0) return false;
+
+  uint8_t byte;
+  size_t hir = fread(&byte, sizeof byte, 1, fp);
+  assert(hir == sizeof *value);
+
+  *value = byte;
+
+  return hir == sizeof *value && ferror(fp) == 0;
+}
+
+static bool sp_read_int8(FILE * fp, int8_t * value) {
+  int8_t byte;
+
+  bool res = sp_read_uint8(fp, (uint8_t *)&byte);
+  assert(res);
+
+  *value = byte;
+
+  return res;
+}
+
+static bool sp_read_uint16(FILE * fp, uint16_t * value) {
+  if(feof(fp) != 0) return false;
+
+  uint8_t bytes[sizeof(uint16_t)] = { 0 } ;
+  size_t hir = fread(&bytes, sizeof bytes, 1, fp);
+  assert(hir);
+
+  /* little endian */
+  *value = (uint16_t)(((uint16_t)(bytes[0] << 0)) | (uint16_t)(bytes[1] << 8));
+
+  return ferror(fp) == 0;
+}
+
+static bool sp_read_int16(FILE * fp, int16_t * value) {
+  if(feof(fp) != 0) return false;
+
+  int8_t bytes[sizeof(int16_t)] = { 0 } ;
+  size_t hir = fread(&bytes, sizeof bytes, 1, fp);
+  assert(hir);
+
+  /* little endian */
+  *value = (int16_t)(((int16_t)bytes[0] << 0) | ((int16_t)bytes[1] << 8));
+
+  return ferror(fp) == 0;
+}
+
+bool sp_read_uint32(FILE * fp, uint32_t * value) {
+  if(feof(fp) != 0) return false;
+
+  uint8_t bytes[sizeof(uint32_t)] = { 0 } ;
+  size_t hir = fread(&bytes, sizeof bytes, 1, fp);
+  assert(hir);
+
+  /* little endian */
+  *value = (uint32_t)((uint32_t)(bytes[0] << 0)) | ((uint32_t)(bytes[1] << 8)) | (uint32_t)(bytes[2] << 16) | (uint32_t)(bytes[3] << 24);
+
+  return ferror(fp) == 0;
+}
+
+static bool sp_read_int32(FILE * fp, int32_t * value) {
+  if(feof(fp) != 0) return false;
+
+  int8_t bytes[sizeof(int32_t)] = { 0 } ;
+  size_t hir = fread(&bytes, sizeof bytes, 1, fp);
+  assert(hir);
+
+  /* little endian */
+  *value = (bytes[0] << 0) | (bytes[1] << 8) | bytes[2] << 16 | bytes[3] << 24;
+
+  return ferror(fp) == 0;
+}
+
+static bool sp_read_uint64(FILE * fp, uint64_t * value) {
+  if(feof(fp) != 0) return false;
+
+  uint8_t bytes[sizeof(uint64_t)] = { 0 } ;
+  size_t hir = fread(&bytes, sizeof(uint8_t), sizeof * value, fp);
+  assert(hir == sizeof(uint8_t) * sizeof * value);
+
+  /* little endian */
+  *value = ((uint64_t)bytes[0] <<  0) | ((uint64_t)bytes[1] <<  8) | ((uint64_t)bytes[2] << 16) | ((uint64_t)bytes[3] << 24)
+    | ((uint64_t)bytes[4] << 32) | ((uint64_t)bytes[5] << 40) | ((uint64_t)bytes[6] << 48) | ((uint64_t)bytes[7] << 56);
+
+  return ferror(fp) == 0;
+}
+
+static bool sp_read_int64(FILE * fp, int64_t * value) {
+  if(feof(fp) != 0) return false;
+
+  uint8_t bytes[sizeof *value] = { 0 } ;
+  size_t hir = fread(&bytes, sizeof(uint8_t), sizeof *value,  fp);
+  assert(hir == sizeof(uint8_t) * sizeof *value);
+
+  /* little endian */
+  *value = ((int64_t)bytes[0] <<  0) | ((int64_t)bytes[1] <<  8) | ((int64_t)bytes[2] << 16) | ((int64_t)bytes[3] << 24)
+    | ((int64_t)bytes[4] << 32) | ((int64_t)bytes[5] << 40) | ((int64_t)bytes[6] << 48) | ((int64_t)bytes[7] << 56);
+
+  return ferror(fp) == 0;
+}
+
+static void sp_write_header(sp_pack_writer * writer, const sp_pack_file * spf, const sp_pack_chunks * chunks, const sp_pack_section * perfect_hash, const sp_pack_segments * segments, const sp_pack_section * dictionary) {
+  size_t start = writer->len;
+
+  sp_pack_writer_put_raw(writer, spf->header, sizeof spf->header);
+  sp_pack_writer_put_uint16(writer, spf->version.major);
+  sp_pack_writer_put_uint16(writer, spf->version.minor);
+  sp_pack_writer_put_uint16(writer, spf->version.revision);
+  sp_pack_writer_put_uint16(writer, spf->version.subrevision);
+  sp_pack_writer_put_uint64(writer, spf->content_offset);
+  sp_pack_writer_put_uint64(writer, spf->content_len);
+  sp_pack_writer_put_uint64(writer, spf->index_entries);
+  sp_pack_writer_put_uint64(writer, spf->index_offset);
+  sp_pack_writer_put_uint64(writer, spf->index_len);
+  sp_pack_writer_put_hash(writer, spf->hash);
+
+  sp_pack_writer_put_zeros(writer, SP_CHUNK_HEADER_OFFSET - (writer->len - start));
+  sp_pack_writer_put_uint64(writer, chunks->chunk_size);
+  sp_pack_writer_put_uint64(writer, chunks->chunk_count);
+  sp_pack_writer_put_uint64(writer, chunks->table_offset);
+
+  assert(writer->len - start == SP_PERFECT_HASH_HEADER_OFFSET);
+  sp_pack_writer_put_uint64(writer, perfect_hash->offset);
+  sp_pack_writer_put_uint64(writer, perfect_hash->len);
+
+  assert(writer->len - start == SP_SEGMENT_HEADER_OFFSET);
+  sp_pack_writer_put_uint64(writer, segments->segment_count);
+  sp_pack_writer_put_uint64(writer, segments->table_offset);
+
+  assert(writer->len - start == SP_DICTIONARY_HEADER_OFFSET);
+  sp_pack_writer_put_uint64(writer, dictionary->offset);
+  sp_pack_writer_put_uint64(writer, dictionary->len);
+
+  assert(writer->len - start == SP_INTEGRITY_HEADER_OFFSET);
+  sp_pack_writer_put_uint64(writer, (uint64_t)spf->integrity);
+
+  /* empty space through the start of the content */
+  sp_pack_writer_put_zeros(writer, SP_CONTENT_OFFSET - (writer->len - start));
+}
+
+static bool sp_read_footer(FILE * fp) {
+  unsigned char footer[SP_FOOTER_LEN] = { 0 };
+
+  size_t r = fread(&footer, sizeof(unsigned char), SP_FOOTER_LEN, fp);
+  if(r != sizeof footer) { return false; }
+
+  bool eq = strncmp((const char *)footer, (const char *)SP_FOOTER, sizeof SP_FOOTER) == 0;
+
+  return eq;
+}
+
+bool sp_pack_create(FILE * fp, const sp_pack_content_entry * content, size_t content_len) {
+  return sp_pack_create_ex(fp, content, content_len, NULL);
+}
+
+static void sp_pack_file_init(sp_pack_file * spf) {
+  const unsigned char * P = SP_PUMPKIN;
+  *spf = (sp_pack_file) {
+    .header = { P[0], P[1], P[2], P[3], 'S', 'P', 'O', 'O', 'K', 'Y', '!', P[0], P[1], P[2], P[3], '\n' },
+    .version = {
+      .major = SP_PACK_MAJOR_VERSION,
+      .minor = SP_PACK_MINOR_VERSION,
+      .revision = SP_PACK_REVISION_VERSION,
+      .subrevision = SP_PACK_SUBREVISION_VERSION
+    },
+    .content_offset = 0, /* offset that content begins */
+    .content_len = 0, /* content length calculated after content added */
+    .index_entries = 0,
+    .index_offset = 0,
+    .index_len = 0,
+    .hash = { 0 }, /* hash calculated after content added */
+    .integrity = spi_blake2b
+  };
+}
+
+bool sp_pack_create_ex(FILE * fp, const sp_pack_content_entry * content, size_t content_len, const sp_pack_create_options * options) {
+  assert(content_len > 0 && content != NULL);
+
+  static const sp_pack_create_options default_options = { .jobs = 0, .chunk_size = 0, .dictionary_size = 0 };
+  if(!options) { options = &default_options; }
+
+  SP_SET_BINARY_MODE(fp);
+  if(options->integrity > spi_none) { return false; }
+
+  sp_pack_file spf;
+  sp_pack_file_init(&spf);
+  spf.integrity = options->integrity;
+
+  assert(SP_ITEM_MAGIC == 0x00706b6e616e6d65);
+
+  /* The header is written last, in one block, once every field is known */
+  spf.content_offset = SP_CONTENT_OFFSET;
+  fseek(fp, SP_CONTENT_OFFSET, SEEK_SET);
+
+  /* Content */
+  /* Write the magic number */
+  sp_write_uint64(SP_ITEM_MAGIC, fp, &spf.content_len);
+
+  /* Preset dictionary, trained on the small entries, ahead of them all */
+  sp_pack_section dictionary = { 0 };
+  unsigned char * dictionary_data = NULL;
+  size_t dictionary_len = 0;
+  if(options->dictionary_size > 0 && sp_pack_train_dictionary(content, content_len, options->dictionary_size, &dictionary_data, &dictionary_len)) {
+    dictionary.offset = SP_DICTIONARY_OFFSET;
+    dictionary.len = dictionary_len;
+    sp_write_raw(dictionary_data, dictionary_len, fp);
+    spf.content_len += dictionary_len;
+  }
+
+  /* Actual pak content */
+  sp_pack_index_entry * entries = calloc(content_len, sizeof * entries);
+  if(!entries) { abort(); }
+
+  bool ret = sp_pack_write_entries(fp, content, content_len, options->jobs, spf.integrity, dictionary_data, dictionary_len, entries, &spf.content_len)
+    && sp_pack_finish(fp, &spf, &dictionary, entries, content_len, options);
+
+  for(size_t i = 0; i < content_len; i++) {
+    free(entries[i].name), entries[i].name = NULL;
+  }
+  free(entries), entries = NULL;
+  free(dictionary_data), dictionary_data = NULL;
+
+  return ret;
+}
+
+/* Hash the content just written to a new pak and write everything after it. */
+static bool sp_pack_finish(FILE * fp, sp_pack_file * spf, const sp_pack_section * dictionary, sp_pack_index_entry * entries, size_t entries_len, const sp_pack_create_options * options) {
+  /* generate content hash; includes magic. Streamed back from the file so
+   * the content never has to fit in memory. */
+  if(fflush(fp) != 0) { return false; }
+
+  sp_pack_chunks chunks = { .chunk_size = spf->integrity == spi_none ? 0 : options->chunk_size, .chunk_count = 0, .table_offset = 0 };
+  unsigned char * chunk_hashes = NULL;
+  if(chunks.chunk_size == 0) {
+    if(!sp_pack_hash_range(fp, spf->integrity, SP_CONTENT_OFFSET, spf->content_len, spf->hash)) { return false; }
+  } else {
+    chunks.chunk_count = (spf->content_len + chunks.chunk_size - 1) / chunks.chunk_size;
+    chunk_hashes = calloc((size_t)chunks.chunk_count, crypto_generichash_BYTES);
+    if(!chunk_hashes) { abort(); }
+
+    if(!sp_pack_hash_chunks(fp, spf->integrity, SP_CONTENT_OFFSET, spf->content_len, chunks.chunk_size, options->jobs, chunk_hashes, false)) {
+      free(chunk_hashes), chunk_hashes = NULL;
+      return false;
+    }
+    /* the header holds the root: the hash of the chunk hash table */
+    sp_pack_digest(spf->integrity, chunk_hashes, (size_t)chunks.chunk_count * crypto_generichash_BYTES, spf->hash);
+  }
+
+  sp_pack_section perfect_hash = { 0 };
+  sp_pack_segments segments = { 0 };
+  bool is_written = sp_write_tail(fp, 0, spf, &chunks, chunk_hashes, &perfect_hash, &segments, NULL, dictionary, entries, entries_len);
+  free(chunk_hashes), chunk_hashes = NULL;
+  if(!is_written) { return false; }
+
+  fseek(fp, 0, SEEK_END);
+  long spdb_len = ftell(fp);
+  assert(spdb_len > 0 && spdb_len <= LONG_MAX);
+
+  size_t expected_len =
+    sizeof * spf  /* header */
+    + (((SP_CONTENT_OFFSET - sizeof * spf)) + spf->content_len + spf->index_len)  /* offset of content - header */
+    + perfect_hash.len /* perfect hash section */
+    + chunks.chunk_count * crypto_generichash_BYTES /* chunk hash table */
+    + ((sizeof(uint64_t) + sizeof SP_FOOTER)) /* (file length + footer marker) */
+    ;
+  assert((size_t)spdb_len == expected_len);
+  (void)expected_len;
+
+  return true;
+}
+
+/* Everything after the content: the index and perfect hash, the chunk and
+ * segment tables, then the trailer. The header at pak_offset goes in last, in
+ * one block, once every field is known. */
+static bool sp_write_tail(FILE * fp, long pak_offset, sp_pack_file * spf, sp_pack_chunks * chunks, unsigned char * chunk_hashes, sp_pack_section * perfect_hash, sp_pack_segments * segments, unsigned char * segment_table, const sp_pack_section * dictionary, sp_pack_index_entry * entries, size_t entries_len) {
+  assert(fp && spf && chunks && perfect_hash && segments && dictionary && entries);
+
+  /* Write index entries */
+  fseek(fp, 0, SEEK_END);
+  long index_offset = ftell(fp);
+  assert(index_offset > pak_offset);
+  spf->index_offset = (uint64_t)(index_offset - pak_offset);
+  spf->index_len = 0;
+  if(!sp_write_index(entries, entries_len, fp, &spf->index_entries, &spf->index_len)) { return false; }
+
+  /* Perfect hash over the index, immediately after it */
+  perfect_hash->offset = 0;
+  if(!sp_write_perfect_hash(entries, entries_len, spf->index_entries, fp, &perfect_hash->len)) { return false; }
+  if(perfect_hash->len > 0) { perfect_hash->offset = spf->index_offset + spf->index_len; }
+
+  /* Chunk hash table */
+  if(chunks->chunk_size > 0) {
+    assert(chunk_hashes && chunks->chunk_count > 0);
+    chunks->table_offset = spf->index_offset + spf->index_len + perfect_hash->len;
+    sp_write_raw(chunk_hashes, (size_t)chunks->chunk_count * crypto_generichash_BYTES, fp);
+  }
+
+  /* Appended segment table */
+  if(segments->segment_count > 0) {
+    sp_pack_segments none = { 0 };
+    assert(segment_table);
+    segments->table_offset = sp_pack_trailer_offset(spf, chunks, perfect_hash, &none);
+    sp_write_raw(segment_table, (size_t)segments->segment_count * SP_SEGMENT_RECORD_LEN, fp);
+  }
+
+  /* SPDB length and footer */
+  long file_len_offset = ftell(fp);
+  assert(file_len_offset > pak_offset);
+  assert((uint64_t)(file_len_offset - pak_offset) == sp_pack_trailer_offset(spf, chunks, perfect_hash, segments));
+
+  sp_pack_writer writer = { 0 };
+  sp_pack_writer_put_uint64(&writer, (uint64_t)(file_len_offset - pak_offset) + sizeof(uint64_t) + sizeof SP_FOOTER);
+  sp_pack_writer_put_raw(&writer, SP_FOOTER, sizeof SP_FOOTER);
+  bool is_written = sp_pack_writer_flush(&writer, fp, NULL);
+
+  /* Header */
+  fseek(fp, pak_offset, SEEK_SET);
+  sp_write_header(&writer, spf, chunks, perfect_hash, segments, dictionary);
+  is_written = is_written && sp_pack_writer_flush(&writer, fp, NULL);
+  sp_pack_writer_free(&writer);
+
+  return is_written && fflush(fp) == 0;
+}
+
+static int sp_pack_index_entry_offset_compare(const void * a, const void * b) {
+  const sp_pack_index_entry * left = a;
+  const sp_pack_index_entry * right = b;
+  return left->offset < right->offset ? -1 : (left->offset > right->offset ? 1 : 0);
+}
+
+bool sp_pack_append(FILE * fp, const sp_pack_content_entry * content, size_t content_len, const sp_pack_create_options * options) {
+  assert(content_len > 0 && content != NULL);
+
+  static const sp_pack_create_options default_options = { .jobs = 0, .chunk_size = 0, .dictionary_size = 0 };
+  if(!options) { options = &default_options; }
+
+  SP_SET_BINARY_MODE(fp);
+
+  sp_pack_file spf = { 0 };
+  sp_pack_chunks chunks = { 0 };
+  sp_pack_section perfect_hash = { 0 };
+  sp_pack_segments segments = { 0 };
+  sp_pack_section dictionary = { 0 };
+  long pak_offset = -1;
+  if(sp_pack_read_layout(fp, &pak_offset, &spf, &chunks, &perfect_hash, &segments, &dictionary) != SP_SUCCESS) { return false; }
+  if(spf.index_entries > SIZE_MAX / 2 - content_len) { return false; }
+
+  bool ret = false;
+
+  /* the chunk and segment tables are carried over to the new end of the pak;
+   * new entries are encoded with the pak's dictionary, if it has one */
+  unsigned char * chunk_hashes = NULL;
+  unsigned char * segment_table = NULL;
+  unsigned char * dictionary_data = NULL;
+  if(chunks.chunk_size > 0) {
+    chunk_hashes = sp_pack_read_chunk_table(fp, pak_offset, &spf, &chunks);
+    if(!chunk_hashes) { goto err0; }
+  }
+  if(sp_pack_read_segments(fp, pak_offset, &spf, &segments, &segment_table) != SP_SUCCESS) { goto err0; }
+  if(sp_pack_read_dictionary(fp, pak_offset, &dictionary, &dictionary_data) != SP_SUCCESS) { goto err0; }
+
+  /* new entries come first, so they win over existing entries with the same
+   * key when the merged index is written */
+  size_t entries_len = content_len + (size_t)spf.index_entries;
+  sp_pack_index_entry * entries = calloc(entries_len, sizeof * entries);
+  if(!entries) { abort(); }
+
+  if(sp_pack_read_index_entries(fp, pak_offset, &spf, entries + content_len) != SP_SUCCESS) { goto err1; }
+
+  /* New segment: the magic, then the new entries */
+  fseek(fp, 0, SEEK_END);
+  long segment_start = ftell(fp);
+  assert(segment_start > pak_offset);
+
+  uint64_t segment_len = 0;
+  sp_write_uint64(SP_ITEM_MAGIC, fp, &segment_len);
+  if(!sp_pack_write_entries(fp, content, content_len, options->jobs, spf.integrity, dictionary_data, (size_t)dictionary.len, entries, &segment_len)) { goto err1; }
+  if(fflush(fp) != 0) { goto err1; }
+
+  /* entry offsets are file positions; the index wants them relative to the pak */
+  for(size_t i = 0; i < content_len; i++) {
+    entries[i].offset -= (uint64_t)pak_offset;
+  }
+
+  segment_table = realloc(segment_table, (size_t)(segments.segment_count + 1) * SP_SEGMENT_RECORD_LEN);
+  if(!segment_table) { abort(); }
+
+  unsigned char * record = segment_table + segments.segment_count * SP_SEGMENT_RECORD_LEN;
+  sp_pack_store_uint64(record, (uint64_t)(segment_start - pak_offset));
+  sp_pack_store_uint64(record + 8, segment_len);
+  if(!sp_pack_hash_range(fp, spf.integrity, (uint64_t)segment_start, segment_len, record + 16)) { goto err1; }
+  segments.segment_count++;
+
+  ret = sp_write_tail(fp, pak_offset, &spf, &chunks, chunk_hashes, &perfect_hash, &segments, segment_table, &dictionary, entries, entries_len);
+
+err1:
+  for(size_t i = 0; i < entries_len; i++) {
+    free(entries[i].name), entries[i].name = NULL;
+  }
+  free(entries), entries = NULL;
+err0:
+  free(dictionary_data), dictionary_data = NULL;
+  free(segment_table), segment_table = NULL;
+  free(chunk_hashes), chunk_hashes = NULL;
+
+  return ret;
+}
+
+/* Content identity of a written entry. Only a BLAKE2b entry hash is good
+ * enough to go by; otherwise the payload is hashed, with its codec, and only
+ * identically encoded copies are merged. */
+static void sp_pack_entry_content_hash(sp_pack_integrity integrity, const sp_pack_entry_view * entry, unsigned char * out) {
+  if(integrity == spi_blake2b) {
+    memmove(out, entry->decompressed_hash, crypto_generichash_BYTES);
+    return;
+  }
+
+  unsigned char codec = (unsigned char)entry->codec;
+  crypto_generichash_state state;
+  crypto_generichash_init(&state, NULL, 0, crypto_generichash_BYTES);
+  crypto_generichash_update(&state, &codec, sizeof codec);
+  crypto_generichash_update(&state, entry->payload, entry->compressed_len);
+  crypto_generichash_final(&state, out, crypto_generichash_BYTES);
+}
+
+bool sp_pack_compact(FILE * src, FILE * dest, const sp_pack_create_options * options) {
+  assert(src && dest && src != dest);
+
+  SP_SET_BINARY_MODE(src);
+  SP_SET_BINARY_MODE(dest);
+
+  sp_pack_file src_spf = { 0 };
+  sp_pack_chunks src_chunks = { 0 };
+  sp_pack_section src_perfect_hash = { 0 };
+  sp_pack_segments src_segments = { 0 };
+  sp_pack_section dictionary = { 0 };
+  long pak_offset = -1;
+  if(sp_pack_read_layout(src, &pak_offset, &src_spf, &src_chunks, &src_perfect_hash, &src_segments, &dictionary) != SP_SUCCESS) { return false; }
+  if(src_spf.index_entries == 0 || src_spf.index_entries > SIZE_MAX / sizeof(sp_pack_index_entry)) { return false; }
+
+  /* by default the compacted pak is hashed the way the original was */
+  sp_pack_create_options compact_options = { .jobs = 0, .chunk_size = src_chunks.chunk_size };
+  if(options) { compact_options = *options; }
+
+  /* only verified content is carried over */
+  if(!sp_pack_check_content(src, pak_offset, &src_spf, &src_chunks, compact_options.jobs)) { return false; }
+
+  unsigned char * segment_table = NULL;
+  if(sp_pack_read_segments(src, pak_offset, &src_spf, &src_segments, &segment_table) != SP_SUCCESS) { return false; }
+
+  bool ret = false;
+  size_t entries_len = (size_t)src_spf.index_entries;
+  sp_pack_index_entry * entries = calloc(entries_len, sizeof * entries);
+  if(!entries) { abort(); }
+
+  unsigned char * dictionary_data = NULL;
+  if(sp_pack_read_dictionary(src, pak_offset, &dictionary, &dictionary_data) != SP_SUCCESS) { goto err0; }
+
+  if(sp_pack_read_index_entries(src, pak_offset, &src_spf, entries) != SP_SUCCESS) { goto err0; }
+
+  /* Live entries keep their content order, appended entries last */
+  qsort(entries, entries_len, sizeof * entries, &sp_pack_index_entry_offset_compare);
+
+  /* entries are copied with their hashes, so the integrity mode comes too */
+  sp_pack_file spf;
+  sp_pack_file_init(&spf);
+  spf.integrity = src_spf.integrity;
+  spf.content_offset = SP_CONTENT_OFFSET;
+  fseek(dest, SP_CONTENT_OFFSET, SEEK_SET);
+  sp_write_uint64(SP_ITEM_MAGIC, dest, &spf.content_len);
+
+  /* Entries are copied as they were encoded, so their dictionary comes too */
+  if(dictionary_data) {
+    sp_write_raw(dictionary_data, (size_t)dictionary.len, dest);
+    spf.content_len += dictionary.len;
+  }
+
+  /* aliases are copied once, and content appended again since is merged */
+  sp_pack_blobs blobs = { 0 };
+  sp_pack_blobs_init(&blobs, entries_len);
+
+  for(size_t i = 0; i < entries_len; i++) {
+    sp_pack_index_entry * e = entries + i;
+    if(e->len == 0 || e->len > SIZE_MAX || e->offset > LONG_MAX) { goto err1; }
+    if(!sp_pack_range_is_content(src_spf.content_offset, src_spf.content_len, segment_table, src_segments.segment_count, e->offset, e->len)) { goto err1; }
+
+    unsigned char * buf = malloc((size_t)e->len);
+    if(!buf) { abort(); }
+
+    sp_pack_entry_view entry = { 0 };
+    fseek(src, pak_offset + (long)e->offset, SEEK_SET);
+    if(!sp_read_raw(src, (size_t)e->len, buf) || !sp_pack_parse_entry(buf, (size_t)e->len, &entry)) {
+      free(buf), buf = NULL;
+      goto err1;
+    }
+
+    unsigned char content_hash[crypto_generichash_BYTES] = { 0 };
+    sp_pack_entry_content_hash(spf.integrity, &entry, content_hash);
+    sp_pack_blob * blob = sp_pack_blobs_find(&blobs, content_hash, entry.decompressed_len);
+    if(blob->len == 0) {
+      long offset = ftell(dest);
+      assert(offset > 0);
+      sp_write_raw(buf, (size_t)e->len, dest);
+      sp_pack_blob_set(blob, content_hash, entry.decompressed_len, (uint64_t)offset, e->len);
+      spf.content_len += e->len;
+    }
+    free(buf), buf = NULL;
+
+    e->offset = blob->offset;
+    e->len = blob->len;
+  }
+
+  ret = sp_pack_finish(dest, &spf, &dictionary, entries, entries_len, &compact_options);
+
+err1:
+  sp_pack_blobs_free(&blobs);
+err0:
+  for(size_t i = 0; i < entries_len; i++) {
+    free(entries[i].name), entries[i].name = NULL;
+  }
+  free(entries), entries = NULL;
+  free(dictionary_data), dictionary_data = NULL;
+  free(segment_table), segment_table = NULL;
+
+  return ret;
+}
+
+errno_t sp_pack_upgrade(FILE * fp, const sp_pack_version * from, const sp_pack_version * to) {
+  (void)fp;
+  (void)from;
+  (void)to;
+  return SP_SUCCESS;
+}
 
-static bool sp_write_fixed_width_string(const char * value, size_t fixed_width, FILE * fp, uint64_t * content_len) {
-  static char nullstr = '\0';
+static int sp_pack_range_compare(const void * a, const void * b) {
+  const uint64_t * left = a;
+  const uint64_t * right = b;
+  return left[0] < right[0] ? -1 : (left[0] > right[0] ? 1 : 0);
+}
+
+errno_t sp_pack_print_resources(FILE * dest, FILE * fp) {
+  SP_SET_BINARY_MODE(fp);
+  (void)dest;
+
+  if(fp) {
+    sp_pack_file spf = { 0 };
+    sp_pack_chunks chunks = { 0 };
+    sp_pack_section perfect_hash = { 0 };
+    sp_pack_segments segments = { 0 };
+    sp_pack_section dictionary = { 0 };
+    long pak_offset = -1;
+
+    if(sp_pack_read_layout(fp, &pak_offset, &spf, &chunks, &perfect_hash, &segments, &dictionary) != SP_SUCCESS) goto err0;
+    /* fprintf(dest, "SPDB Version: %i.%i.%i.%i\n", spf.version.major, spf.version.minor, spf.version.revision, spf.version.subrevision); */
+    /* fprintf(dest, "Content offset: %x\n", (unsigned int)spf.content_offset); */
+    /* fprintf(dest, "Content length: %lu\n", (size_t)spf.content_len); */
+    /* fprintf(dest, "Index entries: %lu\n", (size_t)spf.index_entries); */
+    /* fprintf(dest, "Chunk size: %lu\n", (size_t)chunks.chunk_size); */
+
+    char * content_hash_out = sp_pack_encode_binary_data(spf.hash, sizeof spf.hash / sizeof spf.hash[0]);
+    /* fprintf(dest, "Saved hash: <%s>\n", content_hash_out); */
+    free(content_hash_out), content_hash_out = NULL;
+
+    if(!sp_pack_check_content(fp, pak_offset, &spf, &chunks, 0)) { goto err5; }
+
+    unsigned char * segment_table = NULL;
+    if(sp_pack_read_segments(fp, pak_offset, &spf, &segments, &segment_table) != SP_SUCCESS) { goto err5; }
+    free(segment_table), segment_table = NULL;
+
+    /* Entries are found through the index records, read in one go, and
+     * printed in content order. */
+    if(spf.index_entries > (SIZE_MAX / SP_INDEX_RECORD_LEN) || spf.index_entries * SP_INDEX_RECORD_LEN > spf.index_len) { goto err1; }
+    if(spf.index_entries > 0) {
+      size_t records_len = (size_t)spf.index_entries * SP_INDEX_RECORD_LEN;
+      unsigned char * records = malloc(records_len);
+      uint64_t * ranges = calloc((size_t)spf.index_entries * 2, sizeof * ranges);
+      if(!records || !ranges) { abort(); }
+
+      fseek(fp, pak_offset + (long)spf.index_offset, SEEK_SET);
+      if(!sp_read_raw(fp, records_len, records)) {
+        free(ranges), ranges = NULL;
+        free(records), records = NULL;
+        goto err1;
+      }
+
+      for(uint64_t i = 0; i < spf.index_entries; i++) {
+        ranges[i * 2] = sp_pack_load_uint64(records + i * SP_INDEX_RECORD_LEN + 8);
+        ranges[i * 2 + 1] = sp_pack_load_uint64(records + i * SP_INDEX_RECORD_LEN + 16);
+      }
+      free(records), records = NULL;
+      qsort(ranges, (size_t)spf.index_entries, 2 * sizeof * ranges, &sp_pack_range_compare);
+
+      unsigned char * dictionary_data = NULL;
+      if(sp_pack_read_dictionary(fp, pak_offset, &dictionary, &dictionary_data) != SP_SUCCESS) {
+        free(ranges), ranges = NULL;
+        goto err5;
+      }
+
+      sp_z * z = sp_z_create();
+      sp_z_set_dictionary(z, dictionary_data, (size_t)dictionary.len);
+      for(uint64_t i = 0; i < spf.index_entries; i++) {
+        uint64_t offset = ranges[i * 2], len = ranges[i * 2 + 1];
+        /* aliases of deduplicated content are printed once */
+        if(i > 0 && offset == ranges[(i - 1) * 2]) { continue; }
+        if(len == 0 || len > SIZE_MAX || offset > LONG_MAX) {
+          fprintf(stderr, "Pack contents corrupt. Skipping.\n");
+          continue;
+        }
+
+        unsigned char * buf = malloc((size_t)len);
+        if(!buf) { abort(); }
+
+        sp_pack_entry_view entry = { 0 };
+        unsigned char * data = NULL;
+        fseek(fp, pak_offset + (long)offset, SEEK_SET);
+        if(sp_read_raw(fp, (size_t)len, buf) && sp_pack_parse_entry(buf, (size_t)len, &entry) && sp_pack_decode_entry(z, NULL, spf.integrity, &entry, &data)) {
+          sp_pack_print_file_stats(&entry);
+        } else {
+          fprintf(stderr, "Pack contents corrupt. Skipping.\n");
+        }
+
+        free(data), data = NULL;
+        free(buf), buf = NULL;
+      }
+      sp_z_free(z), z = NULL;
+      free(dictionary_data), dictionary_data = NULL;
+      free(ranges), ranges = NULL;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    long saved_file_len = ftell(fp);
+    assert(saved_file_len > 0 && saved_file_len <= LONG_MAX);
+    /* fprintf(dest, "Calculated SPDB size: %lu\n", saved_file_len); */
+
+    /* read content length */
+    uint64_t trailer_offset = sp_pack_trailer_offset(&spf, &chunks, &perfect_hash, &segments);
+    fseek(fp, pak_offset + (long)trailer_offset, SEEK_SET);
+
+    uint64_t file_len = 0;
+    sp_read_uint64(fp, &file_len);
+    /* fprintf(dest, "Saved SPDB size: %lu\n", (size_t)file_len); */
+    if((long)file_len != saved_file_len - pak_offset) goto err3;
+
+    /* read footer */
+    fseek(fp, pak_offset + (long)(trailer_offset + sizeof(uint64_t)), SEEK_SET);
+    if(!sp_read_footer(fp)) goto err4;
+  }
+
+  return SP_SUCCESS;
+
+err0:
+  fprintf(stderr, "Invalid header\n");
+  return SP_FAILURE;
+err1:
+  fprintf(stderr, "Invalid index\n");
+  return SP_FAILURE;
+err3:
+  fprintf(stderr, "Invalid content length\n");
+  return SP_FAILURE;
+err4:
+  fprintf(stderr, "Invalid footer\n");
+  return SP_FAILURE;
+err5:
+  fprintf(stderr, "Unable to validate resource content. This is a fatal error :(\n");
+  return SP_FAILURE;
+}
+
+char * sp_pack_encode_binary_data(const unsigned char * bin_data, size_t bin_data_len) {
+  size_t max_len = sodium_base64_ENCODED_LEN(bin_data_len, sodium_base64_VARIANT_ORIGINAL_NO_PADDING);
+  char * out = malloc(max_len);
+  sodium_bin2base64(out, max_len, bin_data, bin_data_len, sodium_base64_VARIANT_ORIGINAL_NO_PADDING);
+  return out;
+}
+
+void sp_pack_print_file_stats(const sp_pack_entry_view * entry) {
+  char * encoded_decompressed_hash = sp_pack_encode_binary_data(entry->decompressed_hash, crypto_generichash_BYTES);
+  char * encoded_compressed_hash = sp_pack_encode_binary_data(entry->compressed_hash, crypto_generichash_BYTES);
+
+  fprintf(stdout, "%s@%s [%lu -> %lu, %s] <%s>; <%s>\n", entry->key, entry->file_path, (size_t)entry->decompressed_len, (size_t)entry->compressed_len, sp_pack_codec_name(entry->codec), encoded_decompressed_hash, encoded_compressed_hash);
+
+  free(encoded_decompressed_hash), encoded_decompressed_hash = NULL;
+  free(encoded_compressed_hash), encoded_compressed_hash = NULL;
+}
+
+static size_t sp_pack_resolve_jobs(size_t jobs, size_t work) {
+  if(jobs == 0) { jobs = sp_pack_default_jobs(); }
+  if(jobs > work) { jobs = work; }
+  return jobs > 0 ? jobs : 1;
+}
+
+/* Hash [offset, offset + len) of the file through a fixed window. Uses pread
+ * when fp has a descriptor, which leaves the stream position alone and is
+ * safe to call from several threads at once. */
+static bool sp_pack_hash_range(FILE * fp, sp_pack_integrity integrity, uint64_t offset, uint64_t len, unsigned char * out) {
+  assert(fp && out);
+
+  /* nothing to read */
+  if(integrity == spi_none) {
+    sp_pack_digest(integrity, NULL, 0, out);
+    return true;
+  }
+
+  unsigned char * window = malloc(SP_PACK_HASH_WINDOW);
+  if(!window) { abort(); }
+
+  crypto_generichash_state state;
+  uint32_t crc = 0;
+  if(integrity == spi_blake2b) { crypto_generichash_init(&state, NULL, 0, crypto_generichash_BYTES); }
+
+  int fd = fileno(fp);
+  if(fd < 0) {
+    assert(offset <= LONG_MAX);
+    if(fseek(fp, (long)offset, SEEK_SET) != 0) { goto err0; }
+  }
+
+  uint64_t remaining = len;
+  while(remaining > 0) {
+    size_t want = remaining < SP_PACK_HASH_WINDOW ? (size_t)remaining : SP_PACK_HASH_WINDOW;
+    size_t got = 0;
+    if(fd >= 0) {
+      ssize_t r = pread(fd, window, want, (off_t)(offset + (len - remaining)));
+      if(r <= 0) { goto err0; }
+      got = (size_t)r;
+    } else {
+      got = fread(window, sizeof * window, want, fp);
+      if(got == 0 || ferror(fp) != 0) { goto err0; }
+    }
+    if(integrity == spi_crc32c) {
+      crc = sp_crc32c(crc, window, got);
+    } else {
+      crypto_generichash_update(&state, window, got);
+    }
+    remaining -= got;
+  }
+
+  if(integrity == spi_crc32c) {
+    memset(out, 0, crypto_generichash_BYTES);
+    sp_pack_store_uint32(out, crc);
+  } else {
+    crypto_generichash_final(&state, out, crypto_generichash_BYTES);
+  }
+  free(window), window = NULL;
+
+  return true;
+
+err0:
+  free(window), window = NULL;
+  return false;
+}
+
+typedef struct sp_pack_chunk_pool {
+  pthread_mutex_t lock;
+  FILE * fp;
+  unsigned char * hashes;
+  uint64_t base; /* absolute file offset of the first chunk */
+  uint64_t len;
+  uint64_t chunk_size;
+  size_t chunk_count;
+  size_t next;
+  sp_pack_integrity integrity;
+  bool compare; /* verify against hashes rather than fill them in */
+  bool is_valid;
+  char padding[2]; /* not portable */
+} sp_pack_chunk_pool;
+
+static void * sp_pack_chunk_worker(void * arg) {
+  sp_pack_chunk_pool * pool = arg;
+
+  for(;;) {
+    pthread_mutex_lock(&pool->lock);
+    if(!pool->is_valid || pool->next >= pool->chunk_count) {
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+    size_t i = pool->next++;
+    pthread_mutex_unlock(&pool->lock);
+
+    uint64_t offset = (uint64_t)i * pool->chunk_size;
+    uint64_t len = pool->len - offset < pool->chunk_size ? pool->len - offset : pool->chunk_size;
+    unsigned char * expected = pool->hashes + (size_t)i * crypto_generichash_BYTES;
+    unsigned char digest[crypto_generichash_BYTES] = { 0 };
+
+    bool ok = sp_pack_hash_range(pool->fp, pool->integrity, pool->base + offset, len, digest);
+    if(ok && pool->compare) {
+      ok = memcmp(digest, expected, crypto_generichash_BYTES) == 0;
+    } else if(ok) {
+      memmove(expected, digest, crypto_generichash_BYTES);
+    }
+
+    if(!ok) {
+      pthread_mutex_lock(&pool->lock);
+      pool->is_valid = false;
+      pthread_mutex_unlock(&pool->lock);
+    }
+  }
+
+  return NULL;
+}
+
+/* Hash (or, with compare, verify) every chunk of [base, base + len) across a
+ * pool of threads. Streams without a descriptor are hashed on this thread. */
+static bool sp_pack_hash_chunks(FILE * fp, sp_pack_integrity integrity, uint64_t base, uint64_t len, uint64_t chunk_size, size_t jobs, unsigned char * hashes, bool compare) {
+  assert(fp && hashes && chunk_size > 0);
+
+  sp_pack_chunk_pool pool = {
+    .fp = fp,
+    .hashes = hashes,
+    .base = base,
+    .len = len,
+    .chunk_size = chunk_size,
+    .chunk_count = (size_t)((len + chunk_size - 1) / chunk_size),
+    .next = 0,
+    .integrity = integrity,
+    .compare = compare,
+    .is_valid = true
+  };
+  pthread_mutex_init(&pool.lock, NULL);
+
+  jobs = fileno(fp) < 0 ? 1 : sp_pack_resolve_jobs(jobs, pool.chunk_count);
+
+  pthread_t * workers = calloc(jobs, sizeof * workers);
+  if(!workers) { abort(); }
+
+  /* the calling thread is always one of the workers */
+  size_t started = 0;
+  for(; started + 1 < jobs; started++) {
+    if(pthread_create(workers + started, NULL, sp_pack_chunk_worker, &pool) != 0) { break; }
+  }
+  sp_pack_chunk_worker(&pool);
+
+  for(size_t i = 0; i < started; i++) {
+    pthread_join(workers[i], NULL);
+  }
+
+  pthread_mutex_destroy(&pool.lock);
+  free(workers), workers = NULL;
+
+  return pool.is_valid;
+}
+
+static uint64_t sp_pack_trailer_offset(const sp_pack_file * spf, const sp_pack_chunks * chunks, const sp_pack_section * perfect_hash, const sp_pack_segments * segments) {
+  if(segments->segment_count > 0) {
+    return segments->table_offset + segments->segment_count * SP_SEGMENT_RECORD_LEN;
+  }
+  if(chunks->chunk_size > 0) {
+    return chunks->table_offset + chunks->chunk_count * crypto_generichash_BYTES;
+  }
+  return spf->index_offset + spf->index_len + perfect_hash->len;
+}
+
+/* Read and sanity check the header fields, leaving the content unverified.
+ * The header and the content magic come in with a single read. */
+static errno_t sp_pack_read_layout(FILE * fp, long * pak_offset, sp_pack_file * spf, sp_pack_chunks * chunks, sp_pack_section * perfect_hash, sp_pack_segments * segments, sp_pack_section * dictionary) {
+  assert(fp && pak_offset && spf && chunks && perfect_hash && segments && dictionary);
+
+  uint64_t pak_len = 0;
+  if(sp_pack_read_trailer(fp, pak_offset, &pak_len) != SP_SUCCESS) { goto err; }
+
+  unsigned char preamble[SP_PACK_PREAMBLE_LEN] = { 0 };
+  assert(sizeof preamble == SP_CONTENT_OFFSET + sizeof SP_ITEM_MAGIC);
+
+  fseek(fp, *pak_offset, SEEK_SET);
+  if(!sp_read_raw(fp, sizeof preamble, preamble)) goto err;
+
+  sp_pack_view view = { .data = preamble, .len = sizeof preamble, .pos = 0 };
+
+  const unsigned char * header = NULL;
+  if(!sp_pack_view_get_raw(&view, SP_HEADER_LEN, &header)) goto err;
+  if(memcmp(header, SP_HEADER, SP_HEADER_LEN) != 0) goto err;
+  memcpy(spf->header, header, SP_HEADER_LEN);
+
+  if(!sp_pack_view_get_uint16(&view, &spf->version.major)) goto err;
+  if(!sp_pack_view_get_uint16(&view, &spf->version.minor)) goto err;
+  if(!sp_pack_view_get_uint16(&view, &spf->version.revision)) goto err;
+  if(!sp_pack_view_get_uint16(&view, &spf->version.subrevision)) goto err;
+  /* older paks have a different entry layout; callers rebuild or reject them */
+  if(!(spf->version.major == SP_PACK_MAJOR_VERSION
+      && spf->version.minor == SP_PACK_MINOR_VERSION
+      && spf->version.revision == SP_PACK_REVISION_VERSION
+      && spf->version.subrevision == SP_PACK_SUBREVISION_VERSION
+      )) { goto err; }
+
+  if(!sp_pack_view_get_uint64(&view, &spf->content_offset)) goto err;
+  if(spf->content_offset != SP_CONTENT_OFFSET) goto err;
+
+  if(!sp_pack_view_get_uint64(&view, &spf->content_len)) goto err;
+  if(spf->content_len == 0 || spf->content_len > LONG_MAX) goto err;
+
+  if(!sp_pack_view_get_uint64(&view, &spf->index_entries)) goto err;
+  if(!sp_pack_view_get_uint64(&view, &spf->index_offset)) goto err;
+  if(!sp_pack_view_get_uint64(&view, &spf->index_len)) goto err;
+
+  const unsigned char * hash = NULL;
+  if(!sp_pack_view_get_hash(&view, &hash)) goto err;
+  memcpy(spf->hash, hash, crypto_generichash_BYTES);
+
+  view.pos = SP_CHUNK_HEADER_OFFSET;
+  if(!sp_pack_view_get_uint64(&view, &chunks->chunk_size)) goto err;
+  if(!sp_pack_view_get_uint64(&view, &chunks->chunk_count)) goto err;
+  if(!sp_pack_view_get_uint64(&view, &chunks->table_offset)) goto err;
+
+  view.pos = SP_PERFECT_HASH_HEADER_OFFSET;
+  if(!sp_pack_view_get_uint64(&view, &perfect_hash->offset)) goto err;
+  if(!sp_pack_view_get_uint64(&view, &perfect_hash->len)) goto err;
+
+  view.pos = SP_SEGMENT_HEADER_OFFSET;
+  if(!sp_pack_view_get_uint64(&view, &segments->segment_count)) goto err;
+  if(!sp_pack_view_get_uint64(&view, &segments->table_offset)) goto err;
+
+  view.pos = SP_DICTIONARY_HEADER_OFFSET;
+  if(!sp_pack_view_get_uint64(&view, &dictionary->offset)) goto err;
+  if(!sp_pack_view_get_uint64(&view, &dictionary->len)) goto err;
+
+  uint64_t integrity = 0;
+  view.pos = SP_INTEGRITY_HEADER_OFFSET;
+  if(!sp_pack_view_get_uint64(&view, &integrity)) goto err;
+  if(integrity > spi_none) goto err;
+  spf->integrity = (sp_pack_integrity)integrity;
+
+  if(perfect_hash->len > 0 && perfect_hash->offset != spf->index_offset + spf->index_len) goto err;
+  if(chunks->chunk_size > 0) {
+    if(spf->integrity == spi_none) goto err;
+    if(chunks->chunk_count != (spf->content_len + chunks->chunk_size - 1) / chunks->chunk_size) goto err;
+    if(chunks->table_offset != spf->index_offset + spf->index_len + perfect_hash->len) goto err;
+  }
+  if(segments->segment_count > 0) {
+    sp_pack_segments none = { 0 };
+    if(segments->segment_count > LONG_MAX / SP_SEGMENT_RECORD_LEN) goto err;
+    if(segments->table_offset != sp_pack_trailer_offset(spf, chunks, perfect_hash, &none)) goto err;
+  }
+  if(dictionary->len > 0) {
+    if(dictionary->offset != SP_DICTIONARY_OFFSET || dictionary->len > SP_DICT_MAX_LEN) goto err;
+    if(dictionary->len > spf->content_len - sizeof SP_ITEM_MAGIC) goto err;
+  }
+
+  /* the sections the header describes must end where the trailer starts */
+  if(sp_pack_trailer_offset(spf, chunks, perfect_hash, segments) != pak_len - SP_TRAILER_LEN) goto err;
+
+  uint64_t magic = 0;
+  view.pos = SP_CONTENT_OFFSET;
+  if(!sp_pack_view_get_uint64(&view, &magic)) goto err;
+  if(magic != SP_ITEM_MAGIC) { goto err; }
+
+  return SP_SUCCESS;
+
+err:
+  return SP_FAILURE;
+}
+
+/* Read the chunk hash table and check it against the root in the header. */
+static unsigned char * sp_pack_read_chunk_table(FILE * fp, long pak_offset, const sp_pack_file * spf, const sp_pack_chunks * chunks) {
+  assert(chunks->chunk_size > 0);
+
+  size_t table_len = (size_t)chunks->chunk_count * crypto_generichash_BYTES;
+  unsigned char * table = calloc(table_len, sizeof * table);
+  if(!table) { abort(); }
+
+  fseek(fp, pak_offset + (long)chunks->table_offset, SEEK_SET);
+  if(!sp_read_raw(fp, table_len, table)) { goto err0; }
+
+  unsigned char root[crypto_generichash_BYTES] = { 0 };
+  sp_pack_digest(spf->integrity, table, table_len, root);
+  if(memcmp(root, spf->hash, crypto_generichash_BYTES) != 0) { goto err0; }
+
+  return table;
+
+err0:
+  free(table), table = NULL;
+  return NULL;
+}
+
+/* Read the appended segment table and verify every segment against its hash;
+ * segments are expected in file order, between the original content and the
+ * current index. The table is NULL for paks nothing was appended to. */
+static errno_t sp_pack_read_segments(FILE * fp, long pak_offset, const sp_pack_file * spf, const sp_pack_segments * segments, unsigned char ** out_table) {
+  assert(fp && spf && segments && out_table);
+
+  *out_table = NULL;
+  if(segments->segment_count == 0) { return SP_SUCCESS; }
+
+  size_t table_len = (size_t)segments->segment_count * SP_SEGMENT_RECORD_LEN;
+  unsigned char * table = malloc(table_len);
+  if(!table) { abort(); }
+
+  fseek(fp, pak_offset + (long)segments->table_offset, SEEK_SET);
+  if(!sp_read_raw(fp, table_len, table)) { goto err0; }
+
+  uint64_t previous_end = spf->content_offset + spf->content_len;
+  for(uint64_t i = 0; i < segments->segment_count; i++) {
+    const unsigned char * record = table + i * SP_SEGMENT_RECORD_LEN;
+    uint64_t offset = sp_pack_load_uint64(record);
+    uint64_t len = sp_pack_load_uint64(record + 8);
+
+    if(offset < previous_end || len < sizeof SP_ITEM_MAGIC || offset > spf->index_offset || len > spf->index_offset - offset) { goto err0; }
+    previous_end = offset + len;
+
+    unsigned char digest[crypto_generichash_BYTES] = { 0 };
+    if(!sp_pack_hash_range(fp, spf->integrity, (uint64_t)pak_offset + offset, len, digest)) { goto err0; }
+    if(memcmp(digest, record + 16, crypto_generichash_BYTES) != 0) {
+      fprintf(stderr, "Resource pack segment %" PRIu64 " failed verification.\n", i);
+      goto err0;
+    }
+  }
+
+  *out_table = table;
+  return SP_SUCCESS;
+
+err0:
+  free(table), table = NULL;
+  return SP_FAILURE;
+}
+
+/* Whether [offset, offset + len) lies within the original content or one of
+ * the appended segments. */
+static bool sp_pack_range_is_content(uint64_t content_offset, uint64_t content_len, const unsigned char * segments, uint64_t segment_count, uint64_t offset, uint64_t len) {
+  uint64_t start = content_offset, end = content_offset + content_len;
+  for(uint64_t i = 0; ; i++) {
+    if(offset >= start && len <= end - start && offset - start <= end - start - len) { return true; }
+    if(i >= segment_count) { break; }
+
+    start = sp_pack_load_uint64(segments + i * SP_SEGMENT_RECORD_LEN);
+    end = start + sp_pack_load_uint64(segments + i * SP_SEGMENT_RECORD_LEN + 8);
+  }
+  return false;
+}
+
+/* Read the preset dictionary; *out_dictionary is left NULL when the pak has
+ * none. It lives in the content, so verifying the content covers it. */
+static errno_t sp_pack_read_dictionary(FILE * fp, long pak_offset, const sp_pack_section * dictionary, unsigned char ** out_dictionary) {
+  assert(fp && dictionary && out_dictionary);
+
+  *out_dictionary = NULL;
+  if(dictionary->len == 0) { return SP_SUCCESS; }
+  if(dictionary->len > SP_DICT_MAX_LEN) { return SP_FAILURE; }
+
+  unsigned char * data = malloc((size_t)dictionary->len);
+  if(!data) { abort(); }
+
+  fseek(fp, pak_offset + (long)dictionary->offset, SEEK_SET);
+  if(!sp_read_raw(fp, (size_t)dictionary->len, data)) {
+    free(data), data = NULL;
+    return SP_FAILURE;
+  }
+
+  *out_dictionary = data;
+  return SP_SUCCESS;
+}
+
+/* Read every index record, and its key, into entries (index entries long);
+ * names are allocated and owned by the caller, even on failure. */
+static errno_t sp_pack_read_index_entries(FILE * fp, long pak_offset, const sp_pack_file * spf, sp_pack_index_entry * entries) {
+  assert(fp && spf);
+
+  if(spf->index_entries > (SIZE_MAX / SP_INDEX_RECORD_LEN) || spf->index_entries * SP_INDEX_RECORD_LEN > spf->index_len) { return SP_FAILURE; }
+  if(spf->index_len > SIZE_MAX) { return SP_FAILURE; }
+  if(spf->index_entries == 0) { return SP_SUCCESS; }
+  assert(entries);
+
+  unsigned char * index = malloc((size_t)spf->index_len);
+  if(!index) { abort(); }
+
+  fseek(fp, pak_offset + (long)spf->index_offset, SEEK_SET);
+  if(!sp_read_raw(fp, (size_t)spf->index_len, index)) { goto err0; }
+
+  const unsigned char * pool = index + spf->index_entries * SP_INDEX_RECORD_LEN;
+  uint64_t pool_len = spf->index_len - spf->index_entries * SP_INDEX_RECORD_LEN;
+  for(uint64_t i = 0; i < spf->index_entries; i++) {
+    const unsigned char * record = index + i * SP_INDEX_RECORD_LEN;
+    uint64_t name_offset = sp_pack_load_uint32(record + 24);
+    uint64_t name_len = sp_pack_load_uint32(record + 28);
+    if(name_offset + name_len >= pool_len || pool[name_offset + name_len] != '\0') { goto err0; }
+
+    entries[i].name = strndup((const char *)pool + name_offset, (size_t)name_len);
+    if(!entries[i].name) { abort(); }
+    entries[i].offset = sp_pack_load_uint64(record + 8);
+    entries[i].len = sp_pack_load_uint64(record + 16);
+  }
+
+  free(index), index = NULL;
+  return SP_SUCCESS;
+
+err0:
+  free(index), index = NULL;
+  return SP_FAILURE;
+}
+
+/* Verify the whole content section: one streamed hash for flat paks, or every
+ * chunk, in parallel, for chunked ones. */
+static bool sp_pack_check_content(FILE * fp, long pak_offset, const sp_pack_file * spf, const sp_pack_chunks * chunks, size_t jobs) {
+  uint64_t base = (uint64_t)pak_offset + spf->content_offset;
+  if(spf->integrity == spi_none) { return true; }
+
+  if(chunks->chunk_size == 0) {
+    unsigned char read_content_hash[crypto_generichash_BYTES] = { 0 };
+    if(!sp_pack_hash_range(fp, spf->integrity, base, spf->content_len, read_content_hash)) { return false; }
+    return memcmp(read_content_hash, spf->hash, crypto_generichash_BYTES) == 0;
+  }
+
+  unsigned char * table = sp_pack_read_chunk_table(fp, pak_offset, spf, chunks);
+  if(!table) { return false; }
+
+  bool is_valid = sp_pack_hash_chunks(fp, spf->integrity, base, spf->content_len, chunks->chunk_size, jobs, table, true);
+  free(table), table = NULL;
+
+  return is_valid;
+}
+
+/* Lazy mode: check the chunks under [offset, offset + len) on first use. */
+static bool sp_pack_reader_verify_range(sp_pack_reader * reader, uint64_t offset, uint64_t len) {
+  if(!reader->chunk_hashes) { return true; }
+  /* appended segments were verified at open */
+  if(offset < reader->content_offset || offset - reader->content_offset >= reader->content_len) { return true; }
+
+  const sp_pack_chunks * chunks = &reader->chunks;
+  uint64_t start = offset - reader->content_offset;
+  uint64_t first = start / chunks->chunk_size;
+  uint64_t last = (start + (len > 0 ? len - 1 : 0)) / chunks->chunk_size;
+  if(last >= chunks->chunk_count) { return false; }
+
+  for(uint64_t i = first; i <= last; i++) {
+    pthread_mutex_lock(&reader->io_lock);
+    bool is_verified = reader->chunk_verified[i];
+    pthread_mutex_unlock(&reader->io_lock);
+    if(is_verified) { continue; }
+
+    /* two loads may hash the same chunk; either result stands */
+    uint64_t chunk_offset = reader->content_offset + i * chunks->chunk_size;
+    uint64_t chunk_len = reader->content_len - i * chunks->chunk_size;
+    if(chunk_len > chunks->chunk_size) { chunk_len = chunks->chunk_size; }
+
+    unsigned char digest[crypto_generichash_BYTES] = { 0 };
+    uint64_t at = (uint64_t)reader->pak_offset + chunk_offset;
+    if(reader->map) {
+      if(at > reader->map_len || chunk_len > reader->map_len - at) { return false; }
+      sp_pack_digest(reader->integrity, reader->map + at, (size_t)chunk_len, digest);
+    } else {
+      pthread_mutex_lock(&reader->io_lock);
+      bool is_read = sp_pack_hash_range(reader->fp, reader->integrity, at, chunk_len, digest);
+      pthread_mutex_unlock(&reader->io_lock);
+      if(!is_read) { return false; }
+    }
+
+    if(memcmp(digest, reader->chunk_hashes + i * crypto_generichash_BYTES, crypto_generichash_BYTES) != 0) {
+      fprintf(stderr, "Resource pack chunk %" PRIu64 " failed verification.\n", i);
+      return false;
+    }
+    pthread_mutex_lock(&reader->io_lock);
+    reader->chunk_verified[i] = true;
+    pthread_mutex_unlock(&reader->io_lock);
+  }
+
+  return true;
+}
+
+errno_t sp_pack_is_valid_pak_file(FILE * fp, long * pak_offset, uint64_t * content_offset, uint64_t * content_len, uint64_t * index_entries,  uint64_t * index_offset, uint64_t * index_len) {
+  SP_SET_BINARY_MODE(fp);
+
+  if(!content_offset || !content_len) { abort(); }
+  sp_pack_file spf = {
+    .header = { 0 },
+    .version = { 0 },
+    .content_offset = 0,
+    .content_len = 0,
+    .index_entries = 0,
+    .index_offset = 0,
+    .index_len = 0,
+    .hash = { 0 }
+  };
+  sp_pack_chunks chunks = { 0 };
+  sp_pack_section perfect_hash = { 0 };
+  sp_pack_segments segments = { 0 };
+  sp_pack_section dictionary = { 0 };
+
+  long pak_file_offset = -1;
+  if(sp_pack_read_layout(fp, &pak_file_offset, &spf, &chunks, &perfect_hash, &segments, &dictionary) != SP_SUCCESS) { goto err; }
+  if(pak_offset) { *pak_offset = pak_file_offset; }
+
+  if(!sp_pack_check_content(fp, pak_file_offset, &spf, &chunks, 0)) { goto err; }
+
+  unsigned char * segment_table = NULL;
+  if(sp_pack_read_segments(fp, pak_file_offset, &spf, &segments, &segment_table) != SP_SUCCESS) { goto err; }
+  free(segment_table), segment_table = NULL;
+
+  *content_offset = spf.content_offset;
+  *content_len = spf.content_len;
+  *index_entries = spf.index_entries;
+  *index_offset = spf.index_offset;
+  *index_len = spf.index_len;
+
+  return SP_SUCCESS;
+
+err:
+  return SP_FAILURE;
+}
+
+/* A pak ends in its own length and the footer, so a bundle locates it from
+ * its last SP_TRAILER_LEN bytes alone, without scanning the executable. */
+static errno_t sp_pack_read_trailer(FILE * fp, long * pak_offset, uint64_t * pak_len) {
+  if(fseek(fp, 0, SEEK_END) != 0) goto err;
+
+  long file_len = ftell(fp);
+  if(file_len < (long)SP_TRAILER_LEN) goto err;
+
+  unsigned char trailer[SP_TRAILER_LEN] = { 0 };
+  fseek(fp, file_len - (long)SP_TRAILER_LEN, SEEK_SET);
+  if(!sp_read_raw(fp, sizeof trailer, trailer)) goto err;
+  if(memcmp(trailer + sizeof(uint64_t), SP_FOOTER, sizeof SP_FOOTER) != 0) goto err;
+
+  /* anything that can't hold a header and a trailer isn't a pak */
+  uint64_t len = sp_pack_load_uint64(trailer);
+  if(len < SP_PACK_PREAMBLE_LEN + SP_TRAILER_LEN || len > (uint64_t)file_len) goto err;
+
+  *pak_offset = file_len - (long)len;
+  *pak_len = len;
+
+  return SP_SUCCESS;
+
+err:
+  return SP_FAILURE;
+}
+
+long sp_pack_get_offset(FILE * fp) {
+  long pak_offset = -1;
+  uint64_t pak_len = 0;
+  if(sp_pack_read_trailer(fp, &pak_offset, &pak_len) != SP_SUCCESS) { return -1; }
+
+  return pak_offset;
+}
+
+errno_t sp_pack_probe(FILE * fp, long * pak_offset, uint64_t * content_offset, uint64_t * content_len, uint64_t * index_entries,  uint64_t * index_offset, uint64_t * index_len) {
+  if(!fp) { return SP_FAILURE; }
+  if(!content_offset || !content_len) { abort(); }
+
+  SP_SET_BINARY_MODE(fp);
+
+  sp_pack_file spf = { 0 };
+  sp_pack_chunks chunks = { 0 };
+  sp_pack_section perfect_hash = { 0 };
+  sp_pack_segments segments = { 0 };
+  sp_pack_section dictionary = { 0 };
 
-  assert(fixed_width > 0 && fixed_width <= MAX_PACK_STRING_LEN);
-  assert(value);
+  long pak_file_offset = -1;
+  if(sp_pack_read_layout(fp, &pak_file_offset, &spf, &chunks, &perfect_hash, &segments, &dictionary) != SP_SUCCESS) { return SP_FAILURE; }
+  if(pak_offset) { *pak_offset = pak_file_offset; }
 
-  char * buf = malloc(fixed_width * sizeof(char));
-  if(!buf) goto err0;
+  *content_offset = spf.content_offset;
+  *content_len = spf.content_len;
+  *index_entries = spf.index_entries;
+  *index_offset = spf.index_offset;
+  *index_len = spf.index_len;
 
-  memset(buf, 0, fixed_width * sizeof(char));
-  size_t len = strnlen(value, MAX_PACK_STRING_LEN);
-  size_t min = (fixed_width < len ? fixed_width : len);
-  memcpy(buf, value, min * sizeof(char));
+  return SP_SUCCESS;
+}
 
-  size_t rmin = 0, rbuf = 0, rnull = 0;
+errno_t sp_pack_verify(FILE * fp, sp_pack_reader ** out_reader) {
+  return sp_pack_verify_ex(fp, out_reader, spvm_full);
+}
 
-  rmin = fwrite(&min, sizeof(char), sizeof min, fp);
-  if(rmin != (sizeof min) * 1) goto err1;
+errno_t sp_pack_verify_ex(FILE * fp, sp_pack_reader ** out_reader, sp_pack_verify_mode mode) {
+  if(!fp) { return SP_FAILURE; }
+  if(!out_reader) { return SP_FAILURE; }
 
-  rbuf = fwrite(buf, sizeof(char), min, fp);
-  if((size_t)rbuf != sizeof(char) * min) goto err1;
+  SP_SET_BINARY_MODE(fp);
 
-  rnull =  fwrite(&nullstr, sizeof nullstr, 1, fp);
-  if(rnull != 1) goto err1;
+  sp_pack_file spf = { 0 };
+  sp_pack_chunks chunks = { 0 };
+  sp_pack_section perfect_hash = { 0 };
+  sp_pack_segments segments = { 0 };
+  sp_pack_section dictionary = { 0 };
 
-  free(buf), buf = NULL;
+  long pak_offset = -1;
+  if(sp_pack_read_layout(fp, &pak_offset, &spf, &chunks, &perfect_hash, &segments, &dictionary) != SP_SUCCESS) { goto err5; }
+
+  /* Flat paks can only be verified as a whole. Chunked paks in lazy mode only
+   * check the chunk table against the header root here; each entry's chunks
+   * are verified on its first load. */
+  unsigned char * chunk_hashes = NULL;
+  if(mode == spvm_lazy && chunks.chunk_size > 0) {
+    chunk_hashes = sp_pack_read_chunk_table(fp, pak_offset, &spf, &chunks);
+    if(!chunk_hashes) { goto err5; }
+  } else if(!sp_pack_check_content(fp, pak_offset, &spf, &chunks, 0)) {
+    goto err5;
+  }
 
-  if(content_len != NULL) { *content_len += rmin + rbuf + rnull; }
+  /* appended segments are small; they're verified up front in either mode */
+  unsigned char * segment_table = NULL;
+  if(sp_pack_read_segments(fp, pak_offset, &spf, &segments, &segment_table) != SP_SUCCESS) {
+    free(chunk_hashes), chunk_hashes = NULL;
+    goto err5;
+  }
 
-  assert((size_t)(rmin + rbuf + rnull) == (sizeof min) + (sizeof(char)) * min + (1));
+  uint64_t content_offset = spf.content_offset;
+  uint64_t content_len = spf.content_len;
+  uint64_t index_entries = spf.index_entries;
+  uint64_t index_offset = spf.index_offset;
+  uint64_t index_len = spf.index_len;
+
+  sp_pack_reader * reader = calloc(1, sizeof * reader);
+  if(!reader) { abort(); }
+
+  pthread_mutex_init(&reader->lock, NULL);
+  pthread_cond_init(&reader->loaded, NULL);
+  pthread_mutex_init(&reader->io_lock, NULL);
+  sp_pack_block_workers_init(&reader->workers);
+  reader->fp = fp;
+  reader->pak_offset = pak_offset;
+  reader->content_offset = content_offset;
+  reader->content_len = content_len;
+  reader->index_entries = index_entries;
+  reader->index_offset = index_offset;
+  reader->index_len = index_len;
+  reader->chunks = chunks;
+  reader->chunk_hashes = chunk_hashes;
+  if(chunk_hashes) {
+    reader->chunk_verified = calloc((size_t)chunks.chunk_count, sizeof * reader->chunk_verified);
+    if(!reader->chunk_verified) { abort(); }
+  }
+  reader->segments = segment_table;
+  reader->segment_count = segments.segment_count;
+  reader->integrity = spf.integrity;
 
-  return true;
+  /* caller owns the reader, even on failure; stubs may already reference it */
+  *out_reader = reader;
 
-err1:
-  free(buf), buf = NULL;
+  if(sp_pack_reader_map(reader) != SP_SUCCESS) {
+    fprintf(stderr, "Unable to map resource pack; falling back to buffered reads.\n");
+  }
 
-err0:
-  return false;
-}
+  /* the dictionary is content; lazily verified paks check its chunks now */
+  if(dictionary.len > 0) {
+    if(!sp_pack_reader_verify_range(reader, dictionary.offset, dictionary.len)) { goto err5; }
+    if(sp_pack_read_dictionary(fp, pak_offset, &dictionary, &reader->dictionary) != SP_SUCCESS) { goto err5; }
+    reader->dictionary_len = (size_t)dictionary.len;
+  }
 
-static bool sp_write_float(float value, FILE * fp, uint64_t * content_len) {
-#define BUF_MAX 256
-  char buf[BUF_MAX] = { 0 };
-  int len = snprintf((char *)buf, BUF_MAX - 1, "%.9g", value);
-  assert(len > 0 && len < BUF_MAX);
-#undef BUF_MAX
-  buf[len] = '\0';
+  /* Only the index and perfect hash are read at startup, in a single read
+   * (or not at all when mapped); entries are loaded on first find. */
+  if(index_entries > UINT64_MAX / SP_INDEX_RECORD_LEN || index_len < index_entries * SP_INDEX_RECORD_LEN) { goto err4; }
+  uint64_t section_len = index_len + perfect_hash.len;
+  if(section_len < index_len) { goto err4; }
+  if(section_len > 0) {
+    uint64_t index_start = (uint64_t)pak_offset + index_offset;
+    if(reader->map) {
+      if(index_start > reader->map_len || section_len > reader->map_len - index_start) { goto err4; }
+      reader->index = reader->map + index_start;
+    } else {
+      if(section_len > SIZE_MAX) { goto err4; }
+      reader->index_buf = malloc((size_t)section_len);
+      if(!reader->index_buf) { abort(); }
+      fseek(fp, (long)index_start, SEEK_SET);
+      if(!sp_read_raw(fp, (size_t)section_len, reader->index_buf)) { goto err4; }
+      reader->index = reader->index_buf;
+    }
+  }
 
-  return sp_write_string(buf, fp, content_len);
-}
+  if(perfect_hash.len > 0) {
+    const unsigned char * ph = reader->index + index_len;
+    if(perfect_hash.len > SIZE_MAX) { goto err4; }
 
-static bool sp_read_char(FILE * fp, char * value) {
-  if(feof(fp) != 0) return false;
+    sp_pack_view view = { .data = ph, .len = (size_t)perfect_hash.len, .pos = 0 };
+    uint32_t slots = 0, buckets = 0;
+    if(!sp_pack_view_get_uint32(&view, &slots) || !sp_pack_view_get_uint32(&view, &buckets)) { goto err4; }
+    if(slots != index_entries || buckets == 0) { goto err4; }
+    if(perfect_hash.len != 2 * sizeof(uint32_t) + ((uint64_t)buckets + slots) * sizeof(uint32_t)) { goto err4; }
+    reader->perfect_hash = ph;
+  }
 
-  char c;
-  size_t hir = fread(&c, sizeof c, 1, fp);
-  assert(hir == sizeof *value);
+  if(index_entries > 0) {
+    if(index_entries > SIZE_MAX / (2 * sizeof(uint64_t))) { goto err4; }
+    reader->items = calloc((size_t)index_entries, sizeof * reader->items);
+    if(!reader->items) { abort(); }
+    reader->aliases = sp_pack_reader_find_aliases(reader->index, index_entries);
+  }
 
-  *value = c;
+  return SP_SUCCESS;
 
-  return hir == sizeof *value && ferror(fp) == 0;
+err4:
+  fprintf(stderr, "Invalid index entry\n");
+  return SP_FAILURE;
+
+err5:
+  fprintf(stderr, "Unable to validate resource content. This is a fatal error :(\n");
+  return SP_FAILURE;
 }
 
-static bool sp_read_uint8(FILE * fp, uint8_t * value) {
-  (void)sp_read_char;
+static errno_t sp_pack_reader_map(sp_pack_reader * reader) {
+  assert(reader && reader->fp);
 
-  if(feof(fp) != 0) return false;
+  int fd = fileno(reader->fp);
+  if(fd < 0) { return SP_FAILURE; }
 
-  uint8_t byte;
-  size_t hir = fread(&byte, sizeof byte, 1, fp);
-  assert(hir == sizeof *value);
+  struct stat st = { 0 };
+  if(fstat(fd, &st) != 0 || st.st_size <= 0) { return SP_FAILURE; }
 
-  *value = byte;
+  size_t map_len = (size_t)st.st_size;
+  void * map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(map == MAP_FAILED) { return SP_FAILURE; }
 
-  return hir == sizeof *value && ferror(fp) == 0;
+  reader->map = map;
+  reader->map_len = map_len;
+
+  return SP_SUCCESS;
 }
 
-static bool sp_read_int8(FILE * fp, int8_t * value) {
-  int8_t byte;
+errno_t sp_pack_item_file_load(sp_pack_item_file * pub) {
+  if(!pub) { return SP_FAILURE; }
+  if(!pub->reader) { return pub->is_loaded ? SP_SUCCESS : SP_FAILURE; }
 
-  bool res = sp_read_uint8(fp, (uint8_t *)&byte);
-  assert(res);
+  sp_pack_reader * reader = pub->reader;
+  sp_pack_cache_item * item = (sp_pack_cache_item *)(void *)pub;
 
-  *value = byte;
+  pthread_mutex_lock(&reader->lock);
+  errno_t res = sp_pack_reader_load_item(reader, item);
+  if(res == SP_SUCCESS) { sp_pack_cache_unref(reader, item); }
+  pthread_mutex_unlock(&reader->lock);
 
   return res;
 }
 
-static bool sp_read_uint16(FILE * fp, uint16_t * value) {
-  if(feof(fp) != 0) return false;
-
-  uint8_t bytes[sizeof(uint16_t)] = { 0 } ;
-  size_t hir = fread(&bytes, sizeof bytes, 1, fp);
-  assert(hir);
+/* Called with the reader locked. Loads decode outside the lock, each with
+ * inflate state of its own; spare states are kept for the next load. */
+static sp_z * sp_pack_reader_take_z(sp_pack_reader * reader) {
+  if(reader->spare_z_count > 0) { return reader->spare_z[--reader->spare_z_count]; }
 
-  /* little endian */
-  *value = (uint16_t)(((uint16_t)(bytes[0] << 0)) | (uint16_t)(bytes[1] << 8));
+  sp_z * z = sp_z_create();
+  if(reader->dictionary) { sp_z_set_dictionary(z, reader->dictionary, reader->dictionary_len); }
+  return z;
+}
 
-  return ferror(fp) == 0;
+/* Called with the reader locked. */
+static void sp_pack_reader_give_z(sp_pack_reader * reader, sp_z * z) {
+  if(reader->spare_z_count < SP_PACK_SPARE_Z) {
+    reader->spare_z[reader->spare_z_count++] = z;
+  } else {
+    sp_z_free(z);
+  }
 }
 
-static bool sp_read_int16(FILE * fp, int16_t * value) {
-  if(feof(fp) != 0) return false;
+/* Reads, verifies and decodes the entry at [offset, offset + len); needs no
+ * lock. The entry is parsed in place: straight out of the mapping, or out of
+ * a single read of the whole entry when the pak isn't mapped. */
+static bool sp_pack_reader_decode_item(sp_pack_reader * reader, sp_z * z, uint64_t offset, uint64_t len, char ** out_data, size_t * out_len, bool * out_is_mapped) {
+  unsigned char * buf = NULL;
+  const unsigned char * bytes = sp_pack_reader_read_range(reader, offset, len, &buf);
+  if(!bytes) { goto err0; }
 
-  int8_t bytes[sizeof(int16_t)] = { 0 } ;
-  size_t hir = fread(&bytes, sizeof bytes, 1, fp);
-  assert(hir);
+  sp_pack_entry_view entry = { 0 };
+  unsigned char * data = NULL;
+  if(!sp_pack_parse_entry(bytes, (size_t)len, &entry)) { goto err0; }
+  if(!sp_pack_decode_entry(z, &reader->workers, reader->integrity, &entry, &data)) { goto err0; }
 
-  /* little endian */
-  *value = (int16_t)(((int16_t)bytes[0] << 0) | ((int16_t)bytes[1] << 8));
+  if(data) {
+    free(buf), buf = NULL;
+    *out_data = (char *)data;
+    *out_is_mapped = false;
+  } else if(buf) {
+    /* stored entry read into our own buffer; shift the content to its start */
+    memmove(buf, entry.payload, (size_t)entry.decompressed_len);
+    *out_data = (char *)buf, buf = NULL;
+    *out_is_mapped = false;
+  } else {
+    /* zero-copy: the caller gets a read-only view into the mapping */
+    *out_data = (char *)(uintptr_t)entry.payload;
+    *out_is_mapped = true;
+  }
+  *out_len = (size_t)entry.decompressed_len;
 
-  return ferror(fp) == 0;
+  return true;
+
+err0:
+  free(buf), buf = NULL;
+  return false;
 }
 
-bool sp_read_uint32(FILE * fp, uint32_t * value) {
-  if(feof(fp) != 0) return false;
+/* Called with the reader locked, which is dropped while the entry is read
+ * and decoded; loads of an item that's already loading wait for that one.
+ * On success the caller holds a reference to the item, which also keeps it
+ * off the LRU in the meantime. */
+static errno_t sp_pack_reader_load_item(sp_pack_reader * reader, sp_pack_cache_item * item) {
+  sp_pack_item_file * pub = &item->pub;
+
+  sp_pack_cache_unlink(reader, item);
+  item->refs++;
+  while(item->is_loading) { pthread_cond_wait(&reader->loaded, &reader->lock); }
+  if(pub->is_loaded) { return SP_SUCCESS; }
+
+  item->is_loading = true;
+  sp_z * z = sp_pack_reader_take_z(reader);
+  pthread_mutex_unlock(&reader->lock);
+
+  char * data = NULL;
+  size_t data_len = 0;
+  bool is_mapped = false;
+  bool ok = sp_pack_reader_decode_item(reader, z, pub->offset, pub->len, &data, &data_len, &is_mapped);
+
+  pthread_mutex_lock(&reader->lock);
+  sp_pack_reader_give_z(reader, z);
+  item->is_loading = false;
+  pthread_cond_broadcast(&reader->loaded);
+
+  if(!ok) {
+    sp_pack_cache_unref(reader, item);
+    fprintf(stderr, "Unable to load resource at offset %" PRIu64 ".\n", pub->offset);
+    return SP_FAILURE;
+  }
 
-  uint8_t bytes[sizeof(uint32_t)] = { 0 } ;
-  size_t hir = fread(&bytes, sizeof bytes, 1, fp);
-  assert(hir);
+  pub->data = data;
+  pub->data_len = data_len;
+  pub->is_mapped = is_mapped;
+  pub->is_loaded = true;
 
-  /* little endian */
-  *value = (uint32_t)((uint32_t)(bytes[0] << 0)) | ((uint32_t)(bytes[1] << 8)) | (uint32_t)(bytes[2] << 16) | (uint32_t)(bytes[3] << 24);
+  /* views into the mapping cost nothing to keep */
+  item->is_counted = !is_mapped;
+  if(item->is_counted) { reader->cache_resident += data_len; }
 
-  return ferror(fp) == 0;
+  return SP_SUCCESS;
 }
 
-static bool sp_read_int32(FILE * fp, int32_t * value) {
-  if(feof(fp) != 0) return false;
+errno_t sp_pack_find(sp_pack_reader * reader, const char * key, size_t key_len, sp_pack_item_file ** out_file) {
+  if(!reader || !key || !out_file) { return SP_FAILURE; }
+  *out_file = NULL;
 
-  int8_t bytes[sizeof(int32_t)] = { 0 } ;
-  size_t hir = fread(&bytes, sizeof bytes, 1, fp);
-  assert(hir);
+  uint64_t record = 0, offset = 0, len = 0;
+  if(!sp_pack_reader_lookup(reader, key, key_len, &record, &offset, &len)) { return SP_FAILURE; }
 
-  /* little endian */
-  *value = (bytes[0] << 0) | (bytes[1] << 8) | bytes[2] << 16 | bytes[3] << 24;
+  pthread_mutex_lock(&reader->lock);
 
-  return ferror(fp) == 0;
+  sp_pack_cache_item * item = sp_pack_reader_get_item(reader, record, offset, len);
+  errno_t res = sp_pack_reader_load_item(reader, item);
+  if(res == SP_SUCCESS) {
+    /* found items stay resident for the life of the reader */
+    item->is_pinned = true;
+    sp_pack_cache_unref(reader, item);
+  }
+  pthread_mutex_unlock(&reader->lock);
+  if(res != SP_SUCCESS) { return SP_FAILURE; }
+
+  *out_file = &item->pub;
+  return SP_SUCCESS;
 }
 
-static bool sp_read_uint64(FILE * fp, uint64_t * value) {
-  if(feof(fp) != 0) return false;
+errno_t sp_pack_acquire(sp_pack_reader * reader, const char * key, size_t key_len, sp_pack_item_file ** out_file) {
+  if(!reader || !key || !out_file) { return SP_FAILURE; }
+  *out_file = NULL;
 
-  uint8_t bytes[sizeof(uint64_t)] = { 0 } ;
-  size_t hir = fread(&bytes, sizeof(uint8_t), sizeof * value, fp);
-  assert(hir == sizeof(uint8_t) * sizeof * value);
+  uint64_t record = 0, offset = 0, len = 0;
+  if(!sp_pack_reader_lookup(reader, key, key_len, &record, &offset, &len)) { return SP_FAILURE; }
 
-  /* little endian */
-  *value = ((uint64_t)bytes[0] <<  0) | ((uint64_t)bytes[1] <<  8) | ((uint64_t)bytes[2] << 16) | ((uint64_t)bytes[3] << 24)
-    | ((uint64_t)bytes[4] << 32) | ((uint64_t)bytes[5] << 40) | ((uint64_t)bytes[6] << 48) | ((uint64_t)bytes[7] << 56);
+  pthread_mutex_lock(&reader->lock);
 
-  return ferror(fp) == 0;
+  /* evicted items are re-inflated here */
+  sp_pack_cache_item * item = sp_pack_reader_get_item(reader, record, offset, len);
+  errno_t res = sp_pack_reader_load_item(reader, item);
+  if(res == SP_SUCCESS) { sp_pack_cache_trim(reader); }
+  pthread_mutex_unlock(&reader->lock);
+  if(res != SP_SUCCESS) { return SP_FAILURE; }
+
+  *out_file = &item->pub;
+  return SP_SUCCESS;
 }
 
-static bool sp_read_int64(FILE * fp, int64_t * value) {
-  if(feof(fp) != 0) return false;
+void sp_pack_retain(sp_pack_item_file * file) {
+  if(!file || !file->reader) { return; }
 
-  uint8_t bytes[sizeof *value] = { 0 } ;
-  size_t hir = fread(&bytes, sizeof(uint8_t), sizeof *value,  fp);
-  assert(hir == sizeof(uint8_t) * sizeof *value);
+  sp_pack_cache_item * item = (sp_pack_cache_item *)(void *)file;
+  pthread_mutex_lock(&file->reader->lock);
+  assert(item->refs > 0);
+  item->refs++;
+  pthread_mutex_unlock(&file->reader->lock);
+}
 
-  /* little endian */
-  *value = ((int64_t)bytes[0] <<  0) | ((int64_t)bytes[1] <<  8) | ((int64_t)bytes[2] << 16) | ((int64_t)bytes[3] << 24)
-    | ((int64_t)bytes[4] << 32) | ((int64_t)bytes[5] << 40) | ((int64_t)bytes[6] << 48) | ((int64_t)bytes[7] << 56);
+void sp_pack_release(sp_pack_item_file * file) {
+  if(!file || !file->reader) { return; }
 
-  return ferror(fp) == 0;
+  sp_pack_reader * reader = file->reader;
+  sp_pack_cache_item * item = (sp_pack_cache_item *)(void *)file;
+
+  pthread_mutex_lock(&reader->lock);
+  sp_pack_cache_unref(reader, item);
+  pthread_mutex_unlock(&reader->lock);
 }
 
-static bool sp_read_header(FILE * fp) {
-  unsigned char header[SP_HEADER_LEN] = { 0 };
+void sp_pack_reader_set_cache_budget(sp_pack_reader * reader, uint64_t budget) {
+  if(!reader) { return; }
 
-  if(feof(fp) != 0) { return false; }
+  pthread_mutex_lock(&reader->lock);
+  reader->cache_budget = budget;
+  sp_pack_cache_trim(reader);
+  pthread_mutex_unlock(&reader->lock);
+}
 
-  size_t r = fread(&header, sizeof(unsigned char), SP_HEADER_LEN, fp);
-  assert(r == (sizeof header) * 1);
+uint64_t sp_pack_reader_get_cache_resident(sp_pack_reader * reader) {
+  if(!reader) { return 0; }
 
-  int eq = strncmp((const char *)header, (const char *)SP_HEADER, SP_HEADER_LEN) == 0;
+  pthread_mutex_lock(&reader->lock);
+  uint64_t resident = reader->cache_resident;
+  pthread_mutex_unlock(&reader->lock);
 
-  return eq;
+  return resident;
 }
 
-static bool sp_read_version(FILE * fp, sp_pack_version *version) {
-  if(feof(fp) != 0) return false;
+/* Maps every record to the lowest record with the same entry offset, or
+ * NULL when every record has an offset of its own. */
+static uint64_t * sp_pack_reader_find_aliases(const unsigned char * index, uint64_t index_entries) {
+  uint64_t * ranges = calloc((size_t)index_entries * 2, sizeof * ranges);
+  if(!ranges) { abort(); }
 
-  if(!sp_read_uint16(fp, &(version->major))) return false;
-  if(!sp_read_uint16(fp, &(version->minor))) return false;
-  if(!sp_read_uint16(fp, &(version->revision))) return false;
-  if(!sp_read_uint16(fp, &(version->subrevision))) return false;
+  for(uint64_t i = 0; i < index_entries; i++) {
+    ranges[i * 2] = sp_pack_load_uint64(index + i * SP_INDEX_RECORD_LEN + 8);
+    ranges[i * 2 + 1] = i;
+  }
+  qsort(ranges, (size_t)index_entries, 2 * sizeof * ranges, &sp_pack_range_compare);
 
-  return true;
-}
+  uint64_t * aliases = NULL;
+  for(uint64_t i = 0; i < index_entries; ) {
+    uint64_t end = i + 1, first = ranges[i * 2 + 1];
+    for(; end < index_entries && ranges[end * 2] == ranges[i * 2]; end++) {
+      if(ranges[end * 2 + 1] < first) { first = ranges[end * 2 + 1]; }
+    }
 
-static bool sp_write_version(sp_pack_version version, FILE * fp, uint64_t * content_len) {
-  if(!sp_write_uint16(version.major, fp, content_len)) return false;
-  if(!sp_write_uint16(version.minor, fp, content_len)) return false;
-  if(!sp_write_uint16(version.revision, fp, content_len)) return false;
-  if(!sp_write_uint16(version.subrevision, fp, content_len)) return false;
+    if(end - i > 1 && !aliases) {
+      aliases = calloc((size_t)index_entries, sizeof * aliases);
+      if(!aliases) { abort(); }
+      for(uint64_t j = 0; j < index_entries; j++) { aliases[j] = j; }
+    }
+    for(; aliases && i < end; i++) { aliases[ranges[i * 2 + 1]] = first; }
+    i = end;
+  }
 
-  return true;
+  free(ranges), ranges = NULL;
+  return aliases;
 }
 
-static bool sp_read_footer(FILE * fp) {
-  unsigned char footer[SP_FOOTER_LEN] = { 0 };
+/* Called with the reader locked. */
+static sp_pack_cache_item * sp_pack_reader_get_item(sp_pack_reader * reader, uint64_t record, uint64_t offset, uint64_t len) {
+  if(reader->aliases) { record = reader->aliases[record]; }
+  sp_pack_cache_item * item = reader->items[record];
+  if(!item) {
+    item = calloc(1, sizeof * item);
+    if(!item) { abort(); }
+
+    item->pub.reader = reader;
+    item->pub.offset = offset;
+    item->pub.len = len;
+    item->pub.is_loaded = false;
+    reader->items[record] = item;
+  }
 
-  size_t r = fread(&footer, sizeof(unsigned char), SP_FOOTER_LEN, fp);
-  fflush(stdout);
+  return item;
+}
 
-  assert(r == (sizeof footer) * 1);
+/* Called with the reader locked. Gives record a slot of its own in items;
+ * an item it shared stays with the other records. Returns the item record
+ * held alone, if any, for the caller to replace. */
+static sp_pack_cache_item * sp_pack_reader_unalias(sp_pack_reader * reader, uint64_t record) {
+  if(!reader->aliases) { return reader->items[record]; }
+
+  uint64_t shared = reader->aliases[record];
+  reader->aliases[record] = record;
+  if(shared != record) { return NULL; }
+
+  /* record held the shared item; the lowest of the others takes it over */
+  uint64_t heir = UINT64_MAX;
+  for(uint64_t i = 0; i < reader->index_entries; i++) {
+    if(i == record || reader->aliases[i] != record) { continue; }
+    if(heir == UINT64_MAX) {
+      heir = i;
+      reader->items[heir] = reader->items[record];
+    }
+    reader->aliases[i] = heir;
+  }
 
-  fflush(stdout);
+  return heir == UINT64_MAX ? reader->items[record] : NULL;
+}
 
-  bool eq = strncmp((const char *)footer, (const char *)SP_FOOTER, sizeof SP_FOOTER) == 0;
+/* Called with the reader locked. */
+static void sp_pack_cache_unlink(sp_pack_reader * reader, sp_pack_cache_item * item) {
+  if(!item->is_cached) { return; }
 
-  return eq;
+  if(item->prev) { item->prev->next = item->next; } else { reader->lru_head = item->next; }
+  if(item->next) { item->next->prev = item->prev; } else { reader->lru_tail = item->prev; }
+  item->prev = item->next = NULL;
+  item->is_cached = false;
 }
 
-bool sp_pack_create(FILE * fp, const sp_pack_content_entry * content, size_t content_len) {
-  assert(content_len > 0 && content != NULL);
-
-  const unsigned char * P = SP_PUMPKIN;
-  SP_SET_BINARY_MODE(fp);
-  sp_pack_file spf = {
-    .header = { P[0], P[1], P[2], P[3], 'S', 'P', 'O', 'O', 'K', 'Y', '!', P[0], P[1], P[2], P[3], '\n' },
-    .version = {
-      .major = SP_PACK_MAJOR_VERSION,
-      .minor = SP_PACK_MINOR_VERSION,
-      .revision = SP_PACK_REVISION_VERSION,
-      .subrevision = SP_PACK_SUBREVISION_VERSION
-    },
-    .content_offset = 0, /* offset that content begins */
-    .content_len = 0, /* content length calculated after content added */
-    .index_entries = 0,
-    .index_offset = 0,
-    .index_len = 0,
-    .hash = { 0 } /* hash calculated after content added */
-  };
+/* Called with the reader locked; the last reference puts the item on the LRU,
+ * or frees it once a reload has replaced it. */
+static void sp_pack_cache_unref(sp_pack_reader * reader, sp_pack_cache_item * item) {
+  assert(item->refs > 0);
+  if(item->refs == 0 || --item->refs > 0 || item->is_pinned) { return; }
+  if(item->is_detached) {
+    if(item->prev) { item->prev->next = item->next; } else { reader->detached = item->next; }
+    if(item->next) { item->next->prev = item->prev; }
+    sp_pack_cache_item_free(reader, item);
+    return;
+  }
+  if(item->is_reloaded || !item->is_counted) { return; }
 
-  assert(SP_ITEM_MAGIC == 0x00706b6e616e6d65);
+  item->prev = NULL;
+  item->next = reader->lru_head;
+  if(reader->lru_head) { reader->lru_head->prev = item; }
+  reader->lru_head = item;
+  if(!reader->lru_tail) { reader->lru_tail = item; }
+  item->is_cached = true;
 
-  bool ret = false;
-  /* Header */
-  fwrite(&spf.header, sizeof(unsigned char), sizeof spf.header, fp);
-  /* Version */
-  sp_write_version(spf.version, fp, NULL);
-  /* Content offset */
-  sp_write_uint64(SP_CONTENT_OFFSET, fp, NULL);
-  /* Content length */
-  sp_write_uint64(spf.content_len, fp, NULL);
-  /* Index entries */
-  long index_entries_loc = ftell(fp);
-  sp_write_uint64(0, fp, NULL);
-  /* Index offset */
-  long index_offset_loc = ftell(fp);
-  sp_write_uint64(0, fp, NULL);
-  /* Index length */
-  long index_len_loc = ftell(fp);
-  sp_write_uint64(0, fp, NULL);
-
-  /* placeholder for content hash */
-  sp_write_hash(spf.hash, sizeof spf.hash / sizeof spf.hash[0], fp, NULL);
+  sp_pack_cache_trim(reader);
+}
 
-  /* Content */
-  fseek(fp, SP_CONTENT_OFFSET, SEEK_SET);
-  /* Write the magic number */
-  sp_write_uint64(SP_ITEM_MAGIC, fp, &spf.content_len);
+/* Called with the reader locked; releases the item's bytes but keeps the
+ * item, so handles and stubs stay valid and reload on next acquire. */
+static void sp_pack_cache_drop(sp_pack_reader * reader, sp_pack_cache_item * item) {
+  sp_pack_item_file * pub = &item->pub;
+  if(item->is_counted) {
+    assert(reader->cache_resident >= pub->data_len);
+    reader->cache_resident -= pub->data_len;
+  }
+  if(!pub->is_mapped) { free(pub->data); }
 
-  /* Actual pak content */
-  assert(content_len < 1024); /* Arbitrary number is arbitrary */
+  pub->data = NULL;
+  pub->data_len = 0;
+  pub->is_mapped = false;
+  pub->is_loaded = false;
+  item->is_counted = false;
+}
 
-  sp_pack_index_entry * entries = calloc(sizeof * entries, content_len);
-  sp_pack_index_entry * entry = NULL;
+/* Called with the reader locked; the item must be unreachable. */
+static void sp_pack_cache_item_free(sp_pack_reader * reader, sp_pack_cache_item * item) {
+  sp_pack_cache_drop(reader, item);
+  free(item), item = NULL;
+}
 
-  long offset = ftell(fp);
-  assert(offset > 0);
+/* Called with the reader locked, once a reload has put another item in this
+ * one's place. Handles, cursors and finds holding it keep its bytes; it's
+ * freed with its last reference, or with the reader when it was found. */
+static void sp_pack_cache_detach(sp_pack_reader * reader, sp_pack_cache_item * item) {
+  sp_pack_cache_unlink(reader, item);
+  item->is_detached = true;
 
-  for(size_t i = 0; i < content_len; i++) {
-    entry = entries + i;
-    const sp_pack_content_entry * e = content + i;
-    /* write the content entry... */
-    sp_write_file(e->path, e->name, fp, &spf.content_len);
-    /* ... and setup the index entry */
-    entry->name = strndup(e->name, SP_MAX_STRING_LEN);
-    entry->offset = (uint64_t)offset;
-    entry->len = spf.content_len - (uint64_t)offset;
-    offset = ftell(fp);
-    assert(offset > 0);
+  if(item->refs == 0 && !item->is_pinned) {
+    sp_pack_cache_item_free(reader, item);
+    return;
   }
 
-  /* Update Content Length */
-  fseek(fp, sizeof spf.header + sizeof spf.version + sizeof SP_CONTENT_OFFSET, SEEK_SET);
-  sp_write_uint64(spf.content_len, fp, NULL);
-
-  fseek(fp, 0, SEEK_SET);
-  fseek(fp, sizeof spf - (sizeof spf.hash / sizeof spf.hash[0]), SEEK_SET);
+  item->prev = NULL;
+  item->next = reader->detached;
+  if(reader->detached) { reader->detached->prev = item; }
+  reader->detached = item;
+}
 
-  /* Write an empty hash to the hash offset */
-  sp_write_hash(spf.hash, sizeof spf.hash / sizeof spf.hash[0], fp, NULL);
+/* Called with the reader locked; evicts least recently released first. */
+static void sp_pack_cache_trim(sp_pack_reader * reader) {
+  if(reader->cache_budget == 0) { return; }
 
-  fseek(fp, 0, SEEK_SET);
-  fseek(fp, SP_CONTENT_OFFSET, SEEK_SET);
+  while(reader->cache_resident > reader->cache_budget && reader->lru_tail) {
+    sp_pack_cache_item * item = reader->lru_tail;
+    sp_pack_cache_unlink(reader, item);
+    sp_pack_cache_drop(reader, item);
+  }
+}
 
-  { /* generate content hash; includes magic */
-    unsigned char * buf = calloc(spf.content_len, sizeof * buf);
-    if(!buf) { abort(); }
+uint64_t sp_pack_reader_get_entry_count(const sp_pack_reader * reader) {
+  return reader && reader->index ? reader->index_entries : 0;
+}
 
-    size_t hir = fread(buf, sizeof * buf, spf.content_len, fp);
-    assert(hir);
-    if(!(hir > 0 && ferror(fp) == 0)) { abort(); }
+sp_pack_integrity sp_pack_reader_get_integrity(const sp_pack_reader * reader) {
+  return reader ? reader->integrity : spi_blake2b;
+}
 
-    assert(hir == spf.content_len);
+errno_t sp_pack_reader_find_entry(const sp_pack_reader * reader, const char * key, size_t key_len, uint64_t * out_index) {
+  if(!reader || !key || !out_index) { return SP_FAILURE; }
 
-    fseek(fp, 0, SEEK_SET);
-    size_t hash_offset = sizeof spf - (sizeof spf.hash / sizeof spf.hash[0]);
-    assert(hash_offset < LONG_MAX);
-    fseek(fp, (long)hash_offset, SEEK_SET);
+  uint64_t offset = 0, len = 0;
+  return sp_pack_reader_lookup(reader, key, key_len, out_index, &offset, &len) ? SP_SUCCESS : SP_FAILURE;
+}
 
-    sp_write_hash(buf, (size_t)spf.content_len, fp, NULL);
+/* Reads and parses index record i's entry; the payload is only there when
+ * the whole entry was asked for. */
+static bool sp_pack_reader_read_entry(sp_pack_reader * reader, uint64_t i, bool whole, unsigned char ** buf, sp_pack_entry_view * entry, uint64_t * out_len) {
+  if(!reader->index || i >= reader->index_entries) { return false; }
 
-    free(buf), buf = NULL;
-  }
+  const unsigned char * record = reader->index + i * SP_INDEX_RECORD_LEN;
+  uint64_t offset = sp_pack_load_uint64(record + 8);
+  uint64_t len = sp_pack_load_uint64(record + 16);
+  if(!sp_pack_range_is_content(reader->content_offset, reader->content_len, reader->segments, reader->segment_count, offset, len)) { return false; }
 
-  /* Write index entries */
-  fseek(fp, 0, SEEK_END);
-  long index_offset = ftell(fp);
-  uint64_t index_len = 0, index_entries = 0;
-  for(size_t i = 0; i < content_len; i++) {
-    sp_pack_index_entry * e = entries + i;
-    sp_write_index_entry(e, fp, &index_len);
-    /* fprintf(stdout, "Index written for %s\n", e->name); */
-    free(e->name), e->name = NULL;
-    (void)sp_read_index_entry;
-    index_entries++;
-  }
+  uint64_t read_len = whole || len < SP_PACK_ENTRY_HEADER_MAX ? len : SP_PACK_ENTRY_HEADER_MAX;
+  const unsigned char * bytes = sp_pack_reader_read_range(reader, offset, read_len, buf);
+  if(!bytes) { return false; }
 
-  fseek(fp, index_entries_loc, SEEK_SET);
-  sp_write_uint64((uint64_t)index_entries, fp, NULL);
-  fseek(fp, index_offset_loc, SEEK_SET);
-  sp_write_uint64((uint64_t)index_offset, fp, NULL);
-  fseek(fp, index_len_loc, SEEK_SET);
-  sp_write_uint64((uint64_t)index_len, fp, NULL);
+  size_t header_len = 0;
+  if(!sp_pack_parse_entry_header(bytes, (size_t)read_len, entry, &header_len)) { return false; }
+  if(entry->compressed_len > len - header_len) { return false; }
 
-  /* SPDB length */
-  fseek(fp, 0, SEEK_END);
-  long file_len_offset = ftell(fp);
-  sp_write_uint64((uint64_t)file_len_offset + sizeof(uint64_t) + sizeof SP_FOOTER, fp, NULL);
+  *out_len = len;
+  return true;
+}
 
-  /* Footer */
-  fwrite(SP_FOOTER, sizeof(unsigned char), sizeof SP_FOOTER, fp);
-  fseek(fp, 0, SEEK_END);
-  long spdb_len = ftell(fp);
-  assert(spdb_len > 0 && spdb_len <= LONG_MAX);
+errno_t sp_pack_reader_get_entry(sp_pack_reader * reader, uint64_t index, sp_pack_entry_info * out_info) {
+  if(!reader || !out_info || !reader->index || index >= reader->index_entries) { return SP_FAILURE; }
 
-  size_t expected_len =
-    sizeof spf  /* header */
-    + (((SP_CONTENT_OFFSET - sizeof spf)) + spf.content_len + index_len)  /* offset of content - header */
-    + ((sizeof(uint64_t) + sizeof SP_FOOTER)) /* (file length + footer marker) */
-    ;
-  assert((size_t)spdb_len == expected_len);
+  /* the key comes from the index, which outlives any read buffer */
+  const unsigned char * record = reader->index + index * SP_INDEX_RECORD_LEN;
+  const unsigned char * pool = reader->index + reader->index_entries * SP_INDEX_RECORD_LEN;
+  uint64_t pool_len = reader->index_len - reader->index_entries * SP_INDEX_RECORD_LEN;
+  uint64_t name_offset = sp_pack_load_uint32(record + 24);
+  uint64_t name_len = sp_pack_load_uint32(record + 28);
+  if(name_offset + name_len >= pool_len || pool[name_offset + name_len] != '\0') { return SP_FAILURE; }
 
-  //fseek(fp, (long)file_len_offset, SEEK_SET);
-  //sp_write_uint64((size_t)spdb_len, fp, NULL);
-  fseek(fp, 0, SEEK_END);
+  unsigned char * buf = NULL;
+  sp_pack_entry_view entry = { 0 };
+  uint64_t len = 0;
+  bool ok = sp_pack_reader_read_entry(reader, index, false, &buf, &entry, &len);
+  free(buf), buf = NULL;
+  if(!ok) { return SP_FAILURE; }
 
-  ret = true;
+  out_info->key = (const char *)(pool + name_offset);
+  out_info->key_len = (size_t)name_len;
+  out_info->len = len;
+  out_info->compressed_len = entry.compressed_len;
+  out_info->decompressed_len = entry.decompressed_len;
+  out_info->codec = entry.codec;
 
-  return ret;
+  return SP_SUCCESS;
 }
 
-errno_t sp_pack_upgrade(FILE * fp, const sp_pack_version * from, const sp_pack_version * to) {
-  (void)fp;
-  (void)from;
-  (void)to;
-  return SP_SUCCESS;
+static double sp_pack_seconds(void) {
+  struct timespec now = { 0 };
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
 }
 
-errno_t sp_pack_print_resources(FILE * dest, FILE * fp) {
-  SP_SET_BINARY_MODE(fp);
-  (void)dest;
-  sp_pack_version version = { 0 };
-  uint64_t content_len = 0;
-  uint64_t content_offset = 0;
-  uint64_t index_entries = 0;
-  uint64_t index_offset = 0;
-  uint64_t index_len = 0;
+errno_t sp_pack_reader_bench_entry(sp_pack_reader * reader, uint64_t index, size_t rounds, double * out_inflate_seconds, double * out_hash_seconds) {
+  if(!reader || !out_inflate_seconds || !out_hash_seconds || rounds == 0) { return SP_FAILURE; }
+  *out_inflate_seconds = *out_hash_seconds = 0;
+
+  pthread_mutex_lock(&reader->lock);
+  sp_z * z = sp_pack_reader_take_z(reader);
+  pthread_mutex_unlock(&reader->lock);
+
+  /* reading (and verifying the chunks) is done once, outside the timings */
+  unsigned char * buf = NULL, * data = NULL;
+  sp_pack_entry_view entry = { 0 };
+  uint64_t len = 0;
+  bool ok = sp_pack_reader_read_entry(reader, index, true, &buf, &entry, &len);
+  if(!ok) { goto err0; }
 
-  unsigned char content_hash[crypto_generichash_BYTES] = { 0 };
-  unsigned char read_content_hash[crypto_generichash_BYTES] = { 0 };
+  data = calloc((size_t)entry.decompressed_len + 1, sizeof * data);
+  if(!data) { abort(); }
 
-  if(fp) {
-    long pak_offset = sp_pack_get_offset(fp);
-    if(pak_offset < 0) { return SP_FAILURE; }
-    fseek(fp, pak_offset, SEEK_SET);
+  double start = sp_pack_seconds();
+  for(size_t i = 0; ok && i < rounds; i++) {
+    ok = sp_pack_decode(z, &reader->workers, entry.codec, entry.payload, (size_t)entry.compressed_len, data, (size_t)entry.decompressed_len);
+  }
+  double inflated = sp_pack_seconds();
+  if(!ok) { goto err0; }
+
+  /* both of the entry's hashes, as a load checks them */
+  unsigned char digest[crypto_generichash_BYTES] = { 0 };
+  for(size_t i = 0; i < rounds; i++) {
+    sp_pack_digest(reader->integrity, entry.payload, (size_t)entry.compressed_len, digest);
+    if(entry.codec != spc_stored) {
+      sp_pack_digest(reader->integrity, data, (size_t)entry.decompressed_len, digest);
+    }
+  }
+  double hashed = sp_pack_seconds();
 
-    if(!sp_read_header(fp)) goto err0;
-    if(!sp_read_version(fp, &version)) goto err1;
-    /* fprintf(dest, "SPDB Version: %i.%i.%i.%i\n", version.major, version.minor, version.revision, version.subrevision); */
-    if(!sp_read_uint64(fp, &content_offset)) goto err2;
-    /* fprintf(dest, "Content offset: %x\n", (unsigned int)content_offset); */
+  pthread_mutex_lock(&reader->lock);
+  sp_pack_reader_give_z(reader, z);
+  pthread_mutex_unlock(&reader->lock);
 
-    if(!sp_read_uint64(fp, &content_len)) goto err3;
-    /* fprintf(dest, "Content length: %lu\n", (size_t)content_len); */
+  *out_inflate_seconds = (inflated - start) / (double)rounds;
+  *out_hash_seconds = (hashed - inflated) / (double)rounds;
 
-    if(!sp_read_uint64(fp, &index_entries)) goto err3;
-    /* fprintf(dest, "Index entries: %lu\n", (size_t)index_entries); */
+  free(data), data = NULL;
+  free(buf), buf = NULL;
+  return SP_SUCCESS;
+
+err0:
+  pthread_mutex_lock(&reader->lock);
+  sp_pack_reader_give_z(reader, z);
+  pthread_mutex_unlock(&reader->lock);
+  free(data), data = NULL;
+  free(buf), buf = NULL;
+  return SP_FAILURE;
+}
 
-    if(!sp_read_uint64(fp, &index_offset)) goto err3;
-    /* fprintf(dest, "Index offset: %lu\n", (size_t)index_offset); */
+errno_t sp_pack_reader_reload(sp_pack_reader * reader, const char * key, size_t key_len, const char * path) {
+  if(!reader || !key || !path) { return SP_FAILURE; }
 
-    if(!sp_read_uint64(fp, &index_len)) goto err3;
-    /* fprintf(dest, "Index length: %lu\n", (size_t)index_len); */
+  uint64_t record = 0, offset = 0, len = 0;
+  if(!sp_pack_reader_lookup(reader, key, key_len, &record, &offset, &len)) { return SP_FAILURE; }
 
-    if(!sp_read_hash(fp, content_hash, crypto_generichash_BYTES)) goto err4;
-    char * content_hash_out = sp_pack_encode_binary_data(content_hash, sizeof content_hash / sizeof content_hash[0]);
-    /* fprintf(dest, "Saved hash: <%s>\n", content_hash_out); */
-    free(content_hash_out), content_hash_out = NULL;
+  unsigned char * data = NULL;
+  size_t data_len = 0;
+  if(!sp_pack_read_source(path, &data, &data_len)) { return SP_FAILURE; }
 
-    fseek(fp, pak_offset + (long)content_offset, SEEK_SET);
-    {
-      /* generate read content hash */
-      unsigned char * buf = calloc(content_len, sizeof * buf);
-      if(!buf) { abort(); }
+  sp_pack_cache_item * item = calloc(1, sizeof * item);
+  if(!item) { abort(); }
 
-      size_t hir = fread(buf, sizeof * buf, content_len, fp);
-      assert(hir && hir == content_len);
-      if(!(hir > 0 && ferror(fp) == 0)) { abort(); }
+  item->pub.reader = reader;
+  item->pub.offset = offset;
+  item->pub.len = len;
+  item->pub.data = (char *)data;
+  item->pub.data_len = data_len;
+  item->pub.is_loaded = true;
+  item->is_reloaded = true;
+  item->is_counted = true;
 
-      crypto_generichash(read_content_hash, crypto_generichash_BYTES, buf, (size_t)content_len, NULL, 0);
+  /* The record gets a new item rather than new bytes in its old one, so
+   * nothing holding the old item sees its bytes change or go away. */
+  pthread_mutex_lock(&reader->lock);
 
-      char * saved_content_hash_out = sp_pack_encode_binary_data(read_content_hash, sizeof read_content_hash / sizeof read_content_hash[0]);
-      /* fprintf(dest, "Calculated hash: <%s>\n", saved_content_hash_out); */
-      free(saved_content_hash_out), saved_content_hash_out = NULL;
+  sp_pack_cache_item * replaced = sp_pack_reader_unalias(reader, record);
+  reader->items[record] = item;
+  reader->cache_resident += data_len;
+  if(replaced) { sp_pack_cache_detach(reader, replaced); }
 
-      free(buf), buf = NULL;
-    }
+  pthread_mutex_unlock(&reader->lock);
 
-    for(size_t i = 0; i < crypto_generichash_BYTES; i++) {
-      if(content_hash[i] != read_content_hash[i]) { goto err5; }
-    }
+  return SP_SUCCESS;
+}
 
-    fseek(fp, pak_offset + (long)content_offset, SEEK_SET);
+/* Verifies [offset, offset + len) of the pak and returns it: in place from
+ * the mapping, or read into a fresh *buf. Safe from any thread. */
+static const unsigned char * sp_pack_reader_read_range(sp_pack_reader * reader, uint64_t offset, uint64_t len, unsigned char ** buf) {
+  assert(buf);
 
-    uint64_t magic = 0;
-    if(!sp_read_uint64(fp, &magic)) { goto err5; }
-    if(magic != SP_ITEM_MAGIC) { goto err5; }
-    assert(magic == SP_ITEM_MAGIC);
+  if(len == 0 || len > SIZE_MAX || reader->pak_offset < 0) { return NULL; }
+  if(!sp_pack_reader_verify_range(reader, offset, len)) { return NULL; }
 
-    /* fprintf(dest, "Magic: 0x%" PRIx64 "\n", magic); */
+  uint64_t start = (uint64_t)reader->pak_offset + offset;
+  if(reader->map) {
+    if(start > reader->map_len || len > reader->map_len - start) { return NULL; }
+    return reader->map + start;
+  }
 
-    sp_pack_print_file_stats(fp);
-    sp_pack_print_file_stats(fp);
-    //sp_pack_print_file_stats(fp);
-    sp_pack_print_file_stats(fp);
-    sp_pack_print_file_stats(fp);
+  if(!reader->fp || start > LONG_MAX) { return NULL; }
 
-    fseek(fp, 0, SEEK_END);
-    long saved_file_len = ftell(fp);
-    assert(saved_file_len > 0 && saved_file_len <= LONG_MAX);
-    /* fprintf(dest, "Calculated SPDB size: %lu\n", saved_file_len); */
+  free(*buf);
+  *buf = malloc((size_t)len);
+  if(!*buf) { abort(); }
 
-    fseek(fp, pak_offset, SEEK_SET);
-    /* read content length */
-    fseek(fp, pak_offset + (long)((content_offset + content_len + index_len)), SEEK_SET);
+  pthread_mutex_lock(&reader->io_lock);
+  bool is_read = fseek(reader->fp, (long)start, SEEK_SET) == 0 && sp_read_raw(reader->fp, (size_t)len, *buf);
+  pthread_mutex_unlock(&reader->io_lock);
 
-    uint64_t file_len = 0;
-    sp_read_uint64(fp, &file_len);
-    /* fprintf(dest, "Saved SPDB size: %lu\n", (size_t)file_len); */
-    assert((long)file_len == saved_file_len - pak_offset);
+  return is_read ? *buf : NULL;
+}
 
-    /* read footer */
-    fseek(fp, pak_offset + (long)((content_offset + content_len + index_len + sizeof(uint64_t))), SEEK_SET);
-    if(!sp_read_footer(fp)) goto err3;
+errno_t sp_pack_cursor_open(sp_pack_reader * reader, const char * key, size_t key_len, sp_pack_cursor ** out_cursor) {
+  if(!reader || !key || !out_cursor) { return SP_FAILURE; }
+  *out_cursor = NULL;
+
+  uint64_t record = 0, offset = 0, len = 0;
+  if(!sp_pack_reader_lookup(reader, key, key_len, &record, &offset, &len)) { return SP_FAILURE; }
+
+  sp_pack_cursor * cursor = calloc(1, sizeof * cursor);
+  if(!cursor) { abort(); }
+  cursor->reader = reader;
+  cursor->block_index = UINT64_MAX;
+
+  pthread_mutex_lock(&reader->lock);
+
+  /* resident (or reloaded) items are read as they are */
+  if(reader->aliases) { record = reader->aliases[record]; }
+  bool is_resident = reader->items[record] && reader->items[record]->pub.is_loaded;
+  pthread_mutex_unlock(&reader->lock);
+
+  /* the entry's header and block table are read once, then each block as it's needed */
+  unsigned char * buf = NULL;
+  sp_pack_entry_view entry = { 0 };
+  size_t header_len = 0;
+  uint64_t prefix_len = len < SP_PACK_ENTRY_HEADER_MAX ? len : SP_PACK_ENTRY_HEADER_MAX;
+  const unsigned char * bytes = is_resident ? NULL : sp_pack_reader_read_range(reader, offset, prefix_len, &buf);
+  bool is_blocked = bytes
+    && sp_pack_parse_entry_header(bytes, (size_t)prefix_len, &entry, &header_len)
+    && entry.codec == spc_zlib_blocks
+    && entry.compressed_len <= len - header_len;
+
+  bool ok = true;
+  if(is_blocked) {
+    uint64_t payload_offset = offset + header_len;
+    bytes = sp_pack_reader_read_range(reader, payload_offset, SP_PACK_BLOCK_HEADER_LEN, &buf);
+    uint64_t table_len = bytes ? SP_PACK_BLOCK_HEADER_LEN + (uint64_t)sp_pack_load_uint32(bytes + 4) * sizeof(uint32_t) : 0;
+    ok = bytes
+      && table_len <= entry.compressed_len
+      && (bytes = sp_pack_reader_read_range(reader, payload_offset, table_len, &buf)) != NULL
+      && sp_pack_parse_blocks(bytes, (size_t)table_len, entry.compressed_len, entry.decompressed_len, &cursor->blocks);
+    cursor->blocks_offset = payload_offset + cursor->blocks.data_offset;
   }
 
-  /* fprintf(dest, "Valid SPDB v%hu.%hu.%hu.%hu: ", version.major, version.minor, version.revision, version.subrevision); */
-  char * out = sp_pack_encode_binary_data(content_hash, sizeof content_hash / sizeof content_hash[0]);
-  /* fprintf(dest, "<%s>\n", out); */
-  free(out), out = NULL;
+  free(buf), buf = NULL;
+  if(!ok) { goto err0; }
+
+  if(is_blocked) {
+    cursor->len = entry.decompressed_len;
+    cursor->z = sp_z_create();
+    cursor->block = malloc(cursor->blocks.block_size);
+    if(!cursor->block) { abort(); }
+  } else {
+    /* everything else is small enough to load whole */
+    if(sp_pack_acquire(reader, key, key_len, &cursor->file) != SP_SUCCESS) { goto err0; }
+    cursor->data = (const unsigned char *)cursor->file->data;
+    cursor->len = cursor->file->data_len;
+  }
 
+  *out_cursor = cursor;
   return SP_SUCCESS;
 
 err0:
-  fprintf(stderr, "Invalid header\n");
-  return SP_FAILURE;
-err1:
-  fprintf(stderr, "Invalid version\n");
-  return SP_FAILURE;
-err2:
-  fprintf(stderr, "Invalid content offset\n");
-  return SP_FAILURE;
-err3:
-  fprintf(stderr, "Invalid content length\n");
+  fprintf(stderr, "Unable to open resource at offset %" PRIu64 ".\n", offset);
+  sp_pack_cursor_close(cursor), cursor = NULL;
   return SP_FAILURE;
-err4:
-  fprintf(stderr, "Invalid footer\n");
-  return SP_FAILURE;
-err5:
-  fprintf(stderr, "Unable to validate resource content. This is a fatal error :(\n");
-  return SP_FAILURE;
-}
-
-char * sp_pack_encode_binary_data(const unsigned char * bin_data, size_t bin_data_len) {
-  size_t max_len = sodium_base64_ENCODED_LEN(bin_data_len, sodium_base64_VARIANT_ORIGINAL_NO_PADDING);
-  char * out = malloc(max_len);
-  sodium_bin2base64(out, max_len, bin_data, bin_data_len, sodium_base64_VARIANT_ORIGINAL_NO_PADDING);
-  return out;
 }
 
-void sp_pack_print_file_stats(FILE * fp) {
-  sp_pack_item_bin_file file;
-  if(!sp_read_file(fp, &file)) goto err;
-
-  char * encoded_decompressed_hash = sp_pack_encode_binary_data(file.decompressed_hash, sizeof file.decompressed_hash / sizeof file.decompressed_hash[0]);
-  char * encoded_compressed_hash = sp_pack_encode_binary_data(file.compressed_hash, sizeof file.compressed_hash / sizeof file.compressed_hash[0]);
+static bool sp_pack_cursor_load_block(sp_pack_cursor * cursor, uint64_t i) {
+  sp_pack_reader * reader = cursor->reader;
+  const sp_pack_blocks * blocks = &cursor->blocks;
 
-  fprintf(stdout, "%s@%s [%lu -> %lu] <%s>; <%s>\n", file.key, file.file_path, (size_t)file.decompressed_len, (size_t)file.compressed_len, encoded_decompressed_hash, encoded_compressed_hash);
+  cursor->block_index = UINT64_MAX;
 
-  free(encoded_decompressed_hash), encoded_decompressed_hash = NULL;
-  free(encoded_compressed_hash), encoded_compressed_hash = NULL;
+  const unsigned char * src = sp_pack_reader_read_range(reader, cursor->blocks_offset + blocks->offsets[i], blocks->offsets[i + 1] - blocks->offsets[i], &cursor->encoded);
 
-  return;
+  if(!src || !sp_pack_decode_block(cursor->z, blocks, i, src, cursor->block)) {
+    fprintf(stderr, "Unable to load block %" PRIu64 " of a resource.\n", i);
+    return false;
+  }
 
-err:
-  fprintf(stderr, "Pack contents corrupt. Skipping.\n");
-  return;
+  cursor->block_index = i;
+  return true;
 }
 
-errno_t sp_pack_is_valid_pak_file(FILE * fp, long * pak_offset, uint64_t * content_offset, uint64_t * content_len, uint64_t * index_entries,  uint64_t * index_offset, uint64_t * index_len) {
-  SP_SET_BINARY_MODE(fp);
-
-  if(!content_offset || !content_len) { abort(); }
-  sp_pack_file spf = {
-    .header = { 0 },
-    .version = { 0 },
-    .content_offset = 0,
-    .content_len = 0,
-    .index_entries = 0,
-    .index_offset = 0,
-    .index_len = 0,
-    .hash = { 0 }
-  };
+size_t sp_pack_cursor_read(sp_pack_cursor * cursor, void * dest, size_t len) {
+  if(!cursor || !dest) { return 0; }
 
-  long pak_file_offset = sp_pack_get_offset(fp);
-  if(pak_file_offset < 0) { goto err; }
-  if(pak_offset) { *pak_offset = pak_file_offset; }
+  size_t done = 0;
+  while(done < len && cursor->pos < cursor->len) {
+    const unsigned char * src = NULL;
+    uint64_t available = 0;
+    if(cursor->file) {
+      src = cursor->data + cursor->pos;
+      available = cursor->len - cursor->pos;
+    } else {
+      uint64_t i = cursor->pos / cursor->blocks.block_size;
+      if(i != cursor->block_index && !sp_pack_cursor_load_block(cursor, i)) { break; }
 
-  fseek(fp, *pak_offset, SEEK_SET);
+      uint64_t within = cursor->pos - i * cursor->blocks.block_size;
+      src = cursor->block + within;
+      available = sp_pack_block_len(&cursor->blocks, i) - within;
+    }
 
-  unsigned char content_hash[crypto_generichash_BYTES] = { 0 };
-  unsigned char read_content_hash[crypto_generichash_BYTES] = { 0 };
+    size_t n = available < len - done ? (size_t)available : len - done;
+    memcpy((unsigned char *)dest + done, src, n);
+    done += n;
+    cursor->pos += n;
+  }
 
-  if(!sp_read_header(fp)) goto err;
-  if(!sp_read_version(fp, &spf.version)) goto err;
-  assert(spf.version.major == SP_PACK_MAJOR_VERSION
-      && spf.version.minor == SP_PACK_MINOR_VERSION
-      && spf.version.revision == SP_PACK_REVISION_VERSION
-      && spf.version.subrevision == SP_PACK_SUBREVISION_VERSION
-      );
+  return done;
+}
 
-  if(!sp_read_uint64(fp, &spf.content_offset)) goto err;
-  assert(spf.content_offset == SP_CONTENT_OFFSET);
-  assert(spf.content_offset > 0 && spf.content_offset <= LONG_MAX);
+errno_t sp_pack_cursor_seek(sp_pack_cursor * cursor, uint64_t offset) {
+  if(!cursor || offset > cursor->len) { return SP_FAILURE; }
+  cursor->pos = offset;
+  return SP_SUCCESS;
+}
 
-  if(!sp_read_uint64(fp, &spf.content_len)) goto err;
-  assert(spf.content_len > 0 && spf.content_len <= LONG_MAX);
+uint64_t sp_pack_cursor_tell(const sp_pack_cursor * cursor) {
+  return cursor ? cursor->pos : 0;
+}
 
-  if(!sp_read_uint64(fp, &spf.index_entries)) goto err;
-  if(!sp_read_uint64(fp, &spf.index_offset)) goto err;
-  if(!sp_read_uint64(fp, &spf.index_len)) goto err;
+uint64_t sp_pack_cursor_len(const sp_pack_cursor * cursor) {
+  return cursor ? cursor->len : 0;
+}
 
-  if(!sp_read_hash(fp, content_hash, crypto_generichash_BYTES)) goto err;
+void sp_pack_cursor_close(sp_pack_cursor * cursor) {
+  if(!cursor) { return; }
 
-  fseek(fp, *pak_offset + (long)(spf.content_offset), SEEK_SET);
-  {
-    /* generate read content hash */
-    unsigned char * buf = calloc(spf.content_len, sizeof * buf);
-    if(!buf) { abort(); }
+  cursor->data = NULL;
+  sp_pack_release(cursor->file), cursor->file = NULL;
+  sp_pack_blocks_free(&cursor->blocks);
+  sp_z_free(cursor->z), cursor->z = NULL;
+  free(cursor->block), cursor->block = NULL;
+  free(cursor->encoded), cursor->encoded = NULL;
+  free(cursor), cursor = NULL;
+}
 
-    size_t hir = fread(buf, sizeof * buf, spf.content_len, fp);
-    assert(hir && hir == spf.content_len);
+static void * sp_pack_stream_worker(void * arg) {
+  sp_pack_stream * stream = arg;
 
-    if(!(hir > 0 && ferror(fp) == 0)) { abort(); }
+  for(;;) {
+    pthread_mutex_lock(&stream->lock);
+    while(!stream->requests && !stream->is_stopping) {
+      pthread_cond_wait(&stream->cond, &stream->lock);
+    }
+    if(stream->is_stopping) {
+      pthread_mutex_unlock(&stream->lock);
+      break;
+    }
 
-    crypto_generichash(read_content_hash, crypto_generichash_BYTES, buf, (size_t)(spf.content_len), NULL, 0);
+    sp_pack_stream_request * request = stream->requests;
+    stream->requests = request->next;
+    if(!stream->requests) { stream->requests_tail = NULL; }
+    pthread_mutex_unlock(&stream->lock);
 
-    free(buf), buf = NULL;
-  }
+    /* reads, verifies and inflates off the owning thread */
+    request->result = sp_pack_acquire(stream->reader, request->key, request->key_len, &request->file);
 
-  for(size_t i = 0; i < crypto_generichash_BYTES; i++) {
-    if(content_hash[i] != read_content_hash[i]) { goto err; }
+    sp_pack_stream_request * head = atomic_load_explicit(&stream->completions, memory_order_relaxed);
+    do {
+      request->next = head;
+    } while(!atomic_compare_exchange_weak_explicit(&stream->completions, &head, request, memory_order_release, memory_order_relaxed));
   }
 
-  uint64_t magic = 0;
-  fseek(fp, *pak_offset + (long)(spf.content_offset), SEEK_SET);
-  sp_read_uint64(fp, &magic);
-  if(magic != SP_ITEM_MAGIC) { goto err; }
-  assert(magic == SP_ITEM_MAGIC);
-
-  *content_offset = spf.content_offset;
-  *content_len = spf.content_len;
-  *index_entries = spf.index_entries;
-  *index_offset = spf.index_offset;
-  *index_len = spf.index_len;
-
-  return SP_SUCCESS;
-
-err:
-  return SP_FAILURE;
+  return NULL;
 }
 
-long sp_pack_get_offset(FILE * fp) {
-  fseek(fp, 0, SEEK_END);
-
-  long file_len = ftell(fp);
-  assert(file_len >= 0 && (size_t)file_len <= SIZE_MAX);
-
-  fseek(fp, file_len - (long)(sizeof SP_FOOTER), SEEK_SET);
-  if(!sp_read_footer(fp)) goto err;
+sp_pack_stream * sp_pack_stream_create(sp_pack_reader * reader) {
+  if(!reader) { return NULL; }
 
-  fseek(fp, file_len - (long)(sizeof SP_FOOTER + sizeof(uint64_t)), SEEK_SET);
+  sp_pack_stream * stream = calloc(1, sizeof * stream);
+  if(!stream) { abort(); }
 
-  uint64_t pak_file_len = 0;
-  if(!sp_read_uint64(fp, &pak_file_len)) goto err;
-  assert(pak_file_len <= LONG_MAX);
+  stream->reader = reader;
+  atomic_init(&stream->completions, NULL);
+  pthread_mutex_init(&stream->lock, NULL);
+  pthread_cond_init(&stream->cond, NULL);
 
-  long pak_file_offset = file_len - (long)pak_file_len;
-
-  return pak_file_offset;
+  if(pthread_create(&stream->worker, NULL, sp_pack_stream_worker, stream) != 0) {
+    pthread_cond_destroy(&stream->cond);
+    pthread_mutex_destroy(&stream->lock);
+    free(stream), stream = NULL;
+    return NULL;
+  }
 
-err:
-  return -1;
+  return stream;
 }
 
-errno_t sp_pack_verify(FILE * fp, const sp_hash_table * hash) {
-  if(!fp) { return SP_FAILURE; }
-  if(!hash) { return SP_FAILURE; }
-
-  SP_SET_BINARY_MODE(fp);
+errno_t sp_pack_stream_request_item(sp_pack_stream * stream, const char * key, size_t key_len, sp_pack_stream_callback callback, void * user_data) {
+  if(!stream || !key || !callback) { return SP_FAILURE; }
 
-  uint64_t content_offset = 0;
-  uint64_t content_len = 0;
+  sp_pack_stream_request * request = calloc(1, sizeof * request);
+  if(!request) { abort(); }
 
-  uint64_t index_entries = 0;
-  uint64_t index_offset = 0;
-  uint64_t index_len = 0;
+  request->key = strndup(key, key_len);
+  if(!request->key) { abort(); }
+  request->key_len = key_len;
+  request->callback = callback;
+  request->user_data = user_data;
 
-  long pak_offset = -1;
-  errno_t is_valid = sp_pack_is_valid_pak_file(fp, &pak_offset, &content_offset, &content_len, &index_entries, &index_offset, &index_len);
-  if(is_valid != SP_SUCCESS) { goto err5; }
+  pthread_mutex_lock(&stream->lock);
+  if(stream->requests_tail) {
+    stream->requests_tail->next = request;
+  } else {
+    stream->requests = request;
+  }
+  stream->requests_tail = request;
+  pthread_cond_signal(&stream->cond);
+  pthread_mutex_unlock(&stream->lock);
 
-  fseek(fp, pak_offset + (long)content_offset, SEEK_SET);
+  return SP_SUCCESS;
+}
 
-  uint64_t magic = 0;
-  if(!sp_read_uint64(fp, &magic)) { goto err2; }
-  if(magic != SP_ITEM_MAGIC) { goto err2; }
-  assert(magic == SP_ITEM_MAGIC);
+size_t sp_pack_stream_drain(sp_pack_stream * stream) {
+  if(!stream) { return 0; }
 
-  for(int i = 0; i < 4; i++) {
-    sp_pack_item_bin_file file = { 0 };
-    sp_pack_item_file * pub = calloc(1, sizeof * pub);
+  sp_pack_stream_request * request = atomic_exchange_explicit(&stream->completions, NULL, memory_order_acquire);
 
-    if(!sp_read_file(fp, &file)) { goto err2; }
-    pub->data = file.data;
-    pub->data_len = file.decompressed_len;
-    hash->ensure(hash, file.key, strnlen(file.key, SP_MAX_STRING_LEN), pub, NULL);
+  /* the stack hands completions back newest first; restore request order */
+  sp_pack_stream_request * ordered = NULL;
+  while(request) {
+    sp_pack_stream_request * next = request->next;
+    request->next = ordered;
+    ordered = request;
+    request = next;
   }
 
-  sp_pack_index_entry entry;
-  for(uint64_t i = 0; i < index_entries; i++) {
-    sp_read_index_entry(fp, &entry);
+  size_t drained = 0;
+  while(ordered) {
+    sp_pack_stream_request * next = ordered->next;
+    ordered->callback(ordered->key, ordered->file, ordered->result, ordered->user_data);
+    sp_pack_release(ordered->file);
+
+    free(ordered->key), ordered->key = NULL;
+    free(ordered), ordered = next;
+    drained++;
   }
 
-  fseek(fp, 0, SEEK_END);
-  long saved_file_len = ftell(fp);
-  assert(saved_file_len > 0 && saved_file_len <= LONG_MAX);
+  return drained;
+}
+
+void sp_pack_stream_free(sp_pack_stream * stream) {
+  if(!stream) { return; }
+
+  pthread_mutex_lock(&stream->lock);
+  stream->is_stopping = true;
+  pthread_cond_signal(&stream->cond);
+  pthread_mutex_unlock(&stream->lock);
+  pthread_join(stream->worker, NULL);
+
+  /* requests that never ran, or never drained, are dropped without a callback */
+  sp_pack_stream_request * lists[2] = { stream->requests, atomic_load(&stream->completions) };
+  for(size_t i = 0; i < sizeof lists / sizeof lists[0]; i++) {
+    sp_pack_stream_request * request = lists[i];
+    while(request) {
+      sp_pack_stream_request * next = request->next;
+      sp_pack_release(request->file);
+      free(request->key), request->key = NULL;
+      free(request), request = next;
+    }
+  }
 
-  /* read content length */
-  fseek(fp, pak_offset + (long)((content_offset + content_len + index_len)), SEEK_SET);
+  pthread_cond_destroy(&stream->cond);
+  pthread_mutex_destroy(&stream->lock);
+  free(stream), stream = NULL;
+}
 
-  uint64_t file_len = 0;
-  sp_read_uint64(fp, &file_len);
-  assert((long)file_len == saved_file_len - pak_offset);
+void sp_pack_reader_free(sp_pack_reader * reader) {
+  if(!reader) { return; }
 
-  /* read footer */
-  fseek(fp, pak_offset + (long)((content_offset + content_len + index_len + sizeof(uint64_t))), SEEK_SET);
-  if(!sp_read_footer(fp)) { goto err3; }
+  sp_pack_block_workers_free(&reader->workers);
 
-  return SP_SUCCESS;
+  for(size_t i = 0; i < reader->spare_z_count; i++) {
+    sp_z_free(reader->spare_z[i]), reader->spare_z[i] = NULL;
+  }
+  reader->spare_z_count = 0;
+  free(reader->dictionary), reader->dictionary = NULL;
+  free(reader->chunk_hashes), reader->chunk_hashes = NULL;
+  free(reader->chunk_verified), reader->chunk_verified = NULL;
+  free(reader->segments), reader->segments = NULL;
+  if(reader->items) {
+    for(uint64_t i = 0; i < reader->index_entries; i++) {
+      sp_pack_cache_item * item = reader->items[i];
+      if(!item) { continue; }
+
+      /* mapped entries point into the pak mapping, released below */
+      if(!item->pub.is_mapped) { free(item->pub.data); }
+      free(item), reader->items[i] = NULL;
+    }
+    free(reader->items), reader->items = NULL;
+  }
+  while(reader->detached) {
+    sp_pack_cache_item * item = reader->detached;
+    reader->detached = item->next;
+    if(!item->pub.is_mapped) { free(item->pub.data); }
+    free(item), item = NULL;
+  }
+  free(reader->aliases), reader->aliases = NULL;
 
-err2:
-  fprintf(stderr, "Invalid content offset\n");
-  return SP_FAILURE;
-err3:
-  fprintf(stderr, "Invalid content length\n");
-  return SP_FAILURE;
+  free(reader->index_buf), reader->index_buf = NULL;
+  reader->index = NULL, reader->perfect_hash = NULL;
 
-err5:
-  fprintf(stderr, "Unable to validate resource content. This is a fatal error :(\n");
-  return SP_FAILURE;
+  /* the reader does not own its FILE */
+  if(reader->map) {
+    munmap((void *)(uintptr_t)reader->map, reader->map_len);
+    reader->map = NULL, reader->map_len = 0;
+  }
+  pthread_mutex_destroy(&reader->io_lock);
+  pthread_cond_destroy(&reader->loaded);
+  pthread_mutex_destroy(&reader->lock);
+  free(reader), reader = NULL;
 }
 
 #define MAX_TEST_STACK_BUFFER_SZ 1024
@@ -1783,6 +4787,877 @@ static void sp_read_int64_tests() {
   assert(expected == result);
 }
 
+static void sp_pack_writer_tests() {
+  static const char hello_world[] = "Hello, world!";
+  unsigned char hash[crypto_generichash_BYTES] = { 0 };
+  for(size_t i = 0; i < sizeof hash; i++) { hash[i] = (unsigned char)i; }
+
+  sp_pack_writer writer = { 0 };
+  sp_pack_writer_put_uint8(&writer, 0xff);
+  sp_pack_writer_put_uint16(&writer, 0x0102);
+  sp_pack_writer_put_uint32(&writer, 0x01020304);
+  sp_pack_writer_put_uint64(&writer, 0x0102030405060708);
+  sp_pack_writer_put_hash(&writer, hash);
+  sp_pack_writer_put_string(&writer, hello_world);
+  sp_pack_writer_put_string(&writer, "");
+  sp_pack_writer_put_zeros(&writer, 3);
+
+  size_t expected_len = 1 + 2 + 4 + 8 + (1 + sizeof hash) + (8 + strlen(hello_world) + 1) + (8 + 1) + 3;
+  assert(writer.len == expected_len);
+
+  /* little endian, same as the stdio writers, string lengths included */
+  assert(writer.data[0] == 0xff);
+  assert(writer.data[1] == 0x02 && writer.data[2] == 0x01);
+  assert(writer.data[3] == 0x04 && writer.data[6] == 0x01);
+  assert(writer.data[7] == 0x08 && writer.data[14] == 0x01);
+  size_t string_at = 1 + 2 + 4 + 8 + 1 + sizeof hash;
+  assert(writer.data[string_at] == strlen(hello_world) && sp_pack_load_uint64(writer.data + string_at) == strlen(hello_world));
+
+  sp_pack_view view = { .data = writer.data, .len = writer.len, .pos = 0 };
+  uint8_t u8 = 0;
+  uint16_t u16 = 0;
+  uint32_t u32 = 0;
+  uint64_t u64 = 0;
+  const unsigned char * read_hash = NULL;
+  const char * str = NULL;
+  size_t str_len = 0;
+
+  assert(sp_pack_view_get_uint8(&view, &u8) && u8 == 0xff);
+  assert(sp_pack_view_get_uint16(&view, &u16) && u16 == 0x0102);
+  assert(sp_pack_view_get_uint32(&view, &u32) && u32 == 0x01020304);
+  assert(sp_pack_view_get_uint64(&view, &u64) && u64 == 0x0102030405060708);
+  assert(sp_pack_view_get_hash(&view, &read_hash) && memcmp(read_hash, hash, sizeof hash) == 0);
+  assert(sp_pack_view_get_string(&view, &str, &str_len) && str_len == strlen(hello_world) && strcmp(str, hello_world) == 0);
+  assert(sp_pack_view_get_string(&view, &str, &str_len) && str_len == 0 && *str == '\0');
+
+  /* lengths past the limit are rejected before they're cast */
+  unsigned char long_string[9] = { 0 };
+  sp_pack_store_uint64(long_string, (uint64_t)1 << 40);
+  sp_pack_view long_view = { .data = long_string, .len = sizeof long_string, .pos = 0 };
+  assert(!sp_pack_view_get_string(&long_view, &str, &str_len));
+
+  /* reads past the end fail and leave the cursor alone */
+  size_t pos = view.pos;
+  assert(!sp_pack_view_get_uint32(&view, &u32));
+  assert(view.pos == pos);
+  assert(sp_pack_view_get_raw(&view, 3, &read_hash));
+  assert(!sp_pack_view_get_uint8(&view, &u8));
+
+  /* flushing hands the whole buffer to stdio at once */
+  unsigned char buf[MAX_TEST_STACK_BUFFER_SZ] = { 0 };
+  FILE * fp = fmemopen(buf, sizeof buf, "rb+");
+  assert(fp);
+
+  uint64_t content_len = 0;
+  assert(sp_pack_writer_flush(&writer, fp, &content_len));
+  assert(content_len == expected_len && writer.len == 0);
+  assert(fflush(fp) == 0);
+  assert(fclose(fp) == 0);
+
+  assert(buf[0] == 0xff && buf[1] == 0x02);
+
+  sp_pack_writer_free(&writer);
+  assert(!writer.data && writer.cap == 0);
+}
+
+static void sp_pack_codec_tests() {
+  static const sp_pack_codec codecs[] = { spc_auto, spc_stored, spc_zlib, spc_lz };
+
+  unsigned char text[MAX_TEST_STACK_BUFFER_SZ] = { 0 };
+  unsigned char noise[MAX_TEST_STACK_BUFFER_SZ] = { 0 };
+  uint32_t x = 0x5eed;
+  for(size_t i = 0; i < MAX_TEST_STACK_BUFFER_SZ; i++) {
+    text[i] = (unsigned char)("spooky pumpkin "[i % 15]);
+    x ^= x << 13, x ^= x >> 17, x ^= x << 5; /* xorshift32 */
+    noise[i] = (unsigned char)(x >> 24);
+  }
+
+  const unsigned char * inputs[] = { text, noise, text };
+  const size_t input_lens[] = { sizeof text, sizeof noise, 7 };
+
+  /* one context for every round trip; its streams are reset between them */
+  sp_z * z = sp_z_create();
+  for(size_t i = 0; i < sizeof inputs / sizeof inputs[0]; i++) {
+    for(size_t c = 0; c < sizeof codecs / sizeof codecs[0]; c++) {
+      sp_pack_codec codec = codecs[c];
+      unsigned char * encoded = NULL;
+      size_t encoded_len = 0;
+
+      bool res = sp_pack_encode(z, &codec, inputs[i], input_lens[i], &encoded, &encoded_len);
+      assert(res);
+      assert(codec != spc_auto);
+      /* an encoding is never larger than the input */
+      assert(encoded_len <= input_lens[i]);
+      assert((codec == spc_stored) == (encoded == NULL));
+
+      unsigned char decoded[MAX_TEST_STACK_BUFFER_SZ] = { 0 };
+      res = sp_pack_decode(z, NULL, codec, encoded ? encoded : inputs[i], encoded_len, decoded, input_lens[i]);
+      assert(res);
+      assert(memcmp(decoded, inputs[i], input_lens[i]) == 0);
+
+      free(encoded), encoded = NULL;
+    }
+  }
+
+  /* repetitive text compresses; noise and tiny inputs are stored */
+  sp_pack_codec codec = spc_auto;
+  unsigned char * encoded = NULL;
+  size_t encoded_len = 0;
+  sp_pack_encode(z, &codec, text, sizeof text, &encoded, &encoded_len);
+  assert(codec == spc_zlib);
+
+  /* a failed inflate doesn't poison the context for the next entry */
+  unsigned char inflated[MAX_TEST_STACK_BUFFER_SZ] = { 0 };
+  assert(!sp_pack_decode(z, NULL, spc_zlib, encoded, encoded_len / 2, inflated, sizeof text));
+  assert(sp_pack_decode(z, NULL, spc_zlib, encoded, encoded_len, inflated, sizeof text));
+  assert(memcmp(inflated, text, sizeof text) == 0);
+  free(encoded), encoded = NULL;
+
+  codec = spc_auto;
+  sp_pack_encode(z, &codec, noise, sizeof noise, &encoded, &encoded_len);
+  assert(codec == spc_stored && encoded_len == sizeof noise);
+
+  /* truncated input must be rejected, not overrun */
+  codec = spc_lz;
+  sp_pack_encode(z, &codec, text, sizeof text, &encoded, &encoded_len);
+  assert(codec == spc_lz);
+  unsigned char decoded[MAX_TEST_STACK_BUFFER_SZ] = { 0 };
+  assert(!sp_pack_decode(z, NULL, spc_lz, encoded, encoded_len / 2, decoded, sizeof text));
+  free(encoded), encoded = NULL;
+
+  sp_z_free(z), z = NULL;
+}
+
+static void sp_pack_block_tests() {
+  /* text, then a block and a half of noise */
+  size_t len = SP_PACK_BLOCK_ENTRY_MIN + SP_PACK_BLOCK_SIZE / 2;
+  size_t noise_start = len - SP_PACK_BLOCK_SIZE - SP_PACK_BLOCK_SIZE / 2;
+  unsigned char * src = malloc(len);
+  assert(src);
+  uint32_t x = 0x5eed;
+  for(size_t i = 0; i < len; i++) {
+    x ^= x << 13, x ^= x >> 17, x ^= x << 5; /* xorshift32 */
+    src[i] = i < noise_start ? (unsigned char)("spooky pumpkin "[i % 15]) : (unsigned char)(x >> 24);
+  }
+
+  sp_z * z = sp_z_create();
+  sp_pack_codec codec = spc_auto;
+  unsigned char * encoded = NULL;
+  size_t encoded_len = 0;
+  bool res = sp_pack_encode(z, &codec, src, len, &encoded, &encoded_len);
+  assert(res && codec == spc_zlib_blocks && encoded_len < len);
+
+  /* five blocks, the last half full; the noise blocks are stored */
+  sp_pack_blocks blocks = { 0 };
+  res = sp_pack_parse_blocks(encoded, encoded_len, encoded_len, len, &blocks);
+  assert(res && blocks.block_size == SP_PACK_BLOCK_SIZE && blocks.block_count == 5);
+  assert(sp_pack_block_len(&blocks, 4) == SP_PACK_BLOCK_SIZE / 2);
+  assert(!(blocks.lens[0] & SP_PACK_BLOCK_STORED) && (blocks.lens[4] & SP_PACK_BLOCK_STORED));
+
+  /* any block inflates on its own */
+  unsigned char * block = malloc(SP_PACK_BLOCK_SIZE);
+  assert(block);
+  for(uint64_t i = 0; i < blocks.block_count; i++) {
+    res = sp_pack_decode_block(z, &blocks, i, encoded + blocks.data_offset + blocks.offsets[i], block);
+    assert(res && memcmp(block, src + i * SP_PACK_BLOCK_SIZE, sp_pack_block_len(&blocks, i)) == 0);
+  }
+  free(block), block = NULL;
+  sp_pack_blocks_free(&blocks);
+
+  /* and all of them together */
+  unsigned char * decoded = malloc(len);
+  assert(decoded);
+  res = sp_pack_decode(z, NULL, spc_zlib_blocks, encoded, encoded_len, decoded, len);
+  assert(res && memcmp(decoded, src, len) == 0);
+
+  /* shared out to workers, which stay up between payloads */
+  sp_pack_block_workers workers;
+  sp_pack_block_workers_init(&workers);
+  for(int round = 0; round < 2; round++) {
+    memset(decoded, 0, len);
+    res = sp_pack_decode(z, &workers, spc_zlib_blocks, encoded, encoded_len, decoded, len);
+    assert(res && memcmp(decoded, src, len) == 0);
+  }
+  assert(workers.is_started && !workers.job && workers.active == 0);
+  sp_pack_block_workers_free(&workers);
+
+  /* truncated payloads and the wrong length are rejected */
+  assert(!sp_pack_decode(z, NULL, spc_zlib_blocks, encoded, encoded_len - 1, decoded, len));
+  assert(!sp_pack_decode(z, NULL, spc_zlib_blocks, encoded, encoded_len, decoded, len - 1));
+  free(decoded), decoded = NULL;
+  free(encoded), encoded = NULL;
+
+  /* below the threshold spc_auto deflates as a whole */
+  codec = spc_auto;
+  sp_pack_encode(z, &codec, src, SP_PACK_BLOCK_ENTRY_MIN - 1, &encoded, &encoded_len);
+  assert(codec == spc_zlib);
+  free(encoded), encoded = NULL;
+
+  sp_z_free(z), z = NULL;
+  free(src), src = NULL;
+}
+
+static void sp_pack_dictionary_tests() {
+  /* small config blobs that share most of their text */
+  static const char * names[] = { "pumpkin", "ghost", "candle", "cauldron", "broom", "lantern", "spider", "raven", "skull", "bat" };
+  static const size_t names_len = sizeof names / sizeof names[0];
+
+  char texts[sizeof names / sizeof names[0]][256] = { { 0 } };
+  const unsigned char * samples[sizeof names / sizeof names[0]] = { 0 };
+  size_t sample_lens[sizeof names / sizeof names[0]] = { 0 };
+  for(size_t i = 0; i < names_len; i++) {
+    int len = snprintf(texts[i], sizeof texts[i], "[menu.item.%s]\ntitle = \"A spooky %s\"\nvisible = true\nenabled = true\nshortcut = none\n", names[i], names[i]);
+    assert(len > 0 && (size_t)len < sizeof texts[i]);
+    samples[i] = (const unsigned char *)texts[i];
+    sample_lens[i] = (size_t)len;
+  }
+
+  unsigned char dictionary[1024] = { 0 };
+  size_t dictionary_len = 0;
+  assert(sp_dict_train(samples, sample_lens, 1, dictionary, sizeof dictionary, &dictionary_len) == SP_FAILURE);
+  assert(sp_dict_train(samples, sample_lens, names_len - 1, dictionary, sizeof dictionary, &dictionary_len) == SP_SUCCESS);
+  assert(dictionary_len > 0 && dictionary_len <= sizeof dictionary);
+
+  /* an unseen entry encodes smaller against the dictionary */
+  sp_z * z = sp_z_create();
+  const unsigned char * src = samples[names_len - 1];
+  size_t src_len = sample_lens[names_len - 1];
+
+  sp_pack_codec codec = spc_auto;
+  unsigned char * plain = NULL;
+  size_t plain_len = 0;
+  assert(sp_pack_encode(z, &codec, src, src_len, &plain, &plain_len));
+  assert(codec == spc_zlib || codec == spc_stored);
+
+  sp_z_set_dictionary(z, dictionary, dictionary_len);
+  codec = spc_auto;
+  unsigned char * encoded = NULL;
+  size_t encoded_len = 0;
+  assert(sp_pack_encode(z, &codec, src, src_len, &encoded, &encoded_len));
+  assert(codec == spc_zlib_dict && encoded_len < plain_len);
+
+  unsigned char decoded[256] = { 0 };
+  assert(sp_pack_decode(z, NULL, codec, encoded, encoded_len, decoded, src_len));
+  assert(memcmp(decoded, src, src_len) == 0);
+
+  /* ... and can't be decoded without it */
+  sp_z * bare = sp_z_create();
+  assert(!sp_pack_decode(bare, NULL, codec, encoded, encoded_len, decoded, src_len));
+  sp_z_free(bare), bare = NULL;
+
+  free(encoded), encoded = NULL;
+  free(plain), plain = NULL;
+  sp_z_free(z), z = NULL;
+}
+
+static void sp_pack_index_tests() {
+  static const size_t entries_len = 200;
+  static unsigned char buf[MAX_TEST_STACK_BUFFER_SZ * 16] = { 0 };
+
+  sp_pack_index_entry * entries = calloc(entries_len + 1, sizeof * entries);
+  assert(entries);
+  for(size_t i = 0; i < entries_len; i++) {
+    entries[i].name = calloc(16, sizeof(char));
+    assert(entries[i].name);
+    snprintf(entries[i].name, 16, "key.%zu", i);
+    entries[i].offset = SP_CONTENT_OFFSET + i * 16;
+    entries[i].len = 16;
+  }
+  /* a later duplicate is dropped from the index */
+  entries[entries_len].name = strdup("key.7");
+  entries[entries_len].offset = SP_CONTENT_OFFSET;
+  entries[entries_len].len = 1;
+
+  FILE * fp = fmemopen(buf, sizeof buf, "rb+");
+  assert(fp);
+
+  uint64_t index_entries = 0, index_len = 0, perfect_hash_len = 0;
+  bool res = sp_write_index(entries, entries_len + 1, fp, &index_entries, &index_len);
+  assert(res && index_entries == entries_len);
+  res = sp_write_perfect_hash(entries, entries_len + 1, index_entries, fp, &perfect_hash_len);
+  assert(res && perfect_hash_len == 2 * sizeof(uint32_t) + 2 * entries_len * sizeof(uint32_t));
+  fflush(fp);
+
+  sp_pack_reader reader = {
+    .content_offset = SP_CONTENT_OFFSET,
+    .content_len = entries_len * 16,
+    .index_entries = index_entries,
+    .index_len = index_len,
+    .index = buf,
+    .perfect_hash = buf + index_len
+  };
+
+  /* the perfect hash and the binary search agree on every key */
+  for(size_t pass = 0; pass < 2; pass++) {
+    for(size_t i = 0; i < entries_len; i++) {
+      char key[16] = { 0 };
+      snprintf(key, sizeof key, "key.%zu", i);
+
+      uint64_t record = 0, offset = 0, len = 0;
+      res = sp_pack_reader_lookup(&reader, key, strlen(key), &record, &offset, &len);
+      assert(res && record < index_entries);
+      assert(offset == SP_CONTENT_OFFSET + i * 16 && len == 16);
+
+      uint64_t index = 0;
+      assert(sp_pack_reader_find_entry(&reader, key, strlen(key), &index) == SP_SUCCESS && index == record);
+    }
+
+    uint64_t record = 0, offset = 0, len = 0;
+    assert(!sp_pack_reader_lookup(&reader, "key.200", strlen("key.200"), &record, &offset, &len));
+    assert(!sp_pack_reader_lookup(&reader, "", 0, &record, &offset, &len));
+
+    reader.perfect_hash = NULL;
+  }
+
+  fclose(fp);
+  for(size_t i = 0; i <= entries_len; i++) {
+    free(entries[i].name), entries[i].name = NULL;
+  }
+  free(entries), entries = NULL;
+}
+
+static void sp_pack_segment_tests() {
+  unsigned char segments[2 * SP_SEGMENT_RECORD_LEN] = { 0 };
+  sp_pack_store_uint64(segments, 0x1000);
+  sp_pack_store_uint64(segments + 8, 0x100);
+  sp_pack_store_uint64(segments + SP_SEGMENT_RECORD_LEN, 0x2000);
+  sp_pack_store_uint64(segments + SP_SEGMENT_RECORD_LEN + 8, 0x10);
+
+  /* the original content */
+  assert(sp_pack_range_is_content(SP_CONTENT_OFFSET, 0x200, segments, 2, SP_CONTENT_OFFSET, 0x200));
+  assert(sp_pack_range_is_content(SP_CONTENT_OFFSET, 0x200, NULL, 0, 0x2f0, 0x10));
+  assert(!sp_pack_range_is_content(SP_CONTENT_OFFSET, 0x200, NULL, 0, 0x2f0, 0x11));
+  assert(!sp_pack_range_is_content(SP_CONTENT_OFFSET, 0x200, NULL, 0, 0xff, 0x10));
+
+  /* appended segments, but not the garbage between them */
+  assert(sp_pack_range_is_content(SP_CONTENT_OFFSET, 0x200, segments, 2, 0x1000, 0x100));
+  assert(sp_pack_range_is_content(SP_CONTENT_OFFSET, 0x200, segments, 2, 0x2008, 0x8));
+  assert(!sp_pack_range_is_content(SP_CONTENT_OFFSET, 0x200, segments, 1, 0x2008, 0x8));
+  assert(!sp_pack_range_is_content(SP_CONTENT_OFFSET, 0x200, segments, 2, 0x10f0, 0x20));
+  assert(!sp_pack_range_is_content(SP_CONTENT_OFFSET, 0x200, segments, 2, 0x1800, 0x8));
+  assert(!sp_pack_range_is_content(SP_CONTENT_OFFSET, 0x200, segments, 2, 0x2008, UINT64_MAX));
+}
+
+static void sp_pack_integrity_tests() {
+  static const unsigned char check[] = "123456789";
+  unsigned char digest[crypto_generichash_BYTES] = { 0 };
+  unsigned char zeros[crypto_generichash_BYTES] = { 0 };
+
+  /* the CRC-32C check value, then zeros */
+  sp_pack_digest(spi_crc32c, check, sizeof check - 1, digest);
+  assert(sp_pack_load_uint32(digest) == 0xe3069283);
+  assert(memcmp(digest + 4, zeros, sizeof zeros - 4) == 0);
+  assert(sp_crc32c(sp_crc32c(0, check, 4), check + 4, 5) == 0xe3069283);
+
+  sp_pack_digest(spi_blake2b, check, sizeof check - 1, digest);
+  assert(memcmp(digest, zeros, sizeof zeros) != 0);
+
+  sp_pack_digest(spi_none, check, sizeof check - 1, digest);
+  assert(memcmp(digest, zeros, sizeof zeros) == 0);
+
+  assert(strcmp(sp_pack_integrity_name(spi_crc32c), "crc32c") == 0);
+}
+
+static void sp_pack_dedupe_tests() {
+  sp_pack_blobs blobs = { 0 };
+  sp_pack_blobs_init(&blobs, 4);
+
+  unsigned char a[crypto_generichash_BYTES] = { 0 }, b[crypto_generichash_BYTES] = { 0 };
+  crypto_generichash(a, sizeof a, (const unsigned char *)"a", 1, NULL, 0);
+  crypto_generichash(b, sizeof b, (const unsigned char *)"b", 1, NULL, 0);
+
+  /* first writes take a free slot; the same content finds it again */
+  sp_pack_blob * blob = sp_pack_blobs_find(&blobs, a, 1);
+  assert(blob->len == 0);
+  sp_pack_blob_set(blob, a, 1, 0x108, 0x60);
+  assert(sp_pack_blobs_find(&blobs, a, 1) == blob);
+  assert(sp_pack_blobs_find(&blobs, b, 1)->len == 0);
+  assert(sp_pack_blobs_find(&blobs, a, 2)->len == 0);
+  sp_pack_blobs_free(&blobs);
+
+  /* records 0 and 3 share content, as do 1 and 4 */
+  static const uint64_t offsets[5] = { 0x200, 0x108, 0x300, 0x200, 0x108 };
+  unsigned char index[5 * SP_INDEX_RECORD_LEN] = { 0 };
+  for(size_t i = 0; i < 5; i++) {
+    sp_pack_store_uint64(index + i * SP_INDEX_RECORD_LEN + 8, offsets[i]);
+  }
+
+  uint64_t * aliases = sp_pack_reader_find_aliases(index, 5);
+  assert(aliases);
+  assert(aliases[0] == 0 && aliases[1] == 1 && aliases[2] == 2 && aliases[3] == 0 && aliases[4] == 1);
+  free(aliases), aliases = NULL;
+
+  assert(sp_pack_reader_find_aliases(index, 3) == NULL);
+}
+
+static void sp_pack_cache_tests() {
+  sp_pack_reader reader = { 0 };
+  pthread_mutex_init(&reader.lock, NULL);
+  reader.cache_budget = 8;
+
+  /* three resident 4-byte items, all in use */
+  sp_pack_cache_item items[3] = { 0 };
+  for(size_t i = 0; i < 3; i++) {
+    items[i].pub.reader = &reader;
+    items[i].pub.data = strdup("abcd");
+    items[i].pub.data_len = 4;
+    items[i].pub.is_loaded = true;
+    items[i].is_counted = true;
+    items[i].refs = 1;
+    reader.cache_resident += 4;
+  }
+
+  /* in-use items are never evicted, even over budget */
+  sp_pack_cache_trim(&reader);
+  assert(reader.cache_resident == 12);
+
+  /* released items are evicted least recently released first */
+  sp_pack_release(&items[0].pub);
+  assert(!items[0].pub.is_loaded && !items[0].pub.data && reader.cache_resident == 8);
+  sp_pack_release(&items[1].pub);
+  sp_pack_release(&items[2].pub);
+  assert(items[1].pub.is_loaded && items[2].pub.is_loaded && reader.cache_resident == 8);
+  sp_pack_reader_set_cache_budget(&reader, 4);
+  assert(!items[1].pub.is_loaded && items[2].pub.is_loaded && reader.cache_resident == 4);
+  assert(reader.lru_head == &items[2] && reader.lru_tail == &items[2]);
+
+  /* a retained item leaves the LRU; a zero budget never evicts */
+  sp_pack_cache_unlink(&reader, &items[2]);
+  items[2].refs++;
+  assert(!reader.lru_head && !reader.lru_tail);
+  reader.cache_budget = 0;
+  sp_pack_release(&items[2].pub);
+  assert(items[2].pub.is_loaded && reader.lru_head == &items[2]);
+
+  for(size_t i = 0; i < 3; i++) { free(items[i].pub.data); }
+  pthread_mutex_destroy(&reader.lock);
+}
+
+static void sp_pack_trailer_tests() {
+  unsigned char buf[SP_PACK_PREAMBLE_LEN + 64] = { 0 };
+  long pak_offset = -1;
+  uint64_t pak_len = 0;
+
+  /* a pak taking the last 300 bytes of the file */
+  sp_pack_store_uint64(buf + sizeof buf - SP_TRAILER_LEN, 300);
+  memcpy(buf + sizeof buf - SP_FOOTER_LEN, SP_FOOTER, sizeof SP_FOOTER);
+  FILE * fp = fmemopen(buf, sizeof buf, "rb");
+  assert(sp_pack_read_trailer(fp, &pak_offset, &pak_len) == SP_SUCCESS);
+  assert(pak_offset == (long)(sizeof buf - 300) && pak_len == 300);
+  fclose(fp);
+
+  /* longer than the file, or too short for a header */
+  sp_pack_store_uint64(buf + sizeof buf - SP_TRAILER_LEN, sizeof buf + 1);
+  fp = fmemopen(buf, sizeof buf, "rb");
+  assert(sp_pack_get_offset(fp) == -1);
+  fclose(fp);
+
+  sp_pack_store_uint64(buf + sizeof buf - SP_TRAILER_LEN, SP_TRAILER_LEN);
+  fp = fmemopen(buf, sizeof buf, "rb");
+  assert(sp_pack_get_offset(fp) == -1);
+  fclose(fp);
+
+  /* no footer, and files too short to hold a trailer */
+  fp = fmemopen(buf, sizeof buf - 1, "rb");
+  assert(sp_pack_get_offset(fp) == -1);
+  fclose(fp);
+
+  fp = fmemopen(buf + sizeof buf - SP_FOOTER_LEN, SP_FOOTER_LEN, "rb");
+  assert(sp_pack_get_offset(fp) == -1);
+  fclose(fp);
+}
+
+/* A temp file of len generated bytes, differing by seed; the caller unlinks
+ * path, which must end in XXXXXX. */
+static void sp_pack_test_source(char * path, size_t len, unsigned char seed) {
+  unsigned char * data = malloc(len);
+  assert(data);
+  for(size_t i = 0; i < len; i++) {
+    data[i] = (unsigned char)(seed + i / 64 + (i * i) % 7);
+  }
+
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+  FILE * fp = fdopen(fd, "wb");
+  assert(fp);
+  size_t written = fwrite(data, 1, len, fp);
+  assert(written == len);
+  fclose(fp);
+  free(data), data = NULL;
+}
+
+static bool sp_pack_test_matches(const char * path, const void * data, size_t len) {
+  unsigned char * expected = NULL;
+  size_t expected_len = 0;
+  if(!sp_pack_read_source(path, &expected, &expected_len)) { return false; }
+
+  bool matches = expected_len == len && memcmp(expected, data, len) == 0;
+  free(expected), expected = NULL;
+  return matches;
+}
+
+static void sp_pack_reload_tests() {
+  char source_path[] = "/tmp/sp_pack_testXXXXXX", reload_path[] = "/tmp/sp_pack_testXXXXXX";
+  sp_pack_test_source(source_path, 64 << 10, 1);
+  sp_pack_test_source(reload_path, 100, 2);
+
+  sp_pack_content_entry content[2] = {
+    { .path = source_path, .name = "a", .codec = spc_zlib },
+    { .path = source_path, .name = "b", .codec = spc_zlib }
+  };
+  sp_pack_create_options options = { .jobs = 1, .chunk_size = 4096 };
+  FILE * fp = tmpfile();
+  bool ok = fp && sp_pack_create_ex(fp, content, 2, &options);
+  assert(ok);
+
+  sp_pack_reader * reader = NULL;
+  errno_t res = sp_pack_verify_ex(fp, &reader, spvm_lazy);
+  assert(res == SP_SUCCESS);
+
+  /* a cursor and a handle opened before the reload keep the old bytes */
+  unsigned char * read = malloc(64 << 10);
+  assert(read);
+  sp_pack_cursor * cursor = NULL;
+  sp_pack_item_file * before = NULL;
+  res = sp_pack_cursor_open(reader, "a", 1, &cursor);
+  assert(res == SP_SUCCESS);
+  size_t read_len = sp_pack_cursor_read(cursor, read, 1000);
+  assert(read_len == 1000);
+  res = sp_pack_acquire(reader, "a", 1, &before);
+  assert(res == SP_SUCCESS);
+
+  res = sp_pack_reader_reload(reader, "a", 1, reload_path);
+  assert(res == SP_SUCCESS);
+
+  read_len = sp_pack_cursor_read(cursor, read + 1000, 64 << 10);
+  assert(read_len == (64 << 10) - 1000);
+  assert(sp_pack_test_matches(source_path, read, 64 << 10));
+  assert(sp_pack_test_matches(source_path, before->data, before->data_len));
+  sp_pack_cursor_close(cursor), cursor = NULL;
+
+  /* later acquires see the reloaded bytes; b, packed as a copy of a, doesn't */
+  sp_pack_item_file * after = NULL, * copy = NULL;
+  res = sp_pack_acquire(reader, "a", 1, &after);
+  assert(res == SP_SUCCESS);
+  assert(after != before && sp_pack_test_matches(reload_path, after->data, after->data_len));
+  res = sp_pack_acquire(reader, "b", 1, &copy);
+  assert(res == SP_SUCCESS);
+  assert(copy == before && sp_pack_test_matches(source_path, copy->data, copy->data_len));
+  sp_pack_release(copy), copy = NULL;
+  sp_pack_release(before), before = NULL;
+
+  /* and b reloads on its own too */
+  res = sp_pack_reader_reload(reader, "b", 1, reload_path);
+  assert(res == SP_SUCCESS);
+  res = sp_pack_acquire(reader, "b", 1, &copy);
+  assert(res == SP_SUCCESS);
+  assert(copy != after && sp_pack_test_matches(reload_path, copy->data, copy->data_len));
+  sp_pack_release(copy), copy = NULL;
+
+  /* reloading again frees the unreferenced first reload */
+  sp_pack_release(after), after = NULL;
+  res = sp_pack_reader_reload(reader, "a", 1, source_path);
+  assert(res == SP_SUCCESS);
+  res = sp_pack_acquire(reader, "a", 1, &after);
+  assert(res == SP_SUCCESS);
+  assert(sp_pack_test_matches(source_path, after->data, after->data_len));
+  sp_pack_release(after), after = NULL;
+  assert(!reader->detached);
+
+  free(read), read = NULL;
+  sp_pack_reader_free(reader), reader = NULL;
+  fclose(fp);
+  unlink(source_path);
+  unlink(reload_path);
+}
+
+static long sp_pack_test_file_len(FILE * fp) {
+  fseek(fp, 0, SEEK_END);
+  return ftell(fp);
+}
+
+static bool sp_pack_test_find(sp_pack_reader * reader, const char * key, const char * path) {
+  sp_pack_item_file * file = NULL;
+  if(sp_pack_find(reader, key, strlen(key), &file) != SP_SUCCESS) { return false; }
+  return sp_pack_test_matches(path, file->data, file->data_len);
+}
+
+static void sp_pack_file_tests() {
+  char a_path[] = "/tmp/sp_pack_testXXXXXX", b_path[] = "/tmp/sp_pack_testXXXXXX", c_path[] = "/tmp/sp_pack_testXXXXXX";
+  sp_pack_test_source(a_path, 20000, 3);
+  sp_pack_test_source(b_path, 30000, 4);
+  sp_pack_test_source(c_path, 10000, 5);
+
+  sp_pack_content_entry content[2] = {
+    { .path = a_path, .name = "a", .codec = spc_auto },
+    { .path = b_path, .name = "b", .codec = spc_lz }
+  };
+  sp_pack_create_options options = { .jobs = 2, .chunk_size = 4096 };
+  FILE * fp = tmpfile();
+  bool ok = fp && sp_pack_create_ex(fp, content, 2, &options);
+  assert(ok);
+
+  /* a replaced and c added in an appended segment */
+  sp_pack_content_entry more[2] = {
+    { .path = c_path, .name = "a", .codec = spc_zlib },
+    { .path = c_path, .name = "c", .codec = spc_auto }
+  };
+  ok = sp_pack_append(fp, more, 2, &options);
+  assert(ok);
+
+  sp_pack_reader * reader = NULL;
+  errno_t res = sp_pack_verify_ex(fp, &reader, spvm_full);
+  assert(res == SP_SUCCESS);
+  assert(sp_pack_reader_get_entry_count(reader) == 3);
+  ok = sp_pack_test_find(reader, "a", c_path) && sp_pack_test_find(reader, "b", b_path) && sp_pack_test_find(reader, "c", c_path);
+  assert(ok);
+  sp_pack_item_file * file = NULL;
+  res = sp_pack_find(reader, "d", 1, &file);
+  assert(res == SP_FAILURE && !file);
+  sp_pack_reader_free(reader), reader = NULL;
+
+  /* compaction drops the replaced a, and keeps every live key */
+  FILE * compacted = tmpfile();
+  ok = compacted && sp_pack_compact(fp, compacted, NULL);
+  assert(ok);
+  long compacted_len = sp_pack_test_file_len(compacted), fp_len = sp_pack_test_file_len(fp);
+  assert(compacted_len < fp_len);
+
+  res = sp_pack_verify_ex(compacted, &reader, spvm_lazy);
+  assert(res == SP_SUCCESS);
+  assert(sp_pack_reader_get_entry_count(reader) == 3);
+  ok = sp_pack_test_find(reader, "a", c_path) && sp_pack_test_find(reader, "b", b_path) && sp_pack_test_find(reader, "c", c_path);
+  assert(ok);
+  sp_pack_reader_free(reader), reader = NULL;
+
+  fclose(compacted);
+  fclose(fp);
+  unlink(a_path);
+  unlink(b_path);
+  unlink(c_path);
+}
+
+static void sp_pack_verify_file_tests() {
+  char a_path[] = "/tmp/sp_pack_testXXXXXX", b_path[] = "/tmp/sp_pack_testXXXXXX";
+  sp_pack_test_source(a_path, 16384, 6);
+  sp_pack_test_source(b_path, 16384, 7);
+
+  /* stored, so each entry spans chunks of its own */
+  sp_pack_content_entry content[2] = {
+    { .path = a_path, .name = "a", .codec = spc_stored },
+    { .path = b_path, .name = "b", .codec = spc_stored }
+  };
+  sp_pack_create_options options = { .jobs = 1, .chunk_size = 4096 };
+  FILE * fp = tmpfile();
+  bool ok = fp && sp_pack_create_ex(fp, content, 2, &options);
+  assert(ok);
+
+  /* flip a byte in the middle of b */
+  sp_pack_reader * reader = NULL;
+  uint64_t record = 0;
+  errno_t res = sp_pack_verify_ex(fp, &reader, spvm_full);
+  assert(res == SP_SUCCESS);
+  res = sp_pack_reader_find_entry(reader, "b", 1, &record);
+  assert(res == SP_SUCCESS);
+  const unsigned char * index = reader->index + record * SP_INDEX_RECORD_LEN;
+  long at = reader->pak_offset + (long)(sp_pack_load_uint64(index + 8) + sp_pack_load_uint64(index + 16) / 2);
+  sp_pack_reader_free(reader), reader = NULL;
+
+  fseek(fp, at, SEEK_SET);
+  int c = fgetc(fp);
+  assert(c != EOF);
+  fseek(fp, at, SEEK_SET);
+  fputc(c ^ 0xff, fp);
+  fflush(fp);
+
+  /* full verification rejects the pak; lazy only the entry over the bad chunk */
+  res = sp_pack_verify_ex(fp, &reader, spvm_full);
+  assert(res == SP_FAILURE);
+  sp_pack_reader_free(reader), reader = NULL;
+
+  res = sp_pack_verify_ex(fp, &reader, spvm_lazy);
+  assert(res == SP_SUCCESS);
+  sp_pack_item_file * file = NULL;
+  ok = sp_pack_test_find(reader, "a", a_path);
+  assert(ok);
+  res = sp_pack_find(reader, "b", 1, &file);
+  assert(res == SP_FAILURE);
+  sp_pack_reader_free(reader), reader = NULL;
+
+  fclose(fp);
+  unlink(a_path);
+  unlink(b_path);
+}
+
+static void sp_pack_cursor_file_tests() {
+  /* five blocks, the last one partial */
+  size_t len = 4 * SP_PACK_BLOCK_SIZE + 1000;
+  char big_path[] = "/tmp/sp_pack_testXXXXXX", small_path[] = "/tmp/sp_pack_testXXXXXX";
+  sp_pack_test_source(big_path, len, 8);
+  sp_pack_test_source(small_path, 3000, 9);
+
+  sp_pack_content_entry content[2] = {
+    { .path = big_path, .name = "big", .codec = spc_zlib_blocks },
+    { .path = small_path, .name = "small", .codec = spc_zlib }
+  };
+  sp_pack_create_options options = { .jobs = 2, .chunk_size = 65536 };
+  FILE * fp = tmpfile();
+  bool ok = fp && sp_pack_create_ex(fp, content, 2, &options);
+  assert(ok);
+
+  unsigned char * expected = NULL;
+  size_t expected_len = 0;
+  ok = sp_pack_read_source(big_path, &expected, &expected_len);
+  assert(ok && expected_len == len);
+
+  sp_pack_reader * reader = NULL;
+  errno_t res = sp_pack_verify_ex(fp, &reader, spvm_lazy);
+  assert(res == SP_SUCCESS);
+
+  sp_pack_cursor * cursor = NULL;
+  res = sp_pack_cursor_open(reader, "big", 3, &cursor);
+  assert(res == SP_SUCCESS);
+  assert(sp_pack_cursor_len(cursor) == len && !cursor->file);
+
+  /* reads straddling block boundaries, backwards and forwards */
+  unsigned char buf[4096] = { 0 };
+  size_t read_len = 0;
+  static const uint64_t starts[4] = { 3 * SP_PACK_BLOCK_SIZE - 100, SP_PACK_BLOCK_SIZE - 2000, 0, 4 * SP_PACK_BLOCK_SIZE - 3500 };
+  for(size_t i = 0; i < sizeof starts / sizeof starts[0]; i++) {
+    res = sp_pack_cursor_seek(cursor, starts[i]);
+    assert(res == SP_SUCCESS);
+    read_len = sp_pack_cursor_read(cursor, buf, sizeof buf);
+    assert(read_len == sizeof buf);
+    assert(memcmp(buf, expected + starts[i], sizeof buf) == 0);
+    assert(sp_pack_cursor_tell(cursor) == starts[i] + sizeof buf);
+  }
+
+  /* short at the end, and no seeking past it */
+  res = sp_pack_cursor_seek(cursor, len - 10);
+  assert(res == SP_SUCCESS);
+  read_len = sp_pack_cursor_read(cursor, buf, sizeof buf);
+  assert(read_len == 10 && memcmp(buf, expected + len - 10, 10) == 0);
+  read_len = sp_pack_cursor_read(cursor, buf, sizeof buf);
+  assert(read_len == 0);
+  res = sp_pack_cursor_seek(cursor, len + 1);
+  assert(res == SP_FAILURE);
+
+  /* a reload mid-read leaves the cursor on the pak's bytes */
+  res = sp_pack_cursor_seek(cursor, 0);
+  assert(res == SP_SUCCESS);
+  read_len = sp_pack_cursor_read(cursor, buf, sizeof buf);
+  assert(read_len == sizeof buf);
+  res = sp_pack_reader_reload(reader, "big", 3, small_path);
+  assert(res == SP_SUCCESS);
+  res = sp_pack_cursor_seek(cursor, 2 * SP_PACK_BLOCK_SIZE);
+  assert(res == SP_SUCCESS);
+  read_len = sp_pack_cursor_read(cursor, buf, sizeof buf);
+  assert(read_len == sizeof buf);
+  assert(memcmp(buf, expected + 2 * SP_PACK_BLOCK_SIZE, sizeof buf) == 0);
+  sp_pack_cursor_close(cursor), cursor = NULL;
+
+  res = sp_pack_cursor_open(reader, "big", 3, &cursor);
+  assert(res == SP_SUCCESS);
+  assert(sp_pack_cursor_len(cursor) == 3000);
+  sp_pack_cursor_close(cursor), cursor = NULL;
+  sp_pack_reader_free(reader), reader = NULL;
+
+  /* whole loads share the blocks out to the reader's workers */
+  res = sp_pack_verify_ex(fp, &reader, spvm_full);
+  assert(res == SP_SUCCESS);
+  sp_pack_item_file * file = NULL;
+  res = sp_pack_acquire(reader, "big", 3, &file);
+  assert(res == SP_SUCCESS);
+  assert(file->data_len == len && memcmp(file->data, expected, len) == 0);
+  sp_pack_release(file), file = NULL;
+  sp_pack_reader_free(reader), reader = NULL;
+
+  free(expected), expected = NULL;
+  fclose(fp);
+  unlink(big_path);
+  unlink(small_path);
+}
+
+typedef struct sp_pack_test_stream {
+  const char * const * keys;
+  const char * const * paths;
+  size_t completed;
+  size_t failed;
+} sp_pack_test_stream;
+
+static void sp_pack_test_stream_callback(const char * key, sp_pack_item_file * file, errno_t result, void * user_data) {
+  sp_pack_test_stream * test = user_data;
+
+  /* completions come back in request order */
+  size_t i = test->completed++;
+  assert(strcmp(key, test->keys[i]) == 0);
+  if(!test->paths[i]) {
+    assert(result == SP_FAILURE && !file);
+    test->failed++;
+    return;
+  }
+  assert(result == SP_SUCCESS && sp_pack_test_matches(test->paths[i], file->data, file->data_len));
+}
+
+static void sp_pack_stream_tests() {
+  char a_path[] = "/tmp/sp_pack_testXXXXXX", b_path[] = "/tmp/sp_pack_testXXXXXX";
+  sp_pack_test_source(a_path, 50000, 10);
+  sp_pack_test_source(b_path, 70000, 11);
+
+  sp_pack_content_entry content[2] = {
+    { .path = a_path, .name = "a", .codec = spc_zlib },
+    { .path = b_path, .name = "b", .codec = spc_lz }
+  };
+  sp_pack_create_options options = { .jobs = 1, .chunk_size = 4096 };
+  FILE * fp = tmpfile();
+  bool ok = fp && sp_pack_create_ex(fp, content, 2, &options);
+  assert(ok);
+
+  sp_pack_reader * reader = NULL;
+  errno_t res = sp_pack_verify_ex(fp, &reader, spvm_lazy);
+  assert(res == SP_SUCCESS);
+
+  static const char * const keys[4] = { "b", "missing", "a", "b" };
+  const char * const paths[4] = { b_path, NULL, a_path, b_path };
+  sp_pack_test_stream test = { .keys = keys, .paths = paths, .completed = 0, .failed = 0 };
+
+  sp_pack_stream * stream = sp_pack_stream_create(reader);
+  assert(stream);
+  for(size_t i = 0; i < 4; i++) {
+    res = sp_pack_stream_request_item(stream, keys[i], strlen(keys[i]), sp_pack_test_stream_callback, &test);
+    assert(res == SP_SUCCESS);
+  }
+
+  /* the owning thread finds alongside the worker */
+  ok = sp_pack_test_find(reader, "a", a_path);
+  assert(ok);
+
+  struct timespec pause = { .tv_sec = 0, .tv_nsec = 1000000 };
+  while(test.completed < 4) {
+    sp_pack_stream_drain(stream);
+    if(test.completed < 4) { nanosleep(&pause, NULL); }
+  }
+  size_t drained = sp_pack_stream_drain(stream);
+  assert(test.failed == 1 && drained == 0);
+
+  /* both entries stay loaded, and the drained handles were released: a is
+   * pinned by the find, b back on the LRU list */
+  sp_pack_stream_free(stream), stream = NULL;
+  for(size_t i = 0; i < 2; i++) {
+    uint64_t record = 0;
+    res = sp_pack_reader_find_entry(reader, content[i].name, 1, &record);
+    assert(res == SP_SUCCESS);
+    const sp_pack_cache_item * item = reader->items[record];
+    assert(item && item->pub.data && item->refs == 0);
+    assert(i == 0 ? item->is_pinned : item->is_cached);
+  }
+
+  sp_pack_reader_free(reader), reader = NULL;
+  fclose(fp);
+  unlink(a_path);
+  unlink(b_path);
+}
+
 void sp_pack_tests() {
   sp_write_char_tests();
 
@@ -1815,5 +5690,21 @@ void sp_pack_tests() {
   sp_read_int32_tests();
   sp_read_uint64_tests();
   sp_read_int64_tests();
+
+  sp_pack_writer_tests();
+  sp_pack_codec_tests();
+  sp_pack_block_tests();
+  sp_pack_dictionary_tests();
+  sp_pack_index_tests();
+  sp_pack_segment_tests();
+  sp_pack_trailer_tests();
+  sp_pack_integrity_tests();
+  sp_pack_dedupe_tests();
+  sp_pack_cache_tests();
+  sp_pack_reload_tests();
+  sp_pack_file_tests();
+  sp_pack_verify_file_tests();
+  sp_pack_cursor_file_tests();
+  sp_pack_stream_tests();
 }
 
@@ -0,0 +1,93 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "../include/sp_pak_rw.h"
+
+static sp_pack_cursor * sp_pack_rw_get_cursor(SDL_RWops * rw) {
+  return rw->hidden.unknown.data1;
+}
+
+static Sint64 sp_pack_rw_size(SDL_RWops * rw) {
+  uint64_t len = sp_pack_cursor_len(sp_pack_rw_get_cursor(rw));
+  return len > INT64_MAX ? -1 : (Sint64)len;
+}
+
+static Sint64 sp_pack_rw_seek(SDL_RWops * rw, Sint64 offset, int whence) {
+  sp_pack_cursor * cursor = sp_pack_rw_get_cursor(rw);
+
+  Sint64 base = 0;
+  switch(whence) {
+    case RW_SEEK_SET: base = 0; break;
+    case RW_SEEK_CUR: base = (Sint64)sp_pack_cursor_tell(cursor); break;
+    case RW_SEEK_END: base = sp_pack_rw_size(rw); break;
+    default: return SDL_SetError("Unknown seek origin %d.", whence);
+  }
+
+  if((offset > 0 && base > INT64_MAX - offset) || base + offset < 0) {
+    return SDL_SetError("Seek out of range.");
+  }
+
+  Sint64 position = base + offset;
+  if(sp_pack_cursor_seek(cursor, (uint64_t)position) != SP_SUCCESS) {
+    return SDL_SetError("Seek past the end of a pak entry.");
+  }
+
+  return position;
+}
+
+static size_t sp_pack_rw_read(SDL_RWops * rw, void * ptr, size_t size, size_t maxnum) {
+  if(size == 0 || maxnum == 0) { return 0; }
+  if(maxnum > SIZE_MAX / size) { maxnum = SIZE_MAX / size; }
+
+  sp_pack_cursor * cursor = sp_pack_rw_get_cursor(rw);
+
+  /* SDL counts whole objects; a trailing partial one is left unread */
+  uint64_t start = sp_pack_cursor_tell(cursor);
+  uint64_t available = sp_pack_cursor_len(cursor) - start;
+  size_t len = size * maxnum;
+  if(available < len) { len = (size_t)(available / size) * size; }
+
+  size_t done = sp_pack_cursor_read(cursor, ptr, len);
+  if(done < len) {
+    sp_pack_cursor_seek(cursor, start + (done / size) * size);
+    SDL_SetError("Unable to read a pak entry.");
+  }
+
+  return done / size;
+}
+
+static size_t sp_pack_rw_write(SDL_RWops * rw, const void * ptr, size_t size, size_t num) {
+  (void)rw, (void)ptr, (void)size, (void)num;
+  SDL_SetError("Pak entries are read only.");
+  return 0;
+}
+
+static int sp_pack_rw_close(SDL_RWops * rw) {
+  if(rw) {
+    sp_pack_cursor_close(sp_pack_rw_get_cursor(rw));
+    SDL_FreeRW(rw);
+  }
+  return 0;
+}
+
+SDL_RWops * sp_pack_rw_open(sp_pack_reader * reader, const char * key, size_t key_len) {
+  sp_pack_cursor * cursor = NULL;
+  if(sp_pack_cursor_open(reader, key, key_len, &cursor) != SP_SUCCESS) {
+    SDL_SetError("Unable to open pak entry '%s'.", key ? key : "");
+    return NULL;
+  }
+
+  SDL_RWops * rw = SDL_AllocRW();
+  if(!rw) { abort(); }
+
+  rw->size = &sp_pack_rw_size;
+  rw->seek = &sp_pack_rw_seek;
+  rw->read = &sp_pack_rw_read;
+  rw->write = &sp_pack_rw_write;
+  rw->close = &sp_pack_rw_close;
+  rw->type = SDL_RWOPS_UNKNOWN;
+  rw->hidden.unknown.data1 = cursor;
+
+  return rw;
+}
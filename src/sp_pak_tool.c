@@ -0,0 +1,426 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sodium.h>
+
+#include "../include/sp_error.h"
+#include "../include/sp_limits.h"
+#include "../include/sp_pak.h"
+
+/* spooky-pak: builds, inspects and benchmarks resource packs without the
+ * game, or SDL, so pak performance can be tracked on headless machines. */
+
+#define SP_PAK_TOOL_BUFFER_LEN ((size_t)1 << 16)
+#define SP_PAK_TOOL_BENCH_ROUNDS 5
+#define SP_PAK_TOOL_LOOKUP_ROUNDS 1000
+
+typedef struct sp_pak_tool_options {
+  sp_pack_create_options create;
+  size_t rounds;
+} sp_pak_tool_options;
+
+static void sp_pak_tool_usage(FILE * fp) {
+  fprintf(fp,
+      "usage: spooky-pak <command> [options] <pak> [arguments]\n"
+      "\n"
+      "  list <pak>                        entries, with their codecs and sizes\n"
+      "  extract <pak> <dir> [key...]      write entries (all by default) to dir/key\n"
+      "  create [-j n] [-c chunk] [-d dict] [-i integrity] <pak> <key=path>...\n"
+      "                                    build a pak; chunk and dict sizes are in bytes,\n"
+      "                                    integrity is blake2b (default), crc32c or none\n"
+      "  verify <pak>                      hash the content, then load every entry\n"
+      "  bench [-n rounds] <pak>           per-entry inflate and hash throughput, and\n"
+      "                                    index lookup latency\n"
+      );
+}
+
+static double sp_pak_tool_seconds(void) {
+  struct timespec now = { 0 };
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static double sp_pak_tool_mb_per_second(uint64_t len, double seconds) {
+  return seconds > 0 ? (double)len / (1024.0 * 1024.0) / seconds : 0;
+}
+
+static bool sp_pak_tool_parse_size(const char * value, uint64_t * out) {
+  char * end = NULL;
+  errno = 0;
+  unsigned long long parsed = strtoull(value, &end, 10);
+  if(errno != 0 || !end || end == value || *end != '\0') { return false; }
+  *out = (uint64_t)parsed;
+  return true;
+}
+
+static bool sp_pak_tool_parse_integrity(const char * value, sp_pack_integrity * out) {
+  static const sp_pack_integrity modes[] = { spi_blake2b, spi_crc32c, spi_none };
+  for(size_t i = 0; i < sizeof modes / sizeof modes[0]; i++) {
+    if(strcmp(value, sp_pack_integrity_name(modes[i])) == 0) {
+      *out = modes[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Options come before the pak; returns the index of the first argument left. */
+static int sp_pak_tool_parse_options(int argc, char ** argv, int i, sp_pak_tool_options * options) {
+  for(; i < argc && argv[i][0] == '-'; i++) {
+    if(i + 1 >= argc || argv[i][1] == '\0' || argv[i][2] != '\0') { return -1; }
+
+    if(argv[i][1] == 'i') {
+      if(!sp_pak_tool_parse_integrity(argv[++i], &options->create.integrity)) { return -1; }
+      continue;
+    }
+
+    uint64_t value = 0;
+    if(!sp_pak_tool_parse_size(argv[++i], &value)) { return -1; }
+    switch(argv[i - 1][1]) {
+      case 'j': options->create.jobs = (size_t)value; break;
+      case 'c': options->create.chunk_size = value; break;
+      case 'd': options->create.dictionary_size = (size_t)value; break;
+      case 'n': options->rounds = value > 0 ? (size_t)value : 1; break;
+      default: return -1;
+    }
+  }
+
+  return i;
+}
+
+static errno_t sp_pak_tool_open(const char * path, FILE ** out_fp, sp_pack_reader ** out_reader) {
+  *out_fp = NULL;
+  *out_reader = NULL;
+
+  FILE * fp = fopen(path, "rb");
+  if(!fp) {
+    fprintf(stderr, "Unable to open '%s'. %s\n", path, strerror(errno));
+    return SP_FAILURE;
+  }
+
+  if(sp_pack_verify_ex(fp, out_reader, spvm_full) != SP_SUCCESS) {
+    fprintf(stderr, "'%s' is not a valid resource pack.\n", path);
+    fclose(fp), fp = NULL;
+    return SP_FAILURE;
+  }
+
+  *out_fp = fp;
+  return SP_SUCCESS;
+}
+
+static void sp_pak_tool_close(FILE * fp, sp_pack_reader * reader) {
+  sp_pack_reader_free(reader), reader = NULL;
+  if(fp) { fclose(fp), fp = NULL; }
+}
+
+static errno_t sp_pak_tool_list(const char * path) {
+  FILE * fp = NULL;
+  sp_pack_reader * reader = NULL;
+  if(sp_pak_tool_open(path, &fp, &reader) != SP_SUCCESS) { return SP_FAILURE; }
+
+  errno_t res = SP_SUCCESS;
+  uint64_t count = sp_pack_reader_get_entry_count(reader);
+  fprintf(stdout, "%-32s %-12s %12s %12s\n", "key", "codec", "compressed", "size");
+  for(uint64_t i = 0; i < count; i++) {
+    sp_pack_entry_info info = { 0 };
+    if(sp_pack_reader_get_entry(reader, i, &info) != SP_SUCCESS) {
+      fprintf(stderr, "Unable to read entry %" PRIu64 ".\n", i);
+      res = SP_FAILURE;
+      continue;
+    }
+    fprintf(stdout, "%-32s %-12s %12" PRIu64 " %12" PRIu64 "\n", info.key, sp_pack_codec_name(info.codec), info.compressed_len, info.decompressed_len);
+  }
+
+  sp_pak_tool_close(fp, reader);
+  return res;
+}
+
+/* Keys become file names under dir, so anything that could leave it is refused. */
+static bool sp_pak_tool_is_safe_key(const char * key) {
+  return key[0] != '\0' && key[0] != '.' && strchr(key, '/') == NULL && strchr(key, '\\') == NULL;
+}
+
+static errno_t sp_pak_tool_extract_entry(sp_pack_reader * reader, const char * dir, const char * key) {
+  if(!sp_pak_tool_is_safe_key(key)) {
+    fprintf(stderr, "Not extracting '%s'; the key isn't a plain file name.\n", key);
+    return SP_FAILURE;
+  }
+
+  size_t path_len = strlen(dir) + 1 + strlen(key) + 1;
+  char * path = malloc(path_len);
+  if(!path) { abort(); }
+  snprintf(path, path_len, "%s/%s", dir, key);
+
+  /* read through a cursor, so large entries are never held whole */
+  sp_pack_cursor * cursor = NULL;
+  unsigned char * buf = NULL;
+  FILE * out = NULL;
+  if(sp_pack_cursor_open(reader, key, strnlen(key, SP_MAX_STRING_LEN), &cursor) != SP_SUCCESS) { goto err0; }
+
+  out = fopen(path, "wb");
+  if(!out) { goto err0; }
+
+  buf = malloc(SP_PAK_TOOL_BUFFER_LEN);
+  if(!buf) { abort(); }
+
+  uint64_t remaining = sp_pack_cursor_len(cursor);
+  while(remaining > 0) {
+    size_t len = sp_pack_cursor_read(cursor, buf, SP_PAK_TOOL_BUFFER_LEN);
+    if(len == 0 || fwrite(buf, 1, len, out) != len) { goto err0; }
+    remaining -= len;
+  }
+  if(fclose(out) != 0) { out = NULL; goto err0; }
+  out = NULL;
+
+  fprintf(stdout, "%s\n", path);
+
+  free(buf), buf = NULL;
+  sp_pack_cursor_close(cursor), cursor = NULL;
+  free(path), path = NULL;
+  return SP_SUCCESS;
+
+err0:
+  fprintf(stderr, "Unable to extract '%s' to '%s'.\n", key, path);
+  if(out) { fclose(out), out = NULL; }
+  free(buf), buf = NULL;
+  sp_pack_cursor_close(cursor), cursor = NULL;
+  free(path), path = NULL;
+  return SP_FAILURE;
+}
+
+static errno_t sp_pak_tool_extract(const char * path, const char * dir, char ** keys, int keys_len) {
+  struct stat st;
+  if(stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+    fprintf(stderr, "'%s' is not a directory.\n", dir);
+    return SP_FAILURE;
+  }
+
+  FILE * fp = NULL;
+  sp_pack_reader * reader = NULL;
+  if(sp_pak_tool_open(path, &fp, &reader) != SP_SUCCESS) { return SP_FAILURE; }
+
+  errno_t res = SP_SUCCESS;
+  if(keys_len > 0) {
+    for(int i = 0; i < keys_len; i++) {
+      if(sp_pak_tool_extract_entry(reader, dir, keys[i]) != SP_SUCCESS) { res = SP_FAILURE; }
+    }
+  } else {
+    uint64_t count = sp_pack_reader_get_entry_count(reader);
+    for(uint64_t i = 0; i < count; i++) {
+      sp_pack_entry_info info = { 0 };
+      if(sp_pack_reader_get_entry(reader, i, &info) != SP_SUCCESS
+          || sp_pak_tool_extract_entry(reader, dir, info.key) != SP_SUCCESS) {
+        res = SP_FAILURE;
+      }
+    }
+  }
+
+  sp_pak_tool_close(fp, reader);
+  return res;
+}
+
+static errno_t sp_pak_tool_create(const char * path, char ** specs, int specs_len, const sp_pack_create_options * options) {
+  if(specs_len <= 0) { return SP_FAILURE; }
+
+  /* key=path pairs; the strings are split in place */
+  sp_pack_content_entry * content = calloc((size_t)specs_len, sizeof * content);
+  if(!content) { abort(); }
+
+  for(int i = 0; i < specs_len; i++) {
+    char * eq = strchr(specs[i], '=');
+    if(!eq || eq == specs[i] || eq[1] == '\0') {
+      fprintf(stderr, "Expected key=path, not '%s'.\n", specs[i]);
+      free(content), content = NULL;
+      return SP_FAILURE;
+    }
+    *eq = '\0';
+    content[i].name = specs[i];
+    content[i].path = eq + 1;
+    content[i].codec = spc_auto;
+  }
+
+  FILE * fp = fopen(path, "wb+");
+  if(!fp) {
+    fprintf(stderr, "Unable to create '%s'. %s\n", path, strerror(errno));
+    free(content), content = NULL;
+    return SP_FAILURE;
+  }
+
+  double start = sp_pak_tool_seconds();
+  bool ok = sp_pack_create_ex(fp, content, (size_t)specs_len, options);
+  double elapsed = sp_pak_tool_seconds() - start;
+
+  long len = ftell(fp);
+  if(fclose(fp) != 0) { ok = false; }
+  free(content), content = NULL;
+
+  if(!ok) {
+    fprintf(stderr, "Unable to build '%s'.\n", path);
+    return SP_FAILURE;
+  }
+
+  fprintf(stdout, "%s: %d entries, %ld bytes in %.3fs\n", path, specs_len, len, elapsed);
+  return SP_SUCCESS;
+}
+
+static errno_t sp_pak_tool_verify(const char * path) {
+  FILE * fp = fopen(path, "rb");
+  if(!fp) {
+    fprintf(stderr, "Unable to open '%s'. %s\n", path, strerror(errno));
+    return SP_FAILURE;
+  }
+
+  double start = sp_pak_tool_seconds();
+  sp_pack_reader * reader = NULL;
+  if(sp_pack_verify_ex(fp, &reader, spvm_full) != SP_SUCCESS) {
+    fprintf(stderr, "%s: content failed verification.\n", path);
+    fclose(fp), fp = NULL;
+    return SP_FAILURE;
+  }
+  double verified = sp_pak_tool_seconds();
+
+  /* every entry's own hashes are checked as it loads */
+  errno_t res = SP_SUCCESS;
+  uint64_t count = sp_pack_reader_get_entry_count(reader);
+  sp_pack_reader_set_cache_budget(reader, 1);
+  for(uint64_t i = 0; i < count; i++) {
+    sp_pack_entry_info info = { 0 };
+    sp_pack_item_file * file = NULL;
+    if(sp_pack_reader_get_entry(reader, i, &info) != SP_SUCCESS
+        || sp_pack_acquire(reader, info.key, info.key_len, &file) != SP_SUCCESS) {
+      fprintf(stderr, "%s: entry %" PRIu64 " failed verification.\n", path, i);
+      res = SP_FAILURE;
+      continue;
+    }
+    sp_pack_release(file), file = NULL;
+  }
+  double loaded = sp_pak_tool_seconds();
+
+  if(res == SP_SUCCESS) {
+    fprintf(stdout, "%s: OK, %" PRIu64 " entries, %s (content %.3fs, entries %.3fs)\n", path, count, sp_pack_integrity_name(sp_pack_reader_get_integrity(reader)), verified - start, loaded - verified);
+  }
+
+  sp_pak_tool_close(fp, reader);
+  return res;
+}
+
+static errno_t sp_pak_tool_bench(const char * path, size_t rounds) {
+  FILE * fp = NULL;
+  sp_pack_reader * reader = NULL;
+  if(sp_pak_tool_open(path, &fp, &reader) != SP_SUCCESS) { return SP_FAILURE; }
+
+  errno_t res = SP_SUCCESS;
+  uint64_t count = sp_pack_reader_get_entry_count(reader);
+  uint64_t total_compressed = 0, total_decompressed = 0;
+  double total_inflate = 0, total_hash = 0;
+
+  fprintf(stdout, "%-32s %-12s %12s %12s %12s %12s\n", "key", "codec", "compressed", "size", "inflate MB/s", "hash MB/s");
+  for(uint64_t i = 0; i < count; i++) {
+    sp_pack_entry_info info = { 0 };
+    double inflate_seconds = 0, hash_seconds = 0;
+    if(sp_pack_reader_get_entry(reader, i, &info) != SP_SUCCESS
+        || sp_pack_reader_bench_entry(reader, i, rounds, &inflate_seconds, &hash_seconds) != SP_SUCCESS) {
+      fprintf(stderr, "Unable to benchmark entry %" PRIu64 ".\n", i);
+      res = SP_FAILURE;
+      continue;
+    }
+
+    total_compressed += info.compressed_len;
+    total_decompressed += info.decompressed_len;
+    total_inflate += inflate_seconds;
+    total_hash += hash_seconds;
+
+    fprintf(stdout, "%-32s %-12s %12" PRIu64 " %12" PRIu64 " %12.1f %12.1f\n",
+        info.key, sp_pack_codec_name(info.codec), info.compressed_len, info.decompressed_len,
+        sp_pak_tool_mb_per_second(info.decompressed_len, inflate_seconds),
+        sp_pak_tool_mb_per_second(info.decompressed_len, hash_seconds));
+  }
+
+  fprintf(stdout, "%-32s %-12s %12" PRIu64 " %12" PRIu64 " %12.1f %12.1f\n",
+      "(all)", "", total_compressed, total_decompressed,
+      sp_pak_tool_mb_per_second(total_decompressed, total_inflate),
+      sp_pak_tool_mb_per_second(total_decompressed, total_hash));
+
+  /* lookups of every key, round robin; keys are gathered up front */
+  if(count > 0) {
+    const char ** keys = calloc((size_t)count, sizeof * keys);
+    size_t * key_lens = calloc((size_t)count, sizeof * key_lens);
+    if(!keys || !key_lens) { abort(); }
+
+    for(uint64_t i = 0; i < count; i++) {
+      sp_pack_entry_info info = { 0 };
+      if(sp_pack_reader_get_entry(reader, i, &info) == SP_SUCCESS) {
+        keys[i] = info.key;
+        key_lens[i] = info.key_len;
+      }
+    }
+
+    uint64_t lookups = 0, found = 0;
+    double start = sp_pak_tool_seconds();
+    for(size_t round = 0; round < SP_PAK_TOOL_LOOKUP_ROUNDS; round++) {
+      for(uint64_t i = 0; i < count; i++) {
+        if(!keys[i]) { continue; }
+        uint64_t index = 0;
+        if(sp_pack_reader_find_entry(reader, keys[i], key_lens[i], &index) == SP_SUCCESS && index == i) { found++; }
+        lookups++;
+      }
+    }
+    double elapsed = sp_pak_tool_seconds() - start;
+
+    if(found != lookups) { res = SP_FAILURE; }
+    fprintf(stdout, "index lookup: %.1f ns (%" PRIu64 " lookups)\n", lookups > 0 ? elapsed * 1e9 / (double)lookups : 0, lookups);
+
+    free(key_lens);
+    free(keys);
+  }
+
+  sp_pak_tool_close(fp, reader);
+  return res;
+}
+
+int main(int argc, char ** argv) {
+  if(argc < 3) { goto err0; }
+  if(sodium_init() < 0) {
+    fprintf(stderr, "Unable to initialize libsodium.\n");
+    return EXIT_FAILURE;
+  }
+
+  const char * command = argv[1];
+  sp_pak_tool_options options = {
+    .create = { .jobs = 0, .chunk_size = SP_PACK_DEFAULT_CHUNK_SIZE, .dictionary_size = SP_PACK_DEFAULT_DICTIONARY_SIZE },
+    .rounds = SP_PAK_TOOL_BENCH_ROUNDS
+  };
+
+  int i = sp_pak_tool_parse_options(argc, argv, 2, &options);
+  if(i < 0 || i >= argc) { goto err0; }
+  const char * path = argv[i++];
+
+  errno_t res = SP_FAILURE;
+  if(strcmp(command, "list") == 0 && i == argc) {
+    res = sp_pak_tool_list(path);
+  } else if(strcmp(command, "extract") == 0 && i < argc) {
+    res = sp_pak_tool_extract(path, argv[i], argv + i + 1, argc - i - 1);
+  } else if(strcmp(command, "create") == 0 && i < argc) {
+    res = sp_pak_tool_create(path, argv + i, argc - i, &options.create);
+  } else if(strcmp(command, "verify") == 0 && i == argc) {
+    res = sp_pak_tool_verify(path);
+  } else if(strcmp(command, "bench") == 0 && i == argc) {
+    res = sp_pak_tool_bench(path, options.rounds);
+  } else {
+    goto err0;
+  }
+
+  return res == SP_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE;
+
+err0:
+  sp_pak_tool_usage(stderr);
+  return EXIT_FAILURE;
+}
@@ -7,6 +7,7 @@
 #include <math.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <errno.h>
 #include <sys/time.h>
 #include <sys/resource.h>
@@ -14,17 +15,38 @@
 
 #include "../include/sp_spooky.h"
 
-static errno_t sp_loop(sp_context * context, const sp_ex ** ex);
+static errno_t sp_loop(sp_context * context, sp_watch * watch, const sp_ex ** ex);
 static errno_t sp_command_parser(sp_context * context, const sp_console * console, const char * command) ;
-static void sp_print_licenses(const sp_hash_table * hash);
-static FILE * sp_open_pak_file(char ** argv);
+static void sp_print_licenses(sp_pack_reader * pak);
+static FILE * sp_open_pak_file(char ** argv, size_t jobs);
 
 typedef struct sp_options {
+  size_t jobs; /* pak build threads; 0 is one per CPU */
   bool print_licenses;
-  char padding[7];
+  bool watch; /* development: hot-reload resources from their source files */
+  bool verify; /* hash the whole pak at startup instead of on first load */
+  bool exercise_hash; /* benchmark the hash table engines and exit */
+  char padding[4];
 } sp_options;
 
+/* textures loaded straight from source files, reloaded in place */
+typedef struct sp_reload_texture {
+  const char * path;
+  SDL_Texture ** texture;
+} sp_reload_texture;
+
 static errno_t sp_parse_args(int argc, char ** argv, sp_options * options);
+static void sp_apply_reloads(sp_context * context, sp_watch * watch, const sp_reload_texture * textures, size_t textures_len);
+static void sp_streamed(const char * key, sp_pack_item_file * file, errno_t result, void * user_data);
+
+/* the resources built into pak.spdb, and watched in development */
+static const sp_pack_content_entry sp_pak_content[] = {
+  { .path = "res/fonts/PRNumber3.ttf", .name = "pr.number" },
+  { .path = "res/fonts/PrintChar21.ttf", .name = "print.char" },
+  { .path = "res/fonts/DejaVuSansMono.ttf", .name = "deja.sans" },
+  { .path = "res/fonts/SIL Open Font License.txt", .name = "open.font.license" },
+  { .path = "res/fonts/deja-license.txt", .name = "deja.license" }
+};
 
 int main(int argc, char **argv) {
   sp_options options = { 0 };
@@ -33,9 +55,15 @@ int main(int argc, char **argv) {
 
 #ifdef DEBUG
   sp_pack_tests();
+  sp_hash_tests();
 #endif
 
-  FILE * fp = sp_open_pak_file(argv);
+  if(options.exercise_hash) {
+    sp_hash_bench(stdout, 1 << 16, 16);
+    return EXIT_SUCCESS;
+  }
+
+  FILE * fp = sp_open_pak_file(argv, options.jobs);
 
   sp_context context = { 0 };
   const sp_ex * ex = NULL;
@@ -43,33 +71,28 @@ int main(int argc, char **argv) {
   sp_log_startup();
   SP_LOG(SLS_INFO, "Logging enabled.\n");
 
-  if(sp_init_context(&context, fp) != SP_SUCCESS) { goto err0; }
+  if(sp_init_context_ex(&context, fp, options.verify ? spvm_full : spvm_lazy) != SP_SUCCESS) { goto err0; }
   if(sp_test_resources(&context) != SP_SUCCESS) { goto err0; }
 
-  const sp_hash_table * hash = context.get_hash(&context);
-
-  fclose(fp);
+  /* The pak stays open for the session; entries are loaded on first use. */
+  sp_pack_reader * pak = context.get_pak(&context);
 
   {
 #ifdef DEBUG
     /* Loading a font from the resource pak example */
-    void * temp = NULL;
-    sp_pack_item_file * font = NULL;
-    hash->find(hash, "pr.number", strnlen("pr.number", SP_MAX_STRING_LEN), &temp);
-    font = (sp_pack_item_file *)temp;
-
-    SDL_RWops * src = SDL_RWFromMem(font->data, (int)font->data_len);
+    SDL_RWops * src = sp_pack_rw_open(pak, "pr.number", strnlen("pr.number", SP_MAX_STRING_LEN));
     assert(src);
     TTF_Init();
-    TTF_Font * ttf = TTF_OpenFontRW(src, 0, 10);
+    TTF_Font * ttf = TTF_OpenFontRW(src, 1 /* closes src */, 10);
 
     assert(ttf);
     fprintf(stdout, "Okay!\n");
+    TTF_CloseFont(ttf);
 #endif
   }
 
   if(options.print_licenses) {
-    sp_print_licenses(hash);
+    sp_print_licenses(pak);
   }
 
 #ifdef DEBUG
@@ -78,9 +101,32 @@ int main(int argc, char **argv) {
   sp_pack_print_resources(stdout, fp);
 #endif
 
-  if(sp_loop(&context, &ex) != SP_SUCCESS) { goto err1; }
+  /* development mode: changed source files are swapped in between frames */
+  sp_watch * watch = NULL;
+  if(options.watch) {
+    watch = sp_watch_create();
+    if(!watch) { fprintf(stderr, "Unable to watch resources; hot-reload is disabled.\n"); }
+    for(size_t i = 0; watch && i < sizeof sp_pak_content / sizeof sp_pak_content[0]; i++) {
+      if(sp_watch_add(watch, sp_pak_content[i].path, sp_pak_content[i].name) != SP_SUCCESS) {
+        fprintf(stderr, "Unable to watch %s\n", sp_pak_content[i].path);
+      }
+    }
+  }
+
+  /* stream the rest of the pak in while the first frames render */
+  sp_pack_stream * stream = context.get_stream(&context);
+  for(size_t i = 0; stream && i < sizeof sp_pak_content / sizeof sp_pak_content[0]; i++) {
+    const char * name = sp_pak_content[i].name;
+    sp_pack_stream_request_item(stream, name, strnlen(name, SP_MAX_STRING_LEN), &sp_streamed, NULL);
+  }
+
+  errno_t loop_res = sp_loop(&context, watch, &ex);
+  sp_watch_free(watch), watch = NULL;
+  if(loop_res != SP_SUCCESS) { goto err1; }
   if(sp_quit_context(&context) != SP_SUCCESS) { goto err2; }
 
+  fclose(fp), fp = NULL;
+
   sp_log_shutdown();
 
   fprintf(stdout, "\nThank you for playing! Happy gaming!\n");
@@ -108,7 +154,7 @@ err:
   return SP_FAILURE;
 }
 
-errno_t sp_loop(sp_context * context, const sp_ex ** ex) {
+errno_t sp_loop(sp_context * context, sp_watch * watch, const sp_ex ** ex) {
   static const double SP_HERTZ = 30.0;
   static const unsigned int SP_TARGET_FPS = 60;
   static const unsigned int SP_MILLI = 1000;
@@ -168,6 +214,14 @@ errno_t sp_loop(sp_context * context, const sp_ex ** ex) {
 
   assert(background != NULL && letterbox_background != NULL);
 
+  sp_reload_texture textures[] = {
+    { .path = "./res/bg3.png", .texture = &background },
+    { .path = "./res/bg4.png", .texture = &letterbox_background }
+  };
+  for(size_t i = 0; watch && i < sizeof textures / sizeof textures[0]; i++) {
+    if(sp_watch_add(watch, textures[i].path, NULL) != SP_SUCCESS) { fprintf(stderr, "Unable to watch %s\n", textures[i].path); }
+  }
+
   const sp_wm * wm = sp_wm_acquire();
   wm = wm->ctor(wm, "wm", context);
 
@@ -221,6 +275,10 @@ errno_t sp_loop(sp_context * context, const sp_ex ** ex) {
   const sp_base * menu_base = main_menu->as_base(main_menu);
 
   while(sp_context_get_is_running(context)) {
+    /* hot-reload at the frame boundary, before anything uses the resources */
+    if(watch) { sp_apply_reloads(context, watch, textures, sizeof textures / sizeof textures[0]); }
+    sp_pack_stream_drain(context->get_stream(context));
+
     SDL_SetRenderTarget(renderer, context->get_canvas(context));
 
     SDL_Rect debug_rect = { 0 };
@@ -561,10 +619,26 @@ static errno_t sp_parse_args(int argc, char ** argv, sp_options * options) {
       if(i + 1 > argc) { goto err0; }
       switch (argv[i][1]) {
         /* case 'p': { options->gen_primes = true; return SP_SUCCESS; }
-           case 'E': { options->exercise_hash = true; return SP_SUCCESS; }
            case 'i': options->ifile = argv[i + 1]; break;
            case 'o': options->ofile = argv[i + 1]; break; */
+        case 'E': options->exercise_hash = true; break;
         case 'L': options->print_licenses = true; break;
+        case 'w': options->watch = true; break;
+        case '-':
+          {
+            if(strcmp(argv[i], "--verify") != 0) { goto err0; }
+            options->verify = true;
+          }
+          break;
+        case 'j':
+          {
+            if(i + 1 >= argc) { goto err0; }
+            char * end = NULL;
+            unsigned long jobs = strtoul(argv[++i], &end, 10);
+            if(!end || *end != '\0') { goto err0; }
+            options->jobs = (size_t)jobs;
+          }
+          break;
         default: goto err0;
       }
     }
@@ -576,7 +650,9 @@ err0:
   return SP_FAILURE;
 }
 
-static FILE * sp_open_pak_file(char ** argv) {
+/* The trailer and header locate the pak without reading its content; that
+ * is checked once, by the reader, in full under --verify or lazily. */
+static FILE * sp_open_pak_file(char ** argv, size_t jobs) {
   FILE * fp = NULL;
 
   long pak_offset = 0;
@@ -592,7 +668,7 @@ static FILE * sp_open_pak_file(char ** argv) {
     if(fd >= 0) {
       fp = fdopen(fd, "rb");
       if(fp) {
-        errno_t is_valid = sp_pack_is_valid_pak_file(fp, &pak_offset, &content_offset, &content_len, &index_entries, &index_offset, &index_len);
+        errno_t is_valid = sp_pack_probe(fp, &pak_offset, &content_offset, &content_len, &index_entries, &index_offset, &index_len);
         if(is_valid != SP_SUCCESS) {
           /* not a valid bundle */
           fclose(fp), fp = NULL;
@@ -618,21 +694,25 @@ static FILE * sp_open_pak_file(char ** argv) {
 
     fp = fdopen(fd, "wb+x");
 
+    if(!create) {
+      /* rebuild paks written with an older format */
+      errno_t is_valid = sp_pack_probe(fp, &pak_offset, &content_offset, &content_len, &index_entries, &index_offset, &index_len);
+      if(is_valid != SP_SUCCESS) {
+        fprintf(stderr, "Rebuilding stale resource pack %s\n", pak_file);
+        fseek(fp, 0, SEEK_SET);
+        if(ftruncate(fd, 0) != 0) { abort(); }
+        create = true;
+      }
+    }
+
     if(create) {
       /* only create it if it's not already a valid pak file */
-      sp_pack_content_entry content[] = {
-        { .path = "res/fonts/PRNumber3.ttf", .name = "pr.number" },
-        { .path = "res/fonts/PrintChar21.ttf", .name = "print.char" },
-        { .path = "res/fonts/DejaVuSansMono.ttf", .name = "deja.sans" },
-        { .path = "res/fonts/SIL Open Font License.txt", .name = "open.font.license" },
-        { .path = "res/fonts/deja-license.txt", .name = "deja.license" }
-      };
-
-      sp_pack_create(fp, content, sizeof content / sizeof content[0]);
+      sp_pack_create_options options = { .jobs = jobs, .chunk_size = SP_PACK_DEFAULT_CHUNK_SIZE, .dictionary_size = SP_PACK_DEFAULT_DICTIONARY_SIZE };
+      sp_pack_create_ex(fp, sp_pak_content, sizeof sp_pak_content / sizeof sp_pak_content[0], &options);
     }
     fseek(fp, 0, SEEK_SET);
 
-    errno_t is_valid = sp_pack_is_valid_pak_file(fp, &pak_offset, &content_offset, &content_len, &index_entries, &index_offset, &index_len);
+    errno_t is_valid = sp_pack_probe(fp, &pak_offset, &content_offset, &content_len, &index_entries, &index_offset, &index_len);
 
     assert(is_valid == SP_SUCCESS);
   }
@@ -657,18 +737,50 @@ static FILE * sp_open_pak_file(char ** argv) {
   return fp;
 }
 
-static void sp_print_licenses(const sp_hash_table * hash) {
+static void sp_apply_reloads(sp_context * context, sp_watch * watch, const sp_reload_texture * textures, size_t textures_len) {
+  const char * path = NULL, * key = NULL;
+  while(sp_watch_poll(watch, &path, &key)) {
+    if(key) {
+      /* pak entries, and anything the context built from them */
+      context->reload_resource(context, key, path);
+      continue;
+    }
+
+    for(size_t i = 0; i < textures_len; i++) {
+      if(strcmp(textures[i].path, path) != 0) { continue; }
+
+      SDL_Texture * texture = NULL;
+      if(sp_gui_load_texture(context->get_renderer(context), path, strnlen(path, SP_MAX_STRING_LEN), &texture) != SP_SUCCESS) { continue; }
+      if(*textures[i].texture) { SDL_DestroyTexture(*textures[i].texture); }
+      *textures[i].texture = texture;
+      SP_LOG(SLS_INFO, "Reloaded texture '%s'.\n", path);
+    }
+  }
+}
+
+static void sp_streamed(const char * key, sp_pack_item_file * file, errno_t result, void * user_data) {
+  (void)user_data;
+  if(result != SP_SUCCESS) {
+    SP_LOG(SLS_WARN, "Unable to stream '%s'.\n", key);
+    return;
+  }
+  SP_LOG(SLS_INFO, "Streamed '%s' (%zu bytes).\n", key, file->data_len);
+}
+
+static void sp_print_licenses(sp_pack_reader * pak) {
   fprintf(stdout, "Licenses:\n");
   fprintf(stdout, "********************************************************************************\n");
 
   sp_pack_item_file * temp = NULL;
   char * deja_license = NULL, * open_license = NULL;
-  if(hash->find(hash, "deja.license", strnlen("deja.license", SP_MAX_STRING_LEN), ((void *)&temp)) == SP_SUCCESS) {
+  if(sp_pack_acquire(pak, "deja.license", strnlen("deja.license", SP_MAX_STRING_LEN), &temp) == SP_SUCCESS) {
     deja_license = strndup(temp->data, temp->data_len);
+    sp_pack_release(temp);
   }
 
-  if(hash->find(hash, "open.font.license", strnlen("open.font.license", SP_MAX_STRING_LEN), ((void *)&temp)) == SP_SUCCESS) {
+  if(sp_pack_acquire(pak, "open.font.license", strnlen("open.font.license", SP_MAX_STRING_LEN), &temp) == SP_SUCCESS) {
     open_license = strndup(temp->data, temp->data_len);
+    sp_pack_release(temp);
   }
 
   fprintf(stdout, "%s\n\n%s\n", open_license, deja_license);
@@ -0,0 +1,171 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "../include/sp_watch.h"
+#include "../include/sp_limits.h"
+
+typedef struct sp_watch_entry {
+  char * path;
+  char * dir;
+  const char * name; /* points into path */
+  char * key;
+  int wd;
+  bool is_changed;
+  char padding[3]; /* not portable */
+} sp_watch_entry;
+
+typedef struct sp_watch {
+  sp_watch_entry * entries;
+  size_t len;
+  size_t cap;
+  int fd;
+  char padding[4]; /* not portable */
+} sp_watch;
+
+#ifdef __linux__
+
+sp_watch * sp_watch_create(void) {
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if(fd < 0) { return NULL; }
+
+  sp_watch * watch = calloc(1, sizeof * watch);
+  if(!watch) { abort(); }
+
+  watch->fd = fd;
+  return watch;
+}
+
+errno_t sp_watch_add(sp_watch * watch, const char * path, const char * key) {
+  if(!watch || !path) { return SP_FAILURE; }
+
+  if(watch->len == watch->cap) {
+    size_t cap = watch->cap > 0 ? watch->cap * 2 : 8;
+    sp_watch_entry * entries = realloc(watch->entries, cap * sizeof * entries);
+    if(!entries) { abort(); }
+    watch->entries = entries;
+    watch->cap = cap;
+  }
+
+  sp_watch_entry * e = watch->entries + watch->len;
+  memset(e, 0, sizeof * e);
+
+  e->path = strndup(path, SP_MAX_STRING_LEN);
+  if(!e->path) { abort(); }
+
+  const char * slash = strrchr(e->path, '/');
+  e->dir = slash ? strndup(e->path, (size_t)(slash - e->path) + 1) : strdup(".");
+  if(!e->dir) { abort(); }
+  e->name = slash ? slash + 1 : e->path;
+
+  if(key) {
+    e->key = strndup(key, SP_MAX_STRING_LEN);
+    if(!e->key) { abort(); }
+  }
+
+  /* inotify hands back the same descriptor for a directory watched twice */
+  e->wd = inotify_add_watch(watch->fd, e->dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+  if(e->wd < 0) {
+    free(e->key), e->key = NULL;
+    free(e->dir), e->dir = NULL;
+    free(e->path), e->path = NULL;
+    return SP_FAILURE;
+  }
+
+  watch->len++;
+  return SP_SUCCESS;
+}
+
+static void sp_watch_drain(sp_watch * watch) {
+  union {
+    struct inotify_event event; /* aligns the buffer for the events read into it */
+    char bytes[4096];
+  } buf;
+
+  for(;;) {
+    ssize_t len = read(watch->fd, buf.bytes, sizeof buf.bytes);
+    if(len <= 0) { break; }
+
+    for(size_t at = 0; at + sizeof(struct inotify_event) <= (size_t)len; ) {
+      struct inotify_event event;
+      memcpy(&event, buf.bytes + at, sizeof event);
+      const char * name = buf.bytes + at + sizeof event;
+
+      if(event.len > 0) {
+        for(size_t i = 0; i < watch->len; i++) {
+          sp_watch_entry * e = watch->entries + i;
+          if(e->wd == event.wd && strncmp(e->name, name, event.len) == 0) { e->is_changed = true; }
+        }
+      }
+
+      at += sizeof event + event.len;
+    }
+  }
+}
+
+bool sp_watch_poll(sp_watch * watch, const char ** out_path, const char ** out_key) {
+  assert(out_path && out_key);
+  if(!watch) { return false; }
+
+  sp_watch_drain(watch);
+
+  for(size_t i = 0; i < watch->len; i++) {
+    sp_watch_entry * e = watch->entries + i;
+    if(!e->is_changed) { continue; }
+
+    e->is_changed = false;
+    *out_path = e->path;
+    *out_key = e->key;
+    return true;
+  }
+
+  return false;
+}
+
+void sp_watch_free(sp_watch * watch) {
+  if(!watch) { return; }
+
+  for(size_t i = 0; i < watch->len; i++) {
+    sp_watch_entry * e = watch->entries + i;
+    free(e->key), e->key = NULL;
+    free(e->dir), e->dir = NULL;
+    free(e->path), e->path = NULL;
+  }
+  free(watch->entries), watch->entries = NULL;
+
+  close(watch->fd);
+  free(watch), watch = NULL;
+}
+
+#else /* __linux__ */
+
+sp_watch * sp_watch_create(void) {
+  return NULL;
+}
+
+errno_t sp_watch_add(sp_watch * watch, const char * path, const char * key) {
+  (void)watch;
+  (void)path;
+  (void)key;
+  return SP_FAILURE;
+}
+
+bool sp_watch_poll(sp_watch * watch, const char ** out_path, const char ** out_key) {
+  (void)watch;
+  (void)out_path;
+  (void)out_key;
+  return false;
+}
+
+void sp_watch_free(sp_watch * watch) {
+  (void)watch;
+}
+
+#endif /* __linux__ */
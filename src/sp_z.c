@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <limits.h>
 #include <stdlib.h>
@@ -153,3 +154,155 @@ err0:
   return Z_ERRNO;
 }
 
+
+typedef struct sp_z {
+  z_stream inflate_strm;
+  z_stream deflate_strm;
+  const unsigned char * dict;
+  size_t dict_len;
+  bool has_inflate;
+  bool has_deflate;
+  char padding[6]; /* not portable */
+} sp_z;
+
+static void sp_z_end(sp_z * z) {
+  if(z->has_inflate) { inflateEnd(&z->inflate_strm); }
+  if(z->has_deflate) { deflateEnd(&z->deflate_strm); }
+  z->has_inflate = z->has_deflate = false;
+}
+
+sp_z * sp_z_create(void) {
+  sp_z * z = calloc(1, sizeof * z);
+  if(!z) { abort(); }
+
+  return z;
+}
+
+void sp_z_free(sp_z * z) {
+  if(!z) { return; }
+
+  sp_z_end(z);
+  free(z), z = NULL;
+}
+
+void sp_z_set_dictionary(sp_z * z, const unsigned char * dict, size_t dict_len) {
+  if(!z) { return; }
+
+  z->dict = dict_len > 0 && dict_len <= UINT_MAX ? dict : NULL;
+  z->dict_len = z->dict ? dict_len : 0;
+}
+
+bool sp_z_has_dictionary(const sp_z * z) {
+  return z && z->dict;
+}
+
+static errno_t sp_z_inflate_with(sp_z * z, bool use_dict, const unsigned char * source, size_t source_len, unsigned char * dest, size_t dest_len, size_t * out_len) {
+  assert(SP_SUCCESS == Z_OK);
+  if(!z || !source || (!dest && dest_len > 0)) { return Z_STREAM_ERROR; }
+  if(source_len > UINT_MAX || dest_len > UINT_MAX) { return Z_BUF_ERROR; }
+
+  z_stream * strm = &z->inflate_strm;
+  int ret = Z_OK;
+  if(z->has_inflate) {
+    ret = inflateReset(strm);
+  } else {
+    *strm = (z_stream){ .zalloc = Z_NULL, .zfree = Z_NULL, .opaque = Z_NULL, .avail_in = 0, .next_in = Z_NULL };
+    ret = inflateInit(strm);
+    z->has_inflate = ret == Z_OK;
+  }
+  if(ret != Z_OK) { return ret; }
+
+  /* The decompressed length is known up front, so inflate the whole stream
+   * straight into the caller's buffer with a single call. */
+  strm->next_in = (unsigned char *)(uintptr_t)source;
+  strm->avail_in = (unsigned int)source_len;
+  strm->next_out = dest;
+  strm->avail_out = (unsigned int)dest_len;
+
+  ret = inflate(strm, Z_FINISH);
+  assert(ret != Z_STREAM_ERROR);
+  if(ret == Z_NEED_DICT && use_dict && z->dict) {
+    /* the stream names its dictionary by adler32; zlib checks it here */
+    ret = inflateSetDictionary(strm, z->dict, (unsigned int)z->dict_len);
+    if(ret == Z_OK) { ret = inflate(strm, Z_FINISH); }
+  }
+
+  if(out_len) { *out_len = (size_t)strm->total_out; }
+
+  switch(ret) {
+    case Z_STREAM_END: return Z_OK;
+    case Z_NEED_DICT:
+    case Z_BUF_ERROR:
+    case Z_OK: return Z_DATA_ERROR;
+    default: return ret;
+  }
+}
+
+errno_t sp_z_inflate(sp_z * z, const unsigned char * source, size_t source_len, unsigned char * dest, size_t dest_len, size_t * out_len) {
+  return sp_z_inflate_with(z, false, source, source_len, dest, dest_len, out_len);
+}
+
+errno_t sp_z_inflate_dict(sp_z * z, const unsigned char * source, size_t source_len, unsigned char * dest, size_t dest_len, size_t * out_len) {
+  if(!sp_z_has_dictionary(z)) { return Z_STREAM_ERROR; }
+  return sp_z_inflate_with(z, true, source, source_len, dest, dest_len, out_len);
+}
+
+static errno_t sp_z_deflate_with(sp_z * z, bool use_dict, const unsigned char * source, size_t source_len, unsigned char * dest, size_t dest_len, size_t * out_len) {
+  assert(SP_SUCCESS == Z_OK);
+  if(!z || !source || !dest) { return Z_STREAM_ERROR; }
+  if(source_len > UINT_MAX || dest_len > UINT_MAX) { return Z_BUF_ERROR; }
+
+  z_stream * strm = &z->deflate_strm;
+  int ret = Z_OK;
+  if(z->has_deflate) {
+    ret = deflateReset(strm);
+  } else {
+    *strm = (z_stream){ .zalloc = Z_NULL, .zfree = Z_NULL, .opaque = Z_NULL };
+    ret = deflateInit(strm, Z_DEFAULT_COMPRESSION);
+    z->has_deflate = ret == Z_OK;
+  }
+  if(ret == Z_OK && use_dict) { ret = deflateSetDictionary(strm, z->dict, (unsigned int)z->dict_len); }
+  if(ret != Z_OK) { return ret; }
+
+  /* incompressible input grows slightly rather than shrinks */
+  strm->next_in = (unsigned char *)(uintptr_t)source;
+  strm->avail_in = (unsigned int)source_len;
+  strm->next_out = dest;
+  strm->avail_out = (unsigned int)dest_len;
+
+  ret = deflate(strm, Z_FINISH);
+  assert(ret != Z_STREAM_ERROR);
+
+  if(out_len) { *out_len = (size_t)strm->total_out; }
+
+  return ret == Z_STREAM_END ? Z_OK : Z_BUF_ERROR;
+}
+
+errno_t sp_z_deflate(sp_z * z, const unsigned char * source, size_t source_len, unsigned char * dest, size_t dest_len, size_t * out_len) {
+  return sp_z_deflate_with(z, false, source, source_len, dest, dest_len, out_len);
+}
+
+errno_t sp_z_deflate_dict(sp_z * z, const unsigned char * source, size_t source_len, unsigned char * dest, size_t dest_len, size_t * out_len) {
+  if(!sp_z_has_dictionary(z)) { return Z_STREAM_ERROR; }
+  return sp_z_deflate_with(z, true, source, source_len, dest, dest_len, out_len);
+}
+
+errno_t sp_inflate_buffer(const unsigned char * source, size_t source_len, unsigned char * dest, size_t dest_len, size_t * out_len) {
+  sp_z z = { 0 };
+  errno_t ret = sp_z_inflate(&z, source, source_len, dest, dest_len, out_len);
+  sp_z_end(&z);
+
+  return ret;
+}
+
+size_t sp_deflate_bound(size_t source_len) {
+  return (size_t)compressBound((uLong)source_len);
+}
+
+errno_t sp_deflate_buffer(const unsigned char * source, size_t source_len, unsigned char * dest, size_t dest_len, size_t * out_len) {
+  sp_z z = { 0 };
+  errno_t ret = sp_z_deflate(&z, source, source_len, dest, dest_len, out_len);
+  sp_z_end(&z);
+
+  return ret;
+}